@@ -0,0 +1,219 @@
+// Per-packet cost of the reader-side parse and decode.
+//
+//   cd backend && ./build.sh && ./build/bin/dpi_bench [packets]
+//
+// Replays a small mix of synthetic frames (IPv4/TCP, IPv4/UDP, IPv6/TCP)
+// through each case and reports ns/packet and heap allocations/packet. Global
+// operator new is replaced to count allocations; the parse and the decoders
+// are required to make none, and the run fails if any does, so CI catches a
+// std::string creeping back into the per-packet path.
+
+#include "packet_parser.h"
+#include "packet_decoder.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace PacketAnalyzer;
+
+static uint64_t allocations = 0;
+// Keeps the parse results live so the loops are not optimised away.
+static volatile uint64_t sink = 0;
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+static void put16(std::vector<uint8_t>& f, uint16_t v) {
+    f.push_back(static_cast<uint8_t>(v >> 8));
+    f.push_back(static_cast<uint8_t>(v & 0xFF));
+}
+
+static std::vector<uint8_t> ethernet(uint16_t ether_type) {
+    std::vector<uint8_t> f = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                              0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb};
+    put16(f, ether_type);
+    return f;
+}
+
+static void transport(std::vector<uint8_t>& f, uint8_t protocol, uint16_t sport, uint16_t dport) {
+    put16(f, sport);
+    put16(f, dport);
+    if (protocol == Protocol::TCP) {
+        f.insert(f.end(), {0, 0, 0, 1, 0, 0, 0, 0, 0x50, 0x18, 0xff, 0xff, 0, 0, 0, 0});
+    } else {
+        f.insert(f.end(), {0, 0, 0, 0});
+    }
+    f.insert(f.end(), 200, 0xAB);
+}
+
+static std::vector<uint8_t> ipv4Frame(uint8_t protocol, uint16_t sport, uint16_t dport) {
+    auto f = ethernet(EtherType::IPv4);
+    f.insert(f.end(), {0x45, 0, 0, 0, 0, 0, 0x40, 0, 64, protocol, 0, 0,
+                       192, 168, 1, 10, 93, 184, 216, 34});
+    transport(f, protocol, sport, dport);
+    return f;
+}
+
+static std::vector<uint8_t> ipv6Frame(uint8_t protocol, uint16_t sport, uint16_t dport) {
+    auto f = ethernet(EtherType::IPv6);
+    f.insert(f.end(), {0x60, 0, 0, 0, 0, 0, protocol, 64});
+    for (int i = 0; i < 16; i++) f.push_back(static_cast<uint8_t>(0x20 + i));
+    for (int i = 0; i < 16; i++) f.push_back(static_cast<uint8_t>(0x80 + i));
+    transport(f, protocol, sport, dport);
+    return f;
+}
+
+struct Result {
+    double ns_per_packet;
+    double allocations_per_packet;
+};
+
+template <typename Fn>
+static Result run(const std::vector<RawPacket>& packets, uint64_t count, Fn&& fn) {
+    // One warm-up pass, so first-touch costs are not charged to the loop.
+    for (const auto& raw : packets) fn(raw);
+
+    const uint64_t allocs_before = allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; i++) {
+        fn(packets[i % packets.size()]);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    Result r;
+    r.ns_per_packet = std::chrono::duration<double, std::nano>(elapsed).count() / count;
+    r.allocations_per_packet = static_cast<double>(allocations - allocs_before) / count;
+    return r;
+}
+
+static void report(const std::string& name, const Result& r) {
+    std::cout << "  " << std::left << std::setw(28) << name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(8) << r.ns_per_packet << " ns/pkt"
+              << std::setprecision(2) << std::setw(8) << r.allocations_per_packet << " allocs/pkt\n";
+}
+
+int main(int argc, char* argv[]) {
+    const uint64_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+
+    std::vector<std::vector<uint8_t>> frames = {
+        ipv4Frame(Protocol::TCP, 51000, 443),
+        ipv4Frame(Protocol::UDP, 53000, 53),
+        ipv6Frame(Protocol::TCP, 52000, 443),
+        ipv4Frame(Protocol::TCP, 51001, 80),
+    };
+    std::vector<RawPacket> packets(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        packets[i].header = {1000, 0, static_cast<uint32_t>(frames[i].size()),
+                             static_cast<uint32_t>(frames[i].size())};
+        packets[i].mapped = frames[i].data();
+    }
+
+    std::cout << "dpi_bench: " << count << " packets per case\n";
+
+    ParsedPacket parsed;
+    const Result parse = run(packets, count, [&](const RawPacket& raw) {
+        PacketParser::parse(raw, parsed);
+        sink = sink + parsed.src_port + parsed.src_ipv4;
+    });
+    report("parse", parse);
+
+    // What every packet used to pay: addresses formatted as text.
+    const Result format = run(packets, count / 10 + 1, [&](const RawPacket& raw) {
+        PacketParser::parse(raw, parsed);
+        sink = sink + parsed.srcIPString().size() + parsed.destIPString().size();
+    });
+    report("parse + format addresses", format);
+
+    // The reader's old path: a full parse, then the header walk repeated to
+    // rebuild the PacketJob offsets.
+    // A fresh PacketJob per packet, as the reader loops build them.
+    const Result two_pass = run(packets, count, [&](const RawPacket& raw) {
+        PacketParser::parse(raw, parsed);
+        DPI::PacketJob job;
+        job.tuple.src_ip = DPI::IPAddress::fromV4(parsed.src_ipv4);
+        job.tuple.dst_ip = DPI::IPAddress::fromV4(parsed.dest_ipv4);
+        job.tuple.src_port = parsed.src_port;
+        job.tuple.dst_port = parsed.dest_port;
+        job.tuple.protocol = parsed.protocol;
+        job.tcp_flags = parsed.tcp_flags;
+        const uint8_t* frame = raw.payload();
+        const size_t frame_len = raw.size();
+        job.ip_offset = 14;
+        if (frame_len > 14) {
+            job.transport_offset = 14 + (frame[14] & 0x0F) * 4u;
+            size_t transport_len = 8;
+            if (parsed.protocol == Protocol::TCP && frame_len > job.transport_offset + 12) {
+                transport_len = (frame[job.transport_offset + 12] >> 4) * 4u;
+            }
+            job.payload_offset = job.transport_offset + transport_len;
+            if (job.payload_offset < frame_len) {
+                job.payload_length = frame_len - job.payload_offset;
+            }
+        }
+        sink = sink + job.payload_offset + job.tuple.src_port;
+    });
+    report("parse + build job", two_pass);
+
+    const Result fused = run(packets, count, [&](const RawPacket& raw) {
+        DPI::PacketJob job;
+        DPI::PacketDecoder::decode(raw.payload(), raw.size(), DPI::LinkType::ETHERNET, job);
+        sink = sink + job.payload_offset + job.tuple.src_port;
+    });
+    report("decode into job", fused);
+
+    // What the reader does per packet before it can pick an LB.
+    const Result hashed = run(packets, count, [&](const RawPacket& raw) {
+        DPI::PacketJob job;
+        DPI::PacketDecoder::decode(raw.payload(), raw.size(), DPI::LinkType::ETHERNET, job);
+        sink = sink + DPI::FiveTupleHash{}(job.tuple);
+    });
+    report("decode + hash", hashed);
+
+    // The same, 32 frames at a time as the file readers do it; run() still
+    // makes one call per packet, and every 32nd call decodes a batch.
+    constexpr size_t BATCH = 32;
+    std::vector<DPI::PacketDecoder::Frame> batch_frames(BATCH);
+    for (size_t i = 0; i < BATCH; i++) {
+        batch_frames[i] = {packets[i % packets.size()].payload(), packets[i % packets.size()].size()};
+    }
+    DPI::PacketDecoder::Result results[BATCH];
+    size_t position = 0;
+    const Result batched = run(packets, count, [&](const RawPacket&) {
+        if (position++ % BATCH != 0) return;
+        std::array<DPI::PacketJob, BATCH> jobs;
+        DPI::PacketDecoder::decodeBatch(batch_frames.data(), BATCH, DPI::LinkType::ETHERNET,
+                                        jobs.data(), results);
+        sink = sink + jobs[0].flow_hash + jobs[BATCH - 1].flow_hash;
+    });
+    report("decode + hash, batch of 32", batched);
+
+    if (parse.allocations_per_packet != 0.0) {
+        std::cerr << "FAIL parse allocates on the per-packet path\n";
+        return 1;
+    }
+    if (fused.allocations_per_packet != 0.0 || batched.allocations_per_packet != 0.0) {
+        std::cerr << "FAIL decode allocates on the per-packet path\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef BATCH_HISTOGRAM_H
+#define BATCH_HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace DPI {
+
+// How many items each push or pop on a queue moved at once, in power-of-two
+// buckets: 1, 2-3, 4-7, ... and BUCKETS-1 collects everything from
+// 2^(BUCKETS-1) up. Used to tune burst sizes.
+//
+// One thread records at a time (a queue's producer, or its consumer);
+// snapshot() may be called from anywhere.
+class BatchHistogram {
+public:
+    static constexpr size_t BUCKETS = 8;
+
+    struct Snapshot {
+        uint64_t counts[BUCKETS] = {};
+        uint64_t batches = 0;
+        uint64_t items = 0;
+
+        double mean() const {
+            return batches ? static_cast<double>(items) / batches : 0.0;
+        }
+
+        void merge(const Snapshot& other) {
+            for (size_t i = 0; i < BUCKETS; i++) counts[i] += other.counts[i];
+            batches += other.batches;
+            items += other.items;
+        }
+    };
+
+    // Smallest batch size counted in `bucket`.
+    static constexpr uint64_t bucketFloor(size_t bucket) {
+        return uint64_t{1} << bucket;
+    }
+
+    void record(size_t n) {
+        if (n == 0) return;
+        size_t bucket = 63 - static_cast<size_t>(__builtin_clzll(n));
+        if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+        bump(counts_[bucket], 1);
+        bump(items_, n);
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+            s.batches += s.counts[i];
+        }
+        s.items = items_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    // Single writer, so a plain load and store rather than a locked add.
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> items_{0};
+};
+
+}
+
+#endif
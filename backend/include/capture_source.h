@@ -0,0 +1,88 @@
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "read_ahead.h"
+
+namespace PacketAnalyzer {
+
+struct PcapGlobalHeader {
+    uint32_t magic_number;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+};
+
+struct PcapPacketHeader {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+struct RawPacket {
+    PcapPacketHeader header;
+    std::vector<uint8_t> data;
+
+    // Set instead of `data` by a memory-mapped reader: points into the mapping
+    // and stays valid until that reader is closed, so nothing is copied.
+    const uint8_t* mapped = nullptr;
+
+    const uint8_t* payload() const {
+        if (mapped) return mapped;
+        return data.empty() ? nullptr : data.data();
+    }
+
+    size_t size() const {
+        return mapped ? header.incl_len : data.size();
+    }
+};
+
+// What DPIEngine's reader thread needs from an input, whatever its container.
+//
+// Every source presents packets with classic-pcap headers (microsecond
+// timestamps) and a classic global header, because that is what the output
+// file is written as. Sources with richer metadata convert on the way out.
+class CaptureSource {
+public:
+    virtual ~CaptureSource() = default;
+
+    virtual bool open(const std::string& filename) = 0;
+    virtual void close() = 0;
+    virtual bool readNextPacket(RawPacket& packet) = 0;
+    virtual bool isOpen() const = 0;
+
+    virtual const PcapGlobalHeader& getGlobalHeader() const = 0;
+
+    // Must be set before open(). Falls back to stream reads when the input
+    // cannot be mapped (a pipe, say), so enabling it is always safe.
+    virtual void enableMemoryMap(bool enabled) = 0;
+    virtual bool isMemoryMapped() const = 0;
+
+    // Block size, depth and O_DIRECT for the read-ahead thread that serves
+    // inputs which are not memory-mapped. Must be set before open().
+    virtual void setReadAheadOptions(const ReadAheadOptions& options) = 0;
+};
+
+struct CaptureOptions {
+    bool silent = false;
+    bool use_mmap = true;
+    ReadAheadOptions read_ahead;
+};
+
+// Opens `filename` with the reader its leading magic calls for: classic pcap
+// (either byte order) or pcapng, either of them optionally gzip- or
+// zstd-compressed. Returns nullptr, having printed why, when the
+// file cannot be opened or is neither.
+std::unique_ptr<CaptureSource> openCaptureSource(const std::string& filename,
+                                                 const CaptureOptions& options);
+
+}
+
+#endif
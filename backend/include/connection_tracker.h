@@ -54,6 +54,15 @@ public:
     
     size_t cleanupStale(std::chrono::seconds timeout = std::chrono::seconds(300));
     
+    // Removes and returns the connections whose tuple's FiveTupleHash
+    // `moving` selects, for another FP's tracker to adopt() when their flows
+    // are steered there. Counters (seen, classified, ...) stay here.
+    std::vector<Connection> extract(const std::function<bool(uint64_t flow_hash)>& moving);
+    
+    // Takes over connections extract()ed from another tracker. One for a
+    // tuple already tracked here replaces it.
+    void adopt(std::vector<Connection>&& connections);
+    
     std::vector<Connection> getAllConnections() const;
     
     size_t getActiveCount() const;
@@ -0,0 +1,64 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace DPI {
+
+// The CPUs this process may run on, grouped by NUMA node. Read from
+// /sys/devices/system/node; a machine (or container) without it is one node
+// holding every CPU in the affinity mask.
+struct CpuTopology {
+    struct Node {
+        int id;
+        std::vector<int> cpus;
+    };
+    // Only nodes with a usable CPU.
+    std::vector<Node> nodes;
+
+    static CpuTopology detect();
+
+    // The node id of `cpu`; -1 for a CPU not in the topology.
+    int nodeOf(int cpu) const;
+    size_t cpuCount() const;
+};
+
+// Which CPUs each role's threads are pinned to. Thread i of a role takes
+// cpus[i % cpus.size()]; an empty list leaves that role unpinned.
+struct ThreadPlacement {
+    std::vector<int> reader;
+    std::vector<int> parse_workers;
+    std::vector<int> lbs;
+    std::vector<int> fps;
+    std::vector<int> output;
+
+    // -1 when `cpus` is empty.
+    static int cpuFor(const std::vector<int>& cpus, size_t index);
+
+    // Fills the roles left empty from `topology`. The reader, parse workers
+    // and output thread go on the first node. Each LB, with its FPs, goes on
+    // the (lb % nodes)th node, so an FP's queue, tracker and buffers sit on the
+    // node its producer runs on. CPUs are handed out in order within a node,
+    // wrapping once the node is used up.
+    void fillAuto(const CpuTopology& topology, int num_lbs, int fps_per_lb, int num_parse_workers);
+
+    bool empty() const;
+};
+
+// Parses a Linux-style CPU list such as "0-3,8,10-11".
+std::optional<std::vector<int>> parseCpuList(const std::string& text);
+
+// Pins the calling thread to `cpu` (no-op for -1). False, after a warning on
+// stderr, if the OS refused.
+bool pinCurrentThread(int cpu, const std::string& who);
+
+// Asks the kernel to move the pages of [data, data + length) to `node` and to
+// keep new ones there. Only done on multi-node Linux; elsewhere a no-op.
+void placeOnNode(const void* data, size_t length, int node);
+
+}
+
+#endif
@@ -2,17 +2,31 @@
 #define DPI_ENGINE_H
 
 #include "types.h"
+#include "mpsc_queue.h"
+#include "capture_source.h"
+#include "live_capture.h"
 #include "pcap_reader.h"
+#include "pcap_chunk_reader.h"
+#include "pcap_writer.h"
+#include "reorder_buffer.h"
 #include "packet_parser.h"
+#include "packet_decoder.h"
 #include "load_balancer.h"
+#include "flow_rebalancer.h"
+#include "fragment_steering.h"
 #include "fast_path.h"
 #include "rule_manager.h"
 #include "connection_tracker.h"
+#include "cpu_affinity.h"
+#include "thread_load.h"
+#include "wait_policy.h"
 #include <memory>
 #include <thread>
 #include <atomic>
 #include <fstream>
 #include <mutex>
+#include <unordered_map>
+#include <condition_variable>
 #include <chrono>
 
 namespace DPI {
@@ -30,6 +44,58 @@ public:
         bool silent = false;
         bool enable_periodic_cleanup = true;
         bool enable_auto_scaling_hint = false;
+        // Map the input and hand FPs pointers into it instead of copying each
+        // packet out of a stream read.
+        bool mmap_input = true;
+        // Unmapped inputs are read by a read-ahead thread; O_DIRECT keeps a
+        // one-pass scan of a large capture from evicting the page cache.
+        bool direct_io = false;
+        // processLive() stops after this many seconds or packets, whichever
+        // comes first; 0 means no limit (run until stopLive()).
+        uint32_t live_duration_seconds = 0;
+        uint64_t live_packet_limit = 0;
+        // Write forwarded packets in input order. The window bounds how far
+        // ahead of a missing packet the output thread will buffer; it should
+        // cover what the LB, FP and output queues can hold in flight.
+        bool preserve_order = false;
+        size_t reorder_window = 1 << 16;
+        // Split a memory-mapped classic pcap into this many byte ranges, each
+        // read and parsed by its own thread. Packet ids then no longer follow
+        // file order, so preserve_order keeps a single reader.
+        int num_readers = 1;
+        // Write forwarded records straight from the input, coalescing runs of
+        // consecutive ones into in-kernel copies, instead of rebuilding each
+        // from its job. Needs a mapped classic pcap in host byte order with
+        // microsecond timestamps; implies ordered output.
+        bool forward_by_range = false;
+        // Each FP reassembles IP fragments within this many bytes, the jobs
+        // it holds included, and gives up on a datagram this long (packet
+        // time) after its first fragment arrived.
+        size_t fragment_memory_per_fp = 4 << 20;
+        uint32_t fragment_timeout_seconds = 30;
+        // An unclassified TCP flow whose ClientHello or request spans segments
+        // has up to this many opening bytes buffered for inspection, in one of
+        // this many buffers per FP.
+        size_t stream_buffer_bytes = 16 * 1024;
+        size_t stream_buffers_per_fp = 256;
+        // A single file reader steers each job straight onto its FP's queue,
+        // and the LB threads are not started. Parallel readers and live
+        // capture always go through the LBs: an FP queue takes one producer.
+        bool direct_dispatch = true;
+        // With a single reader, hand batches of framed records to this many
+        // threads to decode and route, instead of decoding on the reader.
+        // 0 decodes on the reader thread.
+        int parse_workers = 0;
+        // Move buckets of flows from busy FPs to idle ones as traffic
+        // shifts, with their state; see FlowRebalancer.
+        bool rebalance = true;
+        // CPUs to pin each role's threads to (the reader list also covers
+        // chunk readers and live capture threads). auto_placement fills the
+        // roles left empty from the NUMA topology; see ThreadPlacement.
+        ThreadPlacement placement;
+        bool auto_placement = false;
+        // How the LB, FP and output threads wait on an empty queue.
+        WaitPolicy wait_policy;
     };
     
     DPIEngine(const Config& config);
@@ -40,6 +106,14 @@ public:
     bool processFile(const std::string& input_file, 
                      const std::string& output_file);
     
+    // Captures from `interface` with one AF_PACKET fanout ring per LB until a
+    // Config limit is hit or stopLive() is called.
+    bool processLive(const std::string& interface,
+                     const std::string& output_file);
+    
+    // Safe to call from a signal handler.
+    void stopLive() { live_stop_ = true; }
+    
     void start();
     
     void stop();
@@ -92,10 +166,21 @@ private:
     std::unique_ptr<FPManager> fp_manager_;
     std::unique_ptr<LBManager> lb_manager_;
     
-    ThreadSafeQueue<PacketJob> output_queue_;
+    // One lane per FP, drained by the output thread OUTPUT_BURST jobs at a
+    // time.
+    static constexpr size_t OUTPUT_LANE_CAPACITY = 4096;
+    static constexpr size_t OUTPUT_BURST = 64;
+    MpscQueue<PacketJob> output_queue_;
     std::thread output_thread_;
-    std::ofstream output_file_;
-    std::mutex output_mutex_;
+    ThreadLoad output_load_;
+    // Owned by the output thread once packets flow; the global header is
+    // written before the first job is queued.
+    PacketAnalyzer::PcapWriter output_writer_;
+    std::unique_ptr<ReorderBuffer> reorder_;
+    // Set by the reader before the first job is queued when forward_by_range
+    // applies to this input.
+    bool forwarding_ranges_ = false;
+    int range_input_fd_ = -1;
     
     DPIStats stats_;
     std::atomic<uint64_t> total_packets_processed_{0};
@@ -107,9 +192,17 @@ private:
     std::atomic<bool> initialized_{false};
     
     std::thread reader_thread_;
+    // Outlives the reader thread: jobs may borrow bytes from its mapping until
+    // the output thread has written them.
+    std::unique_ptr<PacketAnalyzer::CaptureSource> reader_;
+    
+    bool orderedOutput() const { return config_.preserve_order || config_.forward_by_range; }
     
     void outputThreadFunc();
-    void handleOutput(const PacketJob& job, PacketAction action);
+    // Queues an end marker behind the last packet into each first-stage
+    // queue (the LBs', or the FPs' when dispatching directly).
+    void endInput();
+    void handleOutput(int fp_id, PacketJob&& job, PacketAction action);
     
     bool writeOutputHeader(const PacketAnalyzer::PcapGlobalHeader& header);
     
@@ -117,12 +210,129 @@ private:
     
     void readerThreadFunc(const std::string& input_file);
     
+    struct ChunkResult {
+        size_t start = 0;
+        size_t stop = 0;
+        size_t skipped_bytes = 0;
+        uint64_t packets = 0;
+        bool failed = false;
+    };
+    // Ids are handed to chunk readers in blocks, to keep them off one
+    // contended counter.
+    std::atomic<uint32_t> next_packet_id_{0};
+    // Per range, the flows it has packets of and how many it has yet to
+    // push. `done` is what later ranges sharing the flow wait on; the rest
+    // belongs to the range's own reader. A range waits once it holds
+    // RANGE_HOLD_LIMIT jobs of such flows.
+    struct RangeFlow {
+        size_t remaining = 0;
+        std::atomic<bool> done{false};
+        const std::atomic<bool>* after = nullptr;
+    };
+    using RangeFlows = std::unordered_map<uint64_t, RangeFlow>;
+    static constexpr size_t RANGE_HOLD_LIMIT = 1 << 18;
+    std::vector<RangeFlows> range_flows_;
+    size_t ranges_scanned_ = 0;
+    // Bumped under ranges_mutex_ whenever a range finishes some flows.
+    std::atomic<uint64_t> flows_finished_{0};
+    std::mutex ranges_mutex_;
+    std::condition_variable ranges_cv_;
+    
+    void readChunksParallel(const PacketAnalyzer::PcapReader& file);
+    void chunkReaderThreadFunc(const PacketAnalyzer::PcapReader& file, size_t index,
+                               size_t begin, size_t end, ChunkResult& result);
+    
+    std::vector<std::unique_ptr<PacketAnalyzer::AfPacketRing>> live_rings_;
+    std::vector<std::thread> live_threads_;
+    std::atomic<bool> live_stop_{false};
+    std::atomic<uint32_t> live_packet_id_{0};
+    
+    void liveCaptureThreadFunc(int lb_index);
+    
+    // Fills config_.placement if auto_placement, and hands the LBs and FPs
+    // their CPUs; the engine's own threads pin themselves as they start.
+    void applyPlacement();
+    
+    // The output thread's load, with its queue's park count.
+    ThreadLoad::Snapshot outputLoad() const;
+    
+    // DECODE_BATCH records framed by the reader for a parse worker. `seq`
+    // numbers batches in file order.
+    struct FrameBatch {
+        std::vector<PacketAnalyzer::RawPacket> raws;
+        size_t count = 0;
+        uint64_t seq = 0;
+    };
+    using FrameBatchQueue = SpscQueue<std::unique_ptr<FrameBatch>>;
+    
+    // Workers decode in parallel but publish in batch order: each waits for
+    // commit_turn_ to reach its batch's seq, which also lets the one holding
+    // the turn act as the single producer of every LB or FP queue. Packet
+    // ids are handed out in the same order, so they follow the file.
+    std::atomic<uint64_t> commit_turn_{0};
+    uint32_t commit_packet_id_ = 0;
+    // Batches staged ahead of their turn that a move committed meanwhile
+    // made stage again.
+    std::atomic<uint64_t> restaged_batches_{0};
+    // Owned by whichever worker holds the turn. A batch with fragments in it
+    // is staged in its turn rather than ahead of it, so that they are steered
+    // in input order.
+    FragmentSteering commit_steering_;
+    
+    void readWithParseWorkers(PacketAnalyzer::CaptureSource& reader);
+    void parseWorkerThreadFunc(size_t index, FrameBatchQueue& input, FrameBatchQueue& done,
+                               uint32_t link_type);
+    
     void periodicCleanupLoop();
     std::thread cleanup_thread_;
     
-    PacketJob createPacketJob(const PacketAnalyzer::RawPacket& raw,
-                               const PacketAnalyzer::ParsedPacket& parsed,
-                               uint32_t packet_id);
+    // Decodes `raw` straight into `job` and attaches its frame, borrowed
+    // from a mapping unless `copy_frame`. False for anything the FPs do not
+    // handle: non-IP, non-TCP/UDP datagrams and their fragments, malformed
+    // frames.
+    bool decodePacketJob(const PacketAnalyzer::RawPacket& raw, uint32_t link_type,
+                         PacketJob& job, bool copy_frame = false);
+    
+    // Frames the file readers read before decoding them together.
+    static constexpr size_t DECODE_BATCH = 32;
+    
+    // decodePacketJob for `count` packets at once, through
+    // PacketDecoder::decodeBatch, which also sets each job's flow_hash.
+    // Only jobs forFastPath() accepts have their frame attached.
+    void decodePacketJobs(const PacketAnalyzer::RawPacket* raws, size_t count,
+                          uint32_t link_type, PacketJob* jobs,
+                          PacketDecoder::Result* results);
+    
+    void attachFrame(const PacketAnalyzer::RawPacket& raw, PacketJob& job, bool copy_frame);
+    
+    // An LB's input queue takes one producer thread. Parallel chunk readers
+    // share them, so they push under that LB's lock.
+    std::unique_ptr<std::mutex[]> lb_push_locks_;
+    
+    // Hands each LB its jobs in `staged` (indexed by LB id) with one
+    // pushBatch, and empties it. `shared` when other readers push too.
+    void pushToLBs(std::vector<std::vector<PacketJob>>& staged, bool shared);
+    
+    // Set for a run before start(): the reader feeds the FPs itself, steered
+    // by fp_router_ over all of them.
+    bool direct_dispatch_ = false;
+    std::unique_ptr<FlowRebalancer> fp_router_;
+    
+    // pushToLBs for direct dispatch; `staged` is indexed by FP id.
+    void pushToFPs(std::vector<std::vector<PacketJob>>& staged);
+    
+    // Re-sorts jobs staged per FP by fp_router_'s current table. Each flow's
+    // jobs stay in order: a flow was all in one list.
+    void restage(std::vector<std::vector<PacketJob>>& staged);
+    
+    // Complete TCP/UDP packets, and fragments of TCP/UDP datagrams for the
+    // FPs to reassemble.
+    static bool forFastPath(PacketDecoder::Result result, const PacketJob& job) {
+        return result == PacketDecoder::Result::OK ||
+               (result == PacketDecoder::Result::FRAGMENT &&
+                (job.tuple.protocol == PacketAnalyzer::Protocol::TCP ||
+                 job.tuple.protocol == PacketAnalyzer::Protocol::UDP));
+    }
 };
 
 }
@@ -2,10 +2,16 @@
 #define FAST_PATH_H
 
 #include "types.h"
-#include "thread_safe_queue.h"
+#include "spsc_queue.h"
 #include "connection_tracker.h"
 #include "rule_manager.h"
 #include "sni_extractor.h"
+#include "fragment_reassembler.h"
+#include "tcp_reassembler.h"
+#include "cpu_affinity.h"
+#include "flow_rebalancer.h"
+#include "thread_load.h"
+#include "wait_policy.h"
 #include <thread>
 #include <atomic>
 #include <memory>
@@ -15,17 +21,37 @@
 
 namespace DPI {
 
-using PacketOutputCallback = std::function<void(const PacketJob&, PacketAction)>;
+// Takes the job by rvalue: the FP is done with it, so the callback can move it
+// on to the output queue instead of copying the frame. The FP passes its id,
+// so each FP can have an output lane of its own.
+using PacketOutputCallback = std::function<void(int fp_id, PacketJob&&, PacketAction)>;
 
 class FastPathProcessor {
 public:
     FastPathProcessor(int fp_id,
                       RuleManager* rule_manager,
                       PacketOutputCallback output_callback,
-                      bool silent);
+                      bool silent,
+                      FragmentReassembler::Limits fragment_limits = FragmentReassembler::Limits(),
+                      TcpReassembler::Limits stream_limits = TcpReassembler::Limits());
     
     ~FastPathProcessor();
     
+    // Before start(): the thread pins itself to `cpu` and moves its input
+    // queue to `node`, so the tracker and buffers it then allocates are
+    // local too. -1 leaves either alone.
+    void setPlacement(int cpu, int node) { cpu_ = cpu; node_ = node; }
+    
+    // Before start(): how the thread waits on an empty input queue.
+    void setWaitPolicy(const WaitPolicy& policy) { input_queue_.setConsumerWait(policy); }
+    
+    // Before start(): instead of setting handed_over itself, pass each
+    // hand-over on to the output callback as a job carrying the migration,
+    // behind every packet emitted before it. The consumer sets handed_over
+    // once it has taken those packets, so the new FP's packets of a moving
+    // flow cannot overtake them on the way out.
+    void setHandOverThroughOutput(bool enabled) { handover_through_output_ = enabled; }
+    
     void start();
     
     void stop();
@@ -34,10 +60,16 @@ public:
     void resume();
     bool isPaused() const { return paused_; }
     
-    ThreadSafeQueue<PacketJob>& getInputQueue() { return input_queue_; }
+    // An end_of_stream job, pushed last, ends the thread: once every packet
+    // ahead of it has been emitted, it goes to the output callback too.
+    SpscQueue<PacketJob>& getInputQueue() { return input_queue_; }
     
     ConnectionTracker& getConnectionTracker() { return conn_tracker_; }
     
+    const FragmentReassembler& getReassembler() const { return reassembler_; }
+    
+    const TcpReassembler& getStreamReassembler() const { return streams_; }
+    
     struct FPStats {
         uint64_t packets_processed;
         uint64_t packets_forwarded;
@@ -48,6 +80,11 @@ public:
         uint64_t current_queue_depth;
         uint64_t max_queue_depth;
         double   drop_ratio;
+        // Pushes into this FP's queue (by its LB, or by the reader when
+        // dispatching directly) and this FP's pops.
+        BatchHistogram::Snapshot push_batches;
+        BatchHistogram::Snapshot input_batches;
+        ThreadLoad::Snapshot load;
     };
     
     FPStats getStats() const;
@@ -61,10 +98,21 @@ public:
 private:
     int fp_id_;
     
-    ThreadSafeQueue<PacketJob> input_queue_;
+    SpscQueue<PacketJob> input_queue_;
     
     ConnectionTracker conn_tracker_;
     
+    // FragmentSteering gives every fragment of a datagram its flow's hash, so
+    // they all reach this table on the FP that holds the flow's Connection.
+    FragmentReassembler reassembler_;
+    PacketJob reassembled_;
+    std::vector<PacketJob> completed_fragments_;
+    std::vector<PacketJob> discarded_fragments_;
+    
+    // Opening bytes of unclassified TCP flows whose first segment was not
+    // enough to classify them.
+    TcpReassembler streams_;
+    
     RuleManager* rule_manager_;
     
     PacketOutputCallback output_callback_;
@@ -81,16 +129,53 @@ private:
     std::atomic<bool> running_{false};
     std::atomic<bool> paused_{false};
     std::thread thread_;
+    int cpu_ = -1;
+    int node_ = -1;
+    ThreadLoad load_;
+    
+    // A bucket of flows moving onto this FP whose state has not been handed
+    // over yet, and that bucket's packets that arrived since.
+    std::shared_ptr<FlowMigration> pending_;
+    std::vector<PacketJob> held_;
+    bool handover_through_output_ = false;
+    
+    // Jobs are taken off the input queue this many at a time.
+    static constexpr size_t BURST = 32;
+    // How long to wait for input while waiting for a hand-over as well.
+    static constexpr std::chrono::milliseconds HANDOVER_POLL{1};
+    // Stale connections are swept this often, busy or idle.
+    static constexpr std::chrono::seconds CLEANUP_INTERVAL{10};
     
     void run();
     
+    void handle(PacketJob&& job);
+    
+    // A marker from the producer: hand this FP's state for the moving flows
+    // over, or start holding their packets until it arrives.
+    void migrate(std::shared_ptr<FlowMigration> migration);
+    
+    // Takes over the pending move's state (unless `with_state` is false, when
+    // the other FP never got to hand it over), then handles the held packets.
+    void adoptPending(bool with_state);
+    
     PacketAction processPacket(PacketJob& job);
     
+    // Holds the fragment until its datagram is complete, then inspects the
+    // datagram and emits all of its fragments with that verdict.
+    void processFragment(PacketJob&& fragment);
+    
+    // Emits whatever the reassembler gave up on, dropped.
+    void dropDiscardedFragments();
+    
+    void emit(PacketJob&& job, PacketAction action);
+    
     void inspectPayload(PacketJob& job, Connection* conn);
     
-    bool tryExtractSNI(const PacketJob& job, Connection* conn);
+    bool tryExtractSNI(const PacketJob& job, const uint8_t* payload, size_t length,
+                       Connection* conn);
     
-    bool tryExtractHTTPHost(const PacketJob& job, Connection* conn);
+    bool tryExtractHTTPHost(const PacketJob& job, const uint8_t* payload, size_t length,
+                            Connection* conn);
     
     PacketAction checkRules(const PacketJob& job, Connection* conn);
     
@@ -103,7 +188,9 @@ public:
     FPManager(int num_fps,
               RuleManager* rule_manager,
               PacketOutputCallback output_callback,
-              bool silent);
+              bool silent,
+              FragmentReassembler::Limits fragment_limits = FragmentReassembler::Limits(),
+              TcpReassembler::Limits stream_limits = TcpReassembler::Limits());
     
     ~FPManager();
     
@@ -113,10 +200,10 @@ public:
     
     FastPathProcessor& getFP(int id) { return *fps_[id]; }
     
-    ThreadSafeQueue<PacketJob>& getFPQueue(int id) { return fps_[id]->getInputQueue(); }
+    SpscQueue<PacketJob>& getFPQueue(int id) { return fps_[id]->getInputQueue(); }
     
-    std::vector<ThreadSafeQueue<PacketJob>*> getQueuePtrs() {
-        std::vector<ThreadSafeQueue<PacketJob>*> ptrs;
+    std::vector<SpscQueue<PacketJob>*> getQueuePtrs() {
+        std::vector<SpscQueue<PacketJob>*> ptrs;
         for (auto& fp : fps_) {
             ptrs.push_back(&fp->getInputQueue());
         }
@@ -132,9 +219,17 @@ public:
         uint64_t total_connections;
         uint64_t total_max_queue_depth;
         double   overall_drop_ratio;
+        BatchHistogram::Snapshot push_batches;
+        BatchHistogram::Snapshot input_batches;
     };
     
     AggregatedStats getAggregatedStats() const;
+    
+    // Summed over the FPs; peak_bytes is the largest single FP's peak.
+    FragmentReassembler::Stats getReassemblyStats() const;
+    
+    // Summed over the FPs; peak_flows is the largest single FP's peak.
+    TcpReassembler::Stats getStreamStats() const;
 
     std::unordered_map<std::string, uint64_t> getApplicationStats() const;
     
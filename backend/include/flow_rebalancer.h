@@ -0,0 +1,127 @@
+#ifndef FLOW_REBALANCER_H
+#define FLOW_REBALANCER_H
+
+#include "types.h"
+#include "indirection_table.h"
+#include "spsc_queue.h"
+#include "tcp_reassembler.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace DPI {
+
+// One bucket of flows moving from FP `from` to FP `to`. The producer that
+// repointed the bucket queues a marker job carrying this to both FPs, behind
+// everything it already sent them.
+//
+// `from` reaches its marker once it has handled every packet of those flows
+// it will ever get. It moves their state in here -- connections, TCP stream
+// buffers, fragments of unfinished datagrams -- and sets handed_over, or has
+// its output consumer set it behind the packets it emitted first. `to`
+// holds back the bucket's packets from its marker on, until handed_over;
+// then it adopts the state, handles what it held, and sets adopted. So each
+// flow's packets are still inspected one at a time, in order, against all of
+// its state.
+struct FlowMigration {
+    FlowMigration(size_t bucket, size_t buckets, int from, int to)
+        : bucket(bucket), buckets(buckets), from(from), to(to) {}
+
+    bool moves(uint64_t flow_hash) const {
+        return IndirectionTable::bucketOf(flow_hash, buckets) == bucket;
+    }
+
+    const size_t bucket;
+    const size_t buckets;
+    // FP ids.
+    const int from;
+    const int to;
+
+    // Written by `from` before handed_over; read by `to` after it.
+    std::vector<Connection> connections;
+    std::vector<TcpReassembler::FlowBuffer> streams;
+    std::vector<PacketJob> fragments;
+
+    std::atomic<bool> handed_over{false};
+    std::atomic<bool> adopted{false};
+};
+
+// Steers one producer's jobs over a set of FP queues through an
+// IndirectionTable, and keeps their load even by moving hot buckets.
+//
+// route() counts the packets sent to each bucket. Every REBALANCE_INTERVAL
+// packets, rebalance() compares the FPs' shares and, if the busiest is more
+// than an eighth ahead of the idlest, moves the one bucket of the busiest
+// that best splits the difference to the idlest (see FlowMigration). Counts
+// are then halved, so older traffic weighs less. One move is in flight at a
+// time. A single flow is never split, so an elephant flow still loads its FP
+// alone; what moves is the rest of that FP's traffic.
+//
+// Producer thread only, apart from peek() and version().
+class FlowRebalancer {
+public:
+    static constexpr uint64_t REBALANCE_INTERVAL = 16384;
+
+    // `queues[i]` is FP `first_fp_id + i`'s.
+    FlowRebalancer(std::vector<SpscQueue<PacketJob>*> queues, int first_fp_id,
+                   size_t buckets = IndirectionTable::DEFAULT_BUCKETS);
+
+    // Before any routing: false keeps the initial table.
+    void setEnabled(bool enabled) { enabled_ = enabled; }
+
+    // The queue index for a job, counted toward its bucket's load.
+    size_t route(uint64_t flow_hash) {
+        count(flow_hash);
+        return peek(flow_hash);
+    }
+
+    // route() in two halves, for a producer that looks up targets before
+    // it may count them.
+    size_t peek(uint64_t flow_hash) const { return table_.target(flow_hash); }
+    void count(uint64_t flow_hash) {
+        bucket_load_[table_.bucketOf(flow_hash)]++;
+        routed_++;
+    }
+
+    // Bumped by every move, after the table changes: targets peeked while it
+    // did not change are still current.
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+    // Call between bursts, once everything routed so far has been pushed.
+    // May queue markers onto two FPs' queues.
+    void rebalance();
+
+    uint64_t migrations() const { return migrations_.load(std::memory_order_relaxed); }
+
+    const IndirectionTable& table() const { return table_; }
+
+    struct Move {
+        size_t bucket;
+        uint32_t from;
+        uint32_t to;
+    };
+
+    // The move rebalance() would make for these bucket loads, if any.
+    static std::optional<Move> pickMove(const std::vector<uint64_t>& bucket_load,
+                                        const IndirectionTable& table, size_t targets);
+
+private:
+    std::vector<SpscQueue<PacketJob>*> queues_;
+    int first_fp_id_;
+    IndirectionTable table_;
+    bool enabled_ = true;
+
+    std::vector<uint64_t> bucket_load_;
+    uint64_t routed_ = 0;
+    std::shared_ptr<FlowMigration> in_flight_;
+
+    std::atomic<uint64_t> version_{0};
+    std::atomic<uint64_t> migrations_{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef FRAGMENT_REASSEMBLER_H
+#define FRAGMENT_REASSEMBLER_H
+
+#include "types.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace DPI {
+
+// IPv4/IPv6 fragment reassembly for one FP.
+//
+// Fragments arrive as PacketJobs the decoder marked is_fragmented. Their data
+// is copied into fixed-size slabs from a pool carved out of one allocation of
+// `memory_bytes`; the jobs themselves are held, because every fragment is a
+// record in the output and needs the verdict of the datagram it belongs to.
+// When a datagram is complete, add() hands back a job for the whole of it --
+// transport header and payload, ready for the normal inspection path -- and
+// the held fragments to apply that verdict to.
+//
+// Memory is bounded whatever the input does. Slabs, the bytes of any owned
+// (not mapped) fragment frames, and the bookkeeping of what is held -- each
+// fragment's job and byte range, each datagram's entry -- together never
+// exceed `memory_bytes`, and at most `max_datagrams` are in progress. A
+// datagram that would break either limit evicts the oldest ones first. One
+// arriving in more than `max_fragments` pieces is discarded: a flood of tiny
+// fragments then cannot pin a job per 8 bytes of slab, nor make the sorted
+// range insert quadratic. Datagrams time out `timeout_seconds` after
+// their first fragment, on packet time, so replaying a capture behaves like
+// the live traffic did. That time is kept per job `source`: parallel chunk
+// readers feed an FP from far-apart stretches of a capture at once, and only
+// times from the same stretch compare. Overlapping fragments discard the
+// whole datagram (RFC 5722), so a reassembly ambiguity cannot be used to slip
+// a payload past inspection; exact duplicates are dropped on their own.
+//
+// Discarded fragments -- timed out, overlapping, evicted, malformed -- come
+// back to the caller to be dropped. Not thread-safe: one per FP, used by the
+// FP thread; getStats() may be called from anywhere.
+class FragmentReassembler {
+public:
+    struct Limits {
+        size_t memory_bytes = 4 << 20;
+        size_t max_datagrams = 4096;
+        // A 64 KiB datagram over a 1280-byte IPv6 link is 52 fragments.
+        size_t max_fragments = 64;
+        uint32_t timeout_seconds = 30;
+    };
+
+    FragmentReassembler();
+    explicit FragmentReassembler(Limits limits);
+    ~FragmentReassembler();
+
+    FragmentReassembler(const FragmentReassembler&) = delete;
+    FragmentReassembler& operator=(const FragmentReassembler&) = delete;
+
+    // Takes one fragment. True when it completed its datagram: `datagram` is
+    // then the reassembled packet and `fragments` receives all of its held
+    // fragments in arrival order, this one included. Anything discarded
+    // along the way, this fragment or others, is appended to `discarded`.
+    bool add(PacketJob&& fragment, PacketJob& datagram, std::vector<PacketJob>& fragments,
+             std::vector<PacketJob>& discarded);
+
+    // End of input: every incomplete datagram's fragments into `discarded`,
+    // counted as timed out.
+    void flush(std::vector<PacketJob>& discarded);
+
+    // Gives up the incomplete datagrams whose fragments' flow_hash `moving`
+    // selects: their held fragments are appended to `fragments`, each
+    // source's oldest datagram first and in arrival order, for another FP to
+    // add() when their flows are steered there. They are counted again there,
+    // not here.
+    void extract(const std::function<bool(uint64_t flow_hash)>& moving,
+                 std::vector<PacketJob>& fragments);
+
+    struct Stats {
+        uint64_t fragments;
+        uint64_t reassembled;
+        uint64_t timed_out;
+        uint64_t overlapping;
+        uint64_t duplicates;
+        uint64_t evicted;
+        uint64_t malformed;
+        uint64_t too_many_fragments;
+        uint64_t datagrams_in_progress;
+        uint64_t bytes_in_use;
+        uint64_t peak_bytes;
+    };
+
+    Stats getStats() const;
+
+    static constexpr size_t SLAB_SIZE = 2048;
+    // The largest IP payload, in slabs.
+    static constexpr size_t MAX_SLABS_PER_DATAGRAM = (65535 + SLAB_SIZE - 1) / SLAB_SIZE;
+
+private:
+    struct Key {
+        IPAddress src;
+        IPAddress dst;
+        uint32_t id;
+        uint8_t protocol;
+
+        bool operator==(const Key& other) const {
+            return src == other.src && dst == other.dst && id == other.id &&
+                   protocol == other.protocol;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const noexcept;
+    };
+
+    static constexpr uint32_t NO_SLAB = UINT32_MAX;
+
+    struct Datagram {
+        // In by_age_[source].
+        std::list<Key>::iterator age;
+        uint16_t source = 0;
+        uint64_t first_seen_us = 0;
+        // Known once the last fragment (no more-fragments flag) has arrived.
+        uint32_t total_length = 0;
+        bool have_last = false;
+        // Received [begin, end) byte ranges, sorted and non-overlapping.
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        uint32_t slabs[MAX_SLABS_PER_DATAGRAM];
+        size_t slab_count = 0;
+        size_t owned_bytes = 0;
+        // Charged for the entry and its held fragments: DATAGRAM_COST once,
+        // FRAGMENT_COST each.
+        size_t held_bytes = 0;
+        std::vector<PacketJob> fragments;
+    };
+
+    // What holding one more fragment costs besides its slab and frame: its
+    // job and range entry, plus the datagram's entry (map node, age list
+    // node) if it is the first.
+    static constexpr size_t FRAGMENT_COST =
+        sizeof(PacketJob) + sizeof(std::pair<uint32_t, uint32_t>);
+    static constexpr size_t DATAGRAM_COST =
+        sizeof(Datagram) + 2 * sizeof(Key) + 4 * sizeof(void*);
+
+    enum class Placement { NEW, DUPLICATE, OVERLAP };
+
+    Limits limits_;
+    std::unique_ptr<uint8_t[]> arena_;
+    size_t slab_capacity_;
+    std::vector<uint32_t> free_slabs_;
+    size_t owned_bytes_ = 0;
+    size_t held_bytes_ = 0;
+
+    std::unordered_map<Key, Datagram, KeyHash> datagrams_;
+    // Per source, oldest first: the timeout and eviction order. Eviction
+    // takes from the arriving fragment's source first.
+    std::vector<std::list<Key>> by_age_;
+    std::vector<uint64_t> now_us_;
+
+    std::atomic<uint64_t> fragments_{0};
+    std::atomic<uint64_t> reassembled_{0};
+    std::atomic<uint64_t> timed_out_{0};
+    std::atomic<uint64_t> overlapping_{0};
+    std::atomic<uint64_t> duplicates_{0};
+    std::atomic<uint64_t> evicted_{0};
+    std::atomic<uint64_t> malformed_{0};
+    std::atomic<uint64_t> too_many_fragments_{0};
+    std::atomic<uint64_t> in_progress_{0};
+    std::atomic<uint64_t> bytes_in_use_{0};
+    std::atomic<uint64_t> peak_bytes_{0};
+
+    size_t bytesInUse() const;
+    void publishUsage();
+    bool reserve(size_t slabs, size_t bytes, uint16_t source, const Key& keep,
+                 std::vector<PacketJob>& discarded);
+    const Key* oldest(uint16_t source, const Key* keep) const;
+    void store(Datagram& d, uint32_t begin, const uint8_t* data, size_t length);
+    static Placement place(Datagram& d, uint32_t begin, uint32_t end);
+    bool complete(const Datagram& d) const;
+    bool assemble(const Datagram& d, const PacketJob& last, PacketJob& datagram) const;
+    void discard(std::unordered_map<Key, Datagram, KeyHash>::iterator it,
+                 std::vector<PacketJob>& discarded);
+    void expire(uint16_t source, std::vector<PacketJob>& discarded);
+};
+
+}
+
+#endif
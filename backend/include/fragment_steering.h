@@ -0,0 +1,89 @@
+#ifndef FRAGMENT_STEERING_H
+#define FRAGMENT_STEERING_H
+
+#include "types.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace DPI {
+
+// Gives IP fragments their flow's hash, so they are steered to the LB and FP
+// that see the rest of the flow and the reassembled datagram is inspected
+// against the flow's one Connection.
+//
+// The decoder can only hash a fragment on its address pair: only the first
+// fragment (offset 0) carries the ports. This remembers, per datagram, the
+// FiveTupleHash those ports give, and sets it as flow_hash on every fragment
+// of the datagram. A fragment that arrives ahead of its datagram's first is
+// held until the first arrives. Held fragments whose first never comes go on
+// with their address-pair hash when their datagram times out or is evicted,
+// or at flush(); they cannot complete a datagram, so the FP drops them.
+//
+// Runs on whichever thread routes jobs in input order, one at a time. Not
+// thread-safe.
+class FragmentSteering {
+public:
+    struct Limits {
+        size_t max_datagrams = 4096;
+        size_t max_held = 1024;
+        uint32_t timeout_seconds = 30;
+    };
+
+    FragmentSteering();
+    explicit FragmentSteering(Limits limits);
+
+    // Appends `job` to `ready`, its flow_hash fixed up if it is a fragment,
+    // together with any earlier fragments it releases; or holds it.
+    // Unfragmented jobs go straight through.
+    void steer(PacketJob&& job, std::vector<PacketJob>& ready);
+
+    // End of input: everything held goes as it is.
+    void flush(std::vector<PacketJob>& ready);
+
+    size_t held() const { return held_; }
+
+private:
+    struct Key {
+        IPAddress src;
+        IPAddress dst;
+        uint32_t id;
+        uint8_t protocol;
+
+        bool operator==(const Key& other) const {
+            return src == other.src && dst == other.dst && id == other.id &&
+                   protocol == other.protocol;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const noexcept;
+    };
+
+    struct Datagram {
+        std::list<Key>::iterator age;
+        uint64_t first_seen_us = 0;
+        // Set once the first fragment has been seen.
+        bool known = false;
+        uint64_t flow_hash = 0;
+        std::vector<PacketJob> held;
+    };
+
+    using Map = std::unordered_map<Key, Datagram, KeyHash>;
+
+    Limits limits_;
+    Map datagrams_;
+    // Oldest first: the timeout and eviction order.
+    std::list<Key> by_age_;
+    size_t held_ = 0;
+    uint64_t now_us_ = 0;
+
+    // Lets the datagram's held fragments go unchanged and forgets it.
+    void release(Map::iterator it, std::vector<PacketJob>& ready);
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef INDIRECTION_TABLE_H
+#define INDIRECTION_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace DPI {
+
+// RSS-style flow steering: a flow hash picks one of a fixed number of buckets,
+// and each bucket names the queue its flows go to. Buckets start out dealt
+// round robin over the targets, so every target gets an even share; a
+// FlowRebalancer may repoint them later.
+//
+// The bucket comes from the hash's high half. The LB tier picks an LB from
+// `hash % num_lbs`, which depends mostly on the low bits, so an LB's table
+// still spreads its flows over all of its FPs.
+//
+// Only the thread that routes with the table repoints buckets. Entries are
+// atomic so that other threads may look targets up meanwhile (parse workers
+// stage their batches ahead of their turn); they see the old target or the
+// new one.
+class IndirectionTable {
+public:
+    static constexpr size_t DEFAULT_BUCKETS = 512;
+
+    explicit IndirectionTable(size_t targets, size_t buckets = DEFAULT_BUCKETS)
+        : buckets_(buckets),
+          entries_(new std::atomic<uint32_t>[buckets]) {
+        for (size_t i = 0; i < buckets; i++) {
+            entries_[i].store(targets ? static_cast<uint32_t>(i % targets) : 0,
+                              std::memory_order_relaxed);
+        }
+    }
+
+    static size_t bucketOf(uint64_t flow_hash, size_t buckets) {
+        return static_cast<size_t>(flow_hash >> 32) % buckets;
+    }
+
+    size_t bucketOf(uint64_t flow_hash) const {
+        return bucketOf(flow_hash, buckets_);
+    }
+
+    uint32_t target(uint64_t flow_hash) const {
+        return targetOfBucket(bucketOf(flow_hash));
+    }
+
+    uint32_t targetOfBucket(size_t bucket) const {
+        return entries_[bucket].load(std::memory_order_relaxed);
+    }
+
+    void setTarget(size_t bucket, uint32_t target) {
+        entries_[bucket].store(target, std::memory_order_relaxed);
+    }
+
+    size_t buckets() const { return buckets_; }
+
+private:
+    size_t buckets_;
+    std::unique_ptr<std::atomic<uint32_t>[]> entries_;
+};
+
+}
+
+#endif
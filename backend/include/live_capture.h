@@ -0,0 +1,82 @@
+#ifndef LIVE_CAPTURE_H
+#define LIVE_CAPTURE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include "capture_source.h"
+
+namespace PacketAnalyzer {
+
+struct LiveCaptureOptions {
+    std::string interface;
+    // Ring geometry: block_count blocks of block_size bytes, shared with the
+    // kernel. Blocks are handed over whole, so a deep ring absorbs bursts
+    // while the consumer is busy with the previous block.
+    uint32_t block_size = 1 << 22;
+    uint32_t block_count = 64;
+    uint32_t frame_size = 2048;
+    // The kernel retires a partly filled block after this long, which bounds
+    // latency on a quiet link.
+    uint32_t block_timeout_ms = 10;
+    bool promiscuous = true;
+};
+
+// One AF_PACKET socket with a TPACKET_V3 receive ring, optionally joined to a
+// PACKET_FANOUT_HASH group.
+//
+// Every socket in a fanout group sees a disjoint share of the interface's
+// traffic, split by the kernel on the flow hash, so one ring per consumer
+// thread gives the same flow affinity LBManager::getLBForPacket does in
+// software. Linux only; open() fails elsewhere.
+class AfPacketRing {
+public:
+    AfPacketRing() = default;
+    ~AfPacketRing();
+
+    AfPacketRing(const AfPacketRing&) = delete;
+    AfPacketRing& operator=(const AfPacketRing&) = delete;
+
+    // `fanout_group` 0 leaves the socket on its own. Prints why on failure.
+    bool open(const LiveCaptureOptions& options, uint16_t fanout_group);
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+
+    // Waits up to `timeout_ms` for the kernel to retire a block, then calls
+    // `fn` for each packet in it. The packet's `mapped` bytes point into the
+    // ring and are only valid during the call: the block goes back to the
+    // kernel afterwards. Returns the number of packets delivered.
+    size_t poll(int timeout_ms, const std::function<void(const RawPacket&)>& fn);
+
+    // The classic header the captured frames are described by.
+    PcapGlobalHeader globalHeader() const;
+
+    struct Stats {
+        uint64_t packets;
+        // Packets the kernel could not place because the ring was full.
+        uint64_t kernel_drops;
+        // Times the kernel found every block still owned by userspace.
+        uint64_t ring_full_events;
+    };
+
+    Stats getStats();
+
+private:
+    int fd_ = -1;
+    uint8_t* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    uint32_t block_size_ = 0;
+    uint32_t block_count_ = 0;
+    uint32_t current_block_ = 0;
+    uint32_t snaplen_ = 0;
+    bool skip_outgoing_ = false;
+
+    uint64_t packets_ = 0;
+    uint64_t kernel_drops_ = 0;
+    uint64_t ring_full_events_ = 0;
+};
+
+}
+
+#endif
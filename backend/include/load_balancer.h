@@ -2,7 +2,11 @@
 #define LOAD_BALANCER_H
 
 #include "types.h"
-#include "thread_safe_queue.h"
+#include "spsc_queue.h"
+#include "flow_rebalancer.h"
+#include "cpu_affinity.h"
+#include "thread_load.h"
+#include "wait_policy.h"
 #include <thread>
 #include <vector>
 #include <atomic>
@@ -13,12 +17,21 @@ namespace DPI {
 class LoadBalancer {
 public:
     LoadBalancer(int lb_id, 
-                 std::vector<ThreadSafeQueue<PacketJob>*> fp_queues,
+                 std::vector<SpscQueue<PacketJob>*> fp_queues,
                  int fp_start_id,
                  bool silent);
     
     ~LoadBalancer();
     
+    // Before start(): pin the thread to `cpu`; -1 leaves it unpinned.
+    void setCpu(int cpu) { cpu_ = cpu; }
+    
+    // Before start(): how the thread waits on an empty input queue.
+    void setWaitPolicy(const WaitPolicy& policy) { input_queue_.setConsumerWait(policy); }
+    
+    // Before start(): false keeps each flow on the FP its hash first picked.
+    void setRebalancing(bool enabled) { rebalancer_.setEnabled(enabled); }
+    
     void start();
     
     void stop();
@@ -27,7 +40,9 @@ public:
     void resume();
     bool isPaused() const { return paused_; }
     
-    ThreadSafeQueue<PacketJob>& getInputQueue() { return input_queue_; }
+    // An end_of_stream job, pushed last, is passed on to every FP behind
+    // what came before it, and the thread then returns.
+    SpscQueue<PacketJob>& getInputQueue() { return input_queue_; }
     
     struct LBStats {
         uint64_t packets_received;
@@ -36,6 +51,13 @@ public:
         uint64_t max_queue_depth;
         std::vector<uint64_t> per_fp_packets;
         double dispatch_efficiency;
+        // Buckets of flows moved between this LB's FPs.
+        uint64_t migrations;
+        // Reader (or capture ring) pushes into this LB, and this LB's pops.
+        // Its pushes into the FP queues are the FPs' push_batches.
+        BatchHistogram::Snapshot reader_batches;
+        BatchHistogram::Snapshot input_batches;
+        ThreadLoad::Snapshot load;
     };
     
     LBStats getStats() const;
@@ -49,9 +71,9 @@ private:
     int fp_start_id_;
     int num_fps_;
     
-    ThreadSafeQueue<PacketJob> input_queue_;
+    SpscQueue<PacketJob> input_queue_;
     
-    std::vector<ThreadSafeQueue<PacketJob>*> fp_queues_;
+    std::vector<SpscQueue<PacketJob>*> fp_queues_;
     
     std::atomic<uint64_t> packets_received_{0};
     std::atomic<uint64_t> packets_dispatched_{0};
@@ -62,10 +84,20 @@ private:
     std::atomic<bool> paused_{false};
     std::thread thread_;
     bool silent_;
+    int cpu_ = -1;
+    ThreadLoad load_;
     
     void run();
     
-    int selectFP(const FiveTuple& tuple);
+    // Steers each flow to one of this LB's FPs by its job's flow_hash, and
+    // moves flows off FPs that get more than their share.
+    FlowRebalancer rebalancer_;
+    
+    // Jobs are taken off the input queue and handed to each FP this many at
+    // a time.
+    static constexpr size_t BURST = 32;
+    // This LB's jobs for each FP from the current burst.
+    std::vector<std::vector<PacketJob>> staged_;
     
     void updateQueueMetrics();
 };
@@ -73,7 +105,7 @@ private:
 class LBManager {
 public:
     LBManager(int num_lbs, int fps_per_lb,
-              std::vector<ThreadSafeQueue<PacketJob>*> fp_queues,
+              std::vector<SpscQueue<PacketJob>*> fp_queues,
               bool silent);
     
     ~LBManager();
@@ -84,6 +116,9 @@ public:
     
     LoadBalancer& getLBForPacket(const FiveTuple& tuple);
     
+    // Same choice for a FiveTupleHash the caller already has.
+    LoadBalancer& getLBForHash(size_t hash);
+    
     LoadBalancer& getLB(int id) { return *lbs_[id]; }
     
     int getNumLBs() const { return lbs_.size(); }
@@ -91,8 +126,11 @@ public:
     struct AggregatedStats {
         uint64_t total_received;
         uint64_t total_dispatched;
+        uint64_t total_migrations;
         uint64_t total_max_queue_depth;
         double overall_dispatch_efficiency;
+        BatchHistogram::Snapshot reader_batches;
+        BatchHistogram::Snapshot input_batches;
     };
     
     AggregatedStats getAggregatedStats() const;
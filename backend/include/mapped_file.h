@@ -0,0 +1,39 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace PacketAnalyzer {
+
+// Read-only, whole-file memory mapping of a capture.
+//
+// Pointers returned by data() stay valid until close() or destruction, so the
+// owner must outlive every PacketJob that borrows bytes from the mapping --
+// DPIEngine keeps its reader open until the output thread has drained.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Fails (without printing) on anything mmap cannot back: pipes, empty
+    // files, special devices. Callers fall back to stream reads.
+    bool open(const std::string& filename);
+    void close();
+
+    bool isOpen() const { return data_ != nullptr; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+}
+
+#endif
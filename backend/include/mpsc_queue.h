@@ -0,0 +1,173 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include "spsc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DPI {
+
+// Bounded queue with a fixed set of producer threads and one consumer thread.
+// Each producer has its own lane, an SpscQueue, so producers never touch each
+// other's cache lines or share a lock. The consumer drains the lanes round
+// robin. Items from one lane come out in the order they went in; items from
+// different lanes have no order between them.
+//
+// A producer that finds its lane full waits on that lane alone. The consumer
+// waits on all of them, as its WaitPolicy says: under the default it spins,
+// yields, then parks on a condition variable that any producer rings once it
+// sees the consumer has parked.
+template<typename T>
+class MpscQueue {
+public:
+    MpscQueue(size_t lanes, size_t lane_capacity) {
+        lanes_.reserve(lanes);
+        for (size_t i = 0; i < lanes; i++) {
+            lanes_.push_back(std::make_unique<SpscQueue<T>>(lane_capacity));
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // --- Producers: each lane from one thread only ---
+
+    // Waits for room in the lane; false once the queue is shut down.
+    bool push(size_t lane, T item) {
+        if (!lanes_[lane]->push(std::move(item))) return false;
+        ring();
+        return true;
+    }
+
+    // --- Consumer thread only ---
+
+    // Set before the consumer starts.
+    void setConsumerWait(const WaitPolicy& policy) {
+        consumer_wait_ = policy;
+    }
+
+    // Moves out up to `max` items, whatever is there now, taking from each
+    // lane in turn.
+    size_t tryPopBatch(T* out, size_t max) {
+        size_t n = 0;
+        const size_t lanes = lanes_.size();
+        for (size_t i = 0; i < lanes && n < max; i++) {
+            n += lanes_[(next_lane_ + i) % lanes]->tryPopBatch(out + n, max - n);
+        }
+        // Start from the next lane next time, so a busy lane cannot keep the
+        // others waiting for a whole batch each round.
+        if (lanes > 0) next_lane_ = (next_lane_ + 1) % lanes;
+        pop_batches_.record(n);
+        return n;
+    }
+
+    // Like tryPopBatch, but waits up to `timeout` for the first item.
+    size_t popBatch(T* out, size_t max, std::chrono::milliseconds timeout) {
+        size_t n = tryPopBatch(out, max);
+        if (n > 0) return n;
+        if (!waitForItems(std::chrono::steady_clock::now() + timeout)) return 0;
+        return tryPopBatch(out, max);
+    }
+
+    // --- Any thread ---
+
+    bool empty() const {
+        for (const auto& lane : lanes_) {
+            if (!lane->empty()) return false;
+        }
+        return true;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& lane : lanes_) total += lane->size();
+        return total;
+    }
+
+    size_t laneCount() const { return lanes_.size(); }
+
+    const SpscQueue<T>& lane(size_t index) const { return *lanes_[index]; }
+
+    void shutdown() {
+        for (auto& lane : lanes_) lane->shutdown();
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_.store(true);
+        not_empty_.notify_all();
+    }
+
+    bool isShutdown() const {
+        return shutdown_.load();
+    }
+
+    uint64_t totalPushes() const {
+        uint64_t total = 0;
+        for (const auto& lane : lanes_) total += lane->totalPushes();
+        return total;
+    }
+
+    uint64_t totalPops() const {
+        uint64_t total = 0;
+        for (const auto& lane : lanes_) total += lane->totalPops();
+        return total;
+    }
+
+    // Producer pushes over all lanes; consumer pops across lanes.
+    BatchHistogram::Snapshot pushBatchSizes() const {
+        BatchHistogram::Snapshot total;
+        for (const auto& lane : lanes_) total.merge(lane->pushBatchSizes());
+        return total;
+    }
+
+    BatchHistogram::Snapshot popBatchSizes() const { return pop_batches_.snapshot(); }
+
+    uint64_t consumerParks() const { return consumer_parks_.load(std::memory_order_relaxed); }
+
+private:
+    // The lane's push ended with a seq_cst store of its tail, and empty()
+    // reads the tails seq_cst after the consumer's seq_cst store of the flag:
+    // either the flag is seen here or the consumer sees the item.
+    void ring() {
+        if (consumer_parked_.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            not_empty_.notify_one();
+        }
+    }
+
+    // True once some lane has an item; false on timeout, or on shutdown with
+    // nothing left.
+    bool waitForItems(std::chrono::steady_clock::time_point deadline) {
+        auto ready = [this] { return !empty() || shutdown_.load(std::memory_order_relaxed); };
+        if (consumer_wait_.poll(ready, deadline) || !consumer_wait_.parks()) return !empty();
+        std::unique_lock<std::mutex> lock(mutex_);
+        consumer_parked_.store(true, std::memory_order_seq_cst);
+        consumer_parks_.store(consumer_parks_.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+        not_empty_.wait_until(lock, deadline, ready);
+        consumer_parked_.store(false, std::memory_order_relaxed);
+        return !empty();
+    }
+
+    std::vector<std::unique_ptr<SpscQueue<T>>> lanes_;
+    // Consumer only.
+    size_t next_lane_ = 0;
+    BatchHistogram pop_batches_;
+    WaitPolicy consumer_wait_;
+    std::atomic<uint64_t> consumer_parks_{0};
+
+    alignas(64) std::atomic<bool> consumer_parked_{false};
+    std::atomic<bool> shutdown_{false};
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+};
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef PACKET_DECODER_H
+#define PACKET_DECODER_H
+
+#include "types.h"
+#include <cstdint>
+#include <cstddef>
+
+namespace DPI {
+
+// pcap link types (DLT_* values) the decoder understands.
+namespace LinkType {
+    constexpr uint32_t NULL_LOOPBACK = 0;    // 4-byte address family, host order
+    constexpr uint32_t ETHERNET      = 1;
+    constexpr uint32_t RAW_OPENBSD   = 12;   // bare IP; 12 and 14 are old aliases
+    constexpr uint32_t RAW_BSDOS     = 14;
+    constexpr uint32_t RAW           = 101;
+    constexpr uint32_t LOOP          = 108;  // 4-byte address family, network order
+    constexpr uint32_t LINUX_SLL     = 113;
+    constexpr uint32_t LINUX_SLL2    = 276;
+}
+
+// Single-pass decode of a captured frame straight into the PacketJob fields
+// the FPs read: five-tuple, TCP flags, header offsets and the payload span.
+//
+// This is the reader's per-packet path, so it walks each header once, keeps
+// nothing but offsets, and never allocates. Offsets are relative to the start
+// of the frame, whatever the link layer -- VLAN tags, Linux cooked captures
+// and bare-IP links all land ip_offset where the IP header really is. The
+// payload is bounded by the IP length, so Ethernet padding on short frames
+// is not mistaken for payload.
+//
+// Encapsulation is taken off before the five-tuple is read: MPLS label
+// stacks, GRE (IP or Ethernet inside), VXLAN on UDP 4789 and Geneve on UDP
+// 6081, nested up to three deep. The tuple, flags and offsets are the inner
+// flow's, so tunneled traffic hashes, balances and is tracked per inner flow
+// rather than all on the tunnel endpoints; eth_offset points at the inner
+// Ethernet header when there is one.
+//
+// PacketParser still produces the full ParsedPacket for reporting; nothing on
+// the packet path needs it.
+class PacketDecoder {
+public:
+    enum class Result {
+        OK,
+        UNSUPPORTED_LINK,
+        NOT_IP,
+        NOT_TCP_UDP,
+        FRAGMENT,
+        MALFORMED
+    };
+
+    // Fills `job`'s tuple, flags and offsets; payload_data is left for the
+    // caller to point into wherever the frame ends up. OK jobs are meant for
+    // the FPs, and so are FRAGMENT ones of TCP or UDP: those carry the
+    // addresses, protocol and fragment fields, with the payload span being
+    // the fragment's data, for the FP's FragmentReassembler.
+    static Result decode(const uint8_t* frame, size_t len, uint32_t link_type,
+                         PacketJob& job);
+
+    struct Frame {
+        const uint8_t* data;
+        size_t length;
+    };
+
+    // Decodes `count` frames into `jobs` (which must be freshly constructed)
+    // and sets each OK or FRAGMENT job's flow_hash to its FiveTupleHash, so
+    // no later stage has to hash it again.
+    //
+    // Frames are prefetched a few ahead of the one being decoded. On
+    // Ethernet links each frame is first matched against the common shape --
+    // untagged IPv4, 20-byte header, not fragmented, TCP or UDP -- with one
+    // 16-byte compare (SSE2 where available, the same test in scalar code
+    // otherwise), and a match is decoded at fixed offsets. Everything else
+    // goes through decode(). Results are identical either way.
+    static void decodeBatch(const Frame* frames, size_t count, uint32_t link_type,
+                            PacketJob* jobs, Result* results);
+
+    static bool isSupportedLinkType(uint32_t link_type);
+};
+
+}
+
+#endif
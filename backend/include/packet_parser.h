@@ -57,27 +57,41 @@ struct UDPHeader {
     uint16_t checksum;
 };
 
+// Which headers parse() found, as bits of ParsedPacket::layers.
+namespace Layer {
+    constexpr uint16_t ETHERNET   = 1 << 0;
+    constexpr uint16_t IPV4       = 1 << 1;
+    constexpr uint16_t IPV6       = 1 << 2;
+    constexpr uint16_t TCP        = 1 << 3;
+    constexpr uint16_t UDP        = 1 << 4;
+    constexpr uint16_t FRAGMENT   = 1 << 5;
+    constexpr uint16_t MALFORMED  = 1 << 6;
+}
+
+// Result of PacketParser::parse: raw header fields and offsets into the
+// frame, nothing formatted. parse() runs once per packet on the reader
+// thread and must not allocate; the *String() accessors build text on
+// demand for reports and logs.
 struct ParsedPacket {
-    uint32_t timestamp_sec;
-    uint32_t timestamp_usec;
+    uint32_t timestamp_sec = 0;
+    uint32_t timestamp_usec = 0;
 
-    std::string src_mac;
-    std::string dest_mac;
-    uint16_t ether_type;
+    uint16_t layers = 0;
 
-    bool has_ip = false;
-    bool has_ipv4 = false;
-    bool has_ipv6 = false;
+    std::array<uint8_t, 6> src_mac{};
+    std::array<uint8_t, 6> dest_mac{};
+    uint16_t ether_type = 0;
 
     uint8_t ip_version = 0;
-    std::string src_ip;
-    std::string dest_ip;
+    // IPv4 addresses with the first octet in the low byte, which is how
+    // FiveTuple and RuleManager hold them.
+    uint32_t src_ipv4 = 0;
+    uint32_t dest_ipv4 = 0;
+    std::array<uint8_t, 16> src_ipv6{};
+    std::array<uint8_t, 16> dest_ipv6{};
     uint8_t protocol = 0;
     uint8_t ttl = 0;
 
-    bool has_tcp = false;
-    bool has_udp = false;
-
     uint16_t src_port = 0;
     uint16_t dest_port = 0;
 
@@ -85,11 +99,28 @@ struct ParsedPacket {
     uint32_t seq_number = 0;
     uint32_t ack_number = 0;
 
+    // Offsets into the frame of the network and transport headers and of the
+    // payload; 0 where that layer was not reached.
+    uint16_t ip_offset = 0;
+    uint16_t transport_offset = 0;
+    uint16_t payload_offset = 0;
+
     size_t payload_length = 0;
     const uint8_t* payload_data = nullptr;
 
-    bool is_fragmented = false;
-    bool is_malformed = false;
+    bool hasLayer(uint16_t layer) const { return (layers & layer) != 0; }
+    bool hasIP() const { return hasLayer(Layer::IPV4 | Layer::IPV6); }
+    bool hasIPv4() const { return hasLayer(Layer::IPV4); }
+    bool hasIPv6() const { return hasLayer(Layer::IPV6); }
+    bool hasTCP() const { return hasLayer(Layer::TCP); }
+    bool hasUDP() const { return hasLayer(Layer::UDP); }
+    bool isFragmented() const { return hasLayer(Layer::FRAGMENT); }
+    bool isMalformed() const { return hasLayer(Layer::MALFORMED); }
+
+    std::string srcMacString() const;
+    std::string destMacString() const;
+    std::string srcIPString() const;
+    std::string destIPString() const;
 };
 
 class PacketParser {
@@ -100,6 +131,7 @@ public:
 
     static std::string macToString(const uint8_t* mac);
     static std::string ipToString(uint32_t ip);
+    static std::string ipv6ToString(const uint8_t* ip);
     static std::string protocolToString(uint8_t protocol);
     static std::string tcpFlagsToString(uint8_t flags);
 
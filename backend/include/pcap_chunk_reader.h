@@ -0,0 +1,61 @@
+#ifndef PCAP_CHUNK_READER_H
+#define PCAP_CHUNK_READER_H
+
+#include <cstdint>
+#include <cstddef>
+#include "capture_source.h"
+#include "pcap_reader.h"
+
+namespace PacketAnalyzer {
+
+// One byte range of a memory-mapped classic pcap, read without looking at
+// the rest of the file, so that several threads can share one capture.
+//
+// Classic pcap has no sync marker: a range that starts mid-file first has to
+// find a record header by plausibility. A candidate passes when its lengths
+// fit the snaplen and the file, its timestamp is well-formed and not earlier
+// than the capture start, and the records chained after it pass too with
+// timestamps that do not run backwards by more than a little. A chain of
+// plausible headers does not happen by accident inside packet bytes.
+//
+// A range owns the records that start inside it, so the last one it returns
+// may end past `end`. Adjacent ranges agree as long as both resyncs land on
+// real records: stopOffset() of one then equals startOffset() of the next,
+// which callers can check afterwards.
+class PcapChunkReader {
+public:
+    // `file` must be open, memory-mapped, and outlive this reader. Offsets
+    // are into the whole file; anything inside the global header is moved
+    // past it. The resync happens here.
+    PcapChunkReader(const PcapReader& file, size_t begin, size_t end);
+
+    // Packets borrow their bytes from the mapping, as PcapReader's do.
+    bool readNextPacket(RawPacket& packet);
+
+    // Where the first record of this range turned out to be.
+    size_t startOffset() const { return start_; }
+    // Just past the last record read; meaningful once reading has finished.
+    size_t stopOffset() const { return pos_; }
+    // Bytes between the nominal start and the first record.
+    size_t skippedBytes() const { return start_ - begin_; }
+    // A record that failed validation part-way through the range.
+    bool failed() const { return failed_; }
+
+    // Offset of the first plausible record at or after `from`, or the file
+    // size if there is none.
+    static size_t resync(const PcapReader& file, size_t from);
+
+private:
+    const PcapReader& file_;
+    const uint8_t* data_;
+    size_t size_;
+    size_t begin_;
+    size_t end_;
+    size_t start_;
+    size_t pos_;
+    bool failed_ = false;
+};
+
+}
+
+#endif
@@ -7,71 +7,64 @@
 #include <fstream>
 #include <optional>
 #include <limits>
+#include "capture_source.h"
+#include "mapped_file.h"
+#include "read_ahead.h"
 
 namespace PacketAnalyzer {
 
-struct PcapGlobalHeader {
-    uint32_t magic_number;
-    uint16_t version_major;
-    uint16_t version_minor;
-    int32_t  thiszone;
-    uint32_t sigfigs;
-    uint32_t snaplen;
-    uint32_t network;
-};
-
-struct PcapPacketHeader {
-    uint32_t ts_sec;
-    uint32_t ts_usec;
-    uint32_t incl_len;
-    uint32_t orig_len;
-};
-
-struct RawPacket {
-    PcapPacketHeader header;
-    std::vector<uint8_t> data;
-
-    const uint8_t* payload() const {
-        return data.empty() ? nullptr : data.data();
-    }
-
-    size_t size() const {
-        return data.size();
-    }
-};
-
-class PcapReader {
+class PcapReader : public CaptureSource {
 public:
     explicit PcapReader(bool silent = false) : silent_(silent) {}
-    ~PcapReader();
+    ~PcapReader() override;
 
-    bool open(const std::string& filename);
+    bool open(const std::string& filename) override;
     
-    void close();
+    void close() override;
     
-    bool readNextPacket(RawPacket& packet);
+    bool readNextPacket(RawPacket& packet) override;
     bool validateGlobalHeader() const;
     bool validatePacketHeader(const PcapPacketHeader& header) const;
     void enableStrictMode(bool enabled) { strict_mode_ = enabled; }
+
+    void enableMemoryMap(bool enabled) override { use_mmap_ = enabled; }
+    bool isMemoryMapped() const override { return map_.isOpen(); }
+    void setReadAheadOptions(const ReadAheadOptions& options) override { stream_.setOptions(options); }
     
-    const PcapGlobalHeader& getGlobalHeader() const { return global_header_; }
+    const PcapGlobalHeader& getGlobalHeader() const override { return global_header_; }
     
-    bool isOpen() const { return file_.is_open(); }
+    bool isOpen() const override { return stream_.isOpen() || map_.isOpen(); }
     
     bool needsByteSwap() const { return needs_byte_swap_; }
+    bool isNanosecond() const { return nanosecond_; }
+
+    // The whole file, header included, while memory-mapped; for
+    // PcapChunkReader, which reads ranges of it from other threads.
+    const MappedFile& mapping() const { return map_; }
+
+    // Host byte order and microseconds, as readNextPacket hands them out.
+    void normalizeHeader(PcapPacketHeader& header) const;
+
+    // Only meaningful when the input is not memory-mapped.
+    ReadAheadReader::Stats readAheadStats() const { return stream_.getStats(); }
 
 private:
-    std::ifstream file_;
+    ReadAheadReader stream_;
     PcapGlobalHeader global_header_;
     bool needs_byte_swap_ = false;
+    bool nanosecond_ = false;
     bool strict_mode_ = true;
     uint64_t file_size_ = 0;
     uint64_t bytes_read_ = 0;
     bool silent_ = false;
+
+    bool use_mmap_ = false;
+    MappedFile map_;
+    size_t map_offset_ = 0;
     
+    bool readMappedPacket(RawPacket& packet);
     uint16_t maybeSwap16(uint16_t value) const;
     uint32_t maybeSwap32(uint32_t value) const;
-    bool safeRead(char* buffer, std::streamsize size);
 };
 
 }
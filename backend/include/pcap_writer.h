@@ -0,0 +1,121 @@
+#ifndef PCAP_WRITER_H
+#define PCAP_WRITER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "capture_source.h"
+
+namespace PacketAnalyzer {
+
+// Classic pcap writer that turns many small records into few large writes.
+//
+// Records are gathered into a batch: headers (and any payload the caller
+// cannot keep alive) are copied into one contiguous arena, payloads the
+// caller guarantees stable are referenced in place, and adjacent arena
+// pieces coalesce into a single iovec. A batch goes out with one writev()
+// once it reaches `batch_bytes`, runs out of iovecs, or flush() is called.
+//
+// Single-threaded: one thread owns the writer.
+class PcapWriter {
+public:
+    struct Options {
+        size_t batch_bytes = 1 << 20;
+        size_t max_iovecs = 512;
+    };
+
+    PcapWriter() : PcapWriter(Options{}) {}
+    explicit PcapWriter(const Options& options);
+    ~PcapWriter();
+
+    PcapWriter(const PcapWriter&) = delete;
+    PcapWriter& operator=(const PcapWriter&) = delete;
+
+    bool open(const std::string& filename);
+    // Flushes whatever is batched, then closes. False if any write failed.
+    bool close();
+    bool isOpen() const { return fd_ >= 0; }
+
+    bool writeGlobalHeader(const PcapGlobalHeader& header);
+
+    // `stable` payloads must stay valid until the next flush() or close();
+    // anything else is copied into the batch.
+    bool writePacket(const PcapPacketHeader& header, const uint8_t* data,
+                     size_t len, bool stable);
+
+    // Forwarding by range: records are taken byte for byte from the input
+    // instead of being rebuilt from header and frame. `base` is the input's
+    // memory mapping, which must stay valid until close(); `fd` is a
+    // descriptor on the same file for in-kernel copies, or -1 to always
+    // write from the mapping. Only valid when the input's records are
+    // already what this writer would produce: classic pcap, host byte
+    // order, microsecond timestamps.
+    void setRangeSource(int fd, const uint8_t* base);
+
+    // Queues the whole record (header and frame) at `record` inside the
+    // range source. Records that follow each other in the input coalesce
+    // into one run; a run goes out file to file with copy_file_range when it
+    // is big enough to be worth a syscall of its own, and is referenced in
+    // the batch like a stable payload otherwise.
+    bool writeRecordFromSource(const uint8_t* record, size_t len);
+
+    bool flush();
+
+    // True once a write has failed; later writes are dropped.
+    bool failed() const { return failed_; }
+
+    struct Stats {
+        uint64_t packets_written;
+        uint64_t bytes_written;
+        uint64_t flushes;
+        uint64_t total_flush_ns;
+        uint64_t max_flush_ns;
+        // Runs that went out with copy_file_range, and their bytes (part of
+        // bytes_written).
+        uint64_t range_copies;
+        uint64_t range_copy_bytes;
+        // Bytes written over the time the file was open, per second.
+        double bytes_per_second;
+    };
+
+    Stats getStats() const;
+
+private:
+    Options options_;
+    int fd_ = -1;
+    bool failed_ = false;
+
+    std::vector<uint8_t> arena_;
+    size_t arena_used_ = 0;
+    std::vector<iovec> iov_;
+    size_t pending_bytes_ = 0;
+
+    uint64_t packets_written_ = 0;
+    uint64_t bytes_written_ = 0;
+    uint64_t flushes_ = 0;
+    uint64_t total_flush_ns_ = 0;
+    uint64_t max_flush_ns_ = 0;
+    uint64_t range_copies_ = 0;
+    uint64_t range_copy_bytes_ = 0;
+    uint64_t opened_at_ns_ = 0;
+    uint64_t closed_at_ns_ = 0;
+
+    int range_fd_ = -1;
+    const uint8_t* range_base_ = nullptr;
+    bool range_copy_supported_ = true;
+    const uint8_t* run_begin_ = nullptr;
+    const uint8_t* run_end_ = nullptr;
+
+    bool flushRun();
+    bool copyRange(const uint8_t* begin, size_t len);
+    bool writeBatch();
+    void appendCopy(const void* data, size_t len);
+    void appendRef(const void* data, size_t len);
+    bool writeAll();
+};
+
+}
+
+#endif
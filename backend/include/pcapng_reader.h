@@ -0,0 +1,86 @@
+#ifndef PCAPNG_READER_H
+#define PCAPNG_READER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "capture_source.h"
+#include "mapped_file.h"
+#include "read_ahead.h"
+
+namespace PacketAnalyzer {
+
+// Streaming pcapng reader: walks the file one block at a time and never holds
+// more than the current block.
+//
+// Understands Section Header, Interface Description, Enhanced Packet and
+// Simple Packet blocks; every other block type is skipped by its length.
+// Sections may switch byte order, and each interface carries its own
+// timestamp resolution (if_tsresol) and offset (if_tsoffset), which are folded
+// into the microsecond timestamps every CaptureSource hands out.
+//
+// The output is classic pcap, which has one link type per file. It is taken
+// from the first interface; packets from interfaces with a different link type
+// are skipped and counted rather than written under the wrong one.
+class PcapngReader : public CaptureSource {
+public:
+    explicit PcapngReader(bool silent = false) : silent_(silent) {}
+    ~PcapngReader() override;
+
+    bool open(const std::string& filename) override;
+    void close() override;
+    bool readNextPacket(RawPacket& packet) override;
+    bool isOpen() const override { return stream_.isOpen() || map_.isOpen(); }
+
+    const PcapGlobalHeader& getGlobalHeader() const override { return global_header_; }
+
+    void enableMemoryMap(bool enabled) override { use_mmap_ = enabled; }
+    bool isMemoryMapped() const override { return map_.isOpen(); }
+    void setReadAheadOptions(const ReadAheadOptions& options) override { stream_.setOptions(options); }
+
+    size_t interfaceCount() const { return interfaces_.size(); }
+    uint64_t skippedLinkTypeMismatches() const { return skipped_link_type_; }
+
+    static constexpr uint32_t BLOCK_SHB = 0x0A0D0D0A;
+    static constexpr uint32_t BLOCK_IDB = 0x00000001;
+    static constexpr uint32_t BLOCK_SPB = 0x00000003;
+    static constexpr uint32_t BLOCK_EPB = 0x00000006;
+
+private:
+    struct Interface {
+        uint16_t link_type = 0;
+        uint32_t snaplen = 0;
+        // Timestamp units per second, as 10^n or 2^n.
+        bool resolution_is_binary = false;
+        uint8_t resolution_exponent = 6;
+        int64_t ts_offset_sec = 0;
+    };
+
+    ReadAheadReader stream_;
+    MappedFile map_;
+    size_t map_offset_ = 0;
+    bool use_mmap_ = false;
+    bool silent_ = false;
+
+    PcapGlobalHeader global_header_{};
+    bool swap_ = false;
+    std::vector<Interface> interfaces_;
+    uint64_t skipped_link_type_ = 0;
+    PcapPacketHeader last_header_{};
+
+    // Body of the current Section Header Block in stream mode, whose first
+    // field is consumed before the rest; every other body is read in place.
+    std::vector<uint8_t> block_buf_;
+
+    bool nextBlock(uint32_t& type, const uint8_t*& body, size_t& body_len);
+    bool parseSectionHeader(const uint8_t* body, size_t body_len);
+    bool parseInterface(const uint8_t* body, size_t body_len);
+    void toMicroseconds(const Interface& iface, uint64_t ticks, PcapPacketHeader& header) const;
+
+    uint16_t read16(const uint8_t* p) const;
+    uint32_t read32(const uint8_t* p) const;
+};
+
+}
+
+#endif
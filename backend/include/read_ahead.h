@@ -0,0 +1,122 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include "stream_decoder.h"
+
+namespace PacketAnalyzer {
+
+struct ReadAheadOptions {
+    // Large enough that a block read is a single sequential I/O on any disk,
+    // and a multiple of every page/sector size O_DIRECT may demand.
+    size_t block_size = 1 << 20;
+    size_t ring_blocks = 4;
+    // Bypass the page cache (O_DIRECT). Falls back to buffered reads where the
+    // filesystem refuses it, so enabling it is always safe.
+    bool direct_io = false;
+    // Compressed inputs are decompressed by the read-ahead thread, so the
+    // blocks it hands out are always plain capture bytes. O_DIRECT does not
+    // apply to them.
+    Compression compression = Compression::NONE;
+    unsigned decode_threads = 0;
+};
+
+// Sequential file reader with a dedicated I/O thread.
+//
+// The I/O thread fills a ring of aligned blocks ahead of the consumer, so the
+// consumer (the capture parser) only blocks when it has caught up with the
+// disk, never on each record. Records that straddle two blocks are assembled
+// in a staging buffer; everything else is handed out in place.
+//
+// Single consumer. Pointers returned by next() are valid until the following
+// call into the reader.
+class ReadAheadReader {
+public:
+    ReadAheadReader() = default;
+    ~ReadAheadReader();
+
+    ReadAheadReader(const ReadAheadReader&) = delete;
+    ReadAheadReader& operator=(const ReadAheadReader&) = delete;
+
+    void setOptions(const ReadAheadOptions& options) { options_ = options; }
+
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+
+    // Copies exactly `n` bytes; false if the file ends first.
+    bool read(void* dst, size_t n);
+
+    // The next `n` bytes as one contiguous span, or nullptr if the file ends
+    // first. Zero-copy unless the span crosses a block boundary.
+    const uint8_t* next(size_t n);
+
+    bool isDirectIO() const { return direct_io_active_; }
+    Compression compression() const { return decoder_ ? options_.compression : Compression::NONE; }
+
+    // Corrupt compressed input ended the stream early (already reported).
+    bool failed() const;
+
+    struct Stats {
+        uint64_t blocks_read;
+        // After decompression, when the input is compressed.
+        uint64_t bytes_read;
+        // Consumer found the ring empty: the run was I/O-bound at that moment.
+        uint64_t consumer_waits;
+        // I/O thread found the ring full: parsing was the bottleneck.
+        uint64_t producer_waits;
+        uint64_t straddled_records;
+    };
+
+    Stats getStats() const;
+
+private:
+    struct Slot {
+        uint8_t* buf = nullptr;
+        size_t len = 0;
+        bool full = false;
+    };
+
+    ReadAheadOptions options_;
+    int fd_ = -1;
+    bool direct_io_active_ = false;
+    std::unique_ptr<StreamDecoder> decoder_;
+
+    std::vector<Slot> slots_;
+    std::mutex mutex_;
+    std::condition_variable filled_;
+    std::condition_variable freed_;
+    size_t fill_index_ = 0;
+    bool eof_ = false;
+    bool stop_ = false;
+    std::thread io_thread_;
+
+    // Consumer-side state; only touched by the consuming thread.
+    size_t read_index_ = 0;
+    bool holding_slot_ = false;
+    size_t cursor_ = 0;
+    std::vector<uint8_t> staging_;
+
+    std::atomic<uint64_t> blocks_read_{0};
+    std::atomic<uint64_t> bytes_read_{0};
+    std::atomic<uint64_t> consumer_waits_{0};
+    std::atomic<uint64_t> producer_waits_{0};
+    std::atomic<uint64_t> straddled_records_{0};
+
+    void ioLoop();
+    size_t readBlock(uint8_t* buf);
+    bool acquireSlot();
+    void releaseSlot();
+};
+
+}
+
+#endif
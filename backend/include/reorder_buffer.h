@@ -0,0 +1,82 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include "types.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace DPI {
+
+// Puts forwarded packets back into packet_id order before they are written.
+//
+// Every id the reader hands out comes back exactly once, either as a job
+// (forwarded) or as a hole (dropped), so the buffer only ever waits for ids
+// that are still in flight. The window is bounded: when an id arrives that
+// far ahead of the oldest missing one, the buffer gives up on the gap and
+// moves on rather than holding up the FPs, and anything that turns up behind
+// the window afterwards is written straight away. Order is exact as long as
+// the window covers everything the queues can hold in flight.
+//
+// Single-threaded: owned by the output thread.
+class ReorderBuffer {
+public:
+    using EmitCallback = std::function<void(const PacketJob&)>;
+
+    ReorderBuffer(size_t window, EmitCallback emit);
+
+    void push(PacketJob&& job);
+    void pushHole(uint32_t packet_id);
+
+    // Emits everything still held, in order, skipping gaps. Call at end of
+    // input.
+    void flush();
+
+    struct Stats {
+        uint64_t emitted;
+        uint64_t holes;
+        size_t current_occupancy;
+        size_t max_occupancy;
+        double avg_occupancy;
+        // Time spent holding packets back behind a missing id.
+        uint64_t stall_ns;
+        // Gaps abandoned because the window filled up behind them.
+        uint64_t forced_skips;
+        // Packets that arrived after their gap was abandoned: written out of order.
+        uint64_t late_packets;
+    };
+
+    Stats getStats() const;
+
+private:
+    enum SlotState : uint8_t { EMPTY, HELD, HOLE };
+
+    size_t window_;
+    EmitCallback emit_;
+    std::vector<PacketJob> jobs_;
+    std::vector<uint8_t> state_;
+
+    // 64-bit so the 32-bit packet ids can wrap without reordering.
+    uint64_t next_id_ = 0;
+    size_t occupancy_ = 0;
+
+    uint64_t emitted_ = 0;
+    uint64_t holes_ = 0;
+    size_t max_occupancy_ = 0;
+    uint64_t occupancy_sum_ = 0;
+    uint64_t arrivals_ = 0;
+    uint64_t stall_ns_ = 0;
+    uint64_t stall_started_ns_ = 0;
+    uint64_t forced_skips_ = 0;
+    uint64_t late_packets_ = 0;
+
+    uint64_t extend(uint32_t packet_id) const;
+    bool admit(uint64_t id);
+    void release(uint64_t id);
+    void drain();
+    void updateStall();
+};
+
+}
+
+#endif
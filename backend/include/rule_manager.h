@@ -19,13 +19,15 @@ class RuleManager {
 public:
     RuleManager() = default;
     
+    void blockIP(const IPAddress& ip);
     void blockIP(uint32_t ip);
     void blockIP(const std::string& ip);
     
+    void unblockIP(const IPAddress& ip);
     void unblockIP(uint32_t ip);
     void unblockIP(const std::string& ip);
     
-    bool isIPBlocked(uint32_t ip) const;
+    bool isIPBlocked(const IPAddress& ip) const;
     
     std::vector<std::string> getBlockedIPs() const;
     
@@ -65,7 +67,7 @@ public:
     };
     
     std::optional<BlockReason> shouldBlock(
-        uint32_t src_ip,
+        const IPAddress& src_ip,
         uint16_t dst_port,
         AppType app,
         const std::string& domain) const;
@@ -92,7 +94,7 @@ public:
 
 private:
     mutable std::shared_mutex ip_mutex_;
-    std::unordered_set<uint32_t> blocked_ips_;
+    std::unordered_set<IPAddress, IPAddressHash> blocked_ips_;
     
     mutable std::shared_mutex app_mutex_;
     std::unordered_set<AppType> blocked_apps_;
@@ -108,10 +110,6 @@ private:
     std::atomic<uint64_t> total_blocks_triggered_{0};
     std::atomic<bool> strict_domain_matching_{true};
     
-    static uint32_t parseIP(const std::string& ip);
-    
-    static std::string ipToString(uint32_t ip);
-    
     static bool domainMatchesPattern(const std::string& domain, const std::string& pattern);
 };
 
@@ -17,6 +17,10 @@ public:
     static std::vector<std::pair<uint16_t, std::string>> extractExtensions(
         const uint8_t* payload, size_t length);
     static bool validateClientHello(const uint8_t* payload, size_t length);
+    // The size of the ClientHello record `payload` starts, when `length`
+    // stops short of it: the first segment of a ClientHello spread over
+    // several. 0 for a complete record or anything else.
+    static size_t pendingClientHelloLength(const uint8_t* payload, size_t length);
     static constexpr size_t MAX_SNI_LENGTH = 255;
     static constexpr size_t MAX_EXTENSION_TOTAL_LENGTH = 8192;
 
@@ -42,6 +46,8 @@ class HTTPHostExtractor {
 public:
     static std::optional<std::string> extract(const uint8_t* payload, size_t length);
     static bool isHTTPRequest(const uint8_t* payload, size_t length);
+    // A request whose headers have not ended within `length`.
+    static bool isIncompleteRequest(const uint8_t* payload, size_t length);
     static constexpr size_t MAX_HTTP_HEADER_SCAN = 16384;
 };
 
@@ -0,0 +1,309 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include "batch_histogram.h"
+#include "wait_policy.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace DPI {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Same interface as ThreadSafeQueue, plus batch push and pop.
+//
+// Each side writes only its own index, on its own cache line, and keeps a
+// cached copy of the other side's that it refreshes only when the queue looks
+// full (producer) or empty (consumer). So in the steady state a push or pop
+// does not touch a line the other thread is writing. A side that has to wait
+// spins briefly, then yields, then parks on a condition variable (the
+// consumer's schedule is its WaitPolicy). The other side takes the mutex to
+// wake it only once it has actually parked.
+//
+// T must be default-constructible and move-assignable: the slots are built
+// up front and items are moved in and out of them.
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t max_size = 10000)
+        : slot_count_(max_size + 1),
+          slots_(new T[max_size + 1]) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // --- Producer thread only ---
+
+    // Waits for room; false once the queue is shut down.
+    bool push(T item) {
+        return pushBatch(&item, 1) == 1;
+    }
+
+    bool tryPush(T item) {
+        if (shutdown_.load(std::memory_order_relaxed)) return false;
+        if (freeSlots() == 0) return false;
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        slots_[tail] = std::move(item);
+        publish(advance(tail, 1), 1);
+        return true;
+    }
+
+    // Moves items[0, count) in, in order, waiting for room as needed and
+    // publishing as many at once as fit. Returns how many went in: `count`,
+    // unless the queue was shut down first.
+    size_t pushBatch(T* items, size_t count) {
+        size_t done = 0;
+        while (done < count) {
+            if (shutdown_.load(std::memory_order_relaxed)) break;
+            const size_t room = freeSlots();
+            if (room == 0) {
+                waitForRoom();
+                continue;
+            }
+            const size_t n = std::min(room, count - done);
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < n; i++) {
+                slots_[tail] = std::move(items[done + i]);
+                tail = advance(tail, 1);
+            }
+            publish(tail, n);
+            done += n;
+        }
+        return done;
+    }
+
+    // --- Consumer thread only ---
+
+    // How the consumer waits when the queue is empty. Set before it starts.
+    void setConsumerWait(const WaitPolicy& policy) {
+        consumer_wait_ = policy;
+    }
+
+    // Waits for an item; nullopt once the queue is shut down and drained.
+    std::optional<T> pop() {
+        T item;
+        while (tryPopBatch(&item, 1) == 0) {
+            if (!waitForItems(std::chrono::steady_clock::time_point::max())) {
+                return std::nullopt;
+            }
+        }
+        return item;
+    }
+
+    std::optional<T> popWithTimeout(std::chrono::milliseconds timeout) {
+        T item;
+        if (popBatch(&item, 1, timeout) == 0) return std::nullopt;
+        return item;
+    }
+
+    bool tryPop(T& out) {
+        return tryPopBatch(&out, 1) == 1;
+    }
+
+    // Moves out up to `max` items, whatever is there now.
+    size_t tryPopBatch(T* out, size_t max) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t available = used(tail_cache_, head);
+        if (available < max) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            available = used(tail_cache_, head);
+        }
+        const size_t n = std::min(available, max);
+        if (n == 0) return 0;
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::move(slots_[head]);
+            head = advance(head, 1);
+        }
+        head_.store(head, std::memory_order_seq_cst);
+        total_pops_.store(total_pops_.load(std::memory_order_relaxed) + n,
+                          std::memory_order_relaxed);
+        pop_batches_.record(n);
+        wake(producer_parked_, not_full_);
+        return n;
+    }
+
+    // Like tryPopBatch, but waits up to `timeout` for the first item.
+    size_t popBatch(T* out, size_t max, std::chrono::milliseconds timeout) {
+        size_t n = tryPopBatch(out, max);
+        if (n > 0) return n;
+        if (!waitForItems(std::chrono::steady_clock::now() + timeout)) return 0;
+        return tryPopBatch(out, max);
+    }
+
+    void clear() {
+        T discard;
+        while (tryPop(discard)) {}
+    }
+
+    // --- Any thread ---
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t size() const {
+        // Head first: the tail read after it cannot be behind it. seq_cst so
+        // a waiter on several queues (MpscQueue) can rely on it after parking.
+        const size_t head = head_.load(std::memory_order_seq_cst);
+        return used(tail_.load(std::memory_order_seq_cst), head);
+    }
+
+    size_t capacity() const {
+        return slot_count_ - 1;
+    }
+
+    // The slot array, for placing it in memory (see placeOnNode).
+    const void* storage() const { return slots_.get(); }
+    size_t storageBytes() const { return slot_count_ * sizeof(T); }
+
+    void shutdown() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_.store(true);
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool isShutdown() const {
+        return shutdown_.load();
+    }
+
+    uint64_t totalPushes() const { return total_pushes_.load(); }
+    uint64_t totalPops() const { return total_pops_.load(); }
+    // Times the consumer gave up spinning and parked.
+    uint64_t consumerParks() const { return consumer_parks_.load(std::memory_order_relaxed); }
+    size_t maxObservedDepth() const { return max_depth_.load(); }
+    // How many items each publish by the producer, and each non-empty pop by
+    // the consumer, moved.
+    BatchHistogram::Snapshot pushBatchSizes() const { return push_batches_.snapshot(); }
+    BatchHistogram::Snapshot popBatchSizes() const { return pop_batches_.snapshot(); }
+
+private:
+    // The producer samples the depth for maxObservedDepth() this often
+    // rather than reading the consumer's index on every push.
+    static constexpr uint64_t DEPTH_SAMPLE_INTERVAL = 64;
+
+    size_t advance(size_t index, size_t n) const {
+        index += n;
+        return index >= slot_count_ ? index - slot_count_ : index;
+    }
+
+    size_t used(size_t tail, size_t head) const {
+        return tail >= head ? tail - head : tail + slot_count_ - head;
+    }
+
+    // Producer: free slots, refreshing the cached head only when the cached
+    // one says the queue is full.
+    size_t freeSlots() {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t free = slot_count_ - 1 - used(tail, head_cache_);
+        if (free == 0) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            free = slot_count_ - 1 - used(tail, head_cache_);
+        }
+        return free;
+    }
+
+    void publish(size_t tail, size_t n) {
+        tail_.store(tail, std::memory_order_seq_cst);
+        const uint64_t pushes = total_pushes_.load(std::memory_order_relaxed) + n;
+        total_pushes_.store(pushes, std::memory_order_relaxed);
+        push_batches_.record(n);
+        if (pushes - last_depth_sample_ >= DEPTH_SAMPLE_INTERVAL) {
+            last_depth_sample_ = pushes;
+            const size_t depth = used(tail, head_.load(std::memory_order_relaxed));
+            if (depth > max_depth_.load(std::memory_order_relaxed)) {
+                max_depth_.store(depth, std::memory_order_relaxed);
+            }
+        }
+        wake(consumer_parked_, not_empty_);
+    }
+
+    // Called after a seq_cst store of this side's index. Together with
+    // park()'s seq_cst store of the flag and its seq_cst reads of that index,
+    // either the flag is seen here or the parking side sees the new index.
+    void wake(const std::atomic<bool>& parked, std::condition_variable& cv) {
+        if (parked.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv.notify_one();
+        }
+    }
+
+    template<typename Ready>
+    bool park(std::atomic<bool>& parked, std::condition_variable& cv, const WaitPolicy& policy,
+              Ready ready, std::chrono::steady_clock::time_point deadline,
+              std::atomic<uint64_t>& parks) {
+        if (policy.poll(ready, deadline)) return true;
+        if (!policy.parks()) return false;
+        std::unique_lock<std::mutex> lock(mutex_);
+        parked.store(true, std::memory_order_seq_cst);
+        parks.store(parks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            cv.wait(lock, ready);
+        } else {
+            cv.wait_until(lock, deadline, ready);
+        }
+        parked.store(false, std::memory_order_relaxed);
+        return ready();
+    }
+
+    // Consumer: true once there is an item; false on timeout, or on shutdown
+    // with nothing left.
+    bool waitForItems(std::chrono::steady_clock::time_point deadline) {
+        auto has_items = [this] {
+            return tail_.load(std::memory_order_seq_cst) != head_.load(std::memory_order_relaxed);
+        };
+        park(consumer_parked_, not_empty_, consumer_wait_,
+             [&] { return has_items() || shutdown_.load(std::memory_order_relaxed); }, deadline,
+             consumer_parks_);
+        return has_items();
+    }
+
+    void waitForRoom() {
+        park(producer_parked_, not_full_, WaitPolicy::adaptive(),
+             [this] {
+                 return shutdown_.load(std::memory_order_relaxed) ||
+                        used(tail_.load(std::memory_order_relaxed),
+                             head_.load(std::memory_order_seq_cst)) < slot_count_ - 1;
+             },
+             std::chrono::steady_clock::time_point::max(), producer_parks_);
+    }
+
+    const size_t slot_count_;
+    std::unique_ptr<T[]> slots_;
+
+    // Written by the consumer.
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;
+    std::atomic<uint64_t> total_pops_{0};
+    BatchHistogram pop_batches_;
+    WaitPolicy consumer_wait_;
+    std::atomic<uint64_t> consumer_parks_{0};
+
+    // Written by the producer.
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;
+    std::atomic<uint64_t> total_pushes_{0};
+    uint64_t last_depth_sample_ = 0;
+    std::atomic<size_t> max_depth_{0};
+    BatchHistogram push_batches_;
+    std::atomic<uint64_t> producer_parks_{0};
+
+    // Only touched when a side waits or is woken.
+    alignas(64) std::atomic<bool> consumer_parked_{false};
+    std::atomic<bool> producer_parked_{false};
+    std::atomic<bool> shutdown_{false};
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+}
+
+#endif
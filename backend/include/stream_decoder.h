@@ -0,0 +1,52 @@
+#ifndef STREAM_DECODER_H
+#define STREAM_DECODER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace PacketAnalyzer {
+
+enum class Compression {
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+// Recognises a compressed container from the first bytes of a file; NONE for
+// anything else, including a plain pcap or pcapng.
+Compression detectCompression(const uint8_t* head, size_t len);
+
+const char* compressionName(Compression compression);
+
+// Whether this build links the library the format needs (zlib, libzstd).
+bool compressionSupported(Compression compression);
+
+// Decompressed view of a compressed file, read front to back.
+//
+// Used by ReadAheadReader in place of plain reads, so decompression runs on
+// the read-ahead thread and the parser sees ordinary blocks. Nothing is
+// written to disk.
+class StreamDecoder {
+public:
+    virtual ~StreamDecoder() = default;
+
+    // Fills `dst` with up to `n` decompressed bytes; fewer only at the end of
+    // the stream. 0 means the end, or an error if failed() says so.
+    virtual size_t read(uint8_t* dst, size_t n) = 0;
+
+    // Corrupt or truncated input. The message has already been printed.
+    virtual bool failed() const = 0;
+};
+
+// Reads compressed bytes from `fd`, which stays owned by the caller. `threads`
+// bounds how many zstd frames are decoded at once (0 picks from the CPU
+// count, up to 8); their output buffers are capped at 256 MiB in total
+// either way. Returns nullptr, having printed why, if this build cannot decode
+// the format.
+std::unique_ptr<StreamDecoder> makeStreamDecoder(Compression compression, int fd,
+                                                 unsigned threads = 0);
+
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef TCP_REASSEMBLER_H
+#define TCP_REASSEMBLER_H
+
+#include "types.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace DPI {
+
+// The opening bytes of TCP flows an FP has not classified yet, so that a
+// ClientHello or HTTP request spread over several segments is inspected whole.
+//
+// A flow is given a buffer only once inspection finds its first segment cut
+// short. Later segments are appended while they arrive in order, up to
+// `bytes_per_flow`; a retransmission adds only what it has beyond the buffer,
+// and a segment after a gap is not buffered. Buffers come from a pool of
+// `max_flows`, each allocated at full size on first use and reused after,
+// so a warm pool handles handshakes without allocating. The FP releases a
+// flow's buffer the moment the flow is classified or blocked. When every
+// buffer is taken, the flow that has waited longest loses its buffer.
+//
+// Not thread-safe: one per FP, used by the FP thread; getStats() may be
+// called from anywhere.
+class TcpReassembler {
+public:
+    struct Limits {
+        size_t bytes_per_flow = 16 * 1024;
+        size_t max_flows = 256;
+    };
+
+    TcpReassembler();
+    explicit TcpReassembler(Limits limits);
+
+    TcpReassembler(const TcpReassembler&) = delete;
+    TcpReassembler& operator=(const TcpReassembler&) = delete;
+
+    // Starts buffering `tuple` with the segment at `seq`. False if the pool
+    // has no buffers at all.
+    bool begin(const FiveTuple& tuple, uint32_t seq, const uint8_t* data, size_t length);
+
+    struct View {
+        const uint8_t* data;
+        size_t length;
+        // Nothing more will be buffered.
+        bool full;
+    };
+
+    // For a flow being buffered: adds the segment at `seq` if it continues
+    // the buffer, then returns everything buffered. nullopt for other flows.
+    std::optional<View> append(const FiveTuple& tuple, uint32_t seq, const uint8_t* data,
+                               size_t length);
+
+    void release(const FiveTuple& tuple);
+
+    // A flow's buffer on its way to another FP's reassembler.
+    struct FlowBuffer {
+        FiveTuple tuple;
+        uint32_t next_seq;
+        std::vector<uint8_t> bytes;
+    };
+
+    // Releases the flows whose tuple's FiveTupleHash `moving` selects and
+    // returns their buffers, for another FP to adopt() when their flows are
+    // steered there.
+    std::vector<FlowBuffer> extract(const std::function<bool(uint64_t flow_hash)>& moving);
+
+    // Buffers flows extract()ed elsewhere, as if begin() had been called here;
+    // not counted as newly buffered.
+    void adopt(std::vector<FlowBuffer>&& flows);
+
+    struct Stats {
+        uint64_t flows_buffered;
+        uint64_t segments_appended;
+        uint64_t out_of_order;
+        uint64_t overflows;
+        uint64_t evicted;
+        uint64_t flows_in_progress;
+        uint64_t peak_flows;
+    };
+
+    Stats getStats() const;
+
+private:
+    struct Slot {
+        std::unique_ptr<uint8_t[]> buffer;
+        size_t length = 0;
+        uint32_t next_seq = 0;
+        std::list<FiveTuple>::iterator age;
+    };
+
+    Limits limits_;
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_slots_;
+    std::unordered_map<FiveTuple, uint32_t, FiveTupleHash> flows_;
+    // Oldest first: the eviction order.
+    std::list<FiveTuple> by_age_;
+
+    std::atomic<uint64_t> flows_buffered_{0};
+    std::atomic<uint64_t> segments_appended_{0};
+    std::atomic<uint64_t> out_of_order_{0};
+    std::atomic<uint64_t> overflows_{0};
+    std::atomic<uint64_t> evicted_{0};
+    std::atomic<uint64_t> in_progress_{0};
+    std::atomic<uint64_t> peak_flows_{0};
+
+    // A free slot for `tuple`, registered and emptied: the flow's old buffer
+    // if it had one, else a free one, else the oldest flow's. nullptr if the
+    // pool has no buffers at all.
+    Slot* claim(const FiveTuple& tuple);
+    // Copies as much of `data` as fits; false if some did not.
+    bool copyIn(Slot& slot, const uint8_t* data, size_t length);
+    void releaseSlot(std::unordered_map<FiveTuple, uint32_t, FiveTupleHash>::iterator it);
+};
+
+}
+
+#endif
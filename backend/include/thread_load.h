@@ -0,0 +1,73 @@
+#ifndef THREAD_LOAD_H
+#define THREAD_LOAD_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace DPI {
+
+// Where a pipeline thread's time goes: busy handling items, or idle waiting
+// on its input queue (spinning, yielding or parked, as its WaitPolicy says).
+// Together with the queue's park count this shows what a wait policy costs
+// in CPU and what it buys in wake-ups.
+//
+// The owning thread marks each switch; a switch is a steady_clock read.
+// snapshot() may be called from anywhere and sees every span closed so far.
+class ThreadLoad {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot {
+        uint64_t busy_ns = 0;
+        uint64_t idle_ns = 0;
+        // Times the thread parked on its queue; filled in by the queue's owner.
+        uint64_t parks = 0;
+
+        double busyShare() const {
+            const uint64_t total = busy_ns + idle_ns;
+            return total ? static_cast<double>(busy_ns) / total : 0.0;
+        }
+    };
+
+    // The thread has started, busy.
+    void start() {
+        last_ = Clock::now();
+    }
+
+    // About to wait for input. Returns the time, for callers that want one.
+    Clock::time_point idle() {
+        return mark(busy_ns_);
+    }
+
+    // Back from waiting.
+    Clock::time_point busy() {
+        return mark(idle_ns_);
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.busy_ns = busy_ns_.load(std::memory_order_relaxed);
+        s.idle_ns = idle_ns_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    // Charges the span since the last mark to `counter`. Single writer.
+    Clock::time_point mark(std::atomic<uint64_t>& counter) {
+        const Clock::time_point now = Clock::now();
+        const uint64_t ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count());
+        counter.store(counter.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        last_ = now;
+        return now;
+    }
+
+    Clock::time_point last_ = Clock::now();
+    std::atomic<uint64_t> busy_ns_{0};
+    std::atomic<uint64_t> idle_ns_{0};
+};
+
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef THREAD_SAFE_QUEUE_H
 #define THREAD_SAFE_QUEUE_H
 
+#include "batch_histogram.h"
+#include <algorithm>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -21,7 +23,7 @@ public:
         not_full_.wait(lock, [this] { return queue_.size() < max_size_ || shutdown_; });
         if (shutdown_) return false;
         queue_.push(std::move(item));
-        updateMetricsOnPush();
+        updateMetricsOnPush(1);
         not_empty_.notify_one();
         return true;
     }
@@ -30,7 +32,7 @@ public:
         std::lock_guard<std::mutex> lock(mutex_);
         if (queue_.size() >= max_size_ || shutdown_) return false;
         queue_.push(std::move(item));
-        updateMetricsOnPush();
+        updateMetricsOnPush(1);
         not_empty_.notify_one();
         return true;
     }
@@ -41,7 +43,7 @@ public:
         if (queue_.empty()) return std::nullopt;
         T item = std::move(queue_.front());
         queue_.pop();
-        total_pops_++;
+        updateMetricsOnPop(1);
         not_full_.notify_one();
         return item;
     }
@@ -53,7 +55,7 @@ public:
         if (queue_.empty()) return std::nullopt;
         T item = std::move(queue_.front());
         queue_.pop();
-        total_pops_++;
+        updateMetricsOnPop(1);
         not_full_.notify_one();
         return item;
     }
@@ -63,11 +65,49 @@ public:
         if (queue_.empty()) return false;
         out = std::move(queue_.front());
         queue_.pop();
-        total_pops_++;
+        updateMetricsOnPop(1);
         not_full_.notify_one();
         return true;
     }
 
+    // Moves items[0, count) in, in order, taking the lock once for as many
+    // as fit and waiting for room as needed. Returns how many went in:
+    // `count`, unless the queue was shut down first.
+    size_t pushBatch(T* items, size_t count) {
+        size_t done = 0;
+        while (done < count) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] { return queue_.size() < max_size_ || shutdown_; });
+            if (shutdown_) break;
+            const size_t n = std::min(max_size_ - queue_.size(), count - done);
+            for (size_t i = 0; i < n; i++) {
+                queue_.push(std::move(items[done + i]));
+            }
+            updateMetricsOnPush(n);
+            done += n;
+            if (n == 1) {
+                not_empty_.notify_one();
+            } else {
+                not_empty_.notify_all();
+            }
+        }
+        return done;
+    }
+
+    // Moves out up to `max` items, whatever is there now, under one lock.
+    size_t tryPopBatch(T* out, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return takeLocked(out, max);
+    }
+
+    // Like tryPopBatch, but waits up to `timeout` for the first item.
+    size_t popBatch(T* out, size_t max, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!not_empty_.wait_for(lock, timeout, [this] { return !queue_.empty() || shutdown_; }))
+            return 0;
+        return takeLocked(out, max);
+    }
+
     void clear() {
         std::lock_guard<std::mutex> lock(mutex_);
         while (!queue_.empty()) queue_.pop();
@@ -102,10 +142,35 @@ public:
     uint64_t totalPushes() const { return total_pushes_.load(); }
     uint64_t totalPops() const { return total_pops_.load(); }
     size_t maxObservedDepth() const { return max_depth_.load(); }
+    BatchHistogram::Snapshot pushBatchSizes() const { return push_batches_.snapshot(); }
+    BatchHistogram::Snapshot popBatchSizes() const { return pop_batches_.snapshot(); }
 
 private:
-    void updateMetricsOnPush() {
-        total_pushes_++;
+    size_t takeLocked(T* out, size_t max) {
+        const size_t n = std::min(queue_.size(), max);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::move(queue_.front());
+            queue_.pop();
+        }
+        if (n == 0) return 0;
+        updateMetricsOnPop(n);
+        if (n == 1) {
+            not_full_.notify_one();
+        } else {
+            not_full_.notify_all();
+        }
+        return n;
+    }
+
+    // Both called with the lock held.
+    void updateMetricsOnPop(size_t n) {
+        total_pops_ += n;
+        pop_batches_.record(n);
+    }
+
+    void updateMetricsOnPush(size_t n) {
+        total_pushes_ += n;
+        push_batches_.record(n);
         size_t current = queue_.size();
         size_t prev_max = max_depth_.load();
         while (current > prev_max &&
@@ -122,6 +187,8 @@ private:
     std::atomic<uint64_t> total_pushes_{0};
     std::atomic<uint64_t> total_pops_{0};
     std::atomic<size_t> max_depth_{0};
+    BatchHistogram push_batches_;
+    BatchHistogram pop_batches_;
 };
 
 }
@@ -1,6 +1,7 @@
 #ifndef DPI_TYPES_H
 #define DPI_TYPES_H
 
+#include "platform.h"
 #include <cstdint>
 #include <string>
 #include <functional>
@@ -8,13 +9,103 @@
 #include <vector>
 #include <atomic>
 #include <optional>
+#include <memory>
 #include <array>
+#include <cstring>
 
 namespace DPI {
 
+// One address of either family, in network byte order. IPv4 is held
+// v4-mapped (::ffff:a.b.c.d), so a flow key is the same size and compares and
+// hashes the same way whatever the family; the v4 common case pays nothing
+// but the wider compare.
+struct IPAddress {
+    alignas(8) std::array<uint8_t, 16> bytes{};
+
+    // `packed` has the first octet in the low byte, as RuleManager and the
+    // parser's src_ipv4/dest_ipv4 hold it.
+    static IPAddress fromV4(uint32_t packed) {
+        IPAddress a;
+        a.bytes[10] = 0xFF;
+        a.bytes[11] = 0xFF;
+        for (int i = 0; i < 4; i++) {
+            a.bytes[12 + i] = static_cast<uint8_t>(packed >> (8 * i));
+        }
+        return a;
+    }
+
+    static IPAddress fromV4Bytes(const uint8_t* p) {
+        IPAddress a;
+        a.bytes[10] = 0xFF;
+        a.bytes[11] = 0xFF;
+        std::memcpy(a.bytes.data() + 12, p, 4);
+        return a;
+    }
+
+    static IPAddress fromV6Bytes(const uint8_t* p) {
+        IPAddress a;
+        std::memcpy(a.bytes.data(), p, 16);
+        return a;
+    }
+
+    // Dotted quad or RFC 4291 text ("2001:db8::1", "::ffff:10.0.0.1").
+    static std::optional<IPAddress> parse(const std::string& text);
+
+    bool isV4() const {
+        return high() == 0 && (low() & V4_MARK_MASK) == V4_MARK;
+    }
+
+    // Packed as fromV4 takes it; only meaningful when isV4().
+    uint32_t v4() const {
+        return static_cast<uint32_t>(bytes[12]) | (static_cast<uint32_t>(bytes[13]) << 8) |
+               (static_cast<uint32_t>(bytes[14]) << 16) | (static_cast<uint32_t>(bytes[15]) << 24);
+    }
+
+    // The two halves as host-order loads. Only for comparing and hashing --
+    // the values differ between little- and big-endian hosts.
+    uint64_t high() const {
+        uint64_t v;
+        std::memcpy(&v, bytes.data(), sizeof(v));
+        return v;
+    }
+
+    uint64_t low() const {
+        uint64_t v;
+        std::memcpy(&v, bytes.data() + 8, sizeof(v));
+        return v;
+    }
+
+    bool operator==(const IPAddress& other) const {
+        return high() == other.high() && low() == other.low();
+    }
+
+    bool operator!=(const IPAddress& other) const {
+        return !(*this == other);
+    }
+
+    std::string toString() const;
+
+private:
+    // Bytes 8..11 of a v4-mapped address (00 00 ff ff) as low() sees them.
+    static constexpr uint64_t V4_MARK_MASK = PortableNet::isLittleEndian()
+        ? 0x00000000FFFFFFFFULL : 0xFFFFFFFF00000000ULL;
+    static constexpr uint64_t V4_MARK = PortableNet::isLittleEndian()
+        ? 0x00000000FFFF0000ULL : 0x0000FFFF00000000ULL;
+};
+
+struct IPAddressHash {
+    size_t operator()(const IPAddress& addr) const noexcept {
+        uint64_t key = addr.high() ^ (addr.low() * 0x9e3779b97f4a7c15ULL);
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return static_cast<size_t>(key);
+    }
+};
+
 struct FiveTuple {
-    uint32_t src_ip;
-    uint32_t dst_ip;
+    IPAddress src_ip;
+    IPAddress dst_ip;
     uint16_t src_port;
     uint16_t dst_port;
     uint8_t  protocol;
@@ -37,9 +128,16 @@ struct FiveTuple {
         return protocol != 0 && (src_port != 0 || dst_port != 0);
     }
 
+    // Branch-free over both families. For IPv4 the high halves are zero and
+    // the low halves carry the address next to a constant, so this is the
+    // old 32-bit key XOR a constant; IPv6 flows mix in all 128 bits, where folding
+    // them to 32 used to pile v6 traffic onto a few FPs.
     uint64_t compactHashKey() const {
-        return (static_cast<uint64_t>(src_ip) << 32) ^
-               (static_cast<uint64_t>(dst_ip)) ^
+        const uint64_t src_lo = src_ip.low();
+        const uint64_t dst_lo = dst_ip.low();
+        return src_lo ^ ((dst_lo << 32) | (dst_lo >> 32)) ^
+               (src_ip.high() * 0x9e3779b97f4a7c15ULL) ^
+               (dst_ip.high() * 0xc2b2ae3d27d4eb4fULL) ^
                (static_cast<uint64_t>(src_port) << 16) ^
                (static_cast<uint64_t>(dst_port)) ^
                protocol;
@@ -127,22 +225,63 @@ struct Connection {
     double average_packet_size = 0.0;
 };
 
+// See flow_rebalancer.h.
+struct FlowMigration;
+
 struct PacketJob {
-    uint32_t packet_id;
+    uint32_t packet_id = 0;
     FiveTuple tuple;
+    // FiveTupleHash of `tuple`, computed once when the job is decoded; every
+    // stage that steers by flow uses this instead of hashing again.
+    uint64_t flow_hash = 0;
     std::vector<uint8_t> data;
+
+    // Non-owning alternative to `data`, used when the frame lives in a
+    // memory-mapped capture. The engine keeps the mapping alive until the output
+    // thread has drained, so a borrowed job is as safe to queue as an owned one
+    // and costs nothing to copy.
+    const uint8_t* borrowed_data = nullptr;
+    size_t borrowed_length = 0;
+
+    const uint8_t* frameData() const {
+        return borrowed_data ? borrowed_data : data.data();
+    }
+
+    size_t frameLength() const {
+        return borrowed_data ? borrowed_length : data.size();
+    }
+
     size_t eth_offset = 0;
     size_t ip_offset = 0;
     size_t transport_offset = 0;
     size_t payload_offset = 0;
     size_t payload_length = 0;
     uint8_t tcp_flags = 0;
+    // Sequence number of the first payload byte, for TCP.
+    uint32_t tcp_seq = 0;
     const uint8_t* payload_data = nullptr;
     bool is_fragmented = false;
     bool is_malformed = false;
+    // With is_fragmented: the datagram's IP id, where this fragment's data
+    // (payload_offset/payload_length) sits in it, and whether more follows.
+    uint32_t fragment_id = 0;
+    uint32_t fragment_offset = 0;
+    bool more_fragments = false;
+    // The chunk reader range this came from; see FragmentReassembler.
+    uint16_t source = 0;
+    // Placeholder for a dropped packet, queued to the output thread only when
+    // output order is preserved; just packet_id is meaningful.
+    bool is_hole = false;
+    // Set on a marker, not a packet: a bucket of flows is moving off or onto
+    // the FP whose queue this is.
+    std::shared_ptr<FlowMigration> migration;
+    // Set on a marker, not a packet: the producer of this queue is done, and
+    // everything it sent is ahead of this. Each stage passes it on once it
+    // has drained, so the last stage's marker means the pipeline is empty.
+    bool end_of_stream = false;
     
-    uint32_t ts_sec;
-    uint32_t ts_usec;
+    uint32_t ts_sec = 0;
+    uint32_t ts_usec = 0;
 };
 
 struct DPIStats {
@@ -0,0 +1,98 @@
+#ifndef WAIT_POLICY_H
+#define WAIT_POLICY_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace DPI {
+
+// One iteration of a busy-wait loop: tells the core it is spinning, so a
+// hyperthread sibling gets the pipeline and the loop does not hammer memory.
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// How a consumer thread waits on an empty queue.
+//
+// ADAPTIVE spins, then yields, then parks on the queue's condition variable.
+// Parking costs a futex round trip to wake from, but frees the CPU, which is
+// what a shared host wants. spin_limit = yield_limit = 0 parks at once.
+//
+// BUSY_POLL never parks: the thread spins until an item arrives or its wait
+// times out. Wake-up latency is a cache miss, at the price of a whole CPU per
+// consumer, so it only makes sense with each consumer pinned to a core of
+// its own.
+struct WaitPolicy {
+    enum class Mode { ADAPTIVE, BUSY_POLL };
+
+    Mode mode = Mode::ADAPTIVE;
+    int spin_limit = 256;
+    int yield_limit = 16;
+
+    static WaitPolicy adaptive() { return WaitPolicy(); }
+
+    static WaitPolicy busyPoll() {
+        WaitPolicy policy;
+        policy.mode = Mode::BUSY_POLL;
+        return policy;
+    }
+
+    static WaitPolicy park() {
+        WaitPolicy policy;
+        policy.spin_limit = 0;
+        policy.yield_limit = 0;
+        return policy;
+    }
+
+    bool parks() const { return mode == Mode::ADAPTIVE; }
+
+    // Polls `ready` until it holds (true), the deadline passes (false), or,
+    // for ADAPTIVE, the spin and yield rounds run out (false: time to park).
+    template<typename Ready>
+    bool poll(Ready ready, std::chrono::steady_clock::time_point deadline) const {
+        if (mode == Mode::BUSY_POLL) {
+            // The clock is read every so many polls rather than every one.
+            constexpr unsigned CLOCK_INTERVAL = 1024;
+            for (unsigned i = 1;; i++) {
+                if (ready()) return true;
+                if (i % CLOCK_INTERVAL == 0 && std::chrono::steady_clock::now() >= deadline) {
+                    return ready();
+                }
+                cpuRelax();
+            }
+        }
+        for (int i = 0; i < spin_limit; i++) {
+            if (ready()) return true;
+            cpuRelax();
+        }
+        for (int i = 0; i < yield_limit; i++) {
+            if (ready()) return true;
+            std::this_thread::yield();
+        }
+        return ready();
+    }
+
+    // "busy-poll", "adaptive" or "park".
+    std::string name() const {
+        if (mode == Mode::BUSY_POLL) return "busy-poll";
+        return spin_limit == 0 && yield_limit == 0 ? "park" : "adaptive";
+    }
+};
+
+inline std::optional<WaitPolicy> parseWaitPolicy(const std::string& text) {
+    if (text == "busy-poll") return WaitPolicy::busyPoll();
+    if (text == "adaptive") return WaitPolicy::adaptive();
+    if (text == "park") return WaitPolicy::park();
+    return std::nullopt;
+}
+
+}
+
+#endif
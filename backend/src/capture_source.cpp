@@ -0,0 +1,68 @@
+#include "capture_source.h"
+#include "pcap_reader.h"
+#include "pcapng_reader.h"
+#include <iostream>
+#include <fstream>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace PacketAnalyzer {
+
+// The container magic of a compressed capture: the first bytes it
+// decompresses to. Costs one small decode, thrown away.
+static bool peekDecompressed(const std::string& filename, Compression compression,
+                             uint32_t& magic) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = false;
+    if (auto decoder = makeStreamDecoder(compression, fd, 1)) {
+        ok = decoder->read(reinterpret_cast<uint8_t*>(&magic), sizeof(magic)) == sizeof(magic);
+    }
+    ::close(fd);
+    return ok;
+}
+
+std::unique_ptr<CaptureSource> openCaptureSource(const std::string& filename,
+                                                 const CaptureOptions& options) {
+    uint32_t magic = 0;
+    Compression compression = Compression::NONE;
+
+    // Sniffing reads the first bytes, which a pipe would not give back. Only
+    // regular files are probed; anything else is assumed to be classic pcap.
+    struct stat st;
+    if (::stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        std::ifstream probe(filename, std::ios::binary);
+        if (!probe.read(reinterpret_cast<char*>(&magic), sizeof(magic))) {
+            std::cerr << "Error: Could not read capture header: " << filename << std::endl;
+            return nullptr;
+        }
+        compression = detectCompression(reinterpret_cast<const uint8_t*>(&magic), sizeof(magic));
+        if (compression != Compression::NONE &&
+            !peekDecompressed(filename, compression, magic)) {
+            std::cerr << "Error: Could not read capture header inside "
+                      << compressionName(compression) << " input: " << filename << std::endl;
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<CaptureSource> source;
+    if (magic == PcapngReader::BLOCK_SHB) {
+        source = std::make_unique<PcapngReader>(options.silent);
+    } else {
+        // Also the fallback for unknown magics: PcapReader reports them.
+        source = std::make_unique<PcapReader>(options.silent);
+    }
+
+    // A compressed file can only be streamed through its decoder.
+    ReadAheadOptions read_ahead = options.read_ahead;
+    read_ahead.compression = compression;
+    source->enableMemoryMap(options.use_mmap && compression == Compression::NONE);
+    source->setReadAheadOptions(read_ahead);
+    if (!source->open(filename)) {
+        return nullptr;
+    }
+    return source;
+}
+
+}
@@ -141,6 +141,47 @@ size_t ConnectionTracker::cleanupStale(std::chrono::seconds timeout) {
     return removed;
 }
 
+std::vector<Connection> ConnectionTracker::extract(
+    const std::function<bool(uint64_t flow_hash)>& moving) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+
+    const FiveTupleHash hasher;
+    std::vector<Connection> extracted;
+    for (auto it = connections_.begin(); it != connections_.end(); ) {
+        if (moving(hasher(it->first))) {
+            removeFromLRU(it->first);
+            extracted.push_back(std::move(it->second));
+            it = connections_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return extracted;
+}
+
+void ConnectionTracker::adopt(std::vector<Connection>&& connections) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+
+    for (auto& conn : connections) {
+        const FiveTuple tuple = conn.tuple;
+        auto it = connections_.find(tuple);
+        if (it != connections_.end()) {
+            removeFromLRU(tuple);
+            it->second = std::move(conn);
+        } else {
+            if (connections_.size() >= max_connections_) {
+                evictOldest();
+            }
+            it = connections_.emplace(tuple, std::move(conn)).first;
+        }
+        // Closed connections are kept out of the LRU, as closeConnection does.
+        if (it->second.state != ConnectionState::CLOSED) {
+            lru_list_.push_front(tuple);
+            lru_index_[tuple] = lru_list_.begin();
+        }
+    }
+}
+
 std::vector<Connection> ConnectionTracker::getAllConnections() const {
     std::shared_lock<std::shared_mutex> lock(mutex_);
 
@@ -0,0 +1,209 @@
+#include "cpu_affinity.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace DPI {
+
+namespace {
+
+#ifdef __linux__
+// From <linux/mempolicy.h>, which not every libc ships.
+constexpr int MPOL_PREFERRED_ = 1;
+constexpr unsigned MPOL_MF_MOVE_ = 1u << 1;
+#endif
+
+std::optional<std::vector<int>> readCpuList(const std::string& path) {
+    std::ifstream file(path);
+    std::string text;
+    if (!file || !std::getline(file, text)) return std::nullopt;
+    return parseCpuList(text);
+}
+
+// The CPUs the process may use; every CPU the OS reports if that is unknown.
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        const int n = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < n; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+}
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topology;
+    const std::vector<int> allowed = allowedCpus();
+    const auto online = readCpuList("/sys/devices/system/node/online");
+    if (online) {
+        for (int node : *online) {
+            const auto cpus = readCpuList("/sys/devices/system/node/node" +
+                                          std::to_string(node) + "/cpulist");
+            if (!cpus) continue;
+            std::vector<int> usable;
+            for (int cpu : *cpus) {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                    usable.push_back(cpu);
+                }
+            }
+            // A memory-only node, or one outside the mask, has nothing to run
+            // threads on.
+            if (!usable.empty()) topology.nodes.push_back({node, std::move(usable)});
+        }
+    }
+    if (topology.nodes.empty()) {
+        topology.nodes.push_back({0, allowed});
+    }
+    return topology;
+}
+
+int CpuTopology::nodeOf(int cpu) const {
+    for (const auto& node : nodes) {
+        if (std::find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end()) {
+            return node.id;
+        }
+    }
+    return -1;
+}
+
+size_t CpuTopology::cpuCount() const {
+    size_t count = 0;
+    for (const auto& node : nodes) count += node.cpus.size();
+    return count;
+}
+
+int ThreadPlacement::cpuFor(const std::vector<int>& cpus, size_t index) {
+    return cpus.empty() ? -1 : cpus[index % cpus.size()];
+}
+
+void ThreadPlacement::fillAuto(const CpuTopology& topology, int num_lbs, int fps_per_lb,
+                               int num_parse_workers) {
+    if (topology.nodes.empty()) return;
+    std::vector<size_t> next(topology.nodes.size(), 0);
+    auto take = [&](size_t node) {
+        const auto& cpus = topology.nodes[node].cpus;
+        return cpus[next[node]++ % cpus.size()];
+    };
+
+    // Front end first, so on a small machine the FPs are what wraps.
+    const bool fill_reader = reader.empty();
+    const bool fill_output = output.empty();
+    const bool fill_workers = parse_workers.empty();
+    const bool fill_lbs = lbs.empty();
+    const bool fill_fps = fps.empty();
+    if (fill_reader) reader.push_back(take(0));
+    if (fill_output) output.push_back(take(0));
+    if (fill_workers) {
+        for (int i = 0; i < num_parse_workers; i++) parse_workers.push_back(take(0));
+    }
+    for (int lb = 0; lb < num_lbs; lb++) {
+        const size_t node = static_cast<size_t>(lb) % topology.nodes.size();
+        if (fill_lbs) lbs.push_back(take(node));
+        if (fill_fps) {
+            for (int i = 0; i < fps_per_lb; i++) fps.push_back(take(node));
+        }
+    }
+}
+
+bool ThreadPlacement::empty() const {
+    return reader.empty() && parse_workers.empty() && lbs.empty() && fps.empty() &&
+           output.empty();
+}
+
+std::optional<std::vector<int>> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    auto number = [&](int& out) {
+        const size_t start = pos;
+        long value = 0;
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+            value = value * 10 + (text[pos] - '0');
+            if (value > 65535) return false;
+            pos++;
+        }
+        out = static_cast<int>(value);
+        return pos > start;
+    };
+    while (pos < text.size()) {
+        int first = 0, last = 0;
+        if (!number(first)) return std::nullopt;
+        last = first;
+        if (pos < text.size() && text[pos] == '-') {
+            pos++;
+            if (!number(last) || last < first) return std::nullopt;
+        }
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        if (pos < text.size()) {
+            if (text[pos] != ',') return std::nullopt;
+            pos++;
+            if (pos == text.size()) return std::nullopt;
+        }
+    }
+    if (cpus.empty()) return std::nullopt;
+    return cpus;
+}
+
+bool pinCurrentThread(int cpu, const std::string& who) {
+    if (cpu < 0) return true;
+#ifdef __linux__
+    if (cpu >= CPU_SETSIZE) {
+        std::cerr << "[" << who << "] Warning: CPU " << cpu << " is out of range; not pinned\n";
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        std::cerr << "[" << who << "] Warning: cannot pin to CPU " << cpu << ": "
+                  << std::strerror(err) << "\n";
+        return false;
+    }
+    return true;
+#else
+    std::cerr << "[" << who << "] Warning: CPU pinning is not supported on this platform\n";
+    return false;
+#endif
+}
+
+void placeOnNode(const void* data, size_t length, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (!data || length == 0 || node < 0 || node >= 1024) return;
+    const long page = ::sysconf(_SC_PAGESIZE);
+    if (page <= 0) return;
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~static_cast<uintptr_t>(page - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(data) + length;
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    // Best effort: pages shared with other data, or a kernel without NUMA,
+    // just stay where they are.
+    ::syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED_, mask, sizeof(mask) * 8,
+              MPOL_MF_MOVE_);
+#else
+    (void)data;
+    (void)length;
+    (void)node;
+#endif
+}
+
+}
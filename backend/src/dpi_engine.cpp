@@ -3,14 +3,18 @@
 #include <sstream>
 #include <iomanip>
 #include <chrono>
+#include <array>
 #include <cstring>
 #include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace DPI {
 
 
 DPIEngine::DPIEngine(const Config& config)
-    : config_(config), output_queue_(10000) {
+    : config_(config),
+      output_queue_(config.num_load_balancers * config.fps_per_lb, OUTPUT_LANE_CAPACITY) {
     if (!config_.silent) {
         std::cout << "\n";
         std::cout << "╔══════════════════════════════════════════════════════════════╗\n";
@@ -34,17 +38,39 @@ bool DPIEngine::initialize() {
     if (!config_.rules_file.empty()) {
         rule_manager_->loadRules(config_.rules_file);
     }
-    auto output_cb = [this](const PacketJob& job, PacketAction action) {
-        handleOutput(job, action);
+    auto output_cb = [this](int fp_id, PacketJob&& job, PacketAction action) {
+        handleOutput(fp_id, std::move(job), action);
     };
     int total_fps = config_.num_load_balancers * config_.fps_per_lb;
-    fp_manager_ = std::make_unique<FPManager>(total_fps, rule_manager_.get(), output_cb,config_.silent);
+    FragmentReassembler::Limits fragment_limits;
+    fragment_limits.memory_bytes = config_.fragment_memory_per_fp;
+    fragment_limits.timeout_seconds = config_.fragment_timeout_seconds;
+    TcpReassembler::Limits stream_limits;
+    stream_limits.bytes_per_flow = config_.stream_buffer_bytes;
+    stream_limits.max_flows = config_.stream_buffers_per_fp;
+    fp_manager_ = std::make_unique<FPManager>(total_fps, rule_manager_.get(), output_cb,
+                                              config_.silent, fragment_limits, stream_limits);
     lb_manager_ = std::make_unique<LBManager>(
         config_.num_load_balancers,
         config_.fps_per_lb,
         fp_manager_->getQueuePtrs(),
         config_.silent
     );
+    lb_push_locks_.reset(new std::mutex[config_.num_load_balancers]);
+    fp_router_ = std::make_unique<FlowRebalancer>(fp_manager_->getQueuePtrs(), 0);
+    fp_router_->setEnabled(config_.rebalance);
+    applyPlacement();
+    for (int i = 0; i < fp_manager_->getNumFPs(); i++) {
+        fp_manager_->getFP(i).setWaitPolicy(config_.wait_policy);
+        // Unordered output keeps per-flow order across a move only if the
+        // output thread has the old FP's packets before the new FP's.
+        fp_manager_->getFP(i).setHandOverThroughOutput(true);
+    }
+    for (int i = 0; i < lb_manager_->getNumLBs(); i++) {
+        lb_manager_->getLB(i).setWaitPolicy(config_.wait_policy);
+        lb_manager_->getLB(i).setRebalancing(config_.rebalance);
+    }
+    output_queue_.setConsumerWait(config_.wait_policy);
     global_conn_table_ = std::make_unique<GlobalConnectionTable>(total_fps);
     for (int i = 0; i < total_fps; i++) {
         global_conn_table_->registerTracker(i, &fp_manager_->getFP(i).getConnectionTracker());
@@ -55,15 +81,62 @@ bool DPIEngine::initialize() {
     return true;
 }
 
+// Prints a role's CPUs as "0,1,4".
+static std::string cpuListText(const std::vector<int>& cpus) {
+    std::string text;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        text += (i ? "," : "") + std::to_string(cpus[i]);
+    }
+    return text.empty() ? "-" : text;
+}
+
+void DPIEngine::applyPlacement() {
+    ThreadPlacement& placement = config_.placement;
+    if (!config_.auto_placement && placement.empty()) {
+        return;
+    }
+    const CpuTopology topology = CpuTopology::detect();
+    if (config_.auto_placement) {
+        placement.fillAuto(topology, config_.num_load_balancers, config_.fps_per_lb,
+                           config_.parse_workers);
+    }
+    // Memory is only worth moving when there is more than one node to be on.
+    const bool numa = topology.nodes.size() > 1;
+    for (int i = 0; i < fp_manager_->getNumFPs(); i++) {
+        const int cpu = ThreadPlacement::cpuFor(placement.fps, i);
+        fp_manager_->getFP(i).setPlacement(cpu, numa && cpu >= 0 ? topology.nodeOf(cpu) : -1);
+    }
+    for (int i = 0; i < lb_manager_->getNumLBs(); i++) {
+        lb_manager_->getLB(i).setCpu(ThreadPlacement::cpuFor(placement.lbs, i));
+    }
+    if (!config_.silent) {
+        std::cout << "[DPIEngine] CPUs (" << topology.nodes.size() << " NUMA node"
+                  << (topology.nodes.size() == 1 ? "" : "s") << "): reader "
+                  << cpuListText(placement.reader) << ", workers "
+                  << cpuListText(placement.parse_workers) << ", LBs "
+                  << cpuListText(placement.lbs) << ", FPs " << cpuListText(placement.fps)
+                  << ", output " << cpuListText(placement.output) << "\n";
+    }
+}
+
 void DPIEngine::start() {
     if (running_) return;
     
     running_ = true;
     processing_complete_ = false;
+    if (orderedOutput()) {
+        reorder_ = std::make_unique<ReorderBuffer>(
+            config_.reorder_window,
+            [this](const PacketJob& job) { writeOutputPacket(job); });
+    } else {
+        reorder_.reset();
+    }
     
     output_thread_ = std::thread(&DPIEngine::outputThreadFunc, this);
     fp_manager_->startAll();
-    lb_manager_->startAll();
+    if (!direct_dispatch_) {
+        lb_manager_->startAll();
+    }
     if (!config_.silent) {
         std::cout << "[DPIEngine] All threads started\n";
     }
@@ -93,10 +166,33 @@ void DPIEngine::waitForCompletion() {
     if (reader_thread_.joinable()) {
         reader_thread_.join();
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    // The output thread returns once every FP's end marker is in, that is
+    // once every packet has been written.
+    if (output_thread_.joinable()) {
+        endInput();
+        output_thread_.join();
+    }
     processing_complete_ = true;
 }
 
+void DPIEngine::endInput() {
+    // Whatever fed the first stage has been joined, so this thread is now
+    // its queues' only producer.
+    if (direct_dispatch_) {
+        for (int i = 0; i < fp_manager_->getNumFPs(); i++) {
+            PacketJob end;
+            end.end_of_stream = true;
+            fp_manager_->getFPQueue(i).push(std::move(end));
+        }
+        return;
+    }
+    for (int i = 0; i < lb_manager_->getNumLBs(); i++) {
+        PacketJob end;
+        end.end_of_stream = true;
+        lb_manager_->getLB(i).getInputQueue().push(std::move(end));
+    }
+}
+
 bool DPIEngine::processFile(const std::string& input_file,
                             const std::string& output_file) {
     if (!config_.silent) {
@@ -108,159 +204,885 @@ bool DPIEngine::processFile(const std::string& input_file,
             return false;
         }
     }
-    output_file_.open(output_file, std::ios::binary);
-    if (!output_file_.is_open()) {
+    if (!output_writer_.open(output_file)) {
         std::cerr << "[DPIEngine] Error: Cannot open output file\n";
         return false;
     }
+    forwarding_ranges_ = false;
+    direct_dispatch_ = config_.direct_dispatch && config_.num_readers <= 1;
     start();
     reader_thread_ = std::thread(&DPIEngine::readerThreadFunc, this, input_file);
     waitForCompletion();
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
     stop();
-    if (output_file_.is_open()) {
-        output_file_.close();
+    output_writer_.close();
+    if (range_input_fd_ >= 0) {
+        ::close(range_input_fd_);
+        range_input_fd_ = -1;
     }
+    // Only now: jobs from a mapped reader borrow their bytes from the mapping,
+    // and the last of them was written by the output thread stop() just joined.
+    reader_.reset();
     
     return true;
 }
 
+bool DPIEngine::processLive(const std::string& interface,
+                            const std::string& output_file) {
+    if (!config_.silent) {
+        std::cout << "\n[DPIEngine] Capturing on: " << interface << "\n";
+        std::cout << "[DPIEngine] Output to:     " << output_file << "\n\n";
+    }
+    if (!rule_manager_) {
+        if (!initialize()) {
+            return false;
+        }
+    }
+
+    // One ring per LB, all in one fanout group: the kernel hashes each flow to
+    // a single ring, which is the routing getLBForPacket would otherwise do.
+    PacketAnalyzer::LiveCaptureOptions options;
+    options.interface = interface;
+    const uint16_t fanout_group = static_cast<uint16_t>((::getpid() & 0xFFFF) | 1);
+    live_rings_.clear();
+    for (int i = 0; i < lb_manager_->getNumLBs(); i++) {
+        auto ring = std::make_unique<PacketAnalyzer::AfPacketRing>();
+        if (!ring->open(options, fanout_group)) {
+            live_rings_.clear();
+            return false;
+        }
+        live_rings_.push_back(std::move(ring));
+    }
+
+    if (!output_writer_.open(output_file)) {
+        std::cerr << "[DPIEngine] Error: Cannot open output file\n";
+        live_rings_.clear();
+        return false;
+    }
+    writeOutputHeader(live_rings_.front()->globalHeader());
+
+    direct_dispatch_ = false;
+    start();
+    live_stop_ = false;
+    live_packet_id_ = 0;
+    for (int i = 0; i < static_cast<int>(live_rings_.size()); i++) {
+        live_threads_.emplace_back(&DPIEngine::liveCaptureThreadFunc, this, i);
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    while (!live_stop_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (config_.live_duration_seconds > 0 &&
+            std::chrono::steady_clock::now() - started >=
+                std::chrono::seconds(config_.live_duration_seconds)) {
+            live_stop_ = true;
+        }
+    }
+    for (auto& t : live_threads_) {
+        t.join();
+    }
+    live_threads_.clear();
+
+    waitForCompletion();
+    stop();
+    output_writer_.close();
+
+    if (!config_.silent) {
+        uint64_t captured = 0, drops = 0;
+        for (auto& ring : live_rings_) {
+            auto ring_stats = ring->getStats();
+            captured += ring_stats.packets;
+            drops += ring_stats.kernel_drops;
+        }
+        std::cout << "[Live] Captured " << captured << " packets, "
+                  << drops << " dropped by the kernel\n";
+    }
+    live_rings_.clear();
+    return true;
+}
+
+void DPIEngine::liveCaptureThreadFunc(int lb_index) {
+    pinCurrentThread(ThreadPlacement::cpuFor(config_.placement.reader, lb_index),
+                     "Live " + std::to_string(lb_index));
+    PacketAnalyzer::AfPacketRing& ring = *live_rings_[lb_index];
+    LoadBalancer& lb = lb_manager_->getLB(lb_index);
+    const uint32_t link_type = ring.globalHeader().network;
+
+    auto onPacket = [&](const PacketAnalyzer::RawPacket& raw) {
+        // The ring block goes back to the kernel once this batch is done, so
+        // unlike a mapped file the frame cannot be borrowed.
+        PacketJob job;
+        if (!decodePacketJob(raw, link_type, job, true)) {
+            return;
+        }
+        const uint32_t packet_id = live_packet_id_++;
+        if (config_.live_packet_limit > 0 && packet_id >= config_.live_packet_limit) {
+            live_stop_ = true;
+            return;
+        }
+        job.packet_id = packet_id;
+        stats_.total_packets++;
+        stats_.total_bytes += raw.size();
+        if (job.tuple.protocol == PacketAnalyzer::Protocol::TCP) {
+            stats_.tcp_packets++;
+        } else {
+            stats_.udp_packets++;
+        }
+        if (job.is_fragmented) {
+            stats_.fragmented_packets++;
+        }
+        lb.getInputQueue().push(std::move(job));
+    };
+
+    while (!live_stop_) {
+        ring.poll(100, onPacket);
+    }
+}
+
 void DPIEngine::readerThreadFunc(const std::string& input_file) {
-    PacketAnalyzer::PcapReader reader(config_.silent);
+    pinCurrentThread(ThreadPlacement::cpuFor(config_.placement.reader, 0), "Reader");
+    PacketAnalyzer::CaptureOptions options;
+    options.silent = config_.silent;
+    options.use_mmap = config_.mmap_input;
+    options.read_ahead.direct_io = config_.direct_io;
+    reader_ = PacketAnalyzer::openCaptureSource(input_file, options);
     
-    if (!reader.open(input_file)) {
+    if (!reader_) {
         std::cerr << "[Reader] Error: Cannot open input file\n";
         return;
     }
+    PacketAnalyzer::CaptureSource& reader = *reader_;
+    if (!PacketDecoder::isSupportedLinkType(reader.getGlobalHeader().network)) {
+        std::cerr << "[Reader] Warning: link type " << reader.getGlobalHeader().network
+                  << " is not decoded; no packets will be inspected\n";
+    }
     
     writeOutputHeader(reader.getGlobalHeader());
     
-    PacketAnalyzer::RawPacket raw;
-    PacketAnalyzer::ParsedPacket parsed;
+    auto* pcap = dynamic_cast<PacketAnalyzer::PcapReader*>(reader_.get());
+    if (config_.forward_by_range) {
+        if (pcap && pcap->isMemoryMapped() && !pcap->needsByteSwap() && !pcap->isNanosecond()) {
+            // Without a descriptor the writer still forwards from the mapping,
+            // just not inside the kernel.
+            range_input_fd_ = ::open(input_file.c_str(), O_RDONLY);
+            output_writer_.setRangeSource(range_input_fd_, pcap->mapping().data());
+            forwarding_ranges_ = true;
+        } else if (!config_.silent) {
+            std::cout << "[Reader] Forwarding by range needs a memory-mapped classic pcap in host "
+                      << "byte order with microsecond timestamps; writing packet by packet\n";
+        }
+    }
+    
+    if (config_.num_readers > 1) {
+        if (orderedOutput()) {
+            if (!config_.silent) {
+                std::cout << "[Reader] Ordered output needs a single reader; reading sequentially\n";
+            }
+        } else if (!pcap || !pcap->isMemoryMapped()) {
+            if (!config_.silent) {
+                std::cout << "[Reader] Parallel reading needs a memory-mapped classic pcap; "
+                          << "reading sequentially\n";
+            }
+        } else {
+            readChunksParallel(*pcap);
+            return;
+        }
+    }
+    
+    if (config_.parse_workers > 0) {
+        readWithParseWorkers(reader);
+        return;
+    }
+    
+    std::vector<PacketAnalyzer::RawPacket> raws(DECODE_BATCH);
+    PacketDecoder::Result results[DECODE_BATCH];
+    const uint32_t link_type = reader.getGlobalHeader().network;
     uint32_t packet_id = 0;
+    const bool direct = direct_dispatch_;
+    std::vector<std::vector<PacketJob>> staged(direct ? fp_manager_->getNumFPs()
+                                                      : lb_manager_->getNumLBs());
+    FragmentSteering fragment_steering;
+    std::vector<PacketJob> steered;
+    auto stage = [&](PacketJob&& job) {
+        const size_t target = direct ? fp_router_->route(job.flow_hash)
+                                     : lb_manager_->getLBForHash(job.flow_hash).getId();
+        staged[target].push_back(std::move(job));
+    };
     
     if (!config_.silent) {
-        std::cout << "[Reader] Starting packet processing...\n";
+        std::cout << "[Reader] Starting packet processing"
+                  << (direct ? " (direct to FPs)" : "") << "...\n";
     }
     
-    while (reader.readNextPacket(raw)) {
-        if (!PacketAnalyzer::PacketParser::parse(raw, parsed)) {
-            continue;
+    for (bool more = true; more;) {
+        size_t count = 0;
+        while (count < DECODE_BATCH && (more = reader.readNextPacket(raws[count]))) {
+            count++;
         }
-        if (!parsed.has_ip || (!parsed.has_tcp && !parsed.has_udp)) {
-            continue;
+        std::array<PacketJob, DECODE_BATCH> jobs;
+        decodePacketJobs(raws.data(), count, link_type, jobs.data(), results);
+        for (size_t i = 0; i < count; i++) {
+            PacketJob& job = jobs[i];
+            if (!forFastPath(results[i], job)) {
+                continue;
+            }
+            job.packet_id = packet_id++;
+            stats_.total_packets++;
+            stats_.total_bytes += raws[i].size();
+            if (job.tuple.protocol == PacketAnalyzer::Protocol::TCP) {
+                stats_.tcp_packets++;
+            } else {
+                stats_.udp_packets++;
+            }
+            if (!job.is_fragmented) {
+                stage(std::move(job));
+                continue;
+            }
+            stats_.fragmented_packets++;
+            fragment_steering.steer(std::move(job), steered);
+            for (auto& ready : steered) {
+                stage(std::move(ready));
+            }
+            steered.clear();
         }
-        PacketJob job = createPacketJob(raw, parsed, packet_id++);
-        stats_.total_packets++;
-        stats_.total_bytes += raw.data.size();
-        if (parsed.has_tcp) {
-            stats_.tcp_packets++;
-        } else if (parsed.has_udp) {
-            stats_.udp_packets++;
+        if (!more) {
+            fragment_steering.flush(steered);
+            for (auto& ready : steered) {
+                stage(std::move(ready));
+            }
+            steered.clear();
+        }
+        if (direct) {
+            pushToFPs(staged);
+            fp_router_->rebalance();
+        } else {
+            pushToLBs(staged, false);
         }
-        LoadBalancer& lb = lb_manager_->getLBForPacket(job.tuple);
-        lb.getInputQueue().push(std::move(job));
     }
     
     if (!config_.silent) {
         std::cout << "[Reader] Finished reading " << packet_id << " packets\n";
     }
-    reader.close();
 }
 
-PacketJob DPIEngine::createPacketJob(const PacketAnalyzer::RawPacket& raw,
-                                      const PacketAnalyzer::ParsedPacket& parsed,
-                                      uint32_t packet_id) {
-    PacketJob job;
-    job.packet_id = packet_id;
-    job.ts_sec = raw.header.ts_sec;
-    job.ts_usec = raw.header.ts_usec;
+void DPIEngine::readWithParseWorkers(PacketAnalyzer::CaptureSource& reader) {
+    // Batches each worker can have in flight: enough for the reader to frame
+    // the next while the worker decodes this one and waits for its turn.
+    constexpr size_t BATCHES_PER_WORKER = 4;
+    const size_t workers = static_cast<size_t>(config_.parse_workers);
+    const uint32_t link_type = reader.getGlobalHeader().network;
+    
+    if (!config_.silent) {
+        std::cout << "[Reader] Starting packet processing with " << workers << " parse workers"
+                  << (direct_dispatch_ ? " (direct to FPs)" : "") << "...\n";
+    }
+    
+    // Batches go out to the workers in turn and come back once published,
+    // so the reader reuses them and their record buffers.
+    commit_turn_ = 0;
+    commit_packet_id_ = 0;
+    commit_steering_ = FragmentSteering();
+    std::vector<std::unique_ptr<FrameBatchQueue>> inputs;
+    std::vector<std::unique_ptr<FrameBatchQueue>> done;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        inputs.push_back(std::make_unique<FrameBatchQueue>(BATCHES_PER_WORKER));
+        done.push_back(std::make_unique<FrameBatchQueue>(BATCHES_PER_WORKER));
+        for (size_t i = 0; i < BATCHES_PER_WORKER; i++) {
+            auto batch = std::make_unique<FrameBatch>();
+            batch->raws.resize(DECODE_BATCH);
+            done[w]->push(std::move(batch));
+        }
+        threads.emplace_back(&DPIEngine::parseWorkerThreadFunc, this, w, std::ref(*inputs[w]),
+                             std::ref(*done[w]), link_type);
+    }
+    
+    // Batch `seq` goes to worker seq % workers, which is also the order the
+    // commit turn visits them in.
+    uint64_t seq = 0;
+    for (bool more = true; more; seq++) {
+        FrameBatchQueue& free_batches = *done[seq % workers];
+        std::unique_ptr<FrameBatch> batch = std::move(*free_batches.pop());
+        batch->count = 0;
+        while (batch->count < DECODE_BATCH &&
+               (more = reader.readNextPacket(batch->raws[batch->count]))) {
+            batch->count++;
+        }
+        batch->seq = seq;
+        inputs[seq % workers]->push(std::move(batch));
+    }
+    for (auto& input : inputs) {
+        input->shutdown();
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    
+    // Fragments still waiting for their datagram's first one go as they are.
+    std::vector<PacketJob> steered;
+    commit_steering_.flush(steered);
+    if (!steered.empty()) {
+        std::vector<std::vector<PacketJob>> staged(
+            direct_dispatch_ ? fp_manager_->getNumFPs() : lb_manager_->getNumLBs());
+        for (auto& job : steered) {
+            const size_t target = direct_dispatch_
+                                      ? fp_router_->route(job.flow_hash)
+                                      : lb_manager_->getLBForHash(job.flow_hash).getId();
+            staged[target].push_back(std::move(job));
+        }
+        if (direct_dispatch_) {
+            pushToFPs(staged);
+        } else {
+            pushToLBs(staged, false);
+        }
+    }
+    
+    if (!config_.silent) {
+        std::cout << "[Reader] Finished reading " << commit_packet_id_ << " packets\n";
+    }
+}
+
+void DPIEngine::parseWorkerThreadFunc(size_t index, FrameBatchQueue& input,
+                                      FrameBatchQueue& done, uint32_t link_type) {
+    pinCurrentThread(ThreadPlacement::cpuFor(config_.placement.parse_workers, index),
+                     "Worker " + std::to_string(index));
+    PacketDecoder::Result results[DECODE_BATCH];
+    const bool direct = direct_dispatch_;
+    std::vector<std::vector<PacketJob>> staged(direct ? fp_manager_->getNumFPs()
+                                                      : lb_manager_->getNumLBs());
+    std::vector<PacketJob> steered;
     
-    auto parseIP = [](const std::string& ip) -> uint32_t {
-        uint32_t result = 0;
-        int octet = 0;
-        int shift = 0;
-        for (char c : ip) {
-            if (c == '.') {
-                result |= (octet << shift);
-                shift += 8;
-                octet = 0;
-            } else if (c >= '0' && c <= '9') {
-                octet = octet * 10 + (c - '0');
+    while (auto next = input.pop()) {
+        FrameBatch& batch = **next;
+        std::array<PacketJob, DECODE_BATCH> jobs;
+        decodePacketJobs(batch.raws.data(), batch.count, link_type, jobs.data(), results);
+        
+        // Ids are relative to the batch until its turn comes, and so are FP
+        // targets: a move committed meanwhile means staging again.
+        const uint64_t version = direct ? fp_router_->version() : 0;
+        uint32_t accepted = 0;
+        size_t accepted_at[DECODE_BATCH];
+        uint64_t bytes = 0, tcp = 0, udp = 0, fragments = 0;
+        for (size_t i = 0; i < batch.count; i++) {
+            PacketJob& job = jobs[i];
+            if (!forFastPath(results[i], job)) {
+                continue;
+            }
+            job.packet_id = accepted;
+            accepted_at[accepted++] = i;
+            bytes += batch.raws[i].size();
+            if (job.tuple.protocol == PacketAnalyzer::Protocol::TCP) {
+                tcp++;
+            } else {
+                udp++;
+            }
+            if (job.is_fragmented) {
+                fragments++;
             }
         }
-        result |= (octet << shift);
-        return result;
+        auto stage = [&](PacketJob&& job) {
+            const size_t target = direct ? fp_router_->peek(job.flow_hash)
+                                         : lb_manager_->getLBForHash(job.flow_hash).getId();
+            staged[target].push_back(std::move(job));
+        };
+        if (fragments == 0) {
+            for (uint32_t k = 0; k < accepted; k++) {
+                stage(std::move(jobs[accepted_at[k]]));
+            }
+        }
+        
+        while (commit_turn_.load(std::memory_order_acquire) != batch.seq) {
+            std::this_thread::yield();
+        }
+        const uint32_t base = commit_packet_id_;
+        if (fragments == 0) {
+            for (auto& jobs_for_target : staged) {
+                for (auto& job : jobs_for_target) {
+                    job.packet_id += base;
+                }
+            }
+        } else {
+            for (uint32_t k = 0; k < accepted; k++) {
+                PacketJob& job = jobs[accepted_at[k]];
+                job.packet_id += base;
+                commit_steering_.steer(std::move(job), steered);
+            }
+            for (auto& ready : steered) {
+                stage(std::move(ready));
+            }
+            steered.clear();
+        }
+        commit_packet_id_ = base + accepted;
+        if (direct) {
+            if (fp_router_->version() != version) {
+                restage(staged);
+                restaged_batches_.fetch_add(1, std::memory_order_relaxed);
+            }
+            for (const auto& jobs_for_target : staged) {
+                for (const auto& job : jobs_for_target) {
+                    fp_router_->count(job.flow_hash);
+                }
+            }
+            pushToFPs(staged);
+            fp_router_->rebalance();
+        } else {
+            pushToLBs(staged, false);
+        }
+        commit_turn_.store(batch.seq + 1, std::memory_order_release);
+        
+        stats_.total_packets += accepted;
+        stats_.total_bytes += bytes;
+        stats_.tcp_packets += tcp;
+        stats_.udp_packets += udp;
+        stats_.fragmented_packets += fragments;
+        done.push(std::move(*next));
+    }
+}
+
+void DPIEngine::readChunksParallel(const PacketAnalyzer::PcapReader& file) {
+    const size_t first = sizeof(PacketAnalyzer::PcapGlobalHeader);
+    const size_t size = file.mapping().size();
+    const size_t readers = static_cast<size_t>(config_.num_readers);
+    const size_t span = (size - first + readers - 1) / readers;
+    
+    if (!config_.silent) {
+        std::cout << "[Reader] Starting packet processing with " << readers << " readers...\n";
+    }
+    
+    next_packet_id_ = 0;
+    range_flows_.clear();
+    range_flows_.resize(readers);
+    ranges_scanned_ = 0;
+    flows_finished_ = 0;
+    std::vector<ChunkResult> results(readers);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < readers; i++) {
+        const size_t begin = std::min(size, first + i * span);
+        const size_t end = i + 1 == readers ? size : std::min(size, begin + span);
+        threads.emplace_back(&DPIEngine::chunkReaderThreadFunc, this, std::cref(file), i,
+                             begin, end, std::ref(results[i]));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    range_flows_.clear();
+    
+    // Each range resynced on its own; they only tile the file if every one
+    // stopped exactly where the next one started.
+    uint64_t packets = 0;
+    for (size_t i = 0; i < readers; i++) {
+        packets += results[i].packets;
+        const size_t expected = i + 1 < readers ? results[i + 1].start : size;
+        if (!results[i].failed && results[i].stop != expected) {
+            std::cerr << "[Reader] Warning: range " << i << " ended at offset " << results[i].stop
+                      << " but the next record was found at " << expected
+                      << "; packets near that boundary may be lost or repeated\n";
+        }
+    }
+    
+    if (!config_.silent) {
+        for (size_t i = 0; i < readers; i++) {
+            std::cout << "[Reader " << i << "] Bytes " << results[i].start << "-" << results[i].stop
+                      << ": " << results[i].packets << " packets (resync skipped "
+                      << results[i].skipped_bytes << " bytes)\n";
+        }
+        std::cout << "[Reader] Finished reading " << packets << " packets\n";
+    }
+}
+
+void DPIEngine::chunkReaderThreadFunc(const PacketAnalyzer::PcapReader& file, size_t index,
+                                      size_t begin, size_t end, ChunkResult& result) {
+    constexpr uint32_t ID_BLOCK = 1024;
+    pinCurrentThread(ThreadPlacement::cpuFor(config_.placement.reader, index),
+                     "Reader " + std::to_string(index));
+    
+    std::vector<PacketAnalyzer::RawPacket> raws(DECODE_BATCH);
+    PacketDecoder::Result results[DECODE_BATCH];
+    const uint32_t link_type = file.getGlobalHeader().network;
+    uint32_t packet_id = 0;
+    uint32_t id_limit = 0;
+    std::vector<std::vector<PacketJob>> staged(lb_manager_->getNumLBs());
+    auto stage = [&](PacketJob&& job) {
+        staged[lb_manager_->getLBForHash(job.flow_hash).getId()].push_back(std::move(job));
+    };
+    
+    // Counted locally and published once per id block, for the same reason
+    // the ids come in blocks.
+    uint64_t packets = 0, bytes = 0, tcp = 0, udp = 0, fragments = 0;
+    auto publish = [&]() {
+        stats_.total_packets += packets;
+        stats_.total_bytes += bytes;
+        stats_.tcp_packets += tcp;
+        stats_.udp_packets += udp;
+        stats_.fragmented_packets += fragments;
+        result.packets += packets;
+        packets = bytes = tcp = udp = fragments = 0;
+    };
+    
+    // Reads the range and hands `take` its fast-path jobs in file order,
+    // fragments once steered, calling `batched` after each batch. Only the
+    // counting pass numbers and counts them.
+    auto scan = [&](PacketAnalyzer::PcapChunkReader& chunk, bool counting, auto&& take,
+                    auto&& batched) {
+        // Per range: a datagram whose fragments straddle a range boundary is
+        // split between two of these, and its later fragments keep their
+        // address-pair hash. It cannot complete, so its fragments are dropped.
+        FragmentSteering fragment_steering;
+        std::vector<PacketJob> steered;
+        for (bool more = true; more;) {
+            size_t count = 0;
+            while (count < DECODE_BATCH && (more = chunk.readNextPacket(raws[count]))) {
+                count++;
+            }
+            std::array<PacketJob, DECODE_BATCH> jobs;
+            decodePacketJobs(raws.data(), count, link_type, jobs.data(), results);
+            for (size_t i = 0; i < count; i++) {
+                PacketJob& job = jobs[i];
+                if (!forFastPath(results[i], job)) {
+                    continue;
+                }
+                if (counting) {
+                    if (packet_id == id_limit) {
+                        publish();
+                        packet_id = next_packet_id_.fetch_add(ID_BLOCK);
+                        id_limit = packet_id + ID_BLOCK;
+                    }
+                    job.packet_id = packet_id++;
+                    job.source = static_cast<uint16_t>(index);
+                    packets++;
+                    bytes += raws[i].size();
+                    if (job.tuple.protocol == PacketAnalyzer::Protocol::TCP) {
+                        tcp++;
+                    } else {
+                        udp++;
+                    }
+                    if (job.is_fragmented) {
+                        fragments++;
+                    }
+                }
+                if (!job.is_fragmented) {
+                    take(std::move(job));
+                    continue;
+                }
+                fragment_steering.steer(std::move(job), steered);
+                for (auto& ready : steered) {
+                    take(std::move(ready));
+                }
+                steered.clear();
+            }
+            if (!more) {
+                fragment_steering.flush(steered);
+                for (auto& ready : steered) {
+                    take(std::move(ready));
+                }
+                steered.clear();
+            }
+            batched();
+        }
+    };
+    
+    // First pass: which flows this range has, and how many of their packets.
+    RangeFlows& flows = range_flows_[index];
+    {
+        PacketAnalyzer::PcapChunkReader chunk(file, begin, end);
+        scan(chunk, false, [&](PacketJob&& job) { flows[job.flow_hash].remaining++; }, [] {});
+    }
+    {
+        std::unique_lock<std::mutex> lock(ranges_mutex_);
+        if (++ranges_scanned_ == range_flows_.size()) {
+            ranges_cv_.notify_all();
+        }
+        ranges_cv_.wait(lock, [&] { return ranges_scanned_ == range_flows_.size(); });
+    }
+    
+    // A flow an earlier range has too waits until the nearest such range has
+    // pushed its last packet of it. That range's packets of the flow waited
+    // the same way, so the flow reaches its FP in file order while every
+    // other flow is pushed as soon as it is decoded.
+    std::vector<RangeFlow*> waiting;
+    for (auto& [hash, flow] : flows) {
+        for (size_t j = index; j-- > 0;) {
+            auto earlier = range_flows_[j].find(hash);
+            if (earlier != range_flows_[j].end()) {
+                flow.after = &earlier->second.done;
+                waiting.push_back(&flow);
+                break;
+            }
+        }
+    }
+    std::unordered_map<const RangeFlow*, std::vector<PacketJob>> held;
+    size_t held_jobs = 0;
+    std::vector<RangeFlow*> finished;
+    auto push = [&](PacketJob&& job, RangeFlow& flow) {
+        stage(std::move(job));
+        if (--flow.remaining == 0) {
+            finished.push_back(&flow);
+        }
+    };
+    auto release = [&]() {
+        for (size_t w = 0; w < waiting.size();) {
+            RangeFlow& flow = *waiting[w];
+            if (!flow.after->load(std::memory_order_acquire)) {
+                w++;
+                continue;
+            }
+            flow.after = nullptr;
+            auto jobs = held.find(&flow);
+            if (jobs != held.end()) {
+                held_jobs -= jobs->second.size();
+                for (auto& job : jobs->second) {
+                    push(std::move(job), flow);
+                }
+                held.erase(jobs);
+            }
+            waiting[w] = waiting.back();
+            waiting.pop_back();
+        }
+    };
+    // Pushes what is staged, then tells the later ranges which flows this
+    // one is done with.
+    auto flush = [&]() {
+        pushToLBs(staged, true);
+        if (finished.empty()) {
+            return;
+        }
+        for (RangeFlow* flow : finished) {
+            flow->done.store(true, std::memory_order_release);
+        }
+        finished.clear();
+        {
+            std::lock_guard<std::mutex> lock(ranges_mutex_);
+            flows_finished_++;
+        }
+        ranges_cv_.notify_all();
+    };
+    // Waits for an earlier range to finish a flow, unless one has since
+    // the last look.
+    uint64_t seen = 0;
+    auto awaitRelease = [&]() {
+        std::unique_lock<std::mutex> lock(ranges_mutex_);
+        ranges_cv_.wait(lock, [&] { return flows_finished_ != seen; });
+        seen = flows_finished_;
     };
-    job.tuple.src_ip = parseIP(parsed.src_ip);
-    job.tuple.dst_ip = parseIP(parsed.dest_ip);
-    job.tuple.src_port = parsed.src_port;
-    job.tuple.dst_port = parsed.dest_port;
-    job.tuple.protocol = parsed.protocol;
-    job.tcp_flags = parsed.tcp_flags;
-    job.data = raw.data;
-    job.eth_offset = 0;
-    job.ip_offset = 14;  
-    if (job.data.size() > 14) {
-        uint8_t ip_ihl = job.data[14] & 0x0F;
-        size_t ip_header_len = ip_ihl * 4;
-        job.transport_offset = 14 + ip_header_len;
-        if (parsed.has_tcp && job.data.size() > job.transport_offset) {
-            uint8_t tcp_data_offset = (job.data[job.transport_offset + 12] >> 4) & 0x0F;
-            size_t tcp_header_len = tcp_data_offset * 4;
-            job.payload_offset = job.transport_offset + tcp_header_len;
-        } else if (parsed.has_udp) {
-            job.payload_offset = job.transport_offset + 8;  
-        }
-        if (job.payload_offset < job.data.size()) {
-            job.payload_length = job.data.size() - job.payload_offset;
-            job.payload_data = job.data.data() + job.payload_offset;
-        }
-    }
-    return job;
+    
+    PacketAnalyzer::PcapChunkReader chunk(file, begin, end);
+    scan(chunk, true,
+         [&](PacketJob&& job) {
+             auto it = flows.find(job.flow_hash);
+             if (it == flows.end()) {
+                 stage(std::move(job));
+             } else if (it->second.after) {
+                 held[&it->second].push_back(std::move(job));
+                 held_jobs++;
+             } else {
+                 push(std::move(job), it->second);
+             }
+         },
+         [&]() {
+             if (!waiting.empty() && flows_finished_ != seen) {
+                 seen = flows_finished_;
+                 release();
+             }
+             while (held_jobs >= RANGE_HOLD_LIMIT) {
+                 flush();
+                 awaitRelease();
+                 release();
+             }
+             flush();
+         });
+    publish();
+    while (!waiting.empty()) {
+        awaitRelease();
+        release();
+        flush();
+    }
+    // Counts only fall short if the passes disagreed; settle every flow so
+    // no later range waits on one.
+    for (auto& entry : flows) {
+        finished.push_back(&entry.second);
+    }
+    flush();
+    
+    result.start = chunk.startOffset();
+    result.stop = chunk.stopOffset();
+    result.skipped_bytes = chunk.skippedBytes();
+    result.failed = chunk.failed();
 }
 
+void DPIEngine::pushToLBs(std::vector<std::vector<PacketJob>>& staged, bool shared) {
+    for (size_t i = 0; i < staged.size(); i++) {
+        if (staged[i].empty()) {
+            continue;
+        }
+        auto& queue = lb_manager_->getLB(static_cast<int>(i)).getInputQueue();
+        if (shared) {
+            std::lock_guard<std::mutex> lock(lb_push_locks_[i]);
+            queue.pushBatch(staged[i].data(), staged[i].size());
+        } else {
+            queue.pushBatch(staged[i].data(), staged[i].size());
+        }
+        staged[i].clear();
+    }
+}
+
+void DPIEngine::restage(std::vector<std::vector<PacketJob>>& staged) {
+    std::vector<std::vector<PacketJob>> moved(staged.size());
+    for (auto& jobs : staged) {
+        for (auto& job : jobs) {
+            moved[fp_router_->peek(job.flow_hash)].push_back(std::move(job));
+        }
+        jobs.clear();
+    }
+    staged.swap(moved);
+}
+
+void DPIEngine::pushToFPs(std::vector<std::vector<PacketJob>>& staged) {
+    for (size_t i = 0; i < staged.size(); i++) {
+        if (staged[i].empty()) {
+            continue;
+        }
+        fp_manager_->getFPQueue(static_cast<int>(i)).pushBatch(staged[i].data(), staged[i].size());
+        staged[i].clear();
+    }
+}
+
+bool DPIEngine::decodePacketJob(const PacketAnalyzer::RawPacket& raw, uint32_t link_type,
+                                PacketJob& job, bool copy_frame) {
+    if (!forFastPath(PacketDecoder::decode(raw.payload(), raw.size(), link_type, job), job)) {
+        return false;
+    }
+    job.flow_hash = FiveTupleHash()(job.tuple);
+    attachFrame(raw, job, copy_frame);
+    return true;
+}
+
+void DPIEngine::decodePacketJobs(const PacketAnalyzer::RawPacket* raws, size_t count,
+                                 uint32_t link_type, PacketJob* jobs,
+                                 PacketDecoder::Result* results) {
+    PacketDecoder::Frame frames[DECODE_BATCH] = {};
+    for (size_t i = 0; i < count; i++) {
+        frames[i] = {raws[i].payload(), raws[i].size()};
+    }
+    PacketDecoder::decodeBatch(frames, count, link_type, jobs, results);
+    for (size_t i = 0; i < count; i++) {
+        if (forFastPath(results[i], jobs[i])) {
+            attachFrame(raws[i], jobs[i], false);
+        }
+    }
+}
+
+void DPIEngine::attachFrame(const PacketAnalyzer::RawPacket& raw, PacketJob& job,
+                            bool copy_frame) {
+    job.ts_sec = raw.header.ts_sec;
+    job.ts_usec = raw.header.ts_usec;
+    if (raw.mapped && !copy_frame) {
+        job.borrowed_data = raw.mapped;
+        job.borrowed_length = raw.size();
+    } else if (raw.mapped) {
+        job.data.assign(raw.mapped, raw.mapped + raw.size());
+    } else {
+        job.data = raw.data;
+    }
+    if (job.payload_length > 0) {
+        job.payload_data = job.frameData() + job.payload_offset;
+    }
+}
+
+// Batches go out when the writer fills one, when the queue goes idle, and at
+// least this often, so a trickle of live traffic still reaches the file.
+constexpr auto OUTPUT_FLUSH_INTERVAL = std::chrono::milliseconds(100);
+
 void DPIEngine::outputThreadFunc() {
-    while (running_ || !output_queue_.empty()) {
-        auto job_opt = output_queue_.popWithTimeout(std::chrono::milliseconds(100));
+    pinCurrentThread(ThreadPlacement::cpuFor(config_.placement.output, 0), "Output");
+    std::vector<PacketJob> burst(OUTPUT_BURST);
+    auto last_flush = std::chrono::steady_clock::now();
+    // The writer is the reader's until the first job arrives: it writes the
+    // global header then, and an idle flush here would race with it.
+    bool wrote = false;
+    // Every FP sends one end marker, after its last packet.
+    const int fps = fp_manager_->getNumFPs();
+    int ended = 0;
+    output_load_.start();
+    while ((running_ || !output_queue_.empty()) && ended < fps) {
+        output_load_.idle();
+        const size_t count = output_queue_.popBatch(burst.data(), OUTPUT_BURST,
+                                                    std::chrono::milliseconds(100));
+        const auto now = output_load_.busy();
         
-        if (job_opt) {
-            writeOutputPacket(*job_opt);
+        for (size_t i = 0; i < count; i++) {
+            PacketJob& job = burst[i];
+            if (job.end_of_stream) {
+                ended++;
+            } else if (job.migration) {
+                // The old FP's packets of the moving bucket are all ahead of
+                // this; the new FP may emit its own now.
+                job.migration->handed_over.store(true, std::memory_order_release);
+            } else if (reorder_) {
+                if (job.is_hole) {
+                    reorder_->pushHole(job.packet_id);
+                } else {
+                    reorder_->push(std::move(job));
+                }
+            } else {
+                writeOutputPacket(job);
+            }
+            // Let go of the frame now rather than when the slot is reused.
+            job = PacketJob();
+        }
+        wrote = wrote || count > 0;
+        if (wrote && (count == 0 || now - last_flush >= OUTPUT_FLUSH_INTERVAL)) {
+            output_writer_.flush();
+            last_flush = now;
         }
     }
+    if (reorder_) {
+        reorder_->flush();
+    }
+    output_writer_.flush();
 }
 
-void DPIEngine::handleOutput(const PacketJob& job, PacketAction action) {
+void DPIEngine::handleOutput(int fp_id, PacketJob&& job, PacketAction action) {
+    if (job.end_of_stream || job.migration) {
+        output_queue_.push(fp_id, std::move(job));
+        return;
+    }
     if (action == PacketAction::DROP) {
         stats_.dropped_packets++;
+        if (orderedOutput()) {
+            // The reorder stage must hear about every id, or it would wait
+            // for this one until the window forced it past.
+            PacketJob hole;
+            hole.packet_id = job.packet_id;
+            hole.is_hole = true;
+            output_queue_.push(fp_id, std::move(hole));
+        }
         return;
     }
     
     stats_.forwarded_packets++;
-    output_queue_.push(job);
+    output_queue_.push(fp_id, std::move(job));
 }
 
 bool DPIEngine::writeOutputHeader(const PacketAnalyzer::PcapGlobalHeader& header) {
-    std::lock_guard<std::mutex> lock(output_mutex_);
-    
-    if (!output_file_.is_open()) return false;
-    
-    output_file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    return output_file_.good();
+    return output_writer_.writeGlobalHeader(header);
 }
 
 void DPIEngine::writeOutputPacket(const PacketJob& job) {
-    std::lock_guard<std::mutex> lock(output_mutex_);
-    
-    if (!output_file_.is_open()) return;
-    
+    if (forwarding_ranges_ && job.borrowed_data) {
+        // The record header sits right in front of the frame in the input.
+        output_writer_.writeRecordFromSource(
+            job.borrowed_data - sizeof(PacketAnalyzer::PcapPacketHeader),
+            sizeof(PacketAnalyzer::PcapPacketHeader) + job.borrowed_length);
+        return;
+    }
     PacketAnalyzer::PcapPacketHeader pkt_header;
     pkt_header.ts_sec = job.ts_sec;
     pkt_header.ts_usec = job.ts_usec;
-    pkt_header.incl_len = job.data.size();
-    pkt_header.orig_len = job.data.size();
-    output_file_.write(reinterpret_cast<const char*>(&pkt_header), sizeof(pkt_header));
-    output_file_.write(reinterpret_cast<const char*>(job.data.data()), job.data.size());
+    pkt_header.incl_len = job.frameLength();
+    pkt_header.orig_len = job.frameLength();
+    // Borrowed frames live in the input mapping, which outlives the writer,
+    // so the writer can point at them instead of copying.
+    output_writer_.writePacket(pkt_header, job.frameData(), job.frameLength(),
+                               job.borrowed_data != nullptr);
 }
 
 void DPIEngine::blockIP(const std::string& ip) {
@@ -333,6 +1155,53 @@ bool DPIEngine::saveRules(const std::string& filename) {
 }
 
 
+// One row of the batch-size table: mean batch, then the share of batches in
+// each histogram bucket.
+static std::string batchSizeRow(const std::string& label, const BatchHistogram::Snapshot& batches) {
+    std::ostringstream row;
+    row << "║   " << std::left << std::setw(11) << label << std::right
+        << std::setw(5) << std::fixed << std::setprecision(1) << batches.mean();
+    for (size_t i = 0; i < BatchHistogram::BUCKETS; i++) {
+        const double share = batches.batches ? 100.0 * batches.counts[i] / batches.batches : 0.0;
+        row << std::setw(5) << std::setprecision(0) << share;
+    }
+    row << "║\n";
+    return row.str();
+}
+
+static std::string batchSizeJson(const BatchHistogram::Snapshot& batches) {
+    std::ostringstream json;
+    json << "{\"batches\":" << batches.batches << ",\"items\":" << batches.items
+         << ",\"histogram\":[";
+    for (size_t i = 0; i < BatchHistogram::BUCKETS; i++) {
+        json << (i ? "," : "") << batches.counts[i];
+    }
+    json << "]}";
+    return json.str();
+}
+
+static std::string threadLoadRow(const std::string& label, const ThreadLoad::Snapshot& load) {
+    std::ostringstream row;
+    row << "║   " << std::left << std::setw(10) << label << std::right << std::fixed
+        << std::setprecision(1) << std::setw(8) << 100.0 * load.busyShare()
+        << std::setw(12) << load.busy_ns / 1e6 << std::setw(12) << load.idle_ns / 1e6
+        << std::setw(12) << load.parks << "      ║\n";
+    return row.str();
+}
+
+static std::string threadLoadJson(const ThreadLoad::Snapshot& load) {
+    std::ostringstream json;
+    json << "{\"busy_ns\":" << load.busy_ns << ",\"idle_ns\":" << load.idle_ns
+         << ",\"parks\":" << load.parks << "}";
+    return json.str();
+}
+
+ThreadLoad::Snapshot DPIEngine::outputLoad() const {
+    ThreadLoad::Snapshot load = output_load_.snapshot();
+    load.parks = output_queue_.consumerParks();
+    return load;
+}
+
 std::string DPIEngine::generateReport() const {
     std::ostringstream ss;
     
@@ -345,6 +1214,7 @@ std::string DPIEngine::generateReport() const {
     ss << "║   Total Bytes:        " << std::setw(12) << stats_.total_bytes.load() << "                        ║\n";
     ss << "║   TCP Packets:        " << std::setw(12) << stats_.tcp_packets.load() << "                        ║\n";
     ss << "║   UDP Packets:        " << std::setw(12) << stats_.udp_packets.load() << "                        ║\n";
+    ss << "║   IP Fragments:       " << std::setw(12) << stats_.fragmented_packets.load() << "                        ║\n";
     
     ss << "╠══════════════════════════════════════════════════════════════╣\n";
     ss << "║ FILTERING STATISTICS                                          ║\n";
@@ -356,12 +1226,18 @@ std::string DPIEngine::generateReport() const {
         ss << "║   Drop Rate:          " << std::setw(11) << std::fixed << std::setprecision(2) << drop_rate << "%                        ║\n";
     }
     
-    if (lb_manager_) {
+    if (direct_dispatch_) {
+        ss << "╠══════════════════════════════════════════════════════════════╣\n";
+        ss << "║ LOAD BALANCER STATISTICS                                      ║\n";
+        ss << "║   Dispatch:           " << std::setw(12) << "direct" << "                        ║\n";
+        ss << "║   Buckets Moved:      " << std::setw(12) << fp_router_->migrations() << "                        ║\n";
+    } else if (lb_manager_) {
         auto lb_stats = lb_manager_->getAggregatedStats();
         ss << "╠══════════════════════════════════════════════════════════════╣\n";
         ss << "║ LOAD BALANCER STATISTICS                                      ║\n";
         ss << "║   LB Received:        " << std::setw(12) << lb_stats.total_received << "                        ║\n";
         ss << "║   LB Dispatched:      " << std::setw(12) << lb_stats.total_dispatched << "                        ║\n";
+        ss << "║   Buckets Moved:      " << std::setw(12) << lb_stats.total_migrations << "                        ║\n";
     }
     
     if (fp_manager_) {
@@ -372,6 +1248,101 @@ std::string DPIEngine::generateReport() const {
         ss << "║   FP Forwarded:       " << std::setw(12) << fp_stats.total_forwarded << "                        ║\n";
         ss << "║   FP Dropped:         " << std::setw(12) << fp_stats.total_dropped << "                        ║\n";
         ss << "║   Active Connections: " << std::setw(12) << fp_stats.total_connections << "                        ║\n";
+        
+        auto frag_stats = fp_manager_->getReassemblyStats();
+        if (frag_stats.fragments > 0) {
+            ss << "╠══════════════════════════════════════════════════════════════╣\n";
+            ss << "║ FRAGMENT REASSEMBLY                                           ║\n";
+            ss << "║   Reassembled:        " << std::setw(12) << frag_stats.reassembled << "                        ║\n";
+            ss << "║   Timed Out:          " << std::setw(12) << frag_stats.timed_out << "                        ║\n";
+            ss << "║   Overlapping:        " << std::setw(12) << frag_stats.overlapping << "                        ║\n";
+            ss << "║   Duplicates:         " << std::setw(12) << frag_stats.duplicates << "                        ║\n";
+            ss << "║   Evicted:            " << std::setw(12) << frag_stats.evicted << "                        ║\n";
+            ss << "║   Malformed:          " << std::setw(12) << frag_stats.malformed << "                        ║\n";
+            ss << "║   Too Many Fragments: " << std::setw(12) << frag_stats.too_many_fragments << "                        ║\n";
+            ss << "║   Peak Bytes (1 FP):  " << std::setw(12) << frag_stats.peak_bytes << "                        ║\n";
+        }
+        
+        auto stream_stats = fp_manager_->getStreamStats();
+        if (stream_stats.flows_buffered > 0) {
+            ss << "╠══════════════════════════════════════════════════════════════╣\n";
+            ss << "║ TCP HANDSHAKE REASSEMBLY                                      ║\n";
+            ss << "║   Flows Buffered:     " << std::setw(12) << stream_stats.flows_buffered << "                        ║\n";
+            ss << "║   Segments Appended:  " << std::setw(12) << stream_stats.segments_appended << "                        ║\n";
+            ss << "║   Out of Order:       " << std::setw(12) << stream_stats.out_of_order << "                        ║\n";
+            ss << "║   Overflows:          " << std::setw(12) << stream_stats.overflows << "                        ║\n";
+            ss << "║   Evicted:            " << std::setw(12) << stream_stats.evicted << "                        ║\n";
+        }
+    }
+    
+    if (lb_manager_ && fp_manager_) {
+        auto lb_stats = lb_manager_->getAggregatedStats();
+        auto fp_stats = fp_manager_->getAggregatedStats();
+        std::ostringstream header;
+        header << "║   " << std::left << std::setw(11) << "% batches" << std::right
+               << std::setw(5) << "avg";
+        for (size_t i = 0; i < BatchHistogram::BUCKETS; i++) {
+            std::string bucket = std::to_string(BatchHistogram::bucketFloor(i));
+            if (i > 0) bucket += "+";
+            header << std::setw(5) << bucket;
+        }
+        ss << "╠══════════════════════════════════════════════════════════════╣\n";
+        ss << "║ QUEUE BATCH SIZES                                             ║\n";
+        ss << header.str() << "║\n";
+        if (direct_dispatch_) {
+            ss << batchSizeRow("Reader push", fp_stats.push_batches);
+        } else {
+            ss << batchSizeRow("Reader push", lb_stats.reader_batches);
+            ss << batchSizeRow("LB pop", lb_stats.input_batches);
+            ss << batchSizeRow("LB push", fp_stats.push_batches);
+        }
+        ss << batchSizeRow("FP pop", fp_stats.input_batches);
+        ss << batchSizeRow("Output pop", output_queue_.popBatchSizes());
+        
+        // Idle covers spinning as well as parking: under busy-poll a thread
+        // that is never busy still burns its CPU.
+        ss << "╠══════════════════════════════════════════════════════════════╣\n";
+        ss << "║ " << std::left << std::setw(62)
+           << "THREAD LOAD (wait: " + config_.wait_policy.name() + ")" << std::right << "║\n";
+        ss << "║   thread      busy %     busy ms     idle ms       parks      ║\n";
+        if (!direct_dispatch_) {
+            for (int i = 0; i < lb_manager_->getNumLBs(); i++) {
+                ss << threadLoadRow("LB" + std::to_string(i), lb_manager_->getLB(i).getStats().load);
+            }
+        }
+        for (int i = 0; i < fp_manager_->getNumFPs(); i++) {
+            ss << threadLoadRow("FP" + std::to_string(i), fp_manager_->getFP(i).getStats().load);
+        }
+        ss << threadLoadRow("Output", outputLoad());
+    }
+    
+    {
+        auto out_stats = output_writer_.getStats();
+        const double avg_flush_us = out_stats.flushes
+            ? out_stats.total_flush_ns / 1000.0 / out_stats.flushes : 0.0;
+        ss << "╠══════════════════════════════════════════════════════════════╣\n";
+        ss << "║ OUTPUT STATISTICS                                             ║\n";
+        ss << "║   Bytes Written:      " << std::setw(12) << out_stats.bytes_written << "                        ║\n";
+        ss << "║   Throughput (MB/s):  " << std::setw(12) << std::fixed << std::setprecision(2) << out_stats.bytes_per_second / 1e6 << "                        ║\n";
+        ss << "║   Flushes:            " << std::setw(12) << out_stats.flushes << "                        ║\n";
+        ss << "║   Avg Flush (us):     " << std::setw(12) << std::fixed << std::setprecision(2) << avg_flush_us << "                        ║\n";
+        ss << "║   Max Flush (us):     " << std::setw(12) << std::fixed << std::setprecision(2) << out_stats.max_flush_ns / 1000.0 << "                        ║\n";
+        if (forwarding_ranges_) {
+            ss << "║   Range Copies:       " << std::setw(12) << out_stats.range_copies << "                        ║\n";
+            ss << "║   Range Copy Bytes:   " << std::setw(12) << out_stats.range_copy_bytes << "                        ║\n";
+        }
+    }
+    
+    if (reorder_) {
+        auto ro_stats = reorder_->getStats();
+        ss << "╠══════════════════════════════════════════════════════════════╣\n";
+        ss << "║ REORDER STATISTICS                                            ║\n";
+        ss << "║   Max Occupancy:      " << std::setw(12) << ro_stats.max_occupancy << "                        ║\n";
+        ss << "║   Avg Occupancy:      " << std::setw(12) << std::fixed << std::setprecision(2) << ro_stats.avg_occupancy << "                        ║\n";
+        ss << "║   Stall Time (ms):    " << std::setw(12) << std::fixed << std::setprecision(2) << ro_stats.stall_ns / 1e6 << "                        ║\n";
+        ss << "║   Holes (dropped):    " << std::setw(12) << ro_stats.holes << "                        ║\n";
+        ss << "║   Forced Skips:       " << std::setw(12) << ro_stats.forced_skips << "                        ║\n";
+        ss << "║   Late Packets:       " << std::setw(12) << ro_stats.late_packets << "                        ║\n";
     }
     
     if (rule_manager_) {
@@ -405,7 +1376,8 @@ std::string DPIEngine::generateJsonReport() const {
     ss << "\"total_packets\":" << stats_.total_packets.load() << ",";
     ss << "\"total_bytes\":" << stats_.total_bytes.load() << ",";
     ss << "\"tcp_packets\":" << stats_.tcp_packets.load() << ",";
-    ss << "\"udp_packets\":" << stats_.udp_packets.load();
+    ss << "\"udp_packets\":" << stats_.udp_packets.load() << ",";
+    ss << "\"fragmented_packets\":" << stats_.fragmented_packets.load();
     ss << "},";
 
     ss << "\"filtering\":{";
@@ -423,7 +1395,13 @@ std::string DPIEngine::generateJsonReport() const {
         auto lb_stats = lb_manager_->getAggregatedStats();
         ss << "\"load_balancer\":{";
         ss << "\"received\":" << lb_stats.total_received << ",";
-        ss << "\"dispatched\":" << lb_stats.total_dispatched;
+        ss << "\"dispatched\":" << lb_stats.total_dispatched << ",";
+        ss << "\"dispatch\":\"" << (direct_dispatch_ ? "direct" : "two_tier") << "\",";
+        ss << "\"buckets_moved\":"
+           << (direct_dispatch_ ? fp_router_->migrations() : lb_stats.total_migrations) << ",";
+        ss << "\"restaged_batches\":" << restaged_batches_.load(std::memory_order_relaxed) << ",";
+        ss << "\"reader_push_batches\":" << batchSizeJson(lb_stats.reader_batches) << ",";
+        ss << "\"pop_batches\":" << batchSizeJson(lb_stats.input_batches);
         ss << "},";
     }
 
@@ -433,7 +1411,25 @@ std::string DPIEngine::generateJsonReport() const {
         ss << "\"processed\":" << fp_stats.total_processed << ",";
         ss << "\"forwarded\":" << fp_stats.total_forwarded << ",";
         ss << "\"dropped\":" << fp_stats.total_dropped << ",";
-        ss << "\"active_connections\":" << fp_stats.total_connections;
+        ss << "\"active_connections\":" << fp_stats.total_connections << ",";
+        ss << "\"push_batches\":" << batchSizeJson(fp_stats.push_batches) << ",";
+        ss << "\"pop_batches\":" << batchSizeJson(fp_stats.input_batches) << ",";
+        ss << "\"output_pop_batches\":" << batchSizeJson(output_queue_.popBatchSizes());
+        ss << "}";
+        
+        ss << ",\"thread_load\":{";
+        ss << "\"wait_policy\":\"" << config_.wait_policy.name() << "\",";
+        ss << "\"lbs\":[";
+        if (lb_manager_ && !direct_dispatch_) {
+            for (int i = 0; i < lb_manager_->getNumLBs(); i++) {
+                ss << (i ? "," : "") << threadLoadJson(lb_manager_->getLB(i).getStats().load);
+            }
+        }
+        ss << "],\"fps\":[";
+        for (int i = 0; i < fp_manager_->getNumFPs(); i++) {
+            ss << (i ? "," : "") << threadLoadJson(fp_manager_->getFP(i).getStats().load);
+        }
+        ss << "],\"output\":" << threadLoadJson(outputLoad());
         ss << "}";
     }
 
@@ -2,16 +2,21 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
 namespace DPI {
 
 FastPathProcessor::FastPathProcessor(int fp_id,
                                      RuleManager* rule_manager,
                                      PacketOutputCallback output_callback,
-                                     bool silent)
+                                     bool silent,
+                                     FragmentReassembler::Limits fragment_limits,
+                                     TcpReassembler::Limits stream_limits)
     : fp_id_(fp_id),
       input_queue_(10000),
       conn_tracker_(fp_id),
+      reassembler_(fragment_limits),
+      streams_(stream_limits),
       rule_manager_(rule_manager),
       output_callback_(std::move(output_callback)),
       silent_(silent) {
@@ -28,7 +33,9 @@ void FastPathProcessor::start() {
     thread_ = std::thread(&FastPathProcessor::run, this);
     
     if (!silent_) {
-        std::cout << "[FP" << fp_id_ << "] Started\n";
+        std::cout << "[FP" << fp_id_ << "] Started";
+        if (cpu_ >= 0) std::cout << " on CPU " << cpu_;
+        std::cout << "\n";
     }
 }
 
@@ -49,30 +56,151 @@ void FastPathProcessor::stop() {
 }
 
 void FastPathProcessor::run() {
-    while (running_) {
-        auto job_opt = input_queue_.popWithTimeout(std::chrono::milliseconds(100));
+    pinCurrentThread(cpu_, "FP" + std::to_string(fp_id_));
+    // First-touch puts what this thread allocates from here on (tracker
+    // entries, reassembly buffers) on its node; the queue was built by the
+    // engine's thread, so it is moved.
+    placeOnNode(input_queue_.storage(), input_queue_.storageBytes(), node_);
+    std::vector<PacketJob> burst(BURST);
+    load_.start();
+    auto last_cleanup = ThreadLoad::Clock::now();
+    bool ended = false;
+    while (running_ && !ended) {
+        load_.idle();
+        const size_t count = input_queue_.popBatch(
+            burst.data(), BURST, pending_ ? HANDOVER_POLL : std::chrono::milliseconds(100));
+        const auto now = load_.busy();
         
-        if (!job_opt) {
+        if (pending_ && pending_->handed_over.load(std::memory_order_acquire)) {
+            adoptPending(true);
+        }
+        
+        // On a timer rather than on every idle wake-up, so a busy FP still
+        // sweeps and an idle one does not sweep ten times a second.
+        if (now - last_cleanup >= CLEANUP_INTERVAL) {
             conn_tracker_.cleanupStale(std::chrono::seconds(300));
+            last_cleanup = now;
+        }
+        if (count == 0) {
             continue;
         }
         
-        packets_processed_++;
-        
-        PacketAction action = processPacket(*job_opt);
-        
-        if (output_callback_) {
-            output_callback_(*job_opt, action);
+        // The end marker is the last job ever pushed.
+        ended = burst[count - 1].end_of_stream;
+        const size_t jobs = ended ? count - 1 : count;
+        for (size_t i = 0; i < jobs; i++) {
+            PacketJob& job = burst[i];
+            if (job.migration) {
+                migrate(std::move(job.migration));
+            } else if (pending_ && pending_->moves(job.flow_hash)) {
+                held_.push_back(std::move(job));
+            } else {
+                handle(std::move(job));
+            }
         }
-        
-        if (action == PacketAction::DROP) {
-            packets_dropped_++;
+    }
+    
+    if (pending_) {
+        // The other FP's marker is ahead of its end marker, so after ours the
+        // hand-over is sure to come; after stop() it may not.
+        while (ended && running_ && !pending_->handed_over.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_for(HANDOVER_POLL);
+        }
+        adoptPending(pending_->handed_over.load(std::memory_order_acquire));
+    }
+    // Input is over: nothing still waiting for a fragment will get it.
+    reassembler_.flush(discarded_fragments_);
+    dropDiscardedFragments();
+    
+    if (ended && output_callback_) {
+        PacketJob end;
+        end.end_of_stream = true;
+        output_callback_(fp_id_, std::move(end), PacketAction::FORWARD);
+    }
+}
+
+void FastPathProcessor::handle(PacketJob&& job) {
+    if (job.is_fragmented) {
+        processFragment(std::move(job));
+        return;
+    }
+    PacketAction action = processPacket(job);
+    emit(std::move(job), action);
+}
+
+void FastPathProcessor::migrate(std::shared_ptr<FlowMigration> migration) {
+    if (migration->from == fp_id_) {
+        auto moving = [&migration](uint64_t flow_hash) { return migration->moves(flow_hash); };
+        migration->connections = conn_tracker_.extract(moving);
+        migration->streams = streams_.extract(moving);
+        reassembler_.extract(moving, migration->fragments);
+        if (handover_through_output_ && output_callback_) {
+            PacketJob handover;
+            handover.migration = std::move(migration);
+            output_callback_(fp_id_, std::move(handover), PacketAction::FORWARD);
         } else {
-            packets_forwarded_++;
+            migration->handed_over.store(true, std::memory_order_release);
+        }
+    } else if (migration->to == fp_id_) {
+        // The producer starts one move at a time and waits for it to land.
+        pending_ = std::move(migration);
+        if (pending_->handed_over.load(std::memory_order_acquire)) {
+            adoptPending(true);
+        }
+    }
+}
+
+void FastPathProcessor::adoptPending(bool with_state) {
+    std::shared_ptr<FlowMigration> migration = std::move(pending_);
+    if (with_state) {
+        conn_tracker_.adopt(std::move(migration->connections));
+        streams_.adopt(std::move(migration->streams));
+        // Older than anything held here.
+        for (auto& fragment : migration->fragments) {
+            processFragment(std::move(fragment));
         }
+        migration->fragments.clear();
+    }
+    for (auto& job : held_) {
+        handle(std::move(job));
+    }
+    held_.clear();
+    migration->adopted.store(true, std::memory_order_release);
+}
+
+void FastPathProcessor::emit(PacketJob&& job, PacketAction action) {
+    packets_processed_++;
+    
+    if (output_callback_) {
+        output_callback_(fp_id_, std::move(job), action);
+    }
+    
+    if (action == PacketAction::DROP) {
+        packets_dropped_++;
+    } else {
+        packets_forwarded_++;
     }
 }
 
+void FastPathProcessor::processFragment(PacketJob&& fragment) {
+    if (reassembler_.add(std::move(fragment), reassembled_, completed_fragments_,
+                         discarded_fragments_)) {
+        PacketAction action = processPacket(reassembled_);
+        for (auto& held : completed_fragments_) {
+            emit(std::move(held), action);
+        }
+        completed_fragments_.clear();
+    }
+    dropDiscardedFragments();
+}
+
+void FastPathProcessor::dropDiscardedFragments() {
+    for (auto& job : discarded_fragments_) {
+        emit(std::move(job), PacketAction::DROP);
+    }
+    discarded_fragments_.clear();
+}
+
 PacketAction FastPathProcessor::processPacket(PacketJob& job) {
     Connection* conn = conn_tracker_.getOrCreateConnection(job.tuple);
     if (!conn) {
@@ -80,7 +208,7 @@ PacketAction FastPathProcessor::processPacket(PacketJob& job) {
     }
     
     bool is_outbound = true;
-    conn_tracker_.updateConnection(conn, job.data.size(), is_outbound);
+    conn_tracker_.updateConnection(conn, job.frameLength(), is_outbound);
     
     if (job.tuple.protocol == 6) {
         conn_tracker_.updateTcpState(conn, job.tcp_flags);
@@ -100,22 +228,46 @@ PacketAction FastPathProcessor::processPacket(PacketJob& job) {
 }
 
 void FastPathProcessor::inspectPayload(PacketJob& job, Connection* conn) {
-    if (job.payload_length == 0 || job.payload_offset >= job.data.size()) {
+    if (job.payload_length == 0 || job.payload_offset >= job.frameLength()) {
         return;
     }
     
-    const uint8_t* payload = job.data.data() + job.payload_offset;
+    const uint8_t* payload = job.frameData() + job.payload_offset;
+    size_t length = job.payload_length;
+    
+    // A flow whose opening segment fell short is inspected over everything
+    // buffered so far rather than this segment alone.
+    const bool tcp = job.tuple.protocol == 6;
+    bool buffered = false;
+    bool buffer_full = false;
+    if (tcp) {
+        if (auto view = streams_.append(job.tuple, job.tcp_seq, payload, length)) {
+            payload = view->data;
+            length = view->length;
+            buffered = true;
+            buffer_full = view->full;
+        }
+    }
     
-    if (tryExtractSNI(job, conn)) {
+    if (tryExtractSNI(job, payload, length, conn) ||
+        tryExtractHTTPHost(job, payload, length, conn)) {
+        if (buffered) streams_.release(job.tuple);
         return;
     }
     
-    if (tryExtractHTTPHost(job, conn)) {
-        return;
+    // A ClientHello or request cut off at a segment boundary: hold off
+    // classifying until the rest arrives or the buffer is full.
+    if (tcp && !buffer_full &&
+        (SNIExtractor::pendingClientHelloLength(payload, length) > 0 ||
+         (job.tuple.dst_port == 80 && HTTPHostExtractor::isIncompleteRequest(payload, length)))) {
+        if (buffered || streams_.begin(job.tuple, job.tcp_seq, payload, length)) {
+            return;
+        }
     }
+    if (buffered) streams_.release(job.tuple);
     
     if (job.tuple.dst_port == 53 || job.tuple.src_port == 53) {
-        auto domain = DNSExtractor::extractQuery(payload, job.payload_length);
+        auto domain = DNSExtractor::extractQuery(payload, length);
         if (domain) {
             conn_tracker_.classifyConnection(conn, AppType::DNS, *domain);
             return;
@@ -129,17 +281,13 @@ void FastPathProcessor::inspectPayload(PacketJob& job, Connection* conn) {
     }
 }
 
-bool FastPathProcessor::tryExtractSNI(const PacketJob& job, Connection* conn) {
-    if (job.tuple.dst_port != 443 && job.payload_length < 50) {
-        return false;
-    }
-    
-    if (job.payload_offset >= job.data.size() || job.payload_length == 0) {
+bool FastPathProcessor::tryExtractSNI(const PacketJob& job, const uint8_t* payload,
+                                      size_t length, Connection* conn) {
+    if (job.tuple.dst_port != 443 && length < 50) {
         return false;
     }
     
-    const uint8_t* payload = job.data.data() + job.payload_offset;
-    auto sni = SNIExtractor::extract(payload, job.payload_length);
+    auto sni = SNIExtractor::extract(payload, length);
     if (sni) {
         sni_extractions_++;
         
@@ -156,17 +304,13 @@ bool FastPathProcessor::tryExtractSNI(const PacketJob& job, Connection* conn) {
     return false;
 }
 
-bool FastPathProcessor::tryExtractHTTPHost(const PacketJob& job, Connection* conn) {
+bool FastPathProcessor::tryExtractHTTPHost(const PacketJob& job, const uint8_t* payload,
+                                           size_t length, Connection* conn) {
     if (job.tuple.dst_port != 80) {
         return false;
     }
     
-    if (job.payload_offset >= job.data.size() || job.payload_length == 0) {
-        return false;
-    }
-    
-    const uint8_t* payload = job.data.data() + job.payload_offset;
-    auto host = HTTPHostExtractor::extract(payload, job.payload_length);
+    auto host = HTTPHostExtractor::extract(payload, length);
     if (host) {
         AppType app = sniToAppType(*host);
         conn_tracker_.classifyConnection(conn, app, *host);
@@ -186,7 +330,7 @@ PacketAction FastPathProcessor::checkRules(const PacketJob& job, Connection* con
         return PacketAction::FORWARD;
     }
     
-    uint32_t src_ip = job.tuple.src_ip;
+    const IPAddress& src_ip = job.tuple.src_ip;
     
     auto classification = conn_tracker_.getClassification(conn);
 
@@ -221,6 +365,7 @@ PacketAction FastPathProcessor::checkRules(const PacketJob& job, Connection* con
         }
         
         conn_tracker_.blockConnection(conn);
+        streams_.release(job.tuple);
         
         return PacketAction::DROP;
     }
@@ -236,6 +381,10 @@ FastPathProcessor::FPStats FastPathProcessor::getStats() const {
     stats.connections_tracked = conn_tracker_.getActiveCount();
     stats.sni_extractions = sni_extractions_.load();
     stats.classification_hits = classification_hits_.load();
+    stats.push_batches = input_queue_.pushBatchSizes();
+    stats.input_batches = input_queue_.popBatchSizes();
+    stats.load = load_.snapshot();
+    stats.load.parks = input_queue_.consumerParks();
     return stats;
 }
 
@@ -253,11 +402,14 @@ std::unordered_map<std::string, uint64_t> FastPathProcessor::getApplicationStats
 FPManager::FPManager(int num_fps,
                      RuleManager* rule_manager,
                      PacketOutputCallback output_callback,
-                     bool silent)
+                     bool silent,
+                     FragmentReassembler::Limits fragment_limits,
+                     TcpReassembler::Limits stream_limits)
     : silent_(silent) {
 
     for (int i = 0; i < num_fps; i++) {
-        auto fp = std::make_unique<FastPathProcessor>(i, rule_manager, output_callback, silent_);
+        auto fp = std::make_unique<FastPathProcessor>(i, rule_manager, output_callback, silent_,
+                                                      fragment_limits, stream_limits);
         fps_.push_back(std::move(fp));
     }
     
@@ -291,6 +443,46 @@ FPManager::AggregatedStats FPManager::getAggregatedStats() const {
         stats.total_forwarded += fp_stats.packets_forwarded;
         stats.total_dropped += fp_stats.packets_dropped;
         stats.total_connections += fp_stats.connections_tracked;
+        stats.push_batches.merge(fp_stats.push_batches);
+        stats.input_batches.merge(fp_stats.input_batches);
+    }
+    
+    return stats;
+}
+
+FragmentReassembler::Stats FPManager::getReassemblyStats() const {
+    FragmentReassembler::Stats stats = {};
+    
+    for (const auto& fp : fps_) {
+        auto fp_stats = fp->getReassembler().getStats();
+        stats.fragments += fp_stats.fragments;
+        stats.reassembled += fp_stats.reassembled;
+        stats.timed_out += fp_stats.timed_out;
+        stats.overlapping += fp_stats.overlapping;
+        stats.duplicates += fp_stats.duplicates;
+        stats.evicted += fp_stats.evicted;
+        stats.malformed += fp_stats.malformed;
+        stats.too_many_fragments += fp_stats.too_many_fragments;
+        stats.datagrams_in_progress += fp_stats.datagrams_in_progress;
+        stats.bytes_in_use += fp_stats.bytes_in_use;
+        stats.peak_bytes = std::max(stats.peak_bytes, fp_stats.peak_bytes);
+    }
+    
+    return stats;
+}
+
+TcpReassembler::Stats FPManager::getStreamStats() const {
+    TcpReassembler::Stats stats = {};
+    
+    for (const auto& fp : fps_) {
+        auto fp_stats = fp->getStreamReassembler().getStats();
+        stats.flows_buffered += fp_stats.flows_buffered;
+        stats.segments_appended += fp_stats.segments_appended;
+        stats.out_of_order += fp_stats.out_of_order;
+        stats.overflows += fp_stats.overflows;
+        stats.evicted += fp_stats.evicted;
+        stats.flows_in_progress += fp_stats.flows_in_progress;
+        stats.peak_flows = std::max(stats.peak_flows, fp_stats.peak_flows);
     }
     
     return stats;
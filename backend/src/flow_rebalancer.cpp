@@ -0,0 +1,71 @@
+#include "flow_rebalancer.h"
+#include <algorithm>
+
+namespace DPI {
+
+FlowRebalancer::FlowRebalancer(std::vector<SpscQueue<PacketJob>*> queues, int first_fp_id,
+                               size_t buckets)
+    : queues_(std::move(queues)),
+      first_fp_id_(first_fp_id),
+      table_(queues_.size(), buckets),
+      bucket_load_(buckets, 0) {
+}
+
+std::optional<FlowRebalancer::Move> FlowRebalancer::pickMove(
+    const std::vector<uint64_t>& bucket_load, const IndirectionTable& table, size_t targets) {
+    if (targets < 2) return std::nullopt;
+    std::vector<uint64_t> load(targets, 0);
+    for (size_t b = 0; b < bucket_load.size(); b++) {
+        load[table.targetOfBucket(b)] += bucket_load[b];
+    }
+    const auto busiest = std::max_element(load.begin(), load.end()) - load.begin();
+    const auto idlest = std::min_element(load.begin(), load.end()) - load.begin();
+    const uint64_t gap = load[busiest] - load[idlest];
+    if (gap == 0 || gap <= load[busiest] / 8) return std::nullopt;
+
+    // Moving a bucket of load w leaves the two FPs w apart the other way
+    // round, so anything under the gap helps, and half the gap is best.
+    std::optional<Move> best;
+    uint64_t best_miss = 0;
+    for (size_t b = 0; b < bucket_load.size(); b++) {
+        const uint64_t w = bucket_load[b];
+        if (w == 0 || w >= gap || table.targetOfBucket(b) != static_cast<uint32_t>(busiest)) {
+            continue;
+        }
+        const uint64_t miss = w * 2 > gap ? w * 2 - gap : gap - w * 2;
+        if (!best || miss < best_miss) {
+            best = Move{b, static_cast<uint32_t>(busiest), static_cast<uint32_t>(idlest)};
+            best_miss = miss;
+        }
+    }
+    return best;
+}
+
+void FlowRebalancer::rebalance() {
+    if (!enabled_ || routed_ < REBALANCE_INTERVAL) return;
+    // Keep counting until the last move has landed.
+    if (in_flight_ && !in_flight_->adopted.load(std::memory_order_acquire)) return;
+    in_flight_.reset();
+    routed_ = 0;
+
+    const auto move = pickMove(bucket_load_, table_, queues_.size());
+    for (auto& load : bucket_load_) {
+        load /= 2;
+    }
+    if (!move || !queues_[move->from] || !queues_[move->to]) return;
+
+    table_.setTarget(move->bucket, move->to);
+    version_.fetch_add(1, std::memory_order_acq_rel);
+    in_flight_ = std::make_shared<FlowMigration>(move->bucket, table_.buckets(),
+                                                 first_fp_id_ + static_cast<int>(move->from),
+                                                 first_fp_id_ + static_cast<int>(move->to));
+    PacketJob release;
+    release.migration = in_flight_;
+    queues_[move->from]->push(std::move(release));
+    PacketJob acquire;
+    acquire.migration = in_flight_;
+    queues_[move->to]->push(std::move(acquire));
+    migrations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,382 @@
+#include "fragment_reassembler.h"
+#include <algorithm>
+#include <cstring>
+
+namespace DPI {
+
+namespace {
+
+constexpr uint32_t MAX_IP_PAYLOAD = 65535;
+
+constexpr uint8_t IPPROTO_TCP_ = 6;
+constexpr uint8_t IPPROTO_UDP_ = 17;
+
+inline uint16_t load16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint64_t packetTimeUs(const PacketJob& job) {
+    return static_cast<uint64_t>(job.ts_sec) * 1000000 + job.ts_usec;
+}
+
+}
+
+size_t FragmentReassembler::KeyHash::operator()(const Key& key) const noexcept {
+    const IPAddressHash hasher;
+    uint64_t h = hasher(key.src) ^ (hasher(key.dst) * 0x9e3779b97f4a7c15ULL) ^
+                 (static_cast<uint64_t>(key.id) << 8) ^ key.protocol;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+FragmentReassembler::FragmentReassembler() : FragmentReassembler(Limits()) {
+}
+
+FragmentReassembler::FragmentReassembler(Limits limits)
+    : limits_(limits),
+      slab_capacity_(limits.memory_bytes / SLAB_SIZE) {
+}
+
+FragmentReassembler::~FragmentReassembler() = default;
+
+size_t FragmentReassembler::bytesInUse() const {
+    return (slab_capacity_ - free_slabs_.size()) * SLAB_SIZE + owned_bytes_ + held_bytes_;
+}
+
+void FragmentReassembler::publishUsage() {
+    const uint64_t used = arena_ ? bytesInUse() : owned_bytes_ + held_bytes_;
+    bytes_in_use_ = used;
+    if (used > peak_bytes_) peak_bytes_ = used;
+    in_progress_ = datagrams_.size();
+}
+
+bool FragmentReassembler::add(PacketJob&& fragment, PacketJob& datagram,
+                              std::vector<PacketJob>& fragments,
+                              std::vector<PacketJob>& discarded) {
+    fragments_++;
+    const uint16_t source = fragment.source;
+    if (source >= by_age_.size()) {
+        by_age_.resize(source + 1);
+        now_us_.resize(source + 1, 0);
+    }
+    now_us_[source] = std::max(now_us_[source], packetTimeUs(fragment));
+    expire(source, discarded);
+
+    if (!arena_) {
+        // Carved up on first use, so an FP that never sees a fragment costs
+        // nothing.
+        arena_.reset(new uint8_t[slab_capacity_ * SLAB_SIZE]);
+        free_slabs_.reserve(slab_capacity_);
+        for (size_t i = slab_capacity_; i > 0; i--) {
+            free_slabs_.push_back(static_cast<uint32_t>(i - 1));
+        }
+    }
+
+    const uint32_t begin = fragment.fragment_offset;
+    const size_t length = fragment.payload_length;
+    const uint64_t end = static_cast<uint64_t>(begin) + length;
+    // All but the last fragment carry a non-zero multiple of 8 bytes, and no
+    // datagram is longer than the IP length field allows.
+    if (end > MAX_IP_PAYLOAD ||
+        (fragment.more_fragments && (length == 0 || length % 8 != 0)) ||
+        (fragment.tuple.protocol != IPPROTO_TCP_ && fragment.tuple.protocol != IPPROTO_UDP_)) {
+        malformed_++;
+        discarded.push_back(std::move(fragment));
+        publishUsage();
+        return false;
+    }
+
+    const Key key{fragment.tuple.src_ip, fragment.tuple.dst_ip, fragment.fragment_id,
+                  fragment.tuple.protocol};
+    auto it = datagrams_.find(key);
+    if (it == datagrams_.end()) {
+        while (datagrams_.size() >= limits_.max_datagrams) {
+            const Key* victim = oldest(source, nullptr);
+            if (!victim) break;
+            evicted_++;
+            discard(datagrams_.find(*victim), discarded);
+        }
+        std::list<Key>& ages = by_age_[source];
+        ages.push_back(key);
+        it = datagrams_.emplace(key, Datagram()).first;
+        Datagram& fresh = it->second;
+        fresh.age = std::prev(ages.end());
+        fresh.source = source;
+        fresh.first_seen_us = packetTimeUs(fragment);
+        std::fill(std::begin(fresh.slabs), std::end(fresh.slabs), NO_SLAB);
+    }
+    Datagram& d = it->second;
+
+    // The last fragment fixes the length; nothing may disagree with it.
+    bool consistent = true;
+    if (!fragment.more_fragments) {
+        consistent = (!d.have_last || d.total_length == end) &&
+                     (d.ranges.empty() || d.ranges.back().second <= end);
+        d.have_last = true;
+        d.total_length = static_cast<uint32_t>(end);
+    } else if (d.have_last && end > d.total_length) {
+        consistent = false;
+    }
+    if (!consistent) {
+        malformed_++;
+        discarded.push_back(std::move(fragment));
+        discard(it, discarded);
+        publishUsage();
+        return false;
+    }
+
+    switch (place(d, begin, static_cast<uint32_t>(end))) {
+        case Placement::DUPLICATE:
+            duplicates_++;
+            discarded.push_back(std::move(fragment));
+            publishUsage();
+            return false;
+        case Placement::OVERLAP:
+            overlapping_++;
+            discarded.push_back(std::move(fragment));
+            discard(it, discarded);
+            publishUsage();
+            return false;
+        case Placement::NEW:
+            break;
+    }
+    if (d.fragments.size() >= limits_.max_fragments) {
+        too_many_fragments_++;
+        discarded.push_back(std::move(fragment));
+        discard(it, discarded);
+        publishUsage();
+        return false;
+    }
+
+    size_t slabs_needed = 0;
+    if (length > 0) {
+        for (size_t s = begin / SLAB_SIZE; s <= (end - 1) / SLAB_SIZE; s++) {
+            if (d.slabs[s] == NO_SLAB) slabs_needed++;
+        }
+    }
+    // A mapped frame costs nothing to hold; an owned one counts against the
+    // same budget as the slabs, and so does the job holding either.
+    const size_t owned = fragment.borrowed_data ? 0 : fragment.data.capacity();
+    const size_t held = FRAGMENT_COST + (d.fragments.empty() ? DATAGRAM_COST : 0);
+    if (!reserve(slabs_needed, owned + held, source, key, discarded)) {
+        evicted_++;
+        discarded.push_back(std::move(fragment));
+        discard(it, discarded);
+        publishUsage();
+        return false;
+    }
+
+    store(d, begin, fragment.frameData() + fragment.payload_offset, length);
+    d.owned_bytes += owned;
+    owned_bytes_ += owned;
+    d.held_bytes += held;
+    held_bytes_ += held;
+    d.fragments.push_back(std::move(fragment));
+
+    if (!complete(d)) {
+        publishUsage();
+        return false;
+    }
+    if (!assemble(d, d.fragments.back(), datagram)) {
+        malformed_++;
+        discard(it, discarded);
+        publishUsage();
+        return false;
+    }
+
+    reassembled_++;
+    for (auto& f : d.fragments) {
+        fragments.push_back(std::move(f));
+    }
+    d.fragments.clear();
+    discard(it, discarded);
+    publishUsage();
+    return true;
+}
+
+void FragmentReassembler::flush(std::vector<PacketJob>& discarded) {
+    for (auto& ages : by_age_) {
+        while (!ages.empty()) {
+            timed_out_++;
+            discard(datagrams_.find(ages.front()), discarded);
+        }
+    }
+    publishUsage();
+}
+
+void FragmentReassembler::extract(const std::function<bool(uint64_t flow_hash)>& moving,
+                                  std::vector<PacketJob>& fragments) {
+    for (auto& ages : by_age_) {
+        for (auto age = ages.begin(); age != ages.end(); ) {
+            auto it = datagrams_.find(*age++);
+            if (it->second.fragments.empty() ||
+                !moving(it->second.fragments.front().flow_hash)) {
+                continue;
+            }
+            fragments_ -= it->second.fragments.size();
+            discard(it, fragments);
+        }
+    }
+    publishUsage();
+}
+
+FragmentReassembler::Placement FragmentReassembler::place(Datagram& d, uint32_t begin,
+                                                          uint32_t end) {
+    auto pos = std::lower_bound(d.ranges.begin(), d.ranges.end(), begin,
+                                [](const std::pair<uint32_t, uint32_t>& r, uint32_t value) {
+                                    return r.second <= value;
+                                });
+    if (pos != d.ranges.end()) {
+        if (pos->first == begin && pos->second == end) return Placement::DUPLICATE;
+        if (pos->first < end && begin < pos->second) return Placement::OVERLAP;
+    }
+    d.ranges.insert(pos, {begin, end});
+    return Placement::NEW;
+}
+
+bool FragmentReassembler::complete(const Datagram& d) const {
+    if (!d.have_last) return false;
+    uint32_t covered = 0;
+    for (const auto& r : d.ranges) {
+        if (r.first > covered) return false;
+        covered = std::max(covered, r.second);
+    }
+    return covered >= d.total_length;
+}
+
+bool FragmentReassembler::reserve(size_t slabs, size_t bytes, uint16_t source,
+                                  const Key& keep, std::vector<PacketJob>& discarded) {
+    while (bytesInUse() + slabs * SLAB_SIZE + bytes > limits_.memory_bytes) {
+        const Key* victim = oldest(source, &keep);
+        if (!victim) return false;
+        evicted_++;
+        discard(datagrams_.find(*victim), discarded);
+    }
+    return true;
+}
+
+const FragmentReassembler::Key* FragmentReassembler::oldest(uint16_t source,
+                                                            const Key* keep) const {
+    // The source's own first: only ages within one source compare.
+    for (size_t i = 0; i < by_age_.size(); i++) {
+        const auto& ages = by_age_[(source + i) % by_age_.size()];
+        auto it = ages.begin();
+        if (it != ages.end() && keep && *it == *keep) ++it;
+        if (it != ages.end()) return &*it;
+    }
+    return nullptr;
+}
+
+void FragmentReassembler::store(Datagram& d, uint32_t begin, const uint8_t* data,
+                                size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        const size_t position = begin + done;
+        const size_t s = position / SLAB_SIZE;
+        if (d.slabs[s] == NO_SLAB) {
+            d.slabs[s] = free_slabs_.back();
+            free_slabs_.pop_back();
+            d.slab_count++;
+        }
+        const size_t within = position % SLAB_SIZE;
+        const size_t n = std::min(length - done, SLAB_SIZE - within);
+        std::memcpy(arena_.get() + static_cast<size_t>(d.slabs[s]) * SLAB_SIZE + within,
+                    data + done, n);
+        done += n;
+    }
+}
+
+bool FragmentReassembler::assemble(const Datagram& d, const PacketJob& last,
+                                   PacketJob& datagram) const {
+    const PacketJob& first = *std::find_if(
+        d.fragments.begin(), d.fragments.end(),
+        [](const PacketJob& f) { return f.fragment_offset == 0; });
+
+    // Keep the buffer's capacity across datagrams.
+    std::vector<uint8_t> buffer = std::move(datagram.data);
+    datagram = PacketJob();
+    buffer.resize(d.total_length);
+    for (size_t offset = 0; offset < d.total_length; offset += SLAB_SIZE) {
+        const size_t n = std::min<size_t>(SLAB_SIZE, d.total_length - offset);
+        std::memcpy(buffer.data() + offset,
+                    arena_.get() + static_cast<size_t>(d.slabs[offset / SLAB_SIZE]) * SLAB_SIZE,
+                    n);
+    }
+
+    size_t header_len;
+    if (first.tuple.protocol == IPPROTO_TCP_) {
+        if (buffer.size() < 20) return false;
+        header_len = (buffer[12] >> 4) * 4u;
+        if (header_len < 20 || header_len > buffer.size()) return false;
+        datagram.tcp_flags = buffer[13];
+        datagram.tcp_seq = (static_cast<uint32_t>(load16(buffer.data() + 4)) << 16) |
+                           load16(buffer.data() + 6);
+    } else {
+        if (buffer.size() < 8) return false;
+        header_len = 8;
+    }
+
+    datagram.packet_id = last.packet_id;
+    datagram.ts_sec = last.ts_sec;
+    datagram.ts_usec = last.ts_usec;
+    datagram.tuple = first.tuple;
+    datagram.tuple.src_port = load16(buffer.data());
+    datagram.tuple.dst_port = load16(buffer.data() + 2);
+    datagram.data = std::move(buffer);
+    datagram.transport_offset = 0;
+    datagram.payload_offset = header_len;
+    datagram.payload_length = datagram.data.size() - header_len;
+    if (datagram.payload_length > 0) {
+        datagram.payload_data = datagram.data.data() + header_len;
+    }
+    return true;
+}
+
+void FragmentReassembler::discard(std::unordered_map<Key, Datagram, KeyHash>::iterator it,
+                                  std::vector<PacketJob>& discarded) {
+    Datagram& d = it->second;
+    for (auto& f : d.fragments) {
+        discarded.push_back(std::move(f));
+    }
+    for (uint32_t slab : d.slabs) {
+        if (slab != NO_SLAB) free_slabs_.push_back(slab);
+    }
+    owned_bytes_ -= d.owned_bytes;
+    held_bytes_ -= d.held_bytes;
+    by_age_[d.source].erase(d.age);
+    datagrams_.erase(it);
+}
+
+void FragmentReassembler::expire(uint16_t source, std::vector<PacketJob>& discarded) {
+    // Oldest first, so the first one still in time ends the scan. Fragments
+    // a capture holds slightly out of time order can outlive their timeout by
+    // that much; nothing is held past the next in-time arrival.
+    const uint64_t timeout_us = static_cast<uint64_t>(limits_.timeout_seconds) * 1000000;
+    std::list<Key>& ages = by_age_[source];
+    while (!ages.empty()) {
+        auto it = datagrams_.find(ages.front());
+        if (it->second.first_seen_us + timeout_us > now_us_[source]) break;
+        timed_out_++;
+        discard(it, discarded);
+    }
+}
+
+FragmentReassembler::Stats FragmentReassembler::getStats() const {
+    Stats stats;
+    stats.fragments = fragments_.load();
+    stats.reassembled = reassembled_.load();
+    stats.timed_out = timed_out_.load();
+    stats.overlapping = overlapping_.load();
+    stats.duplicates = duplicates_.load();
+    stats.evicted = evicted_.load();
+    stats.malformed = malformed_.load();
+    stats.too_many_fragments = too_many_fragments_.load();
+    stats.datagrams_in_progress = in_progress_.load();
+    stats.bytes_in_use = bytes_in_use_.load();
+    stats.peak_bytes = peak_bytes_.load();
+    return stats;
+}
+
+}
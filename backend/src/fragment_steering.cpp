@@ -0,0 +1,109 @@
+#include "fragment_steering.h"
+#include <algorithm>
+#include <iterator>
+
+namespace DPI {
+
+namespace {
+
+inline uint64_t packetTimeUs(const PacketJob& job) {
+    return static_cast<uint64_t>(job.ts_sec) * 1000000 + job.ts_usec;
+}
+
+}
+
+size_t FragmentSteering::KeyHash::operator()(const Key& key) const noexcept {
+    const IPAddressHash hasher;
+    uint64_t h = hasher(key.src) ^ (hasher(key.dst) * 0x9e3779b97f4a7c15ULL) ^
+                 (static_cast<uint64_t>(key.id) << 8) ^ key.protocol;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+FragmentSteering::FragmentSteering() : FragmentSteering(Limits()) {
+}
+
+FragmentSteering::FragmentSteering(Limits limits) : limits_(limits) {
+}
+
+void FragmentSteering::steer(PacketJob&& job, std::vector<PacketJob>& ready) {
+    if (!job.is_fragmented) {
+        ready.push_back(std::move(job));
+        return;
+    }
+
+    // Datagrams time out on packet time, as they do in the reassembler.
+    now_us_ = std::max(now_us_, packetTimeUs(job));
+    const uint64_t timeout_us = static_cast<uint64_t>(limits_.timeout_seconds) * 1000000;
+    while (!by_age_.empty()) {
+        auto oldest = datagrams_.find(by_age_.front());
+        if (now_us_ - oldest->second.first_seen_us < timeout_us) break;
+        release(oldest, ready);
+    }
+
+    const Key key{job.tuple.src_ip, job.tuple.dst_ip, job.fragment_id, job.tuple.protocol};
+    auto it = datagrams_.find(key);
+    if (it == datagrams_.end()) {
+        while (datagrams_.size() >= limits_.max_datagrams && !by_age_.empty()) {
+            release(datagrams_.find(by_age_.front()), ready);
+        }
+        by_age_.push_back(key);
+        it = datagrams_.emplace(key, Datagram()).first;
+        it->second.age = std::prev(by_age_.end());
+        it->second.first_seen_us = packetTimeUs(job);
+    }
+    Datagram& d = it->second;
+
+    if (!d.known && job.fragment_offset == 0) {
+        d.known = true;
+        // Too short to hold the ports: stay with the address pair.
+        d.flow_hash = job.flow_hash;
+        if (job.payload_length >= 4 && job.payload_data) {
+            FiveTuple tuple = job.tuple;
+            tuple.src_port = static_cast<uint16_t>((job.payload_data[0] << 8) |
+                                                   job.payload_data[1]);
+            tuple.dst_port = static_cast<uint16_t>((job.payload_data[2] << 8) |
+                                                   job.payload_data[3]);
+            d.flow_hash = FiveTupleHash()(tuple);
+        }
+        job.flow_hash = d.flow_hash;
+        ready.push_back(std::move(job));
+        for (auto& held : d.held) {
+            held.flow_hash = d.flow_hash;
+            ready.push_back(std::move(held));
+        }
+        held_ -= d.held.size();
+        d.held.clear();
+        return;
+    }
+    if (d.known) {
+        job.flow_hash = d.flow_hash;
+        ready.push_back(std::move(job));
+        return;
+    }
+
+    d.held.push_back(std::move(job));
+    held_++;
+    while (held_ > limits_.max_held && !by_age_.empty()) {
+        release(datagrams_.find(by_age_.front()), ready);
+    }
+}
+
+void FragmentSteering::flush(std::vector<PacketJob>& ready) {
+    while (!by_age_.empty()) {
+        release(datagrams_.find(by_age_.front()), ready);
+    }
+}
+
+void FragmentSteering::release(Map::iterator it, std::vector<PacketJob>& ready) {
+    for (auto& held : it->second.held) {
+        ready.push_back(std::move(held));
+    }
+    held_ -= it->second.held.size();
+    by_age_.erase(it->second.age);
+    datagrams_.erase(it);
+}
+
+}
@@ -0,0 +1,215 @@
+#include "live_capture.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace PacketAnalyzer {
+
+constexpr uint32_t PCAP_MAGIC_NATIVE = 0xa1b2c3d4;
+constexpr uint32_t LINKTYPE_ETHERNET = 1;
+// Frames on a TPACKET_V3 ring are bounded by the block, not a snaplen; this is
+// what the output header advertises (loopback alone has a 64 KiB MTU).
+constexpr uint32_t LIVE_SNAPLEN = 262144;
+
+AfPacketRing::~AfPacketRing() {
+    close();
+}
+
+PcapGlobalHeader AfPacketRing::globalHeader() const {
+    PcapGlobalHeader header{};
+    header.magic_number = PCAP_MAGIC_NATIVE;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.snaplen = snaplen_ ? snaplen_ : LIVE_SNAPLEN;
+    // SOCK_RAW delivers link-layer frames; loopback gets a zeroed Ethernet
+    // header, so Ethernet describes both.
+    header.network = LINKTYPE_ETHERNET;
+    return header;
+}
+
+#ifdef __linux__
+
+static bool fail(const std::string& what, int fd) {
+    std::cerr << "Error: " << what << ": " << std::strerror(errno) << std::endl;
+    if (fd >= 0) ::close(fd);
+    return false;
+}
+
+bool AfPacketRing::open(const LiveCaptureOptions& options, uint16_t fanout_group) {
+    close();
+
+    const unsigned ifindex = ::if_nametoindex(options.interface.c_str());
+    if (ifindex == 0) {
+        std::cerr << "Error: Unknown interface: " << options.interface << std::endl;
+        return false;
+    }
+
+    int fd = ::socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        return fail("Could not open packet socket (needs CAP_NET_RAW)", -1);
+    }
+
+    int version = TPACKET_V3;
+    if (::setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+        return fail("TPACKET_V3 not supported", fd);
+    }
+
+    tpacket_req3 req{};
+    req.tp_block_size = options.block_size;
+    req.tp_block_nr = options.block_count;
+    req.tp_frame_size = options.frame_size;
+    req.tp_frame_nr = (options.block_size / options.frame_size) * options.block_count;
+    req.tp_retire_blk_tov = options.block_timeout_ms;
+    if (::setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+        return fail("Could not set up the receive ring", fd);
+    }
+
+    const size_t ring_size = static_cast<size_t>(options.block_size) * options.block_count;
+    void* ring = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (ring == MAP_FAILED) {
+        return fail("Could not map the receive ring", fd);
+    }
+
+    sockaddr_ll addr{};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = static_cast<int>(ifindex);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::munmap(ring, ring_size);
+        return fail("Could not bind to " + options.interface, fd);
+    }
+
+    if (options.promiscuous) {
+        packet_mreq mreq{};
+        mreq.mr_ifindex = static_cast<int>(ifindex);
+        mreq.mr_type = PACKET_MR_PROMISC;
+        // Not fatal: some virtual interfaces refuse it and see everything anyway.
+        ::setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+
+    // From here on each ring in the group gets a disjoint, flow-consistent
+    // share; DEFRAG keeps IP fragments with the rest of their flow.
+    if (fanout_group != 0) {
+        const int fanout = fanout_group | (PACKET_FANOUT_HASH << 16) |
+                           (PACKET_FANOUT_FLAG_DEFRAG << 16);
+        if (::setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+            ::munmap(ring, ring_size);
+            return fail("Could not join fanout group", fd);
+        }
+    }
+
+    // On loopback every packet is seen twice, once leaving and once arriving.
+    ifreq ifr{};
+    std::strncpy(ifr.ifr_name, options.interface.c_str(), IFNAMSIZ - 1);
+    skip_outgoing_ = ::ioctl(fd, SIOCGIFFLAGS, &ifr) == 0 && (ifr.ifr_flags & IFF_LOOPBACK);
+
+    fd_ = fd;
+    ring_ = static_cast<uint8_t*>(ring);
+    ring_size_ = ring_size;
+    block_size_ = options.block_size;
+    block_count_ = options.block_count;
+    current_block_ = 0;
+    snaplen_ = LIVE_SNAPLEN;
+    return true;
+}
+
+void AfPacketRing::close() {
+    if (ring_) {
+        ::munmap(ring_, ring_size_);
+        ring_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+size_t AfPacketRing::poll(int timeout_ms, const std::function<void(const RawPacket&)>& fn) {
+    if (fd_ < 0) return 0;
+
+    auto* block = reinterpret_cast<tpacket_block_desc*>(
+        ring_ + static_cast<size_t>(current_block_) * block_size_);
+
+    if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+        pollfd pfd{};
+        pfd.fd = fd_;
+        pfd.events = POLLIN | POLLERR;
+        ::poll(&pfd, 1, timeout_ms);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            return 0;
+        }
+    }
+
+    RawPacket raw;
+    size_t delivered = 0;
+    const uint32_t count = block->hdr.bh1.num_pkts;
+    auto* hdr = reinterpret_cast<tpacket3_hdr*>(
+        reinterpret_cast<uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const auto* ll = reinterpret_cast<const sockaddr_ll*>(
+            reinterpret_cast<const uint8_t*>(hdr) + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+        if (!(skip_outgoing_ && ll->sll_pkttype == PACKET_OUTGOING)) {
+            raw.header.ts_sec = hdr->tp_sec;
+            raw.header.ts_usec = hdr->tp_nsec / 1000;
+            raw.header.incl_len = hdr->tp_snaplen;
+            raw.header.orig_len = hdr->tp_len;
+            raw.mapped = reinterpret_cast<const uint8_t*>(hdr) + hdr->tp_mac;
+            fn(raw);
+            delivered++;
+        }
+        hdr = reinterpret_cast<tpacket3_hdr*>(reinterpret_cast<uint8_t*>(hdr) + hdr->tp_next_offset);
+    }
+
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    current_block_ = (current_block_ + 1) % block_count_;
+    packets_ += delivered;
+    return delivered;
+}
+
+AfPacketRing::Stats AfPacketRing::getStats() {
+    if (fd_ >= 0) {
+        // The kernel resets its counters on every read, so they are summed here.
+        tpacket_stats_v3 kstats{};
+        socklen_t len = sizeof(kstats);
+        if (::getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) == 0) {
+            kernel_drops_ += kstats.tp_drops;
+            ring_full_events_ += kstats.tp_freeze_q_cnt;
+        }
+    }
+    return Stats{packets_, kernel_drops_, ring_full_events_};
+}
+
+#else
+
+bool AfPacketRing::open(const LiveCaptureOptions&, uint16_t) {
+    std::cerr << "Error: Live capture needs AF_PACKET, which is Linux-only" << std::endl;
+    return false;
+}
+
+void AfPacketRing::close() {}
+
+size_t AfPacketRing::poll(int, const std::function<void(const RawPacket&)>&) {
+    return 0;
+}
+
+AfPacketRing::Stats AfPacketRing::getStats() {
+    return Stats{packets_, kernel_drops_, ring_full_events_};
+}
+
+#endif
+
+}
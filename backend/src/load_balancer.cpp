@@ -5,7 +5,7 @@
 namespace DPI {
 
 LoadBalancer::LoadBalancer(int lb_id,
-                           std::vector<ThreadSafeQueue<PacketJob>*> fp_queues,
+                           std::vector<SpscQueue<PacketJob>*> fp_queues,
                            int fp_start_id,
                            bool silent)
     : lb_id_(lb_id),
@@ -13,9 +13,14 @@ LoadBalancer::LoadBalancer(int lb_id,
       num_fps_(fp_queues.size()),
       input_queue_(10000),
       fp_queues_(std::move(fp_queues)),
-      silent_(silent)
+      silent_(silent),
+      rebalancer_(fp_queues_, fp_start_id)
 {
     per_fp_counts_.resize(num_fps_);
+    staged_.resize(num_fps_);
+    for (auto& jobs : staged_) {
+        jobs.reserve(BURST);
+    }
 }
 
 LoadBalancer::~LoadBalancer() {
@@ -30,7 +35,9 @@ void LoadBalancer::start() {
     
     if (!silent_) {
         std::cout << "[LB" << lb_id_ << "] Started (serving FP" 
-                  << fp_start_id_ << "-FP" << (fp_start_id_ + num_fps_ - 1) << ")\n";
+                  << fp_start_id_ << "-FP" << (fp_start_id_ + num_fps_ - 1) << ")";
+        if (cpu_ >= 0) std::cout << " on CPU " << cpu_;
+        std::cout << "\n";
     }
 }
 
@@ -50,40 +57,58 @@ void LoadBalancer::stop() {
 }
 
 void LoadBalancer::run() {
+    pinCurrentThread(cpu_, "LB" + std::to_string(lb_id_));
+    std::vector<PacketJob> burst(BURST);
+    load_.start();
     while (running_) {
-        auto job_opt = input_queue_.popWithTimeout(std::chrono::milliseconds(100));
-        
-        if (!job_opt) {
+        load_.idle();
+        const size_t count = input_queue_.popBatch(burst.data(), BURST,
+                                                   std::chrono::milliseconds(100));
+        load_.busy();
+        if (count == 0) {
             continue;
         }
         
-        packets_received_++;
+        // The end marker is the last job ever pushed.
+        const bool ended = burst[count - 1].end_of_stream;
+        const size_t packets = ended ? count - 1 : count;
+        packets_received_ += packets;
         
         if (num_fps_ == 0) {
+            if (ended) return;
             continue;
         }
 
-        int fp_index = selectFP(job_opt->tuple);
-
-        if (fp_index < 0 || fp_index >= static_cast<int>(fp_queues_.size()) || !fp_queues_[fp_index]) {
-            continue;
+        for (size_t i = 0; i < packets; i++) {
+            const int fp_index = static_cast<int>(rebalancer_.route(burst[i].flow_hash));
+            if (!fp_queues_[fp_index]) {
+                continue;
+            }
+            staged_[fp_index].push_back(std::move(burst[i]));
         }
 
-        fp_queues_[fp_index]->push(std::move(*job_opt));
-
-        packets_dispatched_++;
-        per_fp_counts_[fp_index]++;
-    }
-}
-
-int LoadBalancer::selectFP(const FiveTuple& tuple) {
-    if (num_fps_ == 0) {
-        return 0;
+        // One publish per FP per burst rather than one per packet.
+        for (int fp_index = 0; fp_index < num_fps_; fp_index++) {
+            auto& jobs = staged_[fp_index];
+            if (jobs.empty()) {
+                continue;
+            }
+            fp_queues_[fp_index]->pushBatch(jobs.data(), jobs.size());
+            packets_dispatched_ += jobs.size();
+            per_fp_counts_[fp_index] += jobs.size();
+            jobs.clear();
+        }
+        if (ended) {
+            for (auto* queue : fp_queues_) {
+                if (!queue) continue;
+                PacketJob end;
+                end.end_of_stream = true;
+                queue->push(std::move(end));
+            }
+            return;
+        }
+        rebalancer_.rebalance();
     }
-
-    FiveTupleHash hasher;
-    size_t hash = hasher(tuple);
-    return static_cast<int>(hash % num_fps_);
 }
 
 LoadBalancer::LBStats LoadBalancer::getStats() const {
@@ -93,17 +118,23 @@ LoadBalancer::LBStats LoadBalancer::getStats() const {
     
     stats.per_fp_packets = per_fp_counts_;
     
+    stats.reader_batches = input_queue_.pushBatchSizes();
+    stats.input_batches = input_queue_.popBatchSizes();
+    stats.migrations = rebalancer_.migrations();
+    stats.load = load_.snapshot();
+    stats.load.parks = input_queue_.consumerParks();
+    
     return stats;
 }
 
 LBManager::LBManager(int num_lbs, int fps_per_lb,
-                     std::vector<ThreadSafeQueue<PacketJob>*> fp_queues,
+                     std::vector<SpscQueue<PacketJob>*> fp_queues,
                      bool silent)
     : fps_per_lb_(fps_per_lb),
       silent_(silent) {
     
     for (int lb_id = 0; lb_id < num_lbs; lb_id++) {
-        std::vector<ThreadSafeQueue<PacketJob>*> lb_fp_queues;
+        std::vector<SpscQueue<PacketJob>*> lb_fp_queues;
         int fp_start = lb_id * fps_per_lb;
         
         for (int i = 0; i < fps_per_lb; i++) {
@@ -147,18 +178,24 @@ void LBManager::stopAll() {
 
 LoadBalancer& LBManager::getLBForPacket(const FiveTuple& tuple) {
     FiveTupleHash hasher;
-    size_t hash = hasher(tuple);
+    return getLBForHash(hasher(tuple));
+}
+
+LoadBalancer& LBManager::getLBForHash(size_t hash) {
     int lb_index = hash % lbs_.size();
     return *lbs_[lb_index];
 }
 
 LBManager::AggregatedStats LBManager::getAggregatedStats() const {
-    AggregatedStats stats = {0, 0};
+    AggregatedStats stats{};
     
     for (const auto& lb : lbs_) {
         auto lb_stats = lb->getStats();
         stats.total_received += lb_stats.packets_received;
         stats.total_dispatched += lb_stats.packets_dispatched;
+        stats.total_migrations += lb_stats.migrations;
+        stats.reader_batches.merge(lb_stats.reader_batches);
+        stats.input_batches.merge(lb_stats.input_batches);
     }
     
     return stats;
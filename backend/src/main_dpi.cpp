@@ -1,9 +1,12 @@
+#include <csignal>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 #include <string>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
 #include "dpi_engine.h"
 
 using namespace DPI;
@@ -16,18 +19,40 @@ void printUsage(const char* program) {
 ╚══════════════════════════════════════════════════════════════╝
 
 Usage: )" << program << R"( <input.pcap> <output.pcap> [options]
+       )" << program << R"( --live <interface> <output.pcap> [options]
 
 Arguments:
-  input.pcap     Input PCAP file (captured user traffic)
+  input.pcap     Input capture, pcap or pcapng (captured user traffic)
+  interface      Network interface to capture from (Linux, needs CAP_NET_RAW)
   output.pcap    Output PCAP file (filtered traffic to internet)
 
 Options:
-  --block-ip <ip>        Block packets from source IP
+  --block-ip <ip>        Block packets from source IP (IPv4 or IPv6)
   --block-app <app>      Block application (e.g., YouTube, Facebook)
   --block-domain <dom>   Block domain (supports wildcards: *.facebook.com)
   --rules <file>         Load blocking rules from file
   --lbs <n>              Number of load balancer threads (default: 2)
   --fps <n>              FP threads per LB (default: 2)
+  --readers <n>          Read a classic pcap with n threads, one per byte range
+  --parse-workers <n>    Decode a single reader's records on n worker threads
+  --two-tier             Route a single reader's packets through the LB threads
+                         instead of straight to the FPs
+  --no-rebalance         Keep every flow on the FP its hash first picked, instead
+                         of moving flows off FPs that get more than their share
+  --no-mmap              Read the input with stream I/O instead of mapping it
+  --direct-io            Like --no-mmap, with O_DIRECT reads bypassing the page cache
+  --ordered              Write forwarded packets in input order
+  --forward-ranges       Copy forwarded records straight from the input (implies --ordered)
+  --cpus-reader <list>   Pin the reader threads to these CPUs (e.g. 0-3,8)
+  --cpus-workers <list>  Pin the parse workers to these CPUs
+  --cpus-lb <list>       Pin the LB threads to these CPUs
+  --cpus-fp <list>       Pin the FP threads to these CPUs
+  --cpus-output <list>   Pin the output thread to this CPU
+  --pin-auto             Pin every thread, keeping each LB and its FPs on one NUMA node
+  --wait <policy>        How LB, FP and output threads wait for work: adaptive
+                         (spin, yield, then sleep; default), busy-poll, or park
+  --duration <s>         Live: stop after this many seconds (default: Ctrl-C)
+  --count <n>            Live: stop after this many packets
   --verbose              Enable verbose output
 
 Examples:
@@ -35,6 +60,7 @@ Examples:
   )" << program << R"( capture.pcap filtered.pcap --block-app YouTube
   )" << program << R"( capture.pcap filtered.pcap --block-ip 192.168.1.50 --block-domain *.tiktok.com
   )" << program << R"( capture.pcap filtered.pcap --rules blocking_rules.txt
+  )" << program << R"( --live eth1 filtered.pcap --duration 60 --block-app TikTok
 
 Supported Apps for Blocking:
   Google, YouTube, Facebook, Instagram, Twitter/X, Netflix, Amazon,
@@ -50,7 +76,7 @@ Architecture:
   │ Load Balancer │  2 LB threads distribute to FPs
   │   LB0 │ LB1   │
   └──┬────┴────┬──┘
-     │         │  hash(5-tuple) % fps_per_lb
+     │         │  indirection table on hash(5-tuple)
      ▼         ▼
   ┌──┴──┐   ┌──┴──┐
   │FP0-1│   │FP2-3│  4 FP threads: DPI, classification, blocking
@@ -61,6 +87,9 @@ Architecture:
   │ Output Writer │  Writes forwarded packets to output
   └───────────────┘
 
+  With a single reader (the default) the LB tier is skipped: the reader
+  steers each packet straight to its FP through one table over all FPs.
+
 )";
 }
 
@@ -109,14 +138,61 @@ static bool parseThreadCount(const std::string& flag, const char* value, int& ou
     }
 }
 
+static bool parseLimit(const std::string& flag, const char* value, uint64_t& out) {
+    const std::string text(value);
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+        std::cerr << flag << ": not a number: " << text << "\n";
+        return false;
+    }
+    try {
+        out = std::stoull(text);
+        return true;
+    } catch (const std::out_of_range&) {
+        std::cerr << flag << ": value out of range: " << value << "\n";
+        return false;
+    }
+}
+
+static bool parseCpus(const std::string& flag, const char* value, std::vector<int>& out) {
+    const auto cpus = parseCpuList(value);
+    if (!cpus) {
+        std::cerr << flag << ": not a CPU list: " << value << "\n";
+        return false;
+    }
+    out = *cpus;
+    return true;
+}
+
+static DPIEngine* live_engine = nullptr;
+
+static void stopLiveCapture(int) {
+    if (live_engine) {
+        live_engine->stopLive();
+    }
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 3) {
         printUsage(argv[0]);
         return 1;
     }
     
-    std::string input_file = argv[1];
-    std::string output_file = argv[2];
+    std::string input_file;
+    std::string live_interface;
+    std::string output_file;
+    int first_option = 3;
+    if (std::string(argv[1]) == "--live") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        live_interface = argv[2];
+        output_file = argv[3];
+        first_option = 4;
+    } else {
+        input_file = argv[1];
+        output_file = argv[2];
+    }
     
     DPIEngine::Config config;
     config.num_load_balancers = 2;
@@ -128,7 +204,7 @@ int main(int argc, char* argv[]) {
     std::string rules_file;
     bool json_mode = false;
     
-    for (int i = 3; i < argc; i++) {
+    for (int i = first_option; i < argc; i++) {
         std::string arg = argv[i];
         
         if (arg == "--block-ip" && i + 1 < argc) {
@@ -143,6 +219,48 @@ int main(int argc, char* argv[]) {
             if (!parseThreadCount(arg, argv[++i], config.num_load_balancers)) return 2;
         } else if (arg == "--fps" && i + 1 < argc) {
             if (!parseThreadCount(arg, argv[++i], config.fps_per_lb)) return 2;
+        } else if (arg == "--readers" && i + 1 < argc) {
+            if (!parseThreadCount(arg, argv[++i], config.num_readers)) return 2;
+        } else if (arg == "--parse-workers" && i + 1 < argc) {
+            if (!parseThreadCount(arg, argv[++i], config.parse_workers)) return 2;
+        } else if (arg == "--two-tier") {
+            config.direct_dispatch = false;
+        } else if (arg == "--no-rebalance") {
+            config.rebalance = false;
+        } else if (arg == "--no-mmap") {
+            config.mmap_input = false;
+        } else if (arg == "--direct-io") {
+            config.mmap_input = false;
+            config.direct_io = true;
+        } else if (arg == "--ordered") {
+            config.preserve_order = true;
+        } else if (arg == "--forward-ranges") {
+            config.forward_by_range = true;
+        } else if (arg == "--cpus-reader" && i + 1 < argc) {
+            if (!parseCpus(arg, argv[++i], config.placement.reader)) return 2;
+        } else if (arg == "--cpus-workers" && i + 1 < argc) {
+            if (!parseCpus(arg, argv[++i], config.placement.parse_workers)) return 2;
+        } else if (arg == "--cpus-lb" && i + 1 < argc) {
+            if (!parseCpus(arg, argv[++i], config.placement.lbs)) return 2;
+        } else if (arg == "--cpus-fp" && i + 1 < argc) {
+            if (!parseCpus(arg, argv[++i], config.placement.fps)) return 2;
+        } else if (arg == "--cpus-output" && i + 1 < argc) {
+            if (!parseCpus(arg, argv[++i], config.placement.output)) return 2;
+        } else if (arg == "--pin-auto") {
+            config.auto_placement = true;
+        } else if (arg == "--wait" && i + 1 < argc) {
+            const auto policy = parseWaitPolicy(argv[++i]);
+            if (!policy) {
+                std::cerr << arg << ": expected adaptive, busy-poll or park: " << argv[i] << "\n";
+                return 2;
+            }
+            config.wait_policy = *policy;
+        } else if (arg == "--duration" && i + 1 < argc) {
+            uint64_t seconds = 0;
+            if (!parseLimit(arg, argv[++i], seconds)) return 2;
+            config.live_duration_seconds = static_cast<uint32_t>(std::min<uint64_t>(seconds, UINT32_MAX));
+        } else if (arg == "--count" && i + 1 < argc) {
+            if (!parseLimit(arg, argv[++i], config.live_packet_limit)) return 2;
         } else if (arg == "--verbose") {
             config.verbose = true;
         } else if (arg == "--json") {
@@ -178,7 +296,15 @@ DPIEngine engine(config);
         engine.blockDomain(domain);
     }
     
-    if (!engine.processFile(input_file, output_file)) {
+    if (!live_interface.empty()) {
+        live_engine = &engine;
+        std::signal(SIGINT, stopLiveCapture);
+        std::signal(SIGTERM, stopLiveCapture);
+        if (!engine.processLive(live_interface, output_file)) {
+            std::cerr << "Failed to capture from " << live_interface << "\n";
+            return 1;
+        }
+    } else if (!engine.processFile(input_file, output_file)) {
         std::cerr << "Failed to process file\n";
         return 1;
     }
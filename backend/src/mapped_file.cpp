@@ -0,0 +1,54 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PacketAnalyzer {
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                        MAP_PRIVATE, fd, 0);
+    // The mapping holds its own reference to the file.
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    // The reader walks the file front to back exactly once: ask for aggressive
+    // read-ahead and early reclaim of pages behind the cursor. MADV_WILLNEED is
+    // deliberately not used -- on a multi-GB capture it would queue I/O for the
+    // whole file and evict the pages the FPs are still reading.
+    ::madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+    data_ = static_cast<const uint8_t*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) {
+        ::munmap(const_cast<uint8_t*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+}
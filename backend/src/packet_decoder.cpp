@@ -0,0 +1,458 @@
+#include "packet_decoder.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DPI_DECODER_SSE2 1
+#endif
+
+namespace DPI {
+
+namespace {
+
+constexpr uint16_t ETHERTYPE_IPV4 = 0x0800;
+constexpr uint16_t ETHERTYPE_IPV6 = 0x86DD;
+constexpr uint16_t ETHERTYPE_VLAN = 0x8100;
+constexpr uint16_t ETHERTYPE_QINQ = 0x88A8;
+constexpr uint16_t ETHERTYPE_MPLS = 0x8847;
+constexpr uint16_t ETHERTYPE_MPLS_MULTICAST = 0x8848;
+// GRE and Geneve's name for "an Ethernet frame follows".
+constexpr uint16_t ETHERTYPE_TEB = 0x6558;
+// Bare IP: the version nibble decides.
+constexpr uint16_t ETHERTYPE_FROM_VERSION = 0;
+
+constexpr int MAX_VLAN_TAGS = 2;
+constexpr int MAX_MPLS_LABELS = 8;
+constexpr int MAX_IPV6_EXTENSIONS = 8;
+// Tunnels inside tunnels are followed this deep; anything nested further is
+// left as the tunnel's own traffic.
+constexpr int MAX_ENCAPSULATION = 3;
+
+constexpr uint16_t UDP_PORT_VXLAN = 4789;
+constexpr uint16_t UDP_PORT_GENEVE = 6081;
+
+constexpr uint8_t IPPROTO_HOPOPTS_ = 0;
+constexpr uint8_t IPPROTO_TCP_ = 6;
+constexpr uint8_t IPPROTO_UDP_ = 17;
+constexpr uint8_t IPPROTO_ROUTING_ = 43;
+constexpr uint8_t IPPROTO_FRAGMENT_ = 44;
+constexpr uint8_t IPPROTO_GRE_ = 47;
+constexpr uint8_t IPPROTO_AH_ = 51;
+constexpr uint8_t IPPROTO_DSTOPTS_ = 60;
+
+// BSD address families seen in DLT_NULL / DLT_LOOP headers. IPv6 has a
+// different value on every BSD.
+constexpr uint32_t AF_INET_ = 2;
+constexpr uint32_t AF_INET6_LINUX_NETBSD = 24;
+constexpr uint32_t AF_INET6_FREEBSD = 28;
+constexpr uint32_t AF_INET6_DARWIN = 30;
+
+// How far ahead of the frame being decoded decodeBatch() prefetches.
+constexpr size_t PREFETCH_AHEAD = 4;
+
+inline void prefetchFrame(const uint8_t* p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+    __builtin_prefetch(p + 64);
+#else
+    (void)p;
+#endif
+}
+
+inline uint16_t load16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint32_t load32(const uint8_t* p) {
+    return (static_cast<uint32_t>(load16(p)) << 16) | load16(p + 2);
+}
+
+// An Ethernet header at `offset` plus up to two 802.1Q/802.1ad tags.
+PacketDecoder::Result ethernetHeader(const uint8_t* frame, size_t end, size_t& offset,
+                                     uint16_t& ether_type) {
+    if (end < offset || end - offset < 14) return PacketDecoder::Result::MALFORMED;
+    ether_type = load16(frame + offset + 12);
+    offset += 14;
+    for (int tags = 0; tags < MAX_VLAN_TAGS &&
+         (ether_type == ETHERTYPE_VLAN || ether_type == ETHERTYPE_QINQ); tags++) {
+        if (end - offset < 4) return PacketDecoder::Result::MALFORMED;
+        ether_type = load16(frame + offset + 2);
+        offset += 4;
+    }
+    return PacketDecoder::Result::OK;
+}
+
+// Pops an MPLS label stack down to the bottom-of-stack label. MPLS does not
+// say what it carries; IP is assumed and the version nibble decides, which
+// leaves pseudowires (Ethernet over MPLS) undecoded.
+PacketDecoder::Result mplsStack(const uint8_t* frame, size_t end, size_t& offset,
+                                uint16_t& ether_type) {
+    for (int labels = 0; labels < MAX_MPLS_LABELS; labels++) {
+        if (end - offset < 4) return PacketDecoder::Result::MALFORMED;
+        const bool bottom = frame[offset + 2] & 0x01;
+        offset += 4;
+        if (bottom) {
+            ether_type = ETHERTYPE_FROM_VERSION;
+            return PacketDecoder::Result::OK;
+        }
+    }
+    return PacketDecoder::Result::NOT_IP;
+}
+
+// What a GRE header at `offset` (ending by `end`) carries. Only version 0
+// GRE is followed; PPTP's enhanced GRE carries PPP.
+bool greTunnel(const uint8_t* frame, size_t end, size_t& offset, uint16_t& ether_type) {
+    if (end - offset < 4) return false;
+    const uint16_t flags = load16(frame + offset);
+    if ((flags & 0x0007) != 0) return false;
+    size_t header_len = 4;
+    if (flags & 0x8000) header_len += 4;   // checksum + reserved
+    if (flags & 0x2000) header_len += 4;   // key
+    if (flags & 0x1000) header_len += 4;   // sequence number
+    if (end - offset < header_len) return false;
+    ether_type = load16(frame + offset + 2);
+    offset += header_len;
+    return true;
+}
+
+// What a VXLAN or Geneve header at `offset`, right after the UDP header,
+// carries.
+bool udpTunnel(const uint8_t* frame, size_t end, uint16_t dst_port, size_t& offset,
+               uint16_t& ether_type) {
+    if (end - offset < 8) return false;
+    if (dst_port == UDP_PORT_VXLAN) {
+        if (!(frame[offset] & 0x08)) return false;   // the VNI-valid flag
+        ether_type = ETHERTYPE_TEB;
+        offset += 8;
+        return true;
+    }
+    if (dst_port == UDP_PORT_GENEVE) {
+        if ((frame[offset] >> 6) != 0) return false;  // version 0
+        const size_t header_len = 8 + (frame[offset] & 0x3F) * 4u;
+        if (end - offset < header_len) return false;
+        ether_type = load16(frame + offset + 2);
+        offset += header_len;
+        return true;
+    }
+    return false;
+}
+
+// Fills in what FragmentReassembler needs from a fragment: the datagram it
+// belongs to and where its data goes. Ports are zero, so the fragments of a
+// datagram all hash alike whichever one carries the transport header, until
+// FragmentSteering gives them their flow's hash.
+PacketDecoder::Result fragmentOf(uint8_t protocol, uint32_t id, uint32_t fragment_offset,
+                                 bool more, size_t data_offset, size_t ip_end, PacketJob& job) {
+    job.is_fragmented = true;
+    job.fragment_id = id;
+    job.fragment_offset = fragment_offset;
+    job.more_fragments = more;
+    job.tuple.src_port = 0;
+    job.tuple.dst_port = 0;
+    job.tuple.protocol = protocol;
+    job.transport_offset = data_offset;
+    job.payload_offset = data_offset;
+    job.payload_length = ip_end - data_offset;
+    return PacketDecoder::Result::FRAGMENT;
+}
+
+// Skips the link layer: `offset` ends on the network header, `ether_type`
+// says what it is.
+PacketDecoder::Result linkLayer(const uint8_t* frame, size_t len, uint32_t link_type,
+                                size_t& offset, uint16_t& ether_type) {
+    using Result = PacketDecoder::Result;
+    switch (link_type) {
+        case LinkType::ETHERNET:
+            offset = 0;
+            return ethernetHeader(frame, len, offset, ether_type);
+        case LinkType::LINUX_SLL:
+            if (len < 16) return Result::MALFORMED;
+            ether_type = load16(frame + 14);
+            offset = 16;
+            return Result::OK;
+        case LinkType::LINUX_SLL2:
+            if (len < 20) return Result::MALFORMED;
+            ether_type = load16(frame);
+            offset = 20;
+            return Result::OK;
+        case LinkType::NULL_LOOPBACK:
+        case LinkType::LOOP: {
+            if (len < 4) return Result::MALFORMED;
+            uint32_t family;
+            std::memcpy(&family, frame, sizeof(family));
+            if (link_type == LinkType::LOOP || family > 0xFFFF) {
+                // DLT_LOOP is big-endian; DLT_NULL from the other byte order
+                // shows up as a huge value.
+                family = (family >> 24) | ((family >> 8) & 0xFF00) |
+                         ((family << 8) & 0xFF0000) | (family << 24);
+            }
+            offset = 4;
+            if (family == AF_INET_) {
+                ether_type = ETHERTYPE_IPV4;
+            } else if (family == AF_INET6_LINUX_NETBSD || family == AF_INET6_FREEBSD ||
+                       family == AF_INET6_DARWIN) {
+                ether_type = ETHERTYPE_IPV6;
+            } else {
+                return Result::NOT_IP;
+            }
+            return Result::OK;
+        }
+        case LinkType::RAW:
+        case LinkType::RAW_OPENBSD:
+        case LinkType::RAW_BSDOS:
+            offset = 0;
+            ether_type = ETHERTYPE_FROM_VERSION;
+            return Result::OK;
+        default:
+            return Result::UNSUPPORTED_LINK;
+    }
+}
+
+// Bytes 12..27 of an Ethernet frame: ethertype, version/IHL, the fragment
+// field and the protocol are fixed for the common shape, the rest is free.
+//   index:  0-1 ethertype, 2 version/IHL, 8-9 flags/fragment offset,
+//           11 protocol
+constexpr size_t FAST_WINDOW = 12;
+constexpr uint8_t FAST_MASK[16] = {0xFF, 0xFF, 0xFF, 0, 0, 0, 0, 0,
+                                   0x3F, 0xFF, 0, 0xFF, 0, 0, 0, 0};
+constexpr uint8_t FAST_TCP[16] = {0x08, 0x00, 0x45, 0, 0, 0, 0, 0,
+                                  0, 0, 0, IPPROTO_TCP_, 0, 0, 0, 0};
+constexpr uint8_t FAST_UDP[16] = {0x08, 0x00, 0x45, 0, 0, 0, 0, 0,
+                                  0, 0, 0, IPPROTO_UDP_, 0, 0, 0, 0};
+
+// Whether an Ethernet frame is untagged IPv4 with no options, unfragmented,
+// carrying TCP or UDP. Needs at least 28 bytes.
+inline bool isCommonShape(const uint8_t* frame) {
+#ifdef DPI_DECODER_SSE2
+    const __m128i window = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + FAST_WINDOW));
+    const __m128i masked = _mm_and_si128(
+        window, _mm_loadu_si128(reinterpret_cast<const __m128i*>(FAST_MASK)));
+    const __m128i tcp = _mm_cmpeq_epi8(
+        masked, _mm_loadu_si128(reinterpret_cast<const __m128i*>(FAST_TCP)));
+    const __m128i udp = _mm_cmpeq_epi8(
+        masked, _mm_loadu_si128(reinterpret_cast<const __m128i*>(FAST_UDP)));
+    return _mm_movemask_epi8(tcp) == 0xFFFF || _mm_movemask_epi8(udp) == 0xFFFF;
+#else
+    const uint8_t* w = frame + FAST_WINDOW;
+    return w[0] == 0x08 && w[1] == 0x00 && w[2] == 0x45 && (w[8] & 0x3F) == 0 &&
+           w[9] == 0 && (w[11] == IPPROTO_TCP_ || w[11] == IPPROTO_UDP_);
+#endif
+}
+
+// decode() for a frame isCommonShape() accepted. Returns false without
+// touching `job` when the lengths don't hold up; decode() then has the final
+// say.
+inline bool decodeCommonShape(const uint8_t* frame, size_t len, PacketJob& job) {
+    constexpr size_t IP = 14, L4 = 34;
+    const size_t total_len = load16(frame + IP + 2);
+    size_t ip_end = len;
+    if (total_len != 0) {
+        if (total_len < 20) return false;
+        ip_end = std::min(len, IP + total_len);
+    }
+    const uint8_t protocol = frame[IP + 9];
+    size_t payload_offset;
+    if (protocol == IPPROTO_TCP_) {
+        if (ip_end < L4 + 20) return false;
+        const size_t header_len = (frame[L4 + 12] >> 4) * 4u;
+        if (header_len < 20 || ip_end - L4 < header_len) return false;
+        job.tcp_flags = frame[L4 + 13];
+        job.tcp_seq = load32(frame + L4 + 4);
+        payload_offset = L4 + header_len;
+    } else {
+        if (ip_end < L4 + 8) return false;
+        const uint16_t dst_port = load16(frame + L4 + 2);
+        if (dst_port == UDP_PORT_VXLAN || dst_port == UDP_PORT_GENEVE) return false;
+        payload_offset = L4 + 8;
+    }
+    job.eth_offset = 0;
+    job.ip_offset = IP;
+    job.transport_offset = L4;
+    job.payload_offset = payload_offset;
+    job.payload_length = ip_end - payload_offset;
+    job.tuple.src_ip = IPAddress::fromV4Bytes(frame + IP + 12);
+    job.tuple.dst_ip = IPAddress::fromV4Bytes(frame + IP + 16);
+    job.tuple.src_port = load16(frame + L4);
+    job.tuple.dst_port = load16(frame + L4 + 2);
+    job.tuple.protocol = protocol;
+    return true;
+}
+
+}
+
+bool PacketDecoder::isSupportedLinkType(uint32_t link_type) {
+    switch (link_type) {
+        case LinkType::NULL_LOOPBACK:
+        case LinkType::ETHERNET:
+        case LinkType::RAW_OPENBSD:
+        case LinkType::RAW_BSDOS:
+        case LinkType::RAW:
+        case LinkType::LOOP:
+        case LinkType::LINUX_SLL:
+        case LinkType::LINUX_SLL2:
+            return true;
+        default:
+            return false;
+    }
+}
+
+PacketDecoder::Result PacketDecoder::decode(const uint8_t* frame, size_t len,
+                                            uint32_t link_type, PacketJob& job) {
+    if (!frame || len == 0) return Result::MALFORMED;
+
+    size_t offset = 0;
+    uint16_t ether_type = 0;
+    Result link = linkLayer(frame, len, link_type, offset, ether_type);
+    if (link != Result::OK) {
+        job.is_malformed = link == Result::MALFORMED;
+        return link;
+    }
+    job.eth_offset = 0;
+
+    // Each pass decodes one network and transport header; a tunnel sends
+    // the loop round again on what it carries, bounded by the outer packet.
+    size_t end = len;
+    for (int depth = 0;; depth++) {
+        if (ether_type == ETHERTYPE_TEB) {
+            job.eth_offset = offset;
+            if (ethernetHeader(frame, end, offset, ether_type) != Result::OK) goto malformed;
+        }
+        if (ether_type == ETHERTYPE_MPLS || ether_type == ETHERTYPE_MPLS_MULTICAST) {
+            Result mpls = mplsStack(frame, end, offset, ether_type);
+            if (mpls == Result::MALFORMED) goto malformed;
+            if (mpls != Result::OK) return mpls;
+        }
+        if (ether_type == ETHERTYPE_FROM_VERSION) {
+            const uint8_t version = offset < end ? frame[offset] >> 4 : 0;
+            ether_type = version == 4 ? ETHERTYPE_IPV4 : version == 6 ? ETHERTYPE_IPV6 : 0xFFFF;
+        }
+
+        job.ip_offset = offset;
+        const uint8_t* ip = frame + offset;
+        size_t ip_end = end;
+        uint8_t protocol;
+
+        if (ether_type == ETHERTYPE_IPV4) {
+            if (end - offset < 20 || (ip[0] >> 4) != 4) goto malformed;
+            const size_t header_len = (ip[0] & 0x0F) * 4u;
+            const size_t total_len = load16(ip + 2);
+            if (header_len < 20 || end - offset < header_len) goto malformed;
+            // 0 is what TSO-offloaded captures carry; trust the frame then.
+            if (total_len != 0) {
+                if (total_len < header_len) goto malformed;
+                ip_end = std::min(end, offset + total_len);
+            }
+            protocol = ip[9];
+            job.tuple.src_ip = IPAddress::fromV4Bytes(ip + 12);
+            job.tuple.dst_ip = IPAddress::fromV4Bytes(ip + 16);
+            offset += header_len;
+            const uint16_t fragment = load16(ip + 6);
+            if ((fragment & 0x3FFF) != 0) {
+                return fragmentOf(protocol, load16(ip + 4), (fragment & 0x1FFF) * 8u,
+                                  fragment & 0x2000, offset, ip_end, job);
+            }
+        } else if (ether_type == ETHERTYPE_IPV6) {
+            if (end - offset < 40 || (ip[0] >> 4) != 6) goto malformed;
+            const size_t payload_len = load16(ip + 4);
+            if (payload_len != 0) {
+                ip_end = std::min(end, offset + 40 + payload_len);
+            }
+            protocol = ip[6];
+            job.tuple.src_ip = IPAddress::fromV6Bytes(ip + 8);
+            job.tuple.dst_ip = IPAddress::fromV6Bytes(ip + 24);
+            offset += 40;
+            for (int i = 0; i < MAX_IPV6_EXTENSIONS; i++) {
+                if (protocol == IPPROTO_FRAGMENT_) {
+                    if (ip_end - offset < 8) goto malformed;
+                    const uint16_t fragment = load16(frame + offset + 2);
+                    return fragmentOf(frame[offset], load32(frame + offset + 4), fragment & 0xFFF8,
+                                      fragment & 0x0001, offset + 8, ip_end, job);
+                }
+                if (protocol != IPPROTO_HOPOPTS_ && protocol != IPPROTO_ROUTING_ &&
+                    protocol != IPPROTO_DSTOPTS_ && protocol != IPPROTO_AH_) {
+                    break;
+                }
+                if (ip_end - offset < 2) goto malformed;
+                const size_t ext_len = protocol == IPPROTO_AH_
+                    ? (frame[offset + 1] + 2u) * 4u
+                    : (frame[offset + 1] + 1u) * 8u;
+                if (ip_end - offset < ext_len) goto malformed;
+                protocol = frame[offset];
+                offset += ext_len;
+            }
+        } else {
+            return Result::NOT_IP;
+        }
+
+        job.transport_offset = offset;
+        if (ip_end < offset) goto malformed;
+        if (protocol == IPPROTO_GRE_ && depth < MAX_ENCAPSULATION &&
+            greTunnel(frame, ip_end, offset, ether_type)) {
+            end = ip_end;
+            continue;
+        }
+        if (protocol == IPPROTO_TCP_) {
+            if (ip_end - offset < 20) goto malformed;
+            const size_t header_len = (frame[offset + 12] >> 4) * 4u;
+            if (header_len < 20 || ip_end - offset < header_len) goto malformed;
+            job.tcp_flags = frame[offset + 13];
+            job.tcp_seq = load32(frame + offset + 4);
+            job.payload_offset = offset + header_len;
+        } else if (protocol == IPPROTO_UDP_) {
+            if (ip_end - offset < 8) goto malformed;
+            job.payload_offset = offset + 8;
+            size_t inner = job.payload_offset;
+            if (depth < MAX_ENCAPSULATION &&
+                udpTunnel(frame, ip_end, load16(frame + offset + 2), inner, ether_type)) {
+                offset = inner;
+                end = ip_end;
+                continue;
+            }
+        } else {
+            return Result::NOT_TCP_UDP;
+        }
+
+        job.tuple.src_port = load16(frame + offset);
+        job.tuple.dst_port = load16(frame + offset + 2);
+        job.tuple.protocol = protocol;
+        job.payload_length = ip_end - job.payload_offset;
+        return Result::OK;
+    }
+
+malformed:
+    job.is_malformed = true;
+    return Result::MALFORMED;
+}
+
+void PacketDecoder::decodeBatch(const Frame* frames, size_t count, uint32_t link_type,
+                                PacketJob* jobs, Result* results) {
+    for (size_t i = 0; i < std::min(count, PREFETCH_AHEAD); i++) {
+        prefetchFrame(frames[i].data);
+    }
+
+    const bool ethernet = link_type == LinkType::ETHERNET;
+    for (size_t i = 0; i < count; i++) {
+        if (i + PREFETCH_AHEAD < count) {
+            prefetchFrame(frames[i + PREFETCH_AHEAD].data);
+        }
+        const uint8_t* frame = frames[i].data;
+        const size_t len = frames[i].length;
+        if (ethernet && frame && len >= FAST_WINDOW + 16 && isCommonShape(frame) &&
+            decodeCommonShape(frame, len, jobs[i])) {
+            results[i] = Result::OK;
+        } else {
+            results[i] = decode(frame, len, link_type, jobs[i]);
+        }
+    }
+
+    // A separate pass, so the hashes of neighbouring jobs overlap in the
+    // pipeline instead of each waiting on its own decode.
+    const FiveTupleHash hasher;
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].flow_hash = results[i] == Result::OK || results[i] == Result::FRAGMENT
+            ? hasher(jobs[i].tuple) : 0;
+    }
+}
+
+}
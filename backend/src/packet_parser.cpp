@@ -16,7 +16,15 @@ static inline bool boundsCheck(size_t offset, size_t required, size_t total) {
     return offset <= total && required <= total - offset;
 }
 
+// First octet in the low byte, whatever the host byte order.
+static inline uint32_t packIPv4(const uint8_t* addr) {
+    return static_cast<uint32_t>(addr[0]) | (static_cast<uint32_t>(addr[1]) << 8) |
+           (static_cast<uint32_t>(addr[2]) << 16) | (static_cast<uint32_t>(addr[3]) << 24);
+}
+
 bool PacketParser::parse(const RawPacket& raw, ParsedPacket& parsed) {
+    // Assigning a fresh ParsedPacket is a fixed-size clear: no member owns
+    // memory, so a reused object never allocates.
     parsed = ParsedPacket{};
     parsed.timestamp_sec = raw.header.ts_sec;
     parsed.timestamp_usec = raw.header.ts_usec;
@@ -28,24 +36,25 @@ bool PacketParser::parse(const RawPacket& raw, ParsedPacket& parsed) {
     size_t offset = 0;
 
     if (!parseEthernet(data, len, parsed, offset)) {
-        parsed.is_malformed = true;
+        parsed.layers |= Layer::MALFORMED;
         return false;
     }
 
     if (parsed.ether_type == EtherType::IPv4) {
         if (!parseIPv4(data, len, parsed, offset)) {
-            parsed.is_malformed = true;
+            parsed.layers |= Layer::MALFORMED;
             return false;
         }
     } else if (parsed.ether_type == EtherType::IPv6) {
         if (!parseIPv6(data, len, parsed, offset)) {
-            parsed.is_malformed = true;
+            parsed.layers |= Layer::MALFORMED;
             return false;
         }
     }
 
-    if (parsed.is_fragmented) {
+    if (parsed.isFragmented()) {
         if (offset < len) {
+            parsed.payload_offset = static_cast<uint16_t>(offset);
             parsed.payload_length = len - offset;
             parsed.payload_data = data + offset;
         }
@@ -54,17 +63,18 @@ bool PacketParser::parse(const RawPacket& raw, ParsedPacket& parsed) {
 
     if (parsed.protocol == Protocol::TCP) {
         if (!parseTCP(data, len, parsed, offset)) {
-            parsed.is_malformed = true;
+            parsed.layers |= Layer::MALFORMED;
             return false;
         }
     } else if (parsed.protocol == Protocol::UDP) {
         if (!parseUDP(data, len, parsed, offset)) {
-            parsed.is_malformed = true;
+            parsed.layers |= Layer::MALFORMED;
             return false;
         }
     }
 
     if (offset < len) {
+        parsed.payload_offset = static_cast<uint16_t>(offset);
         parsed.payload_length = len - offset;
         parsed.payload_data = data + offset;
     }
@@ -77,12 +87,13 @@ bool PacketParser::parseEthernet(const uint8_t* data, size_t len,
     constexpr size_t ETH_LEN = 14;
     if (!boundsCheck(offset, ETH_LEN, len)) return false;
 
-    parsed.dest_mac = macToString(data + offset);
-    parsed.src_mac  = macToString(data + offset + 6);
+    std::memcpy(parsed.dest_mac.data(), data + offset, 6);
+    std::memcpy(parsed.src_mac.data(), data + offset + 6, 6);
 
     uint16_t type;
     std::memcpy(&type, data + offset + 12, sizeof(uint16_t));
     parsed.ether_type = ntohs(type);
+    parsed.layers |= Layer::ETHERNET;
 
     offset += ETH_LEN;
     return true;
@@ -107,20 +118,16 @@ bool PacketParser::parseIPv4(const uint8_t* data, size_t len,
     flags_frag = ntohs(flags_frag);
     bool mf = flags_frag & 0x2000;
     bool has_offset = (flags_frag & 0x1FFF) != 0;
-    if (mf || has_offset) parsed.is_fragmented = true;
+    if (mf || has_offset) parsed.layers |= Layer::FRAGMENT;
 
-    parsed.has_ip = true;
-    parsed.has_ipv4 = true;
+    parsed.layers |= Layer::IPV4;
     parsed.ip_version = 4;
+    parsed.ip_offset = static_cast<uint16_t>(offset);
     parsed.ttl = ip[8];
     parsed.protocol = ip[9];
 
-    uint32_t src, dst;
-    std::memcpy(&src, ip + 12, 4);
-    std::memcpy(&dst, ip + 16, 4);
-
-    parsed.src_ip = ipToString(src);
-    parsed.dest_ip = ipToString(dst);
+    parsed.src_ipv4 = packIPv4(ip + 12);
+    parsed.dest_ipv4 = packIPv4(ip + 16);
 
     offset += header_len;
     return true;
@@ -133,32 +140,16 @@ bool PacketParser::parseIPv6(const uint8_t* data, size_t len,
 
     const uint8_t* ip = data + offset;
 
-    parsed.has_ip = true;
-    parsed.has_ipv6 = true;
+    parsed.layers |= Layer::IPV6;
     parsed.ip_version = 6;
+    parsed.ip_offset = static_cast<uint16_t>(offset);
     parsed.protocol = ip[6];
     parsed.ttl = ip[7];
 
-    std::ostringstream src, dst;
-    for (int i = 0; i < 16; i += 2) {
-        uint16_t part;
-        std::memcpy(&part, ip + 8 + i, 2);
-        part = ntohs(part);
-        src << std::hex << part;
-        if (i < 14) src << ":";
-    }
-    for (int i = 0; i < 16; i += 2) {
-        uint16_t part;
-        std::memcpy(&part, ip + 24 + i, 2);
-        part = ntohs(part);
-        dst << std::hex << part;
-        if (i < 14) dst << ":";
-    }
-
-    parsed.src_ip = src.str();
-    parsed.dest_ip = dst.str();
+    std::memcpy(parsed.src_ipv6.data(), ip + 8, 16);
+    std::memcpy(parsed.dest_ipv6.data(), ip + 24, 16);
 
-    if (parsed.protocol == 44) parsed.is_fragmented = true;
+    if (parsed.protocol == 44) parsed.layers |= Layer::FRAGMENT;
 
     offset += IPV6_LEN;
     return true;
@@ -189,7 +180,8 @@ bool PacketParser::parseTCP(const uint8_t* data, size_t len,
     if (header_len < MIN_LEN || !boundsCheck(offset, header_len, len)) return false;
 
     parsed.tcp_flags = tcp[13];
-    parsed.has_tcp = true;
+    parsed.transport_offset = static_cast<uint16_t>(offset);
+    parsed.layers |= Layer::TCP;
 
     offset += header_len;
     return true;
@@ -208,7 +200,8 @@ bool PacketParser::parseUDP(const uint8_t* data, size_t len,
 
     parsed.src_port = ntohs(sp);
     parsed.dest_port = ntohs(dp);
-    parsed.has_udp = true;
+    parsed.transport_offset = static_cast<uint16_t>(offset);
+    parsed.layers |= Layer::UDP;
 
     offset += UDP_LEN;
     return true;
@@ -233,6 +226,34 @@ std::string PacketParser::ipToString(uint32_t ip) {
     return ss.str();
 }
 
+std::string PacketParser::ipv6ToString(const uint8_t* ip) {
+    std::ostringstream ss;
+    ss << std::hex;
+    for (int i = 0; i < 16; i += 2) {
+        if (i) ss << ":";
+        ss << ((ip[i] << 8) | ip[i + 1]);
+    }
+    return ss.str();
+}
+
+std::string ParsedPacket::srcMacString() const {
+    return PacketParser::macToString(src_mac.data());
+}
+
+std::string ParsedPacket::destMacString() const {
+    return PacketParser::macToString(dest_mac.data());
+}
+
+std::string ParsedPacket::srcIPString() const {
+    if (hasIPv6()) return PacketParser::ipv6ToString(src_ipv6.data());
+    return hasIPv4() ? PacketParser::ipToString(src_ipv4) : std::string();
+}
+
+std::string ParsedPacket::destIPString() const {
+    if (hasIPv6()) return PacketParser::ipv6ToString(dest_ipv6.data());
+    return hasIPv4() ? PacketParser::ipToString(dest_ipv4) : std::string();
+}
+
 std::string PacketParser::protocolToString(uint8_t protocol) {
     switch (protocol) {
         case Protocol::ICMP: return "ICMP";
@@ -0,0 +1,117 @@
+#include "pcap_chunk_reader.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace PacketAnalyzer {
+
+// Records that must follow a candidate, each plausible, before it is taken.
+constexpr int RESYNC_CHAIN = 8;
+// Tolerated backwards step between neighbouring timestamps: captures merged
+// from several interfaces are only roughly sorted.
+constexpr uint32_t TS_BACKWARD_SLACK = 60;
+// Largest forward step between neighbours that still looks like one capture.
+constexpr uint32_t TS_FORWARD_GAP = 24 * 3600;
+// Largest on-the-wire length any capture tool records.
+constexpr uint32_t MAX_ORIG_LEN = 262144;
+
+// Header at `offset` as the reader would see it, if it could be a record:
+// sane lengths and timestamp, and the whole record inside the file.
+static bool plausibleHeader(const PcapReader& file, const uint8_t* data, size_t size,
+                            size_t offset, PcapPacketHeader& header) {
+    if (size - offset < sizeof(PcapPacketHeader)) {
+        return false;
+    }
+    std::memcpy(&header, data + offset, sizeof(PcapPacketHeader));
+    file.normalizeHeader(header);
+    return file.validatePacketHeader(header) &&
+           header.ts_usec < 1000000 &&
+           header.incl_len <= header.orig_len &&
+           header.orig_len <= MAX_ORIG_LEN &&
+           header.incl_len <= size - offset - sizeof(PcapPacketHeader);
+}
+
+static bool followsInTime(uint32_t prev_sec, uint32_t sec) {
+    return static_cast<uint64_t>(sec) + TS_BACKWARD_SLACK >= prev_sec &&
+           static_cast<uint64_t>(sec) <= static_cast<uint64_t>(prev_sec) + TS_FORWARD_GAP;
+}
+
+size_t PcapChunkReader::resync(const PcapReader& file, size_t from) {
+    const uint8_t* data = file.mapping().data();
+    const size_t size = file.mapping().size();
+    const size_t first = sizeof(PcapGlobalHeader);
+    from = std::max(from, first);
+
+    // Nothing in a capture predates its first packet by much.
+    PcapPacketHeader header;
+    uint32_t capture_start = 0;
+    if (plausibleHeader(file, data, size, first, header)) {
+        capture_start = header.ts_sec;
+    }
+
+    for (size_t candidate = from; candidate < size; candidate++) {
+        if (!plausibleHeader(file, data, size, candidate, header) ||
+            static_cast<uint64_t>(header.ts_sec) + TS_BACKWARD_SLACK < capture_start) {
+            continue;
+        }
+        // The file start is a record boundary by definition.
+        if (candidate == first) {
+            return candidate;
+        }
+        size_t offset = candidate;
+        uint32_t prev_sec = header.ts_sec;
+        bool chained = true;
+        for (int i = 0; i < RESYNC_CHAIN; i++) {
+            offset += sizeof(PcapPacketHeader) + header.incl_len;
+            if (offset == size) {
+                break;
+            }
+            if (!plausibleHeader(file, data, size, offset, header) ||
+                !followsInTime(prev_sec, header.ts_sec)) {
+                chained = false;
+                break;
+            }
+            prev_sec = header.ts_sec;
+        }
+        if (chained) {
+            return candidate;
+        }
+    }
+    return size;
+}
+
+PcapChunkReader::PcapChunkReader(const PcapReader& file, size_t begin, size_t end)
+    : file_(file),
+      data_(file.mapping().data()),
+      size_(file.mapping().size()),
+      begin_(std::max(begin, sizeof(PcapGlobalHeader))),
+      end_(std::min(end, size_)) {
+    start_ = begin_ < end_ ? resync(file, begin_) : begin_;
+    pos_ = start_;
+}
+
+// Same validation as PcapReader's mapped path; a failure here means the file
+// is damaged inside the range, not that the resync went wrong.
+bool PcapChunkReader::readNextPacket(RawPacket& packet) {
+    if (failed_ || pos_ >= end_ || size_ - pos_ < sizeof(PcapPacketHeader)) {
+        return false;
+    }
+
+    std::memcpy(&packet.header, data_ + pos_, sizeof(PcapPacketHeader));
+    file_.normalizeHeader(packet.header);
+
+    if (!file_.validatePacketHeader(packet.header) ||
+        packet.header.incl_len > size_ - pos_ - sizeof(PcapPacketHeader)) {
+        std::cerr << "Error: Invalid packet record at offset " << pos_ << std::endl;
+        failed_ = true;
+        return false;
+    }
+
+    pos_ += sizeof(PcapPacketHeader);
+    packet.data.clear();
+    packet.mapped = data_ + pos_;
+    pos_ += packet.header.incl_len;
+    return true;
+}
+
+}
@@ -6,6 +6,9 @@ namespace PacketAnalyzer {
 
 constexpr uint32_t PCAP_MAGIC_NATIVE = 0xa1b2c3d4;  
 constexpr uint32_t PCAP_MAGIC_SWAPPED = 0xd4c3b2a1; 
+// Same layout with ts_usec holding nanoseconds; written by newer tooling.
+constexpr uint32_t PCAP_MAGIC_NSEC_NATIVE = 0xa1b23c4d;
+constexpr uint32_t PCAP_MAGIC_NSEC_SWAPPED = 0x4d3cb2a1;
 
 PcapReader::~PcapReader() {
     close();
@@ -14,25 +17,39 @@ PcapReader::~PcapReader() {
 bool PcapReader::open(const std::string& filename) {
     close();
     
-    file_.open(filename, std::ios::binary);
-    if (!file_.is_open()) {
-        std::cerr << "Error: Could not open file: " << filename << std::endl;
-        return false;
-    }
-    
-    file_.read(reinterpret_cast<char*>(&global_header_), sizeof(PcapGlobalHeader));
-    if (!file_.good()) {
-        std::cerr << "Error: Could not read PCAP global header" << std::endl;
-        close();
-        return false;
+    if (use_mmap_ && map_.open(filename)) {
+        if (map_.size() < sizeof(PcapGlobalHeader)) {
+            std::cerr << "Error: Could not read PCAP global header" << std::endl;
+            close();
+            return false;
+        }
+        std::memcpy(&global_header_, map_.data(), sizeof(PcapGlobalHeader));
+        map_offset_ = sizeof(PcapGlobalHeader);
+    } else {
+        if (!stream_.open(filename)) {
+            std::cerr << "Error: Could not open file: " << filename << std::endl;
+            return false;
+        }
+
+        if (!stream_.read(&global_header_, sizeof(PcapGlobalHeader))) {
+            std::cerr << "Error: Could not read PCAP global header" << std::endl;
+            close();
+            return false;
+        }
     }
     
-    if (global_header_.magic_number == PCAP_MAGIC_NATIVE) {
+    const uint32_t magic = global_header_.magic_number;
+    if (magic == PCAP_MAGIC_NATIVE || magic == PCAP_MAGIC_NSEC_NATIVE) {
         needs_byte_swap_ = false;
-    } else if (global_header_.magic_number == PCAP_MAGIC_SWAPPED) {
+        nanosecond_ = magic == PCAP_MAGIC_NSEC_NATIVE;
+    } else if (magic == PCAP_MAGIC_SWAPPED || magic == PCAP_MAGIC_NSEC_SWAPPED) {
         needs_byte_swap_ = true;
+        nanosecond_ = magic == PCAP_MAGIC_NSEC_SWAPPED;
         global_header_.version_major = maybeSwap16(global_header_.version_major);
         global_header_.version_minor = maybeSwap16(global_header_.version_minor);
+        global_header_.thiszone = static_cast<int32_t>(
+            maybeSwap32(static_cast<uint32_t>(global_header_.thiszone)));
+        global_header_.sigfigs = maybeSwap32(global_header_.sigfigs);
         global_header_.snaplen = maybeSwap32(global_header_.snaplen);
         global_header_.network = maybeSwap32(global_header_.network);
     } else {
@@ -41,6 +58,11 @@ bool PcapReader::open(const std::string& filename) {
         close();
         return false;
     }
+
+    // Packets are handed out in host order with microsecond timestamps, so the
+    // header that describes them -- and that the output file is written with --
+    // must say so, whatever the input's byte order and resolution were.
+    global_header_.magic_number = PCAP_MAGIC_NATIVE;
     
     if (!silent_) {
         std::cout << "Opened PCAP file: " << filename << std::endl;
@@ -49,51 +71,102 @@ bool PcapReader::open(const std::string& filename) {
         std::cout << "  Snaplen: " << global_header_.snaplen << " bytes" << std::endl;
         std::cout << "  Link type: " << global_header_.network 
                   << (global_header_.network == 1 ? " (Ethernet)" : "") << std::endl;
+        std::cout << "  Access: " << (map_.isOpen() ? "memory-mapped"
+                                     : stream_.isDirectIO() ? "read-ahead (direct I/O)"
+                                     : "read-ahead");
+        if (stream_.compression() != Compression::NONE) {
+            std::cout << ", " << compressionName(stream_.compression()) << "-decompressed";
+        }
+        std::cout << std::endl;
     }
     
     return true;
 }
 
 void PcapReader::close() {
-    if (file_.is_open()) {
-        file_.close();
-    }
+    stream_.close();
+    map_.close();
+    map_offset_ = 0;
     needs_byte_swap_ = false;
+    nanosecond_ = false;
 }
 
 bool PcapReader::readNextPacket(RawPacket& packet) {
-    if (!file_.is_open()) {
+    if (map_.isOpen()) {
+        return readMappedPacket(packet);
+    }
+    if (!stream_.isOpen()) {
         return false;
     }
+    packet.mapped = nullptr;
     
-    file_.read(reinterpret_cast<char*>(&packet.header), sizeof(PcapPacketHeader));
-    if (!file_.good()) {
+    if (!stream_.read(&packet.header, sizeof(PcapPacketHeader))) {
         return false;
     }
     
-    if (needs_byte_swap_) {
-        packet.header.ts_sec = maybeSwap32(packet.header.ts_sec);
-        packet.header.ts_usec = maybeSwap32(packet.header.ts_usec);
-        packet.header.incl_len = maybeSwap32(packet.header.incl_len);
-        packet.header.orig_len = maybeSwap32(packet.header.orig_len);
-    }
+    normalizeHeader(packet.header);
     
-    if (packet.header.incl_len > global_header_.snaplen || 
-        packet.header.incl_len > 65535) {
+    if (!validatePacketHeader(packet.header)) {
         std::cerr << "Error: Invalid packet length: " << packet.header.incl_len << std::endl;
         return false;
     }
     
-    packet.data.resize(packet.header.incl_len);
-    file_.read(reinterpret_cast<char*>(packet.data.data()), packet.header.incl_len);
-    if (!file_.good()) {
+    // The read-ahead block is recycled once the reader moves past it, so the
+    // bytes are copied out here rather than borrowed as the mmap path does.
+    const uint8_t* bytes = stream_.next(packet.header.incl_len);
+    if (!bytes) {
         std::cerr << "Error: Could not read packet data" << std::endl;
         return false;
     }
+    packet.data.assign(bytes, bytes + packet.header.incl_len);
     
     return true;
 }
 
+// Same record validation as the stream path, but the packet bytes are handed
+// out as a pointer into the mapping instead of being read into `data`.
+bool PcapReader::readMappedPacket(RawPacket& packet) {
+    const size_t remaining = map_.size() - map_offset_;
+    if (remaining < sizeof(PcapPacketHeader)) {
+        return false;
+    }
+
+    std::memcpy(&packet.header, map_.data() + map_offset_, sizeof(PcapPacketHeader));
+    normalizeHeader(packet.header);
+
+    if (!validatePacketHeader(packet.header)) {
+        std::cerr << "Error: Invalid packet length: " << packet.header.incl_len << std::endl;
+        return false;
+    }
+
+    if (packet.header.incl_len > remaining - sizeof(PcapPacketHeader)) {
+        std::cerr << "Error: Could not read packet data" << std::endl;
+        return false;
+    }
+
+    map_offset_ += sizeof(PcapPacketHeader);
+    packet.data.clear();
+    packet.mapped = map_.data() + map_offset_;
+    map_offset_ += packet.header.incl_len;
+    return true;
+}
+
+bool PcapReader::validatePacketHeader(const PcapPacketHeader& header) const {
+    return header.incl_len <= global_header_.snaplen && header.incl_len <= 65535;
+}
+
+void PcapReader::normalizeHeader(PcapPacketHeader& header) const {
+    if (needs_byte_swap_) {
+        header.ts_sec = maybeSwap32(header.ts_sec);
+        header.ts_usec = maybeSwap32(header.ts_usec);
+        header.incl_len = maybeSwap32(header.incl_len);
+        header.orig_len = maybeSwap32(header.orig_len);
+    }
+    if (nanosecond_) {
+        header.ts_usec /= 1000;
+    }
+}
+
 uint16_t PcapReader::maybeSwap16(uint16_t value) const {
     if (!needs_byte_swap_) return value;
     return ((value & 0xFF00) >> 8) | ((value & 0x00FF) << 8);
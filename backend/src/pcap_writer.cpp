@@ -0,0 +1,272 @@
+#include "pcap_writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Runs shorter than this are cheaper to reference in the next writev than
+// to send through a copy_file_range call of their own.
+constexpr size_t RANGE_COPY_MIN = 64 * 1024;
+}
+
+namespace PacketAnalyzer {
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PcapWriter::PcapWriter(const Options& options) : options_(options) {
+#ifdef IOV_MAX
+    options_.max_iovecs = std::min<size_t>(options_.max_iovecs, IOV_MAX);
+#endif
+    options_.max_iovecs = std::max<size_t>(options_.max_iovecs, 2);
+    options_.batch_bytes = std::max<size_t>(options_.batch_bytes, 4096);
+}
+
+PcapWriter::~PcapWriter() {
+    close();
+}
+
+bool PcapWriter::open(const std::string& filename) {
+    close();
+
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    arena_.resize(options_.batch_bytes);
+    arena_used_ = 0;
+    iov_.clear();
+    iov_.reserve(options_.max_iovecs);
+    pending_bytes_ = 0;
+    failed_ = false;
+    packets_written_ = 0;
+    bytes_written_ = 0;
+    flushes_ = 0;
+    total_flush_ns_ = 0;
+    max_flush_ns_ = 0;
+    range_copies_ = 0;
+    range_copy_bytes_ = 0;
+    run_begin_ = run_end_ = nullptr;
+    opened_at_ns_ = nowNs();
+    closed_at_ns_ = 0;
+    return true;
+}
+
+bool PcapWriter::close() {
+    if (fd_ < 0) return !failed_;
+    flush();
+    ::close(fd_);
+    fd_ = -1;
+    closed_at_ns_ = nowNs();
+    arena_.clear();
+    arena_.shrink_to_fit();
+    iov_.clear();
+    range_fd_ = -1;
+    range_base_ = nullptr;
+    return !failed_;
+}
+
+bool PcapWriter::writeGlobalHeader(const PcapGlobalHeader& header) {
+    if (fd_ < 0 || failed_) return false;
+    if (arena_used_ + sizeof(header) > arena_.size() && !flush()) return false;
+    appendCopy(&header, sizeof(header));
+    return true;
+}
+
+bool PcapWriter::writePacket(const PcapPacketHeader& header, const uint8_t* data,
+                             size_t len, bool stable) {
+    if (fd_ < 0 || failed_) return false;
+    if (run_begin_ && !flushRun()) return false;
+
+    // A payload too big for the arena is written from where it is, which is
+    // only safe if the batch goes out before the caller gets control back.
+    const bool copy = !stable && len <= arena_.size() - sizeof(header);
+    const bool flush_now = !stable && !copy;
+    const size_t arena_need = sizeof(header) + (copy ? len : 0);
+
+    if (arena_used_ + arena_need > arena_.size() || iov_.size() + 2 > options_.max_iovecs) {
+        if (!flush()) return false;
+    }
+
+    appendCopy(&header, sizeof(header));
+    if (copy) {
+        appendCopy(data, len);
+    } else {
+        appendRef(data, len);
+    }
+    packets_written_++;
+
+    if (flush_now || pending_bytes_ >= options_.batch_bytes) {
+        return flush();
+    }
+    return true;
+}
+
+void PcapWriter::setRangeSource(int fd, const uint8_t* base) {
+    range_fd_ = fd;
+    range_base_ = base;
+    range_copy_supported_ = true;
+}
+
+bool PcapWriter::writeRecordFromSource(const uint8_t* record, size_t len) {
+    if (fd_ < 0 || failed_ || !range_base_) return false;
+    if (record != run_end_ && !flushRun()) return false;
+    if (!run_begin_) run_begin_ = record;
+    run_end_ = record + len;
+    packets_written_++;
+    return true;
+}
+
+bool PcapWriter::flushRun() {
+    if (!run_begin_) return !failed_;
+    const uint8_t* begin = run_begin_;
+    const size_t len = static_cast<size_t>(run_end_ - run_begin_);
+    run_begin_ = run_end_ = nullptr;
+
+    if (len < RANGE_COPY_MIN || range_fd_ < 0 || !range_copy_supported_) {
+        if (iov_.size() + 1 > options_.max_iovecs && !writeBatch()) return false;
+        appendRef(begin, len);
+        return pending_bytes_ < options_.batch_bytes || writeBatch();
+    }
+    // The run must land after everything batched ahead of it.
+    return writeBatch() && copyRange(begin, len);
+}
+
+// File to file inside the kernel, which on filesystems that share extents
+// (btrfs, XFS) is a reflink rather than a copy. Anything the kernel will not
+// do is written from the mapping instead, and the in-kernel path is not tried
+// again for this source.
+bool PcapWriter::copyRange(const uint8_t* begin, size_t len) {
+    const uint64_t start = nowNs();
+    size_t done = 0;
+#ifdef __linux__
+    loff_t offset = static_cast<loff_t>(begin - range_base_);
+    while (done < len && range_copy_supported_) {
+        const ssize_t n = ::copy_file_range(range_fd_, &offset, fd_, nullptr, len - done, 0);
+        if (n > 0) {
+            done += static_cast<size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            // 0 (source shorter than the mapping said) or EXDEV, ENOSYS,
+            // EOPNOTSUPP and friends: finish the run through writev.
+            range_copy_supported_ = false;
+        }
+    }
+#else
+    range_copy_supported_ = false;
+#endif
+    if (done > 0) {
+        const uint64_t elapsed = nowNs() - start;
+        flushes_++;
+        total_flush_ns_ += elapsed;
+        max_flush_ns_ = std::max(max_flush_ns_, elapsed);
+        bytes_written_ += done;
+        range_copies_++;
+        range_copy_bytes_ += done;
+    }
+    if (done < len) {
+        appendRef(begin + done, len - done);
+        return writeBatch();
+    }
+    return true;
+}
+
+// Extends the last iovec when it ends exactly where this copy starts, which
+// is the common case: header then copied payload, record after record.
+void PcapWriter::appendCopy(const void* data, size_t len) {
+    if (len == 0) return;
+    uint8_t* dst = arena_.data() + arena_used_;
+    std::memcpy(dst, data, len);
+    arena_used_ += len;
+    pending_bytes_ += len;
+    if (!iov_.empty() &&
+        static_cast<uint8_t*>(iov_.back().iov_base) + iov_.back().iov_len == dst) {
+        iov_.back().iov_len += len;
+    } else {
+        iov_.push_back(iovec{dst, len});
+    }
+}
+
+void PcapWriter::appendRef(const void* data, size_t len) {
+    if (len == 0) return;
+    pending_bytes_ += len;
+    iov_.push_back(iovec{const_cast<void*>(data), len});
+}
+
+bool PcapWriter::flush() {
+    if (fd_ < 0) return false;
+    return flushRun() && writeBatch();
+}
+
+bool PcapWriter::writeBatch() {
+    if (iov_.empty()) return !failed_;
+
+    const uint64_t start = nowNs();
+    const bool ok = writeAll();
+    const uint64_t elapsed = nowNs() - start;
+
+    flushes_++;
+    total_flush_ns_ += elapsed;
+    max_flush_ns_ = std::max(max_flush_ns_, elapsed);
+    if (ok) {
+        bytes_written_ += pending_bytes_;
+    }
+
+    iov_.clear();
+    arena_used_ = 0;
+    pending_bytes_ = 0;
+    return ok;
+}
+
+bool PcapWriter::writeAll() {
+    iovec* iov = iov_.data();
+    int count = static_cast<int>(iov_.size());
+    while (count > 0) {
+        ssize_t n = ::writev(fd_, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: Could not write output: " << std::strerror(errno) << std::endl;
+            failed_ = true;
+            return false;
+        }
+        // Partial write: skip the iovecs that went out, trim the one that
+        // was cut, and go again.
+        size_t done = static_cast<size_t>(n);
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+PcapWriter::Stats PcapWriter::getStats() const {
+    Stats stats;
+    stats.packets_written = packets_written_;
+    stats.bytes_written = bytes_written_;
+    stats.flushes = flushes_;
+    stats.total_flush_ns = total_flush_ns_;
+    stats.max_flush_ns = max_flush_ns_;
+    stats.range_copies = range_copies_;
+    stats.range_copy_bytes = range_copy_bytes_;
+    const uint64_t end = closed_at_ns_ ? closed_at_ns_ : nowNs();
+    const uint64_t elapsed = opened_at_ns_ ? end - opened_at_ns_ : 0;
+    stats.bytes_per_second = elapsed ? bytes_written_ * 1e9 / elapsed : 0.0;
+    return stats;
+}
+
+}
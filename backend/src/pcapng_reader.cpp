@@ -0,0 +1,361 @@
+#include "pcapng_reader.h"
+#include "platform.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+namespace PacketAnalyzer {
+
+constexpr uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+constexpr uint32_t PCAP_MAGIC_NATIVE = 0xa1b2c3d4;
+
+// Block type + total length up front, total length again at the end.
+constexpr size_t BLOCK_FRAMING = 12;
+// Far above any real block (an EPB tops out near 256 KiB), low enough that a
+// corrupt length field cannot make the stream path allocate gigabytes.
+constexpr uint32_t MAX_BLOCK_LENGTH = 16 * 1024 * 1024;
+// Largest snaplen any DLT allows; the classic reader's 65535 is too tight for
+// pcapng writers that capture TSO/GRO super-frames.
+constexpr uint32_t MAX_PACKET_LENGTH = 262144;
+
+constexpr uint16_t OPT_END = 0;
+constexpr uint16_t OPT_IF_TSRESOL = 9;
+constexpr uint16_t OPT_IF_TSOFFSET = 14;
+
+PcapngReader::~PcapngReader() {
+    close();
+}
+
+bool PcapngReader::open(const std::string& filename) {
+    close();
+
+    if (!(use_mmap_ && map_.open(filename))) {
+        if (!stream_.open(filename)) {
+            std::cerr << "Error: Could not open file: " << filename << std::endl;
+            return false;
+        }
+    }
+
+    uint32_t type = 0;
+    const uint8_t* body = nullptr;
+    size_t body_len = 0;
+    if (!nextBlock(type, body, body_len) || type != BLOCK_SHB) {
+        std::cerr << "Error: pcapng file does not start with a Section Header Block"
+                  << std::endl;
+        close();
+        return false;
+    }
+    if (!parseSectionHeader(body, body_len)) {
+        close();
+        return false;
+    }
+
+    // The output header needs a link type before the first packet is written,
+    // so read ahead to the first interface. Packets cannot precede it: every
+    // packet block names an interface that must already be described.
+    while (interfaces_.empty() && nextBlock(type, body, body_len)) {
+        if (type == BLOCK_IDB) {
+            if (!parseInterface(body, body_len)) {
+                close();
+                return false;
+            }
+        } else if (type == BLOCK_EPB || type == BLOCK_SPB) {
+            std::cerr << "Error: pcapng packet block before any interface" << std::endl;
+            close();
+            return false;
+        }
+    }
+
+    global_header_.magic_number = PCAP_MAGIC_NATIVE;
+    global_header_.version_major = 2;
+    global_header_.version_minor = 4;
+    global_header_.thiszone = 0;
+    global_header_.sigfigs = 0;
+    if (interfaces_.empty()) {
+        // A section with no interfaces is a valid, empty capture.
+        global_header_.snaplen = 65535;
+        global_header_.network = 1;
+    } else {
+        const Interface& first = interfaces_.front();
+        global_header_.snaplen = first.snaplen ? first.snaplen : MAX_PACKET_LENGTH;
+        global_header_.network = first.link_type;
+    }
+
+    if (!silent_) {
+        std::cout << "Opened PCAPNG file: " << filename << std::endl;
+        std::cout << "  Snaplen: " << global_header_.snaplen << " bytes" << std::endl;
+        std::cout << "  Link type: " << global_header_.network
+                  << (global_header_.network == 1 ? " (Ethernet)" : "") << std::endl;
+        std::cout << "  Access: " << (map_.isOpen() ? "memory-mapped"
+                                     : stream_.isDirectIO() ? "read-ahead (direct I/O)"
+                                     : "read-ahead");
+        if (stream_.compression() != Compression::NONE) {
+            std::cout << ", " << compressionName(stream_.compression()) << "-decompressed";
+        }
+        std::cout << std::endl;
+    }
+
+    return true;
+}
+
+void PcapngReader::close() {
+    stream_.close();
+    map_.close();
+    map_offset_ = 0;
+    swap_ = false;
+    interfaces_.clear();
+    block_buf_.clear();
+    last_header_ = PcapPacketHeader{};
+}
+
+bool PcapngReader::readNextPacket(RawPacket& packet) {
+    uint32_t type = 0;
+    const uint8_t* body = nullptr;
+    size_t body_len = 0;
+
+    while (nextBlock(type, body, body_len)) {
+        size_t iface_id = 0;
+        uint32_t cap_len = 0;
+        uint32_t orig_len = 0;
+        const uint8_t* frame = nullptr;
+
+        if (type == BLOCK_SHB) {
+            // A new section restarts interface numbering and may flip byte order.
+            interfaces_.clear();
+            if (!parseSectionHeader(body, body_len)) return false;
+            continue;
+        } else if (type == BLOCK_IDB) {
+            if (!parseInterface(body, body_len)) return false;
+            continue;
+        } else if (type == BLOCK_EPB) {
+            if (body_len < 20) {
+                std::cerr << "Error: Truncated pcapng Enhanced Packet Block" << std::endl;
+                return false;
+            }
+            iface_id = read32(body);
+            if (iface_id >= interfaces_.size()) {
+                std::cerr << "Error: pcapng packet names undefined interface "
+                          << iface_id << std::endl;
+                return false;
+            }
+            uint64_t ticks = (static_cast<uint64_t>(read32(body + 4)) << 32) | read32(body + 8);
+            cap_len = read32(body + 12);
+            orig_len = read32(body + 16);
+            if (cap_len > body_len - 20) {
+                std::cerr << "Error: pcapng packet overruns its block" << std::endl;
+                return false;
+            }
+            frame = body + 20;
+            toMicroseconds(interfaces_[iface_id], ticks, packet.header);
+        } else if (type == BLOCK_SPB) {
+            if (body_len < 4 || interfaces_.empty()) {
+                std::cerr << "Error: Malformed pcapng Simple Packet Block" << std::endl;
+                return false;
+            }
+            orig_len = read32(body);
+            // An SPB carries no captured length: it is the original length,
+            // clipped to the block and to interface 0's snaplen.
+            cap_len = static_cast<uint32_t>(std::min<size_t>(orig_len, body_len - 4));
+            if (interfaces_[0].snaplen && cap_len > interfaces_[0].snaplen) {
+                cap_len = interfaces_[0].snaplen;
+            }
+            frame = body + 4;
+            // Nor a timestamp. Reuse the previous one so output stays monotone.
+            packet.header.ts_sec = last_header_.ts_sec;
+            packet.header.ts_usec = last_header_.ts_usec;
+        } else {
+            continue;
+        }
+
+        if (cap_len > MAX_PACKET_LENGTH) {
+            std::cerr << "Error: Invalid packet length: " << cap_len << std::endl;
+            return false;
+        }
+
+        if (interfaces_[iface_id].link_type != global_header_.network) {
+            if (skipped_link_type_++ == 0 && !silent_) {
+                std::cerr << "Warning: skipping packets from interfaces whose link type "
+                          << "differs from the output's (" << global_header_.network << ")\n";
+            }
+            continue;
+        }
+
+        packet.header.incl_len = cap_len;
+        packet.header.orig_len = orig_len;
+        if (map_.isOpen()) {
+            packet.data.clear();
+            packet.mapped = frame;
+        } else {
+            packet.mapped = nullptr;
+            packet.data.assign(frame, frame + cap_len);
+        }
+        last_header_ = packet.header;
+        return true;
+    }
+
+    return false;
+}
+
+// Hands back the body of the next block (everything between the leading
+// type/length and the trailing length). In mmap mode `body` points into the
+// mapping; in stream mode it points into the read-ahead block (or block_buf_)
+// and is valid until the next call.
+bool PcapngReader::nextBlock(uint32_t& type, const uint8_t*& body, size_t& body_len) {
+    uint8_t head[12];
+    size_t head_len = 8;
+
+    if (map_.isOpen()) {
+        if (map_.size() - map_offset_ < 12) return false;
+        std::memcpy(head, map_.data() + map_offset_, 12);
+    } else {
+        if (!stream_.read(head, 8)) return false;
+    }
+
+    uint32_t raw_type;
+    std::memcpy(&raw_type, head, 4);
+
+    // The SHB type code is a byte palindrome, so it is recognisable before the
+    // byte order is known -- which the SHB's own first body field then sets.
+    if (raw_type == BLOCK_SHB) {
+        if (!map_.isOpen() && !stream_.read(head + 8, 4)) return false;
+        head_len = 12;
+        uint32_t bom;
+        std::memcpy(&bom, head + 8, 4);
+        if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+            swap_ = false;
+        } else if (bom == PortableNet::swapBytes32(PCAPNG_BYTE_ORDER_MAGIC)) {
+            swap_ = true;
+        } else {
+            std::cerr << "Error: Invalid pcapng byte-order magic" << std::endl;
+            return false;
+        }
+    }
+
+    type = read32(head);
+    const uint32_t total_len = read32(head + 4);
+    if (total_len < BLOCK_FRAMING + (head_len - 8) || total_len % 4 != 0 ||
+        total_len > MAX_BLOCK_LENGTH) {
+        std::cerr << "Error: Invalid pcapng block length: " << total_len << std::endl;
+        return false;
+    }
+    body_len = total_len - BLOCK_FRAMING;
+
+    if (map_.isOpen()) {
+        if (total_len > map_.size() - map_offset_) {
+            std::cerr << "Error: Truncated pcapng block" << std::endl;
+            return false;
+        }
+        body = map_.data() + map_offset_ + 8;
+        map_offset_ += total_len;
+        return true;
+    }
+
+    // Stream mode: the body plus trailing length, in place in the read-ahead
+    // block where it fits in one.
+    const size_t already = head_len - 8;
+    const uint8_t* rest = stream_.next(body_len + 4 - already);
+    if (!rest) {
+        std::cerr << "Error: Truncated pcapng block" << std::endl;
+        return false;
+    }
+    if (already == 0) {
+        body = rest;
+        return true;
+    }
+
+    // The SHB's byte-order field has already been consumed, so put it back at
+    // the front of the body.
+    block_buf_.resize(body_len + 4);
+    std::memcpy(block_buf_.data(), head + 8, already);
+    std::memcpy(block_buf_.data() + already, rest, body_len + 4 - already);
+    body = block_buf_.data();
+    return true;
+}
+
+bool PcapngReader::parseSectionHeader(const uint8_t* body, size_t body_len) {
+    // Byte-order magic, major, minor, 64-bit section length.
+    if (body_len < 16) {
+        std::cerr << "Error: Truncated pcapng Section Header Block" << std::endl;
+        return false;
+    }
+    const uint16_t major = read16(body + 4);
+    if (major != 1) {
+        std::cerr << "Error: Unsupported pcapng version: " << major << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool PcapngReader::parseInterface(const uint8_t* body, size_t body_len) {
+    if (body_len < 8) {
+        std::cerr << "Error: Truncated pcapng Interface Description Block" << std::endl;
+        return false;
+    }
+
+    Interface iface;
+    iface.link_type = read16(body);
+    iface.snaplen = read32(body + 4);
+
+    size_t offset = 8;
+    while (offset + 4 <= body_len) {
+        const uint16_t code = read16(body + offset);
+        const uint16_t len = read16(body + offset + 2);
+        offset += 4;
+        if (code == OPT_END || len > body_len - offset) break;
+
+        if (code == OPT_IF_TSRESOL && len >= 1) {
+            const uint8_t v = body[offset];
+            iface.resolution_is_binary = (v & 0x80) != 0;
+            iface.resolution_exponent = v & 0x7F;
+            // 10^19 and 2^63 are the last exponents a 64-bit tick count can use.
+            if ((!iface.resolution_is_binary && iface.resolution_exponent > 19) ||
+                (iface.resolution_is_binary && iface.resolution_exponent > 63)) {
+                std::cerr << "Error: Unsupported pcapng timestamp resolution" << std::endl;
+                return false;
+            }
+        } else if (code == OPT_IF_TSOFFSET && len >= 8) {
+            uint64_t v;
+            std::memcpy(&v, body + offset, 8);
+            iface.ts_offset_sec = static_cast<int64_t>(swap_ ? PortableNet::swapBytes64(v) : v);
+        }
+
+        offset += (len + 3u) & ~3u;
+    }
+
+    interfaces_.push_back(iface);
+    return true;
+}
+
+void PcapngReader::toMicroseconds(const Interface& iface, uint64_t ticks,
+                                  PcapPacketHeader& header) const {
+    uint64_t sec;
+    uint64_t usec;
+    if (iface.resolution_is_binary) {
+        const unsigned shift = iface.resolution_exponent;
+        sec = shift ? (ticks >> shift) : ticks;
+        const uint64_t frac = shift ? (ticks & ((uint64_t{1} << shift) - 1)) : 0;
+        usec = static_cast<uint64_t>((static_cast<unsigned __int128>(frac) * 1000000u) >> shift);
+    } else {
+        uint64_t units = 1;
+        for (uint8_t i = 0; i < iface.resolution_exponent; i++) units *= 10;
+        sec = ticks / units;
+        usec = static_cast<uint64_t>(
+            static_cast<unsigned __int128>(ticks % units) * 1000000u / units);
+    }
+    header.ts_sec = static_cast<uint32_t>(static_cast<int64_t>(sec) + iface.ts_offset_sec);
+    header.ts_usec = static_cast<uint32_t>(usec);
+}
+
+uint16_t PcapngReader::read16(const uint8_t* p) const {
+    uint16_t v;
+    std::memcpy(&v, p, 2);
+    return swap_ ? PortableNet::swapBytes16(v) : v;
+}
+
+uint32_t PcapngReader::read32(const uint8_t* p) const {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return swap_ ? PortableNet::swapBytes32(v) : v;
+}
+
+}
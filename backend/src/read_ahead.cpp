@@ -0,0 +1,234 @@
+#include "read_ahead.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace PacketAnalyzer {
+
+// Covers the logical block size of every device O_DIRECT is likely to meet.
+constexpr size_t IO_ALIGNMENT = 4096;
+
+ReadAheadReader::~ReadAheadReader() {
+    close();
+}
+
+bool ReadAheadReader::open(const std::string& filename) {
+    close();
+
+    if (options_.block_size < IO_ALIGNMENT) options_.block_size = IO_ALIGNMENT;
+    options_.block_size = (options_.block_size + IO_ALIGNMENT - 1) & ~(IO_ALIGNMENT - 1);
+    if (options_.ring_blocks < 2) options_.ring_blocks = 2;
+
+    direct_io_active_ = false;
+    const bool compressed = options_.compression != Compression::NONE;
+#ifdef O_DIRECT
+    if (options_.direct_io && !compressed) {
+        fd_ = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
+        // tmpfs and some network filesystems reject O_DIRECT at open time.
+        direct_io_active_ = fd_ >= 0;
+    }
+#endif
+    if (fd_ < 0) {
+        fd_ = ::open(filename.c_str(), O_RDONLY);
+    }
+    if (fd_ < 0) {
+        return false;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (!direct_io_active_) {
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+    if (compressed) {
+        decoder_ = makeStreamDecoder(options_.compression, fd_, options_.decode_threads);
+        if (!decoder_) {
+            close();
+            return false;
+        }
+    }
+
+    slots_.assign(options_.ring_blocks, Slot{});
+    for (auto& slot : slots_) {
+        void* p = nullptr;
+        if (::posix_memalign(&p, IO_ALIGNMENT, options_.block_size) != 0) {
+            close();
+            return false;
+        }
+        slot.buf = static_cast<uint8_t*>(p);
+    }
+
+    fill_index_ = 0;
+    read_index_ = 0;
+    holding_slot_ = false;
+    cursor_ = 0;
+    eof_ = false;
+    stop_ = false;
+    blocks_read_ = 0;
+    bytes_read_ = 0;
+    consumer_waits_ = 0;
+    producer_waits_ = 0;
+    straddled_records_ = 0;
+    io_thread_ = std::thread(&ReadAheadReader::ioLoop, this);
+    return true;
+}
+
+void ReadAheadReader::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    freed_.notify_all();
+    if (io_thread_.joinable()) {
+        io_thread_.join();
+    }
+    for (auto& slot : slots_) {
+        std::free(slot.buf);
+    }
+    slots_.clear();
+    staging_.clear();
+    // After the I/O thread is gone: it was the decoder's only user.
+    decoder_.reset();
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+// Fills one block. A short count means end of file (or a read error, which
+// ends the capture the same way a truncated file would).
+size_t ReadAheadReader::readBlock(uint8_t* buf) {
+    if (decoder_) {
+        return decoder_->read(buf, options_.block_size);
+    }
+    size_t got = 0;
+    while (got < options_.block_size) {
+        ssize_t n = ::read(fd_, buf + got, options_.block_size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += static_cast<size_t>(n);
+        // O_DIRECT only returns an unaligned count at end of file.
+        if (direct_io_active_ && (got % IO_ALIGNMENT) != 0) break;
+    }
+    return got;
+}
+
+void ReadAheadReader::ioLoop() {
+    for (;;) {
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (slots_[fill_index_].full && !stop_) {
+                producer_waits_++;
+                freed_.wait(lock, [this] { return !slots_[fill_index_].full || stop_; });
+            }
+            if (stop_) return;
+            slot = &slots_[fill_index_];
+        }
+
+        // The slot is ours until marked full, so the read runs unlocked.
+        const size_t n = readBlock(slot->buf);
+        blocks_read_++;
+        bytes_read_ += n;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot->len = n;
+            slot->full = true;
+            fill_index_ = (fill_index_ + 1) % slots_.size();
+            if (n < options_.block_size) eof_ = true;
+        }
+        filled_.notify_one();
+        if (n < options_.block_size) return;
+    }
+}
+
+bool ReadAheadReader::acquireSlot() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!slots_[read_index_].full && !eof_) {
+        consumer_waits_++;
+    }
+    filled_.wait(lock, [this] { return slots_[read_index_].full || eof_ || stop_; });
+    if (!slots_[read_index_].full) {
+        return false;
+    }
+    holding_slot_ = true;
+    cursor_ = 0;
+    return true;
+}
+
+void ReadAheadReader::releaseSlot() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_[read_index_].full = false;
+        slots_[read_index_].len = 0;
+        read_index_ = (read_index_ + 1) % slots_.size();
+    }
+    holding_slot_ = false;
+    freed_.notify_one();
+}
+
+const uint8_t* ReadAheadReader::next(size_t n) {
+    if (fd_ < 0) return nullptr;
+    if (n == 0) {
+        static const uint8_t empty = 0;
+        return &empty;
+    }
+
+    if (!holding_slot_ && !acquireSlot()) return nullptr;
+    // `len` of a held slot is only written by the I/O thread before it is
+    // marked full, so reading it here without the lock is safe.
+    if (slots_[read_index_].len - cursor_ == 0) {
+        releaseSlot();
+        if (!acquireSlot()) return nullptr;
+    }
+
+    Slot& slot = slots_[read_index_];
+    if (slot.len - cursor_ >= n) {
+        const uint8_t* p = slot.buf + cursor_;
+        cursor_ += n;
+        return p;
+    }
+
+    // The span crosses into the next block (or several, for a tiny block size).
+    straddled_records_++;
+    staging_.resize(n);
+    size_t copied = 0;
+    while (copied < n) {
+        Slot& cur = slots_[read_index_];
+        const size_t take = std::min(n - copied, cur.len - cursor_);
+        std::memcpy(staging_.data() + copied, cur.buf + cursor_, take);
+        copied += take;
+        cursor_ += take;
+        if (copied < n) {
+            releaseSlot();
+            if (!acquireSlot()) return nullptr;
+        }
+    }
+    return staging_.data();
+}
+
+bool ReadAheadReader::read(void* dst, size_t n) {
+    const uint8_t* p = next(n);
+    if (!p) return false;
+    std::memcpy(dst, p, n);
+    return true;
+}
+
+bool ReadAheadReader::failed() const {
+    return decoder_ && decoder_->failed();
+}
+
+ReadAheadReader::Stats ReadAheadReader::getStats() const {
+    Stats stats;
+    stats.blocks_read = blocks_read_.load();
+    stats.bytes_read = bytes_read_.load();
+    stats.consumer_waits = consumer_waits_.load();
+    stats.producer_waits = producer_waits_.load();
+    stats.straddled_records = straddled_records_.load();
+    return stats;
+}
+
+}
@@ -0,0 +1,142 @@
+#include "reorder_buffer.h"
+#include <algorithm>
+#include <chrono>
+
+namespace DPI {
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ReorderBuffer::ReorderBuffer(size_t window, EmitCallback emit)
+    : window_(std::max<size_t>(window, 1)),
+      emit_(std::move(emit)),
+      jobs_(window_),
+      state_(window_, EMPTY) {
+}
+
+// Ids are 32-bit and wrap; interpret each relative to the oldest one still
+// awaited, which is never more than a window away from anything in flight.
+uint64_t ReorderBuffer::extend(uint32_t packet_id) const {
+    const int32_t delta = static_cast<int32_t>(packet_id - static_cast<uint32_t>(next_id_));
+    return next_id_ + static_cast<int64_t>(delta);
+}
+
+// Makes room for `id` in the window. False if its gap was already abandoned,
+// in which case the caller deals with it outside the window.
+bool ReorderBuffer::admit(uint64_t id) {
+    if (id < next_id_) {
+        return false;
+    }
+    if (id >= next_id_ + window_) {
+        // Whatever is missing below the new window is not coming back soon
+        // enough to wait for; emit what is there and move on.
+        const uint64_t new_base = id - window_ + 1;
+        while (next_id_ < new_base) {
+            if (state_[next_id_ % window_] == EMPTY) {
+                forced_skips_++;
+            }
+            release(next_id_);
+            next_id_++;
+        }
+    }
+    return true;
+}
+
+void ReorderBuffer::release(uint64_t id) {
+    const size_t slot = id % window_;
+    if (state_[slot] == HELD) {
+        emit_(jobs_[slot]);
+        emitted_++;
+        jobs_[slot] = PacketJob{};
+    }
+    if (state_[slot] != EMPTY) {
+        occupancy_--;
+    }
+    state_[slot] = EMPTY;
+}
+
+void ReorderBuffer::drain() {
+    while (state_[next_id_ % window_] != EMPTY) {
+        release(next_id_);
+        next_id_++;
+    }
+}
+
+// A stall is any stretch during which packets sit in the buffer waiting for
+// an earlier id; only the transitions need a clock read.
+void ReorderBuffer::updateStall() {
+    if (occupancy_ > 0 && stall_started_ns_ == 0) {
+        stall_started_ns_ = nowNs();
+    } else if (occupancy_ == 0 && stall_started_ns_ != 0) {
+        stall_ns_ += nowNs() - stall_started_ns_;
+        stall_started_ns_ = 0;
+    }
+}
+
+void ReorderBuffer::push(PacketJob&& job) {
+    const uint64_t id = extend(job.packet_id);
+    arrivals_++;
+    if (!admit(id)) {
+        late_packets_++;
+        emit_(job);
+        emitted_++;
+        return;
+    }
+
+    const size_t slot = id % window_;
+    if (state_[slot] == EMPTY) {
+        occupancy_++;
+    }
+    jobs_[slot] = std::move(job);
+    state_[slot] = HELD;
+    max_occupancy_ = std::max(max_occupancy_, occupancy_);
+    occupancy_sum_ += occupancy_;
+
+    drain();
+    updateStall();
+}
+
+void ReorderBuffer::pushHole(uint32_t packet_id) {
+    const uint64_t id = extend(packet_id);
+    arrivals_++;
+    holes_++;
+    if (!admit(id)) {
+        return;
+    }
+
+    const size_t slot = id % window_;
+    if (state_[slot] == EMPTY) {
+        occupancy_++;
+        state_[slot] = HOLE;
+    }
+    max_occupancy_ = std::max(max_occupancy_, occupancy_);
+    occupancy_sum_ += occupancy_;
+
+    drain();
+    updateStall();
+}
+
+void ReorderBuffer::flush() {
+    while (occupancy_ > 0) {
+        release(next_id_);
+        next_id_++;
+    }
+    updateStall();
+}
+
+ReorderBuffer::Stats ReorderBuffer::getStats() const {
+    Stats stats;
+    stats.emitted = emitted_;
+    stats.holes = holes_;
+    stats.current_occupancy = occupancy_;
+    stats.max_occupancy = max_occupancy_;
+    stats.avg_occupancy = arrivals_ ? static_cast<double>(occupancy_sum_) / arrivals_ : 0.0;
+    stats.stall_ns = stall_ns_;
+    stats.forced_skips = forced_skips_;
+    stats.late_packets = late_packets_;
+    return stats;
+}
+
+}
@@ -6,55 +6,45 @@
 
 namespace DPI {
 
-uint32_t RuleManager::parseIP(const std::string& ip) {
-    uint32_t result = 0;
-    int octet = 0;
-    int shift = 0;
-    
-    for (char c : ip) {
-        if (c == '.') {
-            result |= (octet << shift);
-            shift += 8;
-            octet = 0;
-        } else if (c >= '0' && c <= '9') {
-            octet = octet * 10 + (c - '0');
-        }
-    }
-    result |= (octet << shift);
-    
-    return result;
-}
-
-std::string RuleManager::ipToString(uint32_t ip) {
-    std::ostringstream ss;
-    ss << ((ip >> 0) & 0xFF) << "."
-       << ((ip >> 8) & 0xFF) << "."
-       << ((ip >> 16) & 0xFF) << "."
-       << ((ip >> 24) & 0xFF);
-    return ss.str();
+void RuleManager::blockIP(const IPAddress& ip) {
+    std::unique_lock<std::shared_mutex> lock(ip_mutex_);
+    blocked_ips_.insert(ip);
+    std::cout << "[RuleManager] Blocked IP: " << ip.toString() << std::endl;
 }
 
 void RuleManager::blockIP(uint32_t ip) {
-    std::unique_lock<std::shared_mutex> lock(ip_mutex_);
-    blocked_ips_.insert(ip);
-    std::cout << "[RuleManager] Blocked IP: " << ipToString(ip) << std::endl;
+    blockIP(IPAddress::fromV4(ip));
 }
 
 void RuleManager::blockIP(const std::string& ip) {
-    blockIP(parseIP(ip));
+    auto addr = IPAddress::parse(ip);
+    if (!addr) {
+        std::cerr << "[RuleManager] Invalid IP address: " << ip << std::endl;
+        return;
+    }
+    blockIP(*addr);
 }
 
-void RuleManager::unblockIP(uint32_t ip) {
+void RuleManager::unblockIP(const IPAddress& ip) {
     std::unique_lock<std::shared_mutex> lock(ip_mutex_);
     blocked_ips_.erase(ip);
-    std::cout << "[RuleManager] Unblocked IP: " << ipToString(ip) << std::endl;
+    std::cout << "[RuleManager] Unblocked IP: " << ip.toString() << std::endl;
+}
+
+void RuleManager::unblockIP(uint32_t ip) {
+    unblockIP(IPAddress::fromV4(ip));
 }
 
 void RuleManager::unblockIP(const std::string& ip) {
-    unblockIP(parseIP(ip));
+    auto addr = IPAddress::parse(ip);
+    if (!addr) {
+        std::cerr << "[RuleManager] Invalid IP address: " << ip << std::endl;
+        return;
+    }
+    unblockIP(*addr);
 }
 
-bool RuleManager::isIPBlocked(uint32_t ip) const {
+bool RuleManager::isIPBlocked(const IPAddress& ip) const {
     std::shared_lock<std::shared_mutex> lock(ip_mutex_);
     return blocked_ips_.count(ip) > 0;
 }
@@ -62,8 +52,8 @@ bool RuleManager::isIPBlocked(uint32_t ip) const {
 std::vector<std::string> RuleManager::getBlockedIPs() const {
     std::shared_lock<std::shared_mutex> lock(ip_mutex_);
     std::vector<std::string> result;
-    for (uint32_t ip : blocked_ips_) {
-        result.push_back(ipToString(ip));
+    for (const IPAddress& ip : blocked_ips_) {
+        result.push_back(ip.toString());
     }
     return result;
 }
@@ -182,13 +172,13 @@ bool RuleManager::isPortBlocked(uint16_t port) const {
 }
 
 std::optional<RuleManager::BlockReason> RuleManager::shouldBlock(
-    uint32_t src_ip,
+    const IPAddress& src_ip,
     uint16_t dst_port,
     AppType app,
     const std::string& domain) const {
     
     if (isIPBlocked(src_ip)) {
-        return BlockReason{BlockReason::IP_RULE, ipToString(src_ip)};
+        return BlockReason{BlockReason::IP_RULE, src_ip.toString()};
     }
     
     if (isPortBlocked(dst_port)) {
@@ -30,6 +30,20 @@ bool SNIExtractor::isTLSClientHello(const uint8_t* payload, size_t length) {
     return true;
 }
 
+size_t SNIExtractor::pendingClientHelloLength(const uint8_t* payload, size_t length) {
+    if (length < 6) return 0;
+    
+    if (payload[0] != CONTENT_TYPE_HANDSHAKE) return 0;
+    
+    uint16_t version = readUint16BE(payload + 1);
+    if (version < 0x0300 || version > 0x0304) return 0;
+    
+    if (payload[5] != HANDSHAKE_CLIENT_HELLO) return 0;
+    
+    size_t record_size = 5 + static_cast<size_t>(readUint16BE(payload + 3));
+    return record_size > length ? record_size : 0;
+}
+
 std::optional<std::string> SNIExtractor::extract(const uint8_t* payload, size_t length) {
     if (!isTLSClientHello(payload, length)) {
         return std::nullopt;
@@ -116,6 +130,16 @@ bool HTTPHostExtractor::isHTTPRequest(const uint8_t* payload, size_t length) {
     return false;
 }
 
+bool HTTPHostExtractor::isIncompleteRequest(const uint8_t* payload, size_t length) {
+    if (!isHTTPRequest(payload, length)) {
+        return false;
+    }
+    
+    const char* end_of_headers = "\r\n\r\n";
+    const uint8_t* stop = payload + std::min(length, MAX_HTTP_HEADER_SCAN);
+    return std::search(payload, stop, end_of_headers, end_of_headers + 4) == stop;
+}
+
 std::optional<std::string> HTTPHostExtractor::extract(const uint8_t* payload, size_t length) {
     if (!isHTTPRequest(payload, length)) {
         return std::nullopt;
@@ -0,0 +1,378 @@
+#include "stream_decoder.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#ifdef DPI_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef DPI_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace PacketAnalyzer {
+
+constexpr uint8_t GZIP_MAGIC[] = {0x1f, 0x8b};
+constexpr uint8_t ZSTD_MAGIC[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+// Compressed bytes pulled from the file per read().
+constexpr size_t INPUT_CHUNK = 1 << 18;
+
+Compression detectCompression(const uint8_t* head, size_t len) {
+    if (len >= sizeof(GZIP_MAGIC) && std::memcmp(head, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) {
+        return Compression::GZIP;
+    }
+    if (len >= sizeof(ZSTD_MAGIC) && std::memcmp(head, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0) {
+        return Compression::ZSTD;
+    }
+    return Compression::NONE;
+}
+
+const char* compressionName(Compression compression) {
+    switch (compression) {
+        case Compression::GZIP: return "gzip";
+        case Compression::ZSTD: return "zstd";
+        default:                return "none";
+    }
+}
+
+bool compressionSupported(Compression compression) {
+    switch (compression) {
+        case Compression::NONE: return true;
+#ifdef DPI_HAVE_ZLIB
+        case Compression::GZIP: return true;
+#endif
+#ifdef DPI_HAVE_ZSTD
+        case Compression::ZSTD: return true;
+#endif
+        default: return false;
+    }
+}
+
+// Reads up to `n` bytes, retrying interrupted reads. -1 on error.
+static ssize_t readSome(int fd, uint8_t* buf, size_t n) {
+    for (;;) {
+        ssize_t r = ::read(fd, buf, n);
+        if (r >= 0 || errno != EINTR) return r;
+    }
+}
+
+#ifdef DPI_HAVE_ZLIB
+
+// gzip, including files of several concatenated members (pigz, `cat a.gz
+// b.gz`), which gunzip also reads as one stream.
+class GzipDecoder : public StreamDecoder {
+public:
+    explicit GzipDecoder(int fd) : fd_(fd), in_(INPUT_CHUNK) {
+        std::memset(&zs_, 0, sizeof(zs_));
+        // 15 window bits + 16: gzip wrapper only.
+        if (inflateInit2(&zs_, 15 + 16) != Z_OK) {
+            fail("could not initialise zlib");
+        }
+    }
+
+    ~GzipDecoder() override {
+        inflateEnd(&zs_);
+    }
+
+    size_t read(uint8_t* dst, size_t n) override {
+        zs_.next_out = dst;
+        zs_.avail_out = static_cast<uInt>(n);
+
+        while (zs_.avail_out > 0 && !done_) {
+            if (zs_.avail_in == 0) {
+                const ssize_t r = readSome(fd_, in_.data(), in_.size());
+                if (r < 0) {
+                    fail(std::strerror(errno));
+                    break;
+                }
+                if (r == 0) {
+                    if (in_member_) fail("truncated gzip stream");
+                    done_ = true;
+                    break;
+                }
+                zs_.next_in = in_.data();
+                zs_.avail_in = static_cast<uInt>(r);
+            }
+
+            in_member_ = true;
+            const int rc = inflate(&zs_, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END) {
+                in_member_ = false;
+                inflateReset(&zs_);
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                fail(zs_.msg ? zs_.msg : "corrupt gzip stream");
+                break;
+            }
+        }
+        return n - zs_.avail_out;
+    }
+
+    bool failed() const override { return failed_; }
+
+private:
+    int fd_;
+    z_stream zs_;
+    std::vector<uint8_t> in_;
+    bool in_member_ = false;
+    bool done_ = false;
+    bool failed_ = false;
+
+    void fail(const char* why) {
+        std::cerr << "Error: gzip input: " << why << std::endl;
+        failed_ = true;
+        done_ = true;
+    }
+};
+
+#endif
+
+#ifdef DPI_HAVE_ZSTD
+
+// Frames up to this decompressed size are decoded whole, in parallel with
+// each other. Larger ones, and ones that do not state their size (streamed
+// compression), are decoded incrementally on the calling thread.
+constexpr unsigned long long MAX_PARALLEL_FRAME = 64ull << 20;
+// Output buffers of the frames in flight, by their declared sizes, plus the
+// one being read out, stay under this whatever the thread count. One frame
+// is always let through, so a lone MAX_PARALLEL_FRAME one still decodes.
+constexpr size_t MAX_IN_FLIGHT_BYTES = 256u << 20;
+// Enough for any frame header, so its content size can be read.
+constexpr size_t FRAME_HEADER_MAX = 18;
+
+// zstd. Files written by pzstd, `zstd -T0 --rsyncable` or any chunked writer
+// consist of many independent frames; those are decoded concurrently, up to
+// `threads` and MAX_IN_FLIGHT_BYTES at a time, and handed out in file order. A file that is one big
+// frame (plain `zstd`) is streamed.
+class ZstdDecoder : public StreamDecoder {
+public:
+    ZstdDecoder(int fd, unsigned threads) : fd_(fd), threads_(threads), in_(INPUT_CHUNK) {
+        stream_ctx_ = ZSTD_createDCtx();
+    }
+
+    ~ZstdDecoder() override {
+        for (auto& frame : pending_) frame.chunk.wait();
+        ZSTD_freeDCtx(stream_ctx_);
+    }
+
+    size_t read(uint8_t* dst, size_t n) override {
+        size_t out = 0;
+        while (out < n && !failed_) {
+            if (chunk_pos_ < chunk_.data.size()) {
+                const size_t take = std::min(n - out, chunk_.data.size() - chunk_pos_);
+                std::memcpy(dst + out, chunk_.data.data() + chunk_pos_, take);
+                chunk_pos_ += take;
+                out += take;
+                continue;
+            }
+            if (!pending_.empty()) {
+                chunk_ = pending_.front().chunk.get();
+                in_flight_bytes_ -= pending_.front().declared;
+                pending_.pop_front();
+                chunk_pos_ = 0;
+                if (!chunk_.ok) fail(chunk_.error);
+                // Keep the workers busy while this chunk is copied out.
+                schedule();
+                continue;
+            }
+            if (streaming_) {
+                out += streamFrame(dst + out, n - out);
+                continue;
+            }
+            // Spent: let its buffer go before counting the budget.
+            chunk_ = Chunk();
+            chunk_pos_ = 0;
+            schedule();
+            if (pending_.empty() && !streaming_) break;
+        }
+        return out;
+    }
+
+    bool failed() const override { return failed_; }
+
+private:
+    struct Chunk {
+        std::vector<uint8_t> data;
+        bool ok = true;
+        const char* error = "";
+    };
+
+    int fd_;
+    unsigned threads_;
+    // Compressed bytes not yet handed to a decoder: in_[in_begin_, in_end_).
+    std::vector<uint8_t> in_;
+    size_t in_begin_ = 0;
+    size_t in_end_ = 0;
+    bool eof_ = false;
+
+    struct InFlight {
+        std::future<Chunk> chunk;
+        // The frame header's content size, which its buffer is sized to.
+        size_t declared;
+    };
+
+    std::deque<InFlight> pending_;
+    size_t in_flight_bytes_ = 0;
+    Chunk chunk_;
+    size_t chunk_pos_ = 0;
+
+    ZSTD_DCtx* stream_ctx_ = nullptr;
+    bool streaming_ = false;
+    bool failed_ = false;
+
+    void fail(const char* why) {
+        if (!failed_) std::cerr << "Error: zstd input: " << why << std::endl;
+        failed_ = true;
+    }
+
+    size_t available() const { return in_end_ - in_begin_; }
+
+    // Pulls more compressed input, growing the buffer when a frame needs more
+    // than it holds. False at end of file or on error.
+    bool fill() {
+        if (eof_) return false;
+        if (in_begin_ > 0) {
+            std::memmove(in_.data(), in_.data() + in_begin_, available());
+            in_end_ -= in_begin_;
+            in_begin_ = 0;
+        }
+        if (in_end_ == in_.size()) {
+            in_.resize(in_.size() * 2);
+        }
+        const ssize_t r = readSome(fd_, in_.data() + in_end_, in_.size() - in_end_);
+        if (r < 0) {
+            fail(std::strerror(errno));
+            return false;
+        }
+        if (r == 0) {
+            eof_ = true;
+            return false;
+        }
+        in_end_ += static_cast<size_t>(r);
+        return true;
+    }
+
+    // Queues frames for the workers until `threads_` are in flight or the next
+    // would take the byte budget over, or hands the next frame to the
+    // streaming path if it is too big to decode whole.
+    // Streaming waits for the queue to drain first, to keep output in order.
+    void schedule() {
+        while (!failed_ && !streaming_ && pending_.size() < threads_) {
+            while (available() < FRAME_HEADER_MAX && fill()) {}
+            if (available() == 0) return;
+
+            const uint8_t* src = in_.data() + in_begin_;
+            const unsigned long long content = ZSTD_getFrameContentSize(src, available());
+            if (content == ZSTD_CONTENTSIZE_ERROR) {
+                fail("not a zstd frame");
+                return;
+            }
+            if (content == ZSTD_CONTENTSIZE_UNKNOWN || content > MAX_PARALLEL_FRAME) {
+                if (pending_.empty()) {
+                    ZSTD_DCtx_reset(stream_ctx_, ZSTD_reset_session_only);
+                    streaming_ = true;
+                }
+                return;
+            }
+            const size_t declared = static_cast<size_t>(content);
+            if (!pending_.empty() &&
+                in_flight_bytes_ + chunk_.data.size() + declared > MAX_IN_FLIGHT_BYTES) {
+                return;
+            }
+
+            size_t frame_len = ZSTD_findFrameCompressedSize(in_.data() + in_begin_, available());
+            while (ZSTD_isError(frame_len)) {
+                if (!fill()) {
+                    if (!failed_) fail("truncated zstd frame");
+                    return;
+                }
+                frame_len = ZSTD_findFrameCompressedSize(in_.data() + in_begin_, available());
+            }
+
+            std::vector<uint8_t> frame(in_.data() + in_begin_, in_.data() + in_begin_ + frame_len);
+            in_begin_ += frame_len;
+            pending_.push_back({std::async(std::launch::async, decodeFrame, std::move(frame),
+                                           declared),
+                                declared});
+            in_flight_bytes_ += declared;
+        }
+    }
+
+    static Chunk decodeFrame(std::vector<uint8_t> frame, size_t content) {
+        Chunk chunk;
+        chunk.data.resize(content);
+        ZSTD_DCtx* ctx = ZSTD_createDCtx();
+        const size_t r = ZSTD_decompressDCtx(ctx, chunk.data.data(), content,
+                                             frame.data(), frame.size());
+        ZSTD_freeDCtx(ctx);
+        if (ZSTD_isError(r)) {
+            chunk.ok = false;
+            chunk.error = ZSTD_getErrorName(r);
+            chunk.data.clear();
+        } else {
+            chunk.data.resize(r);
+        }
+        return chunk;
+    }
+
+    // Incremental decode of one large frame straight into the caller's buffer.
+    size_t streamFrame(uint8_t* dst, size_t n) {
+        ZSTD_outBuffer out{dst, n, 0};
+        while (out.pos < out.size) {
+            if (available() == 0 && !fill()) {
+                if (!failed_) fail("truncated zstd frame");
+                break;
+            }
+            ZSTD_inBuffer in{in_.data() + in_begin_, available(), 0};
+            const size_t r = ZSTD_decompressStream(stream_ctx_, &out, &in);
+            in_begin_ += in.pos;
+            if (ZSTD_isError(r)) {
+                fail(ZSTD_getErrorName(r));
+                break;
+            }
+            if (r == 0) {
+                // Frame complete; the next one may be small enough to fan out.
+                streaming_ = false;
+                break;
+            }
+        }
+        return out.pos;
+    }
+};
+
+#endif
+
+// Default decode threads: past a handful, the read-ahead and the parser are
+// the bottleneck, not frame decoding.
+constexpr unsigned MAX_DEFAULT_THREADS = 8;
+
+std::unique_ptr<StreamDecoder> makeStreamDecoder(Compression compression, int fd,
+                                                 unsigned threads) {
+    if (threads == 0) {
+        threads = std::min(MAX_DEFAULT_THREADS,
+                           std::max(2u, std::thread::hardware_concurrency()));
+    }
+    switch (compression) {
+#ifdef DPI_HAVE_ZLIB
+        case Compression::GZIP:
+            return std::make_unique<GzipDecoder>(fd);
+#endif
+#ifdef DPI_HAVE_ZSTD
+        case Compression::ZSTD:
+            return std::make_unique<ZstdDecoder>(fd, threads);
+#endif
+        default:
+            break;
+    }
+    std::cerr << "Error: This build cannot read " << compressionName(compression)
+              << "-compressed input" << std::endl;
+    return nullptr;
+}
+
+}
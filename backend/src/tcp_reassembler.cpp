@@ -0,0 +1,149 @@
+#include "tcp_reassembler.h"
+#include <algorithm>
+#include <cstring>
+
+namespace DPI {
+
+TcpReassembler::TcpReassembler() : TcpReassembler(Limits()) {
+}
+
+TcpReassembler::TcpReassembler(Limits limits)
+    : limits_(limits),
+      slots_(limits.max_flows) {
+    free_slots_.reserve(limits.max_flows);
+    for (size_t i = limits.max_flows; i > 0; i--) {
+        free_slots_.push_back(static_cast<uint32_t>(i - 1));
+    }
+    flows_.reserve(limits.max_flows);
+}
+
+bool TcpReassembler::begin(const FiveTuple& tuple, uint32_t seq, const uint8_t* data,
+                           size_t length) {
+    Slot* slot = claim(tuple);
+    if (!slot) return false;
+    slot->next_seq = seq + static_cast<uint32_t>(length);
+    if (!copyIn(*slot, data, length)) {
+        overflows_++;
+    }
+
+    flows_buffered_++;
+    in_progress_ = flows_.size();
+    if (flows_.size() > peak_flows_) peak_flows_ = flows_.size();
+    return true;
+}
+
+TcpReassembler::Slot* TcpReassembler::claim(const FiveTuple& tuple) {
+    auto existing = flows_.find(tuple);
+    if (existing != flows_.end()) {
+        releaseSlot(existing);
+    }
+    if (free_slots_.empty()) {
+        if (by_age_.empty()) return nullptr;
+        evicted_++;
+        releaseSlot(flows_.find(by_age_.front()));
+    }
+
+    const uint32_t index = free_slots_.back();
+    free_slots_.pop_back();
+    Slot& slot = slots_[index];
+    if (!slot.buffer) {
+        slot.buffer.reset(new uint8_t[limits_.bytes_per_flow]);
+    }
+    slot.length = 0;
+    by_age_.push_back(tuple);
+    slot.age = std::prev(by_age_.end());
+    flows_.emplace(tuple, index);
+    return &slot;
+}
+
+std::optional<TcpReassembler::View> TcpReassembler::append(const FiveTuple& tuple, uint32_t seq,
+                                                           const uint8_t* data, size_t length) {
+    auto it = flows_.find(tuple);
+    if (it == flows_.end()) {
+        return std::nullopt;
+    }
+    Slot& slot = slots_[it->second];
+
+    // How far this segment starts behind the end of the buffer, in sequence
+    // space: 0 continues it, more is a retransmission that may still carry
+    // new bytes, negative leaves a gap.
+    const int32_t behind = static_cast<int32_t>(slot.next_seq - seq);
+    if (behind < 0) {
+        out_of_order_++;
+    } else if (static_cast<size_t>(behind) < length && slot.length < limits_.bytes_per_flow) {
+        const size_t fresh = length - static_cast<size_t>(behind);
+        slot.next_seq += static_cast<uint32_t>(fresh);
+        segments_appended_++;
+        if (!copyIn(slot, data + behind, fresh)) {
+            overflows_++;
+        }
+    }
+
+    return View{slot.buffer.get(), slot.length, slot.length == limits_.bytes_per_flow};
+}
+
+void TcpReassembler::release(const FiveTuple& tuple) {
+    auto it = flows_.find(tuple);
+    if (it != flows_.end()) {
+        releaseSlot(it);
+        in_progress_ = flows_.size();
+    }
+}
+
+std::vector<TcpReassembler::FlowBuffer> TcpReassembler::extract(
+    const std::function<bool(uint64_t flow_hash)>& moving) {
+    const FiveTupleHash hasher;
+    std::vector<FlowBuffer> extracted;
+    for (auto it = flows_.begin(); it != flows_.end(); ) {
+        if (!moving(hasher(it->first))) {
+            ++it;
+            continue;
+        }
+        const Slot& slot = slots_[it->second];
+        extracted.push_back({it->first, slot.next_seq,
+                             std::vector<uint8_t>(slot.buffer.get(),
+                                                  slot.buffer.get() + slot.length)});
+        releaseSlot(it++);
+    }
+    in_progress_ = flows_.size();
+    return extracted;
+}
+
+void TcpReassembler::adopt(std::vector<FlowBuffer>&& flows) {
+    for (const auto& flow : flows) {
+        Slot* slot = claim(flow.tuple);
+        if (!slot) return;
+        slot->next_seq = flow.next_seq;
+        copyIn(*slot, flow.bytes.data(), flow.bytes.size());
+    }
+    in_progress_ = flows_.size();
+    if (flows_.size() > peak_flows_) peak_flows_ = flows_.size();
+}
+
+bool TcpReassembler::copyIn(Slot& slot, const uint8_t* data, size_t length) {
+    const size_t n = std::min(length, limits_.bytes_per_flow - slot.length);
+    std::memcpy(slot.buffer.get() + slot.length, data, n);
+    slot.length += n;
+    return n == length;
+}
+
+void TcpReassembler::releaseSlot(
+    std::unordered_map<FiveTuple, uint32_t, FiveTupleHash>::iterator it) {
+    by_age_.erase(slots_[it->second].age);
+    free_slots_.push_back(it->second);
+    flows_.erase(it);
+}
+
+TcpReassembler::Stats TcpReassembler::getStats() const {
+    Stats stats;
+    stats.flows_buffered = flows_buffered_.load();
+    stats.segments_appended = segments_appended_.load();
+    stats.out_of_order = out_of_order_.load();
+    stats.overflows = overflows_.load();
+    stats.evicted = evicted_.load();
+    stats.flows_in_progress = in_progress_.load();
+    stats.peak_flows = peak_flows_.load();
+    return stats;
+}
+
+}
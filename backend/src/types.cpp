@@ -6,21 +6,139 @@
 
 namespace DPI {
 
+std::optional<IPAddress> IPAddress::parse(const std::string& text) {
+    auto parseV4 = [](const std::string& s, uint8_t* out) {
+        int octet = -1;
+        int count = 0;
+        for (char c : s) {
+            if (c == '.') {
+                if (octet < 0 || count == 3) return false;
+                out[count++] = static_cast<uint8_t>(octet);
+                octet = -1;
+            } else if (c >= '0' && c <= '9') {
+                octet = (octet < 0 ? 0 : octet * 10) + (c - '0');
+                if (octet > 255) return false;
+            } else {
+                return false;
+            }
+        }
+        if (octet < 0 || count != 3) return false;
+        out[3] = static_cast<uint8_t>(octet);
+        return true;
+    };
+
+    IPAddress addr;
+    if (text.find(':') == std::string::npos) {
+        uint8_t v4[4];
+        if (!parseV4(text, v4)) return std::nullopt;
+        return fromV4Bytes(v4);
+    }
+
+    // Groups before and after "::", each up to 8 of 16 bits; a trailing
+    // dotted quad counts as two.
+    std::vector<uint16_t> head, tail;
+    std::vector<uint16_t>* groups = &head;
+    bool compressed = false;
+    size_t pos = 0;
+    if (text.compare(0, 2, "::") == 0) {
+        compressed = true;
+        groups = &tail;
+        pos = 2;
+    }
+    while (pos < text.size()) {
+        size_t end = text.find(':', pos);
+        const std::string group = text.substr(pos, end == std::string::npos ? std::string::npos
+                                                                            : end - pos);
+        if (group.find('.') != std::string::npos) {
+            uint8_t v4[4];
+            if (end != std::string::npos || !parseV4(group, v4)) return std::nullopt;
+            groups->push_back(static_cast<uint16_t>((v4[0] << 8) | v4[1]));
+            groups->push_back(static_cast<uint16_t>((v4[2] << 8) | v4[3]));
+            break;
+        }
+        if (group.empty() || group.size() > 4) return std::nullopt;
+        uint16_t value = 0;
+        for (char c : group) {
+            if (!std::isxdigit(static_cast<unsigned char>(c))) return std::nullopt;
+            value = static_cast<uint16_t>((value << 4) |
+                (c <= '9' ? c - '0' : (std::tolower(static_cast<unsigned char>(c)) - 'a' + 10)));
+        }
+        groups->push_back(value);
+        if (end == std::string::npos) break;
+        pos = end + 1;
+        if (pos < text.size() && text[pos] == ':') {
+            if (compressed) return std::nullopt;
+            compressed = true;
+            groups = &tail;
+            pos++;
+        } else if (pos == text.size()) {
+            return std::nullopt;
+        }
+    }
+
+    const size_t total = head.size() + tail.size();
+    if (compressed ? total > 7 : total != 8) return std::nullopt;
+    for (size_t i = 0; i < head.size(); i++) {
+        addr.bytes[2 * i] = static_cast<uint8_t>(head[i] >> 8);
+        addr.bytes[2 * i + 1] = static_cast<uint8_t>(head[i]);
+    }
+    const size_t tail_start = 8 - tail.size();
+    for (size_t i = 0; i < tail.size(); i++) {
+        addr.bytes[2 * (tail_start + i)] = static_cast<uint8_t>(tail[i] >> 8);
+        addr.bytes[2 * (tail_start + i) + 1] = static_cast<uint8_t>(tail[i]);
+    }
+    return addr;
+}
+
+std::string IPAddress::toString() const {
+    std::ostringstream ss;
+    if (isV4()) {
+        ss << static_cast<int>(bytes[12]) << "." << static_cast<int>(bytes[13]) << "."
+           << static_cast<int>(bytes[14]) << "." << static_cast<int>(bytes[15]);
+        return ss.str();
+    }
+
+    // RFC 5952: the longest run of two or more zero groups becomes "::".
+    uint16_t groups[8];
+    for (int i = 0; i < 8; i++) {
+        groups[i] = static_cast<uint16_t>((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+    }
+    int best_start = -1, best_len = 1;
+    for (int i = 0; i < 8;) {
+        int j = i;
+        while (j < 8 && groups[j] == 0) j++;
+        if (j - i > best_len) {
+            best_start = i;
+            best_len = j - i;
+        }
+        i = j == i ? i + 1 : j;
+    }
+
+    ss << std::hex;
+    for (int i = 0; i < 8; i++) {
+        if (i == best_start) {
+            ss << "::";
+            i += best_len - 1;
+            continue;
+        }
+        if (i && i != best_start + best_len) ss << ":";
+        ss << groups[i];
+    }
+    return ss.str();
+}
+
 std::string FiveTuple::toString() const {
     std::ostringstream ss;
+    const bool v6 = !src_ip.isV4() || !dst_ip.isV4();
     
-    auto formatIP = [](uint32_t ip) {
-        std::ostringstream s;
-        s << ((ip >> 0) & 0xFF) << "."
-          << ((ip >> 8) & 0xFF) << "."
-          << ((ip >> 16) & 0xFF) << "."
-          << ((ip >> 24) & 0xFF);
-        return s.str();
+    auto endpoint = [&](const IPAddress& ip, uint16_t port) {
+        return v6 ? "[" + ip.toString() + "]:" + std::to_string(port)
+                  : ip.toString() + ":" + std::to_string(port);
     };
     
-    ss << formatIP(src_ip) << ":" << src_port
+    ss << endpoint(src_ip, src_port)
        << " -> "
-       << formatIP(dst_ip) << ":" << dst_port
+       << endpoint(dst_ip, dst_port)
        << " (" << (protocol == 6 ? "TCP" : protocol == 17 ? "UDP" : "?") << ")";
     
     return ss.str();
@@ -0,0 +1,769 @@
+// Correctness tests for the capture readers.
+//
+//   cd backend && ./build.sh && ./build/bin/dpi_capture_tests
+//
+// Same shape as test_extractors.cpp: plain checks and a counter. Each test
+// writes a small capture to the temp directory and reads it back through every
+// access path the engine can take, because the paths are separate code and a
+// record-boundary bug in one would otherwise hide behind the other.
+
+#include "capture_source.h"
+#include "pcap_reader.h"
+#include "pcap_chunk_reader.h"
+#include "pcapng_reader.h"
+#include "read_ahead.h"
+#include "live_capture.h"
+#include "pcap_writer.h"
+#include "stream_decoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#ifdef DPI_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef DPI_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace PacketAnalyzer;
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond, what)                                                      \
+    do {                                                                       \
+        ++checks;                                                              \
+        if (!(cond)) {                                                         \
+            ++failures;                                                        \
+            std::cerr << "FAIL " << (what) << "  [" << __FILE__ << ":"         \
+                      << __LINE__ << "]\n";                                    \
+        }                                                                      \
+    } while (0)
+
+static std::string tempPath(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static void putLE32(std::vector<uint8_t>& v, uint32_t x) {
+    for (int i = 0; i < 4; i++) v.push_back(static_cast<uint8_t>(x >> (8 * i)));
+}
+
+static void putLE16(std::vector<uint8_t>& v, uint16_t x) {
+    v.push_back(static_cast<uint8_t>(x & 0xFF));
+    v.push_back(static_cast<uint8_t>(x >> 8));
+}
+
+/** Frames of distinct sizes and contents, so a shifted boundary cannot match. */
+static std::vector<std::vector<uint8_t>> sampleFrames(size_t count) {
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t i = 0; i < count; i++) {
+        std::vector<uint8_t> f(60 + (i * 37) % 1400);
+        for (size_t j = 0; j < f.size(); j++) f[j] = static_cast<uint8_t>(i * 31 + j);
+        frames.push_back(std::move(f));
+    }
+    return frames;
+}
+
+static std::vector<uint8_t> classicPcap(const std::vector<std::vector<uint8_t>>& frames) {
+    std::vector<uint8_t> out;
+    putLE32(out, 0xa1b2c3d4);
+    putLE16(out, 2);
+    putLE16(out, 4);
+    putLE32(out, 0);
+    putLE32(out, 0);
+    putLE32(out, 65535);
+    putLE32(out, 1);
+    for (size_t i = 0; i < frames.size(); i++) {
+        putLE32(out, static_cast<uint32_t>(1000 + i));
+        putLE32(out, static_cast<uint32_t>(i * 10));
+        putLE32(out, static_cast<uint32_t>(frames[i].size()));
+        putLE32(out, static_cast<uint32_t>(frames[i].size()));
+        out.insert(out.end(), frames[i].begin(), frames[i].end());
+    }
+    return out;
+}
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& bytes) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+static std::vector<RawPacket> readAll(PcapReader& reader, std::vector<std::vector<uint8_t>>& copies) {
+    std::vector<RawPacket> packets;
+    RawPacket raw;
+    while (reader.readNextPacket(raw)) {
+        copies.emplace_back(raw.payload(), raw.payload() + raw.size());
+        packets.push_back(raw);
+    }
+    return packets;
+}
+
+static void testClassicPcapAccessPaths() {
+    const auto frames = sampleFrames(50);
+    const std::string path = tempPath("dpi_capture_classic.pcap");
+    writeFile(path, classicPcap(frames));
+
+    for (bool use_mmap : {false, true}) {
+        const std::string mode = use_mmap ? "mmap" : "stream";
+        PcapReader reader(true);
+        reader.enableMemoryMap(use_mmap);
+        CHECK(reader.open(path), mode + ": opens a classic pcap");
+        CHECK(reader.isMemoryMapped() == use_mmap, mode + ": uses the requested access path");
+        CHECK(reader.getGlobalHeader().network == 1, mode + ": link type read");
+
+        std::vector<std::vector<uint8_t>> copies;
+        auto packets = readAll(reader, copies);
+        CHECK(packets.size() == frames.size(), mode + ": every record read");
+        bool all_equal = packets.size() == frames.size();
+        for (size_t i = 0; all_equal && i < frames.size(); i++) {
+            all_equal = copies[i] == frames[i] &&
+                        packets[i].header.ts_sec == 1000 + i &&
+                        packets[i].header.ts_usec == i * 10;
+        }
+        CHECK(all_equal, mode + ": bytes and timestamps match what was written");
+        if (use_mmap && !packets.empty()) {
+            CHECK(packets[0].mapped != nullptr && packets[0].data.empty(),
+                  "mmap: packets borrow from the mapping instead of copying");
+        }
+    }
+
+    // A record whose length runs past end of file must end the read cleanly,
+    // not hand out a pointer past the mapping.
+    auto truncated = classicPcap(frames);
+    truncated.resize(truncated.size() - 10);
+    writeFile(path, truncated);
+    for (bool use_mmap : {false, true}) {
+        PcapReader reader(true);
+        reader.enableMemoryMap(use_mmap);
+        CHECK(reader.open(path), "truncated capture still opens");
+        std::vector<std::vector<uint8_t>> copies;
+        auto packets = readAll(reader, copies);
+        CHECK(packets.size() == frames.size() - 1,
+              std::string(use_mmap ? "mmap" : "stream") + ": truncated last record is not returned");
+    }
+
+    std::remove(path.c_str());
+}
+
+// The read-ahead ring with the smallest legal block, so most spans straddle a
+// block boundary and some cover several blocks.
+static void testReadAhead() {
+    std::vector<uint8_t> bytes(100000);
+    for (size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<uint8_t>(i * 7 + i / 251);
+    const std::string path = tempPath("dpi_capture_readahead.bin");
+    writeFile(path, bytes);
+
+    for (bool direct : {false, true}) {
+        const std::string mode = direct ? "direct" : "buffered";
+        ReadAheadOptions options;
+        options.block_size = 4096;
+        options.ring_blocks = 2;
+        options.direct_io = direct;
+
+        ReadAheadReader reader;
+        reader.setOptions(options);
+        CHECK(reader.open(path), mode + ": read-ahead opens");
+
+        size_t offset = 0;
+        bool all_equal = true;
+        for (size_t step = 1; offset < bytes.size(); step = step * 5 % 9973 + 1) {
+            const size_t n = std::min(step, bytes.size() - offset);
+            const uint8_t* p = reader.next(n);
+            if (!p || std::memcmp(p, bytes.data() + offset, n) != 0) {
+                all_equal = false;
+                break;
+            }
+            offset += n;
+        }
+        CHECK(all_equal && offset == bytes.size(), mode + ": spans match the file, across blocks");
+        CHECK(reader.next(1) == nullptr, mode + ": end of file reported");
+        CHECK(reader.getStats().straddled_records > 0, mode + ": some spans straddled blocks");
+        CHECK(reader.getStats().bytes_read == bytes.size(), mode + ": every byte read once");
+    }
+
+    // A span running past end of file fails rather than returning short.
+    ReadAheadReader reader;
+    CHECK(reader.open(path), "read-ahead reopens");
+    CHECK(reader.next(bytes.size() - 10) != nullptr, "read-ahead: long span read");
+    CHECK(reader.next(20) == nullptr, "read-ahead: span past end of file fails");
+
+    // The classic reader's stream path over the same ring, records straddling.
+    const auto frames = sampleFrames(50);
+    writeFile(path, classicPcap(frames));
+    ReadAheadOptions small;
+    small.block_size = 4096;
+    small.ring_blocks = 2;
+    PcapReader pcap(true);
+    pcap.enableMemoryMap(false);
+    pcap.setReadAheadOptions(small);
+    CHECK(pcap.open(path), "read-ahead: classic pcap opens");
+    std::vector<std::vector<uint8_t>> copies;
+    readAll(pcap, copies);
+    CHECK(copies == frames, "read-ahead: classic records intact across small blocks");
+    CHECK(pcap.readAheadStats().straddled_records > 0, "read-ahead: classic records straddled blocks");
+
+    std::remove(path.c_str());
+}
+
+// pcapng writer for the tests. Big-endian sections are produced by the same
+// code so both byte orders exercise identical block layouts.
+struct NgWriter {
+    std::vector<uint8_t> out;
+    bool big_endian = false;
+
+    void u16(std::vector<uint8_t>& v, uint16_t x) const {
+        if (big_endian) { v.push_back(x >> 8); v.push_back(x & 0xFF); }
+        else putLE16(v, x);
+    }
+    void u32(std::vector<uint8_t>& v, uint32_t x) const {
+        if (big_endian) { for (int i = 3; i >= 0; i--) v.push_back(static_cast<uint8_t>(x >> (8 * i))); }
+        else putLE32(v, x);
+    }
+    void block(uint32_t type, std::vector<uint8_t> body) {
+        while (body.size() % 4) body.push_back(0);
+        const uint32_t total = static_cast<uint32_t>(body.size() + 12);
+        u32(out, type);
+        u32(out, total);
+        out.insert(out.end(), body.begin(), body.end());
+        u32(out, total);
+    }
+    void section() {
+        std::vector<uint8_t> b;
+        u32(b, 0x1A2B3C4D);
+        u16(b, 1);
+        u16(b, 0);
+        for (int i = 0; i < 8; i++) b.push_back(0xFF);   // section length: unknown
+        block(PcapngReader::BLOCK_SHB, b);
+    }
+    void interface(uint16_t link_type, int tsresol = -1) {
+        std::vector<uint8_t> b;
+        u16(b, link_type);
+        u16(b, 0);
+        u32(b, 0);                                        // snaplen: unlimited
+        if (tsresol >= 0) {
+            u16(b, 9);
+            u16(b, 1);
+            b.push_back(static_cast<uint8_t>(tsresol));
+            b.insert(b.end(), 3, 0);
+            u16(b, 0);
+            u16(b, 0);
+        }
+        block(PcapngReader::BLOCK_IDB, b);
+    }
+    void epb(uint32_t iface, uint64_t ticks, const std::vector<uint8_t>& frame) {
+        std::vector<uint8_t> b;
+        u32(b, iface);
+        u32(b, static_cast<uint32_t>(ticks >> 32));
+        u32(b, static_cast<uint32_t>(ticks));
+        u32(b, static_cast<uint32_t>(frame.size()));
+        u32(b, static_cast<uint32_t>(frame.size()));
+        b.insert(b.end(), frame.begin(), frame.end());
+        block(PcapngReader::BLOCK_EPB, b);
+    }
+    void spb(const std::vector<uint8_t>& frame) {
+        std::vector<uint8_t> b;
+        u32(b, static_cast<uint32_t>(frame.size()));
+        b.insert(b.end(), frame.begin(), frame.end());
+        block(PcapngReader::BLOCK_SPB, b);
+    }
+};
+
+static void testPcapng() {
+    const auto frames = sampleFrames(6);
+    NgWriter w;
+    w.section();
+    w.interface(1);                       // default resolution: microseconds
+    w.interface(1, 9);                    // nanoseconds
+    w.interface(101);                     // raw IP: not writable under Ethernet
+    w.block(4, std::vector<uint8_t>(16, 0xAB));   // name resolution block: skipped
+    w.epb(0, 5000001234ull, frames[0]);           // 5000 s + 1234 us
+    w.epb(1, 7000000123456789ull, frames[1]);     // 7000000 s + 123456 us
+    w.epb(2, 1, frames[2]);                       // mismatched link type
+    w.spb(frames[3]);                             // inherits the previous timestamp
+    w.big_endian = true;                  // new section, other byte order
+    w.section();
+    w.interface(1, 0x80 | 10);            // 2^-10 s units
+    w.epb(0, (42ull << 10) | 512, frames[4]);     // 42.5 s
+    w.epb(0, 43ull << 10, frames[5]);
+
+    const std::string path = tempPath("dpi_capture.pcapng");
+    writeFile(path, w.out);
+
+    for (bool use_mmap : {false, true}) {
+        const std::string mode = use_mmap ? "pcapng mmap" : "pcapng stream";
+        CaptureOptions options;
+        options.silent = true;
+        options.use_mmap = use_mmap;
+        auto source = openCaptureSource(path, options);
+        CHECK(source != nullptr, mode + ": opened through the format sniffer");
+        if (!source) continue;
+        CHECK(dynamic_cast<PcapngReader*>(source.get()) != nullptr,
+              mode + ": sniffer picked the pcapng reader");
+        CHECK(source->isMemoryMapped() == use_mmap, mode + ": uses the requested access path");
+        CHECK(source->getGlobalHeader().network == 1 &&
+              source->getGlobalHeader().magic_number == 0xa1b2c3d4,
+              mode + ": output header is classic pcap with the first interface's link type");
+
+        std::vector<RawPacket> packets;
+        std::vector<std::vector<uint8_t>> copies;
+        RawPacket raw;
+        while (source->readNextPacket(raw)) {
+            copies.emplace_back(raw.payload(), raw.payload() + raw.size());
+            packets.push_back(raw);
+        }
+
+        CHECK(packets.size() == 5, mode + ": five Ethernet packets across two sections");
+        if (packets.size() != 5) continue;
+        CHECK(copies[0] == frames[0] && copies[1] == frames[1] && copies[2] == frames[3] &&
+              copies[3] == frames[4] && copies[4] == frames[5],
+              mode + ": packet bytes survive both byte orders and block types");
+        CHECK(packets[0].header.ts_sec == 5000 && packets[0].header.ts_usec == 1234,
+              mode + ": microsecond interface timestamps");
+        CHECK(packets[1].header.ts_sec == 7000000 && packets[1].header.ts_usec == 123456,
+              mode + ": nanosecond interface scaled to microseconds");
+        CHECK(packets[2].header.ts_sec == 7000000 && packets[2].header.ts_usec == 123456,
+              mode + ": SPB reuses the previous timestamp");
+        CHECK(packets[3].header.ts_sec == 42 && packets[3].header.ts_usec == 500000,
+              mode + ": binary-resolution interface in a big-endian section");
+        CHECK(packets[4].header.ts_sec == 43 && packets[4].header.ts_usec == 0,
+              mode + ": second packet in the big-endian section");
+        auto* ng = dynamic_cast<PcapngReader*>(source.get());
+        CHECK(ng && ng->skippedLinkTypeMismatches() == 1,
+              mode + ": packet on a mismatched link type skipped and counted");
+    }
+
+    // A block length running past end of file ends the read instead of
+    // reading past the buffer.
+    auto truncated = w.out;
+    truncated.resize(truncated.size() - 8);
+    writeFile(path, truncated);
+    for (bool use_mmap : {false, true}) {
+        CaptureOptions options;
+        options.silent = true;
+        options.use_mmap = use_mmap;
+        auto source = openCaptureSource(path, options);
+        size_t n = 0;
+        RawPacket raw;
+        while (source && source->readNextPacket(raw)) n++;
+        CHECK(n == 4, std::string(use_mmap ? "mmap" : "stream") +
+                          ": truncated final pcapng block is not returned");
+    }
+
+    std::remove(path.c_str());
+}
+
+static void testSnifferClassic() {
+    const std::string path = tempPath("dpi_capture_sniff.pcap");
+    writeFile(path, classicPcap(sampleFrames(3)));
+    CaptureOptions options;
+    options.silent = true;
+    auto source = openCaptureSource(path, options);
+    CHECK(source && dynamic_cast<PcapReader*>(source.get()) != nullptr,
+          "sniffer picks the classic reader for a classic pcap");
+
+    // Big-endian, nanosecond-resolution classic pcap: packets come out in host
+    // order with microseconds, and the header describing them says so.
+    std::vector<uint8_t> be;
+    auto putBE32 = [&be](uint32_t x) {
+        for (int i = 3; i >= 0; i--) be.push_back(static_cast<uint8_t>(x >> (8 * i)));
+    };
+    putBE32(0xa1b23c4d);
+    be.insert(be.end(), {0x00, 0x02, 0x00, 0x04});
+    putBE32(0);
+    putBE32(0);
+    putBE32(65535);
+    putBE32(1);
+    const auto frame = sampleFrames(1)[0];
+    putBE32(77);
+    putBE32(123456789);
+    putBE32(static_cast<uint32_t>(frame.size()));
+    putBE32(static_cast<uint32_t>(frame.size()));
+    be.insert(be.end(), frame.begin(), frame.end());
+    writeFile(path, be);
+    source = openCaptureSource(path, options);
+    RawPacket raw;
+    CHECK(source && source->readNextPacket(raw), "big-endian nanosecond pcap opens and reads");
+    if (source) {
+        CHECK(source->getGlobalHeader().magic_number == 0xa1b2c3d4 &&
+              source->getGlobalHeader().snaplen == 65535,
+              "header normalised to native byte order and microseconds");
+        CHECK(raw.header.ts_sec == 77 && raw.header.ts_usec == 123456 &&
+              raw.size() == frame.size(),
+              "nanosecond timestamp scaled to microseconds");
+    }
+
+    writeFile(path, std::vector<uint8_t>(64, 0x42));
+    CHECK(openCaptureSource(path, options) == nullptr, "unknown magic is rejected");
+    std::remove(path.c_str());
+}
+
+static void checkCompressedRoundTrip(const std::string& path,
+                                     const std::vector<std::vector<uint8_t>>& frames,
+                                     const std::string& what) {
+    CaptureOptions options;
+    options.silent = true;
+    options.read_ahead.block_size = 4096;
+    auto source = openCaptureSource(path, options);
+    CHECK(source != nullptr, what + ": opens");
+    if (!source) return;
+    CHECK(!source->isMemoryMapped(), what + ": streamed, never mapped");
+    std::vector<std::vector<uint8_t>> copies;
+    RawPacket raw;
+    while (source->readNextPacket(raw)) copies.emplace_back(raw.payload(), raw.payload() + raw.size());
+    CHECK(copies == frames, what + ": every record intact");
+}
+
+// Compressed inputs: gzip with two concatenated members, and zstd as several
+// independent frames (the parallel path) plus one frame of unstated size (the
+// streaming path). Each split lands mid-record, as real chunked writers do.
+static void testCompressedInputs() {
+    const auto frames = sampleFrames(200);
+    const auto plain = classicPcap(frames);
+    const std::string path = tempPath("dpi_capture_compressed.pcap.z");
+    const size_t split = plain.size() / 3 + 7;
+
+    CHECK(detectCompression(plain.data(), plain.size()) == Compression::NONE,
+          "compression: plain pcap is not mistaken for compressed");
+
+#ifdef DPI_HAVE_ZLIB
+    {
+        std::vector<uint8_t> gz;
+        for (auto part : {std::make_pair(size_t{0}, split), std::make_pair(split, plain.size())}) {
+            z_stream zs{};
+            deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+            std::vector<uint8_t> out(deflateBound(&zs, part.second - part.first) + 64);
+            zs.next_in = const_cast<uint8_t*>(plain.data() + part.first);
+            zs.avail_in = static_cast<uInt>(part.second - part.first);
+            zs.next_out = out.data();
+            zs.avail_out = static_cast<uInt>(out.size());
+            deflate(&zs, Z_FINISH);
+            out.resize(zs.total_out);
+            deflateEnd(&zs);
+            gz.insert(gz.end(), out.begin(), out.end());
+        }
+        CHECK(detectCompression(gz.data(), gz.size()) == Compression::GZIP, "gzip: detected by magic");
+        writeFile(path, gz);
+        checkCompressedRoundTrip(path, frames, "gzip");
+
+        gz.resize(gz.size() - 40);
+        writeFile(path, gz);
+        CaptureOptions options;
+        options.silent = true;
+        std::cerr.setstate(std::ios::failbit);
+        auto source = openCaptureSource(path, options);
+        size_t n = 0;
+        RawPacket raw;
+        while (source && source->readNextPacket(raw)) n++;
+        source.reset();
+        std::cerr.clear();
+        CHECK(n > 0 && n < frames.size(), "gzip: truncated stream ends the read early");
+    }
+#else
+    std::cout << "skip: gzip input (built without zlib)\n";
+#endif
+
+#ifdef DPI_HAVE_ZSTD
+    {
+        std::vector<uint8_t> zst;
+        const size_t chunk = plain.size() / 5 + 3;
+        for (size_t off = 0; off < plain.size(); off += chunk) {
+            const size_t len = std::min(chunk, plain.size() - off);
+            std::vector<uint8_t> out(ZSTD_compressBound(len));
+            out.resize(ZSTD_compress(out.data(), out.size(), plain.data() + off, len, 3));
+            zst.insert(zst.end(), out.begin(), out.end());
+        }
+        CHECK(detectCompression(zst.data(), zst.size()) == Compression::ZSTD, "zstd: detected by magic");
+        writeFile(path, zst);
+        checkCompressedRoundTrip(path, frames, "zstd frames");
+
+        // Streamed compression leaves the content size out of the header.
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        std::vector<uint8_t> streamed(ZSTD_compressBound(plain.size()) + 1024);
+        ZSTD_outBuffer out{streamed.data(), streamed.size(), 0};
+        ZSTD_inBuffer first{plain.data(), split, 0};
+        ZSTD_compressStream2(cctx, &out, &first, ZSTD_e_continue);
+        ZSTD_inBuffer rest{plain.data() + split, plain.size() - split, 0};
+        while (ZSTD_compressStream2(cctx, &out, &rest, ZSTD_e_end) != 0) {}
+        ZSTD_freeCCtx(cctx);
+        streamed.resize(out.pos);
+        CHECK(ZSTD_getFrameContentSize(streamed.data(), streamed.size()) == ZSTD_CONTENTSIZE_UNKNOWN,
+              "zstd: test frame really has no stated size");
+        // Followed by a small frame, to check the decoder fans out again after.
+        const size_t tail_len = 24;
+        std::vector<uint8_t> tail(ZSTD_compressBound(tail_len));
+        tail.resize(ZSTD_compress(tail.data(), tail.size(), plain.data(), tail_len, 3));
+        writeFile(path, streamed);
+        checkCompressedRoundTrip(path, frames, "zstd streamed frame");
+
+        streamed.insert(streamed.end(), tail.begin(), tail.end());
+        writeFile(path, streamed);
+        int fd = ::open(path.c_str(), O_RDONLY);
+        auto decoder = makeStreamDecoder(Compression::ZSTD, fd, 2);
+        std::vector<uint8_t> all(plain.size() + tail_len + 100);
+        size_t got = 0, n;
+        while ((n = decoder->read(all.data() + got, std::min<size_t>(1000, all.size() - got))) > 0) got += n;
+        ::close(fd);
+        all.resize(got);
+        std::vector<uint8_t> expected = plain;
+        expected.insert(expected.end(), plain.begin(), plain.begin() + tail_len);
+        CHECK(all == expected && !decoder->failed(), "zstd: streamed frame then a parallel one");
+    }
+#else
+    std::cout << "skip: zstd input (built without libzstd)\n";
+#endif
+
+    std::remove(path.c_str());
+}
+
+// Small batches and few iovecs force every flush path: arena full, iovecs
+// exhausted, a payload larger than the arena, and the final flush on close.
+// Splits a capture at arbitrary byte offsets and checks that the ranges,
+// each resynced on its own, tile the file: every record read exactly once, in
+// file order when the ranges are concatenated.
+static void testPcapChunks() {
+    auto frames = sampleFrames(300);
+    // A header-shaped run inside a packet: plausible on its own, but what
+    // follows it is not, so a resync must not stop there.
+    {
+        std::vector<uint8_t> fake;
+        putLE32(fake, 1100);
+        putLE32(fake, 0);
+        putLE32(fake, 20);
+        putLE32(fake, 20);
+        std::copy(fake.begin(), fake.end(), frames[100].begin() + 40);
+    }
+    const auto bytes = classicPcap(frames);
+    const std::string path = tempPath("dpi_capture_chunks.pcap");
+    writeFile(path, bytes);
+
+    std::vector<size_t> offsets;
+    size_t offset = sizeof(PcapGlobalHeader);
+    for (const auto& f : frames) {
+        offsets.push_back(offset);
+        offset += sizeof(PcapPacketHeader) + f.size();
+    }
+
+    PcapReader file(true);
+    file.enableMemoryMap(true);
+    CHECK(file.open(path) && file.isMemoryMapped(), "chunks: file maps");
+
+    CHECK(PcapChunkReader::resync(file, 0) == offsets[0], "chunks: resync from the start lands on record 0");
+    CHECK(PcapChunkReader::resync(file, offsets[7] + 1) == offsets[8],
+          "chunks: resync from inside a record lands on the next one");
+    CHECK(PcapChunkReader::resync(file, offsets[100] + 41) == offsets[101],
+          "chunks: resync skips a lone header-shaped run in packet bytes");
+    CHECK(PcapChunkReader::resync(file, offsets.back() + 1) == bytes.size(),
+          "chunks: resync past the last record finds nothing");
+
+    for (size_t parts : {1, 2, 3, 7, 16, 64}) {
+        const std::string mode = "chunks x" + std::to_string(parts);
+        const size_t span = (bytes.size() + parts - 1) / parts;
+        std::vector<std::vector<uint8_t>> copies;
+        bool tiled = true;
+        size_t prev_stop = sizeof(PcapGlobalHeader);
+        for (size_t i = 0; i < parts; i++) {
+            PcapChunkReader chunk(file, i * span, std::min(bytes.size(), (i + 1) * span));
+            RawPacket raw;
+            while (chunk.readNextPacket(raw)) {
+                copies.emplace_back(raw.payload(), raw.payload() + raw.size());
+            }
+            tiled = tiled && !chunk.failed() && chunk.startOffset() == prev_stop;
+            prev_stop = chunk.stopOffset();
+        }
+        CHECK(tiled && prev_stop == bytes.size(), mode + ": ranges meet exactly at record boundaries");
+        CHECK(copies == frames, mode + ": every record once, in order");
+    }
+    std::remove(path.c_str());
+}
+
+static void testPcapWriter() {
+    auto frames = sampleFrames(40);
+    frames.push_back(std::vector<uint8_t>(9000, 0x5A));   // larger than the arena
+    const std::string path = tempPath("dpi_capture_writer.pcap");
+
+    PcapWriter::Options options;
+    options.batch_bytes = 4096;
+    options.max_iovecs = 8;
+    PcapWriter writer(options);
+    CHECK(writer.open(path), "writer: opens");
+
+    PcapGlobalHeader global{0xa1b2c3d4, 2, 4, 0, 0, 65535, 1};
+    CHECK(writer.writeGlobalHeader(global), "writer: global header queued");
+    for (size_t i = 0; i < frames.size(); i++) {
+        PcapPacketHeader header{static_cast<uint32_t>(1000 + i), static_cast<uint32_t>(i), 0, 0};
+        header.incl_len = header.orig_len = static_cast<uint32_t>(frames[i].size());
+        // Alternate borrowed and copied payloads; a copied one is scribbled
+        // over right after, which must not reach the file.
+        std::vector<uint8_t> scratch = frames[i];
+        const bool stable = i % 2 == 0;
+        writer.writePacket(header, stable ? frames[i].data() : scratch.data(), scratch.size(), stable);
+        std::fill(scratch.begin(), scratch.end(), 0xEE);
+    }
+    CHECK(writer.close(), "writer: closes cleanly");
+
+    auto stats = writer.getStats();
+    CHECK(stats.packets_written == frames.size(), "writer: every packet counted");
+    CHECK(stats.flushes > 2, "writer: output went out in several batches");
+
+    PcapReader reader(true);
+    CHECK(reader.open(path), "writer: output reads back");
+    std::vector<std::vector<uint8_t>> copies;
+    auto packets = readAll(reader, copies);
+    CHECK(copies == frames, "writer: every record intact and in order");
+    CHECK(packets.size() == frames.size() && packets.back().header.ts_sec == 1000 + frames.size() - 1,
+          "writer: headers intact");
+    CHECK(stats.bytes_written == sizeof(PcapGlobalHeader) + frames.size() * sizeof(PcapPacketHeader) +
+                                     [&] { size_t n = 0; for (auto& f : frames) n += f.size(); return n; }(),
+          "writer: byte count matches the file");
+
+    std::remove(path.c_str());
+}
+
+// Forwarding by range: records taken from a mapped input with some dropped,
+// so the writer sees long runs (copied in the kernel), short runs (written
+// from the mapping) and an ordinary packet in between.
+static void testRangeForwarding() {
+#ifdef __linux__
+    const auto frames = sampleFrames(400);
+    const std::string in_path = tempPath("dpi_capture_range_in.pcap");
+    const std::string out_path = tempPath("dpi_capture_range_out.pcap");
+    writeFile(in_path, classicPcap(frames));
+
+    PcapReader input(true);
+    input.enableMemoryMap(true);
+    CHECK(input.open(in_path) && input.isMemoryMapped(), "ranges: input maps");
+    const int fd = ::open(in_path.c_str(), O_RDONLY);
+
+    PcapWriter writer;
+    CHECK(writer.open(out_path), "ranges: output opens");
+    writer.setRangeSource(fd, input.mapping().data());
+    writer.writeGlobalHeader(input.getGlobalHeader());
+
+    const std::set<size_t> dropped = {3, 4, 200, 201, 202, 350, 399};
+    std::vector<std::vector<uint8_t>> expected;
+    RawPacket raw;
+    for (size_t i = 0; input.readNextPacket(raw); i++) {
+        if (dropped.count(i)) continue;
+        expected.emplace_back(raw.payload(), raw.payload() + raw.size());
+        if (i == 300) {
+            // Rebuilt rather than copied: must land between its neighbours.
+            writer.writePacket(raw.header, raw.payload(), raw.size(), true);
+        } else {
+            writer.writeRecordFromSource(raw.mapped - sizeof(PcapPacketHeader),
+                                         sizeof(PcapPacketHeader) + raw.size());
+        }
+    }
+    CHECK(writer.close(), "ranges: closes cleanly");
+    ::close(fd);
+
+    const auto stats = writer.getStats();
+    CHECK(stats.packets_written == expected.size(), "ranges: every record counted");
+    CHECK(stats.range_copies > 0 && stats.range_copy_bytes > 64 * 1024,
+          "ranges: long runs went through copy_file_range");
+
+    PcapReader reader(true);
+    CHECK(reader.open(out_path), "ranges: output reads back");
+    std::vector<std::vector<uint8_t>> copies;
+    auto packets = readAll(reader, copies);
+    CHECK(copies == expected, "ranges: forwarded records intact and in order");
+    CHECK(std::filesystem::file_size(out_path) == stats.bytes_written,
+          "ranges: byte count matches the file");
+
+    std::remove(in_path.c_str());
+    std::remove(out_path.c_str());
+#endif
+}
+
+// Two fanout rings on loopback with locally generated UDP. Needs CAP_NET_RAW;
+// without it the test reports itself skipped rather than failed.
+static void testLiveLoopback() {
+#ifdef __linux__
+    LiveCaptureOptions options;
+    options.interface = "lo";
+    options.block_size = 1 << 16;
+    options.block_count = 8;
+    options.promiscuous = false;
+
+    const uint16_t group = static_cast<uint16_t>((::getpid() & 0xFFFF) | 1);
+    AfPacketRing rings[2];
+    std::cerr.setstate(std::ios::failbit);
+    const bool opened = rings[0].open(options, group) && rings[1].open(options, group);
+    std::cerr.clear();
+    if (!opened) {
+        std::cout << "skip: live capture (no CAP_NET_RAW or AF_PACKET)\n";
+        return;
+    }
+
+    // Eight flows, distinguished by destination port, each sent several times.
+    const int FLOWS = 8, PER_FLOW = 5;
+    int sock = ::socket(AF_INET, SOCK_DGRAM, 0);
+    for (int round = 0; round < PER_FLOW; round++) {
+        for (int f = 0; f < FLOWS; f++) {
+            sockaddr_in to{};
+            to.sin_family = AF_INET;
+            to.sin_port = htons(static_cast<uint16_t>(47100 + f));
+            to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            const char payload[] = "dpi-live-test";
+            ::sendto(sock, payload, sizeof(payload), 0, reinterpret_cast<sockaddr*>(&to), sizeof(to));
+        }
+    }
+    ::close(sock);
+
+    // Frame: 14 Ethernet + 20 IPv4 + 8 UDP; the destination port identifies
+    // the flow. Loopback also carries ICMP port-unreachable replies, ignored.
+    std::map<uint16_t, std::set<int>> rings_per_flow;
+    int seen = 0;
+    for (int attempt = 0; attempt < 20 && seen < FLOWS * PER_FLOW; attempt++) {
+        for (int r = 0; r < 2; r++) {
+            rings[r].poll(20, [&](const RawPacket& raw) {
+                const uint8_t* p = raw.payload();
+                if (raw.size() < 42 || p[12] != 0x08 || p[13] != 0x00 || p[23] != 17) return;
+                const uint16_t port = static_cast<uint16_t>((p[36] << 8) | p[37]);
+                if (port < 47100 || port >= 47100 + FLOWS) return;
+                rings_per_flow[port].insert(r);
+                seen++;
+            });
+        }
+    }
+
+    CHECK(seen == FLOWS * PER_FLOW, "live: every datagram captured exactly once across the group");
+    bool pinned = rings_per_flow.size() == static_cast<size_t>(FLOWS);
+    for (const auto& entry : rings_per_flow) pinned = pinned && entry.second.size() == 1;
+    CHECK(pinned, "live: each flow stays on one ring");
+    CHECK(rings[0].globalHeader().network == 1, "live: output header is Ethernet");
+#endif
+}
+
+int main() {
+    testClassicPcapAccessPaths();
+    testReadAhead();
+    testPcapng();
+    testSnifferClassic();
+    testPcapChunks();
+    testPcapWriter();
+    testRangeForwarding();
+    testCompressedInputs();
+    testLiveLoopback();
+
+    std::cout << (failures ? "FAILED " : "ok ") << (checks - failures) << "/" << checks
+              << " checks\n";
+    return failures ? 1 : 0;
+}
@@ -1,4 +1,5 @@
-// Correctness tests for the protocol extractors and app classifier.
+// Correctness tests for the protocol extractors, the frame decoder and the app
+// classifier.
 //
 //   cd backend && ./build.sh && ./build/bin/dpi_tests
 //
@@ -11,8 +12,11 @@
 // stopped classifying would have looked healthy in CI.
 
 #include "sni_extractor.h"
+#include "packet_decoder.h"
+#include "tcp_reassembler.h"
 #include "types.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
@@ -97,6 +101,26 @@ static void testSniExtraction() {
               "truncated ClientHello yields no malformed SNI");
     }
 
+    // A ClientHello spread over segments: the first one says how much is to
+    // come, and the SNI is there once the segments are put back together.
+    const size_t first = rec.size() / 2;
+    CHECK(SNIExtractor::pendingClientHelloLength(rec.data(), first) == rec.size() &&
+              SNIExtractor::pendingClientHelloLength(rec.data(), rec.size()) == 0,
+          "pending ClientHello length from the record header");
+    {
+        FiveTuple flow{};
+        flow.protocol = 6;
+        flow.dst_port = 443;
+        TcpReassembler streams;
+        CHECK(!SNIExtractor::extract(rec.data(), first).has_value() &&
+                  streams.begin(flow, 1000, rec.data(), first),
+              "first segment alone yields no SNI and is buffered");
+        auto view = streams.append(flow, 1000 + first, rec.data() + first, rec.size() - first);
+        CHECK(view && SNIExtractor::extract(view->data, view->length).value_or("") ==
+                          "www.youtube.com",
+              "SNI from the reassembled ClientHello");
+    }
+
     const uint8_t junk[] = {0x17, 0x03, 0x03, 0x00, 0x05, 0x01, 0x02, 0x03, 0x04, 0x05};
     CHECK(!SNIExtractor::isTLSClientHello(junk, sizeof(junk)),
           "application data is not a ClientHello");
@@ -168,6 +192,10 @@ static void testHttpHost() {
     CHECK(!HTTPHostExtractor::extract(q, no_host.size()).has_value(),
           "a request without Host yields nothing");
 
+    CHECK(!HTTPHostExtractor::isIncompleteRequest(p, req.size()) &&
+              HTTPHostExtractor::isIncompleteRequest(p, 20),
+          "request headers cut short are incomplete");
+
     const std::string tls_bytes = "\x16\x03\x01\x00\x05";
     CHECK(!HTTPHostExtractor::isHTTPRequest(
               reinterpret_cast<const uint8_t*>(tls_bytes.data()), tls_bytes.size()),
@@ -197,11 +225,323 @@ static void testDnsQuery() {
           "a truncated header is not a query");
 }
 
+/** IPv4 + TCP or UDP with `payload`, wrapped in nothing: a bare IP packet.
+ *  Any other protocol gets `payload` straight after the IP header. */
+static std::vector<uint8_t> ipv4Packet(uint8_t protocol, const std::vector<uint8_t>& payload,
+                                       uint16_t frag = 0, uint16_t sport = 40000,
+                                       uint16_t dport = 443) {
+    const size_t l4 = protocol == 6 ? 20 : protocol == 17 ? 8 : 0;
+    std::vector<uint8_t> p = {0x45, 0x00};
+    put16(p, static_cast<uint16_t>(20 + l4 + payload.size()));
+    put16(p, 0x1234);
+    put16(p, frag);
+    p.insert(p.end(), {64, protocol, 0, 0, 10, 0, 0, 1, 93, 184, 216, 34});
+    if (protocol == 6) {
+        put16(p, sport);
+        put16(p, dport);
+        p.insert(p.end(), {0, 0, 0, 1, 0, 0, 0, 0, 0x50, 0x18, 0xff, 0xff, 0, 0, 0, 0});
+    } else if (protocol == 17) {
+        put16(p, sport);
+        put16(p, dport);
+        put16(p, static_cast<uint16_t>(8 + payload.size()));
+        put16(p, 0);
+    }
+    p.insert(p.end(), payload.begin(), payload.end());
+    return p;
+}
+
+static std::vector<uint8_t> withEthernet(const std::vector<uint8_t>& ip, uint16_t ether_type,
+                                         std::vector<uint16_t> vlans = {}) {
+    std::vector<uint8_t> f(12, 0x02);
+    for (uint16_t tpid : vlans) {
+        put16(f, tpid);
+        put16(f, 100);   // the tag control field
+    }
+    put16(f, ether_type);
+    f.insert(f.end(), ip.begin(), ip.end());
+    return f;
+}
+
+static void testPacketDecoder() {
+    const std::vector<uint8_t> payload = {'h', 'e', 'l', 'l', 'o'};
+    const auto tcp = ipv4Packet(6, payload);
+
+    // Ethernet, padded to the 60-byte minimum: the padding is not payload.
+    {
+        auto f = withEthernet(tcp, 0x0800);
+        f.resize(std::max<size_t>(f.size(), 60) + 6, 0x00);
+        PacketJob job;
+        CHECK(PacketDecoder::decode(f.data(), f.size(), LinkType::ETHERNET, job) ==
+                  PacketDecoder::Result::OK, "decoder: Ethernet IPv4/TCP decodes");
+        CHECK(job.ip_offset == 14 && job.transport_offset == 34 && job.payload_offset == 54,
+              "decoder: Ethernet offsets");
+        CHECK(job.payload_length == payload.size(), "decoder: Ethernet padding is not payload");
+        CHECK(job.tuple.src_ip == IPAddress::fromV4(10u | (1u << 24)) && job.tuple.dst_port == 443 &&
+              job.tuple.protocol == 6 && job.tcp_flags == 0x18,
+              "decoder: tuple and flags");
+    }
+
+    // 802.1Q and QinQ tags move everything along by four bytes each.
+    {
+        auto f = withEthernet(tcp, 0x0800, {0x88A8, 0x8100});
+        PacketJob job;
+        CHECK(PacketDecoder::decode(f.data(), f.size(), LinkType::ETHERNET, job) ==
+                  PacketDecoder::Result::OK && job.ip_offset == 22 && job.payload_offset == 62,
+              "decoder: QinQ-tagged frame lands on the IP header");
+    }
+
+    // Linux cooked capture (v1), bare IP and DLT_NULL.
+    {
+        std::vector<uint8_t> sll(14, 0x00);
+        put16(sll, 0x0800);
+        sll.insert(sll.end(), tcp.begin(), tcp.end());
+        PacketJob job;
+        CHECK(PacketDecoder::decode(sll.data(), sll.size(), LinkType::LINUX_SLL, job) ==
+                  PacketDecoder::Result::OK && job.ip_offset == 16,
+              "decoder: Linux cooked capture");
+
+        PacketJob raw;
+        CHECK(PacketDecoder::decode(tcp.data(), tcp.size(), LinkType::RAW, raw) ==
+                  PacketDecoder::Result::OK && raw.ip_offset == 0 && raw.payload_offset == 40,
+              "decoder: bare IP");
+
+        std::vector<uint8_t> null = {2, 0, 0, 0};   // AF_INET, little-endian host
+        null.insert(null.end(), tcp.begin(), tcp.end());
+        PacketJob lo;
+        CHECK(PacketDecoder::decode(null.data(), null.size(), LinkType::NULL_LOOPBACK, lo) ==
+                  PacketDecoder::Result::OK && lo.ip_offset == 4,
+              "decoder: BSD loopback");
+    }
+
+    // IPv6 with a hop-by-hop header in front of UDP.
+    {
+        std::vector<uint8_t> v6 = {0x60, 0, 0, 0};
+        put16(v6, static_cast<uint16_t>(8 + 8 + payload.size()));
+        v6.push_back(0);      // next header: hop-by-hop
+        v6.push_back(64);
+        v6.insert(v6.end(), 32, 0x20);
+        v6.insert(v6.end(), {17, 0, 1, 4, 0, 0, 0, 0});   // -> UDP, 8 bytes
+        put16(v6, 5353);
+        put16(v6, 53);
+        put16(v6, static_cast<uint16_t>(8 + payload.size()));
+        put16(v6, 0);
+        v6.insert(v6.end(), payload.begin(), payload.end());
+        auto f = withEthernet(v6, 0x86DD);
+        PacketJob job;
+        CHECK(PacketDecoder::decode(f.data(), f.size(), LinkType::ETHERNET, job) ==
+                  PacketDecoder::Result::OK && job.transport_offset == 14 + 40 + 8 &&
+                  job.tuple.protocol == 17 && job.tuple.dst_port == 53 &&
+                  job.payload_length == payload.size(),
+              "decoder: IPv6 extension header walked to UDP");
+    }
+
+    // Fragments go to the FP's reassembler, with where their data belongs.
+    {
+        PacketJob frag;
+        auto f = withEthernet(ipv4Packet(6, payload, 0x2000), 0x0800);
+        CHECK(PacketDecoder::decode(f.data(), f.size(), LinkType::ETHERNET, frag) ==
+                  PacketDecoder::Result::FRAGMENT && frag.is_fragmented &&
+                  frag.fragment_id == 0x1234 && frag.fragment_offset == 0 &&
+                  frag.more_fragments && frag.tuple.protocol == 6 &&
+                  frag.tuple.src_port == 0 && frag.payload_offset == 14 + 20 &&
+                  frag.payload_length == 20 + payload.size(),
+              "decoder: first IPv4 fragment spans the TCP header and payload");
+
+        PacketJob tail;
+        auto t = withEthernet(ipv4Packet(17, payload, 0x0003), 0x0800);
+        CHECK(PacketDecoder::decode(t.data(), t.size(), LinkType::ETHERNET, tail) ==
+                  PacketDecoder::Result::FRAGMENT && tail.fragment_offset == 24 &&
+                  !tail.more_fragments,
+              "decoder: last IPv4 fragment offset in bytes");
+
+        std::vector<uint8_t> v6 = {0x60, 0, 0, 0};
+        put16(v6, static_cast<uint16_t>(8 + payload.size()));
+        v6.insert(v6.end(), {44, 64});
+        v6.insert(v6.end(), 32, 0x20);
+        v6.insert(v6.end(), {17, 0});
+        put16(v6, (185 << 3) | 1);
+        v6.insert(v6.end(), {0xde, 0xad, 0xbe, 0xef});
+        v6.insert(v6.end(), payload.begin(), payload.end());
+        auto g = withEthernet(v6, 0x86DD);
+        PacketJob frag6;
+        CHECK(PacketDecoder::decode(g.data(), g.size(), LinkType::ETHERNET, frag6) ==
+                  PacketDecoder::Result::FRAGMENT && frag6.fragment_id == 0xdeadbeef &&
+                  frag6.fragment_offset == 185 * 8 && frag6.more_fragments &&
+                  frag6.tuple.protocol == 17 && frag6.payload_offset == 14 + 40 + 8 &&
+                  frag6.payload_length == payload.size(),
+              "decoder: IPv6 fragment header read");
+
+        v6.resize(40 + 4);
+        auto h = withEthernet(v6, 0x86DD);
+        PacketJob cut6;
+        CHECK(PacketDecoder::decode(h.data(), h.size(), LinkType::ETHERNET, cut6) ==
+                  PacketDecoder::Result::MALFORMED, "decoder: truncated fragment header");
+    }
+
+    // What the FPs never see.
+    {
+
+        PacketJob cut;
+        auto t = withEthernet(tcp, 0x0800);
+        t.resize(14 + 20 + 10);
+        CHECK(PacketDecoder::decode(t.data(), t.size(), LinkType::ETHERNET, cut) ==
+                  PacketDecoder::Result::MALFORMED, "decoder: truncated TCP header is malformed");
+
+        PacketJob arp;
+        auto a = withEthernet(std::vector<uint8_t>(28, 0), 0x0806);
+        CHECK(PacketDecoder::decode(a.data(), a.size(), LinkType::ETHERNET, arp) ==
+                  PacketDecoder::Result::NOT_IP, "decoder: ARP is not IP");
+
+        PacketJob other;
+        CHECK(PacketDecoder::decode(tcp.data(), tcp.size(), 147, other) ==
+                  PacketDecoder::Result::UNSUPPORTED_LINK, "decoder: unknown link type");
+    }
+}
+
+// decodeBatch's fixed-offset path has to agree with decode() on every frame,
+// including the ones that look like the common shape but are not.
+static void testDecodeBatch() {
+    const std::vector<uint8_t> payload = {'h', 'e', 'l', 'l', 'o'};
+    std::vector<std::vector<uint8_t>> frames;
+    frames.push_back(withEthernet(ipv4Packet(6, payload), 0x0800));
+    frames.push_back(withEthernet(ipv4Packet(17, payload), 0x0800));
+    auto padded = withEthernet(ipv4Packet(17, {}), 0x0800);
+    padded.resize(60, 0);
+    frames.push_back(padded);
+    frames.push_back(withEthernet(ipv4Packet(6, payload), 0x0800, {0x8100}));
+    frames.push_back(withEthernet(ipv4Packet(6, payload, 0x4000), 0x0800));   // DF only
+    frames.push_back(withEthernet(ipv4Packet(6, payload, 0x2000), 0x0800));   // MF
+    auto cut = withEthernet(ipv4Packet(6, payload), 0x0800);
+    cut.resize(14 + 20 + 12);
+    frames.push_back(cut);
+    auto bad_offset = withEthernet(ipv4Packet(6, payload), 0x0800);
+    bad_offset[14 + 20 + 12] = 0x20;   // TCP header shorter than 20 bytes
+    frames.push_back(bad_offset);
+    auto zero_len = withEthernet(ipv4Packet(6, payload), 0x0800);
+    zero_len[16] = zero_len[17] = 0;   // TSO: no IP length
+    frames.push_back(zero_len);
+    frames.push_back(withEthernet(std::vector<uint8_t>(28, 0), 0x0806));
+    frames.push_back(std::vector<uint8_t>(20, 0x08));
+
+    std::vector<PacketDecoder::Frame> in;
+    for (const auto& f : frames) in.push_back({f.data(), f.size()});
+    std::vector<PacketJob> batch(in.size());
+    std::vector<PacketDecoder::Result> results(in.size());
+    PacketDecoder::decodeBatch(in.data(), in.size(), LinkType::ETHERNET, batch.data(),
+                               results.data());
+
+    bool same = true;
+    for (size_t i = 0; i < in.size(); i++) {
+        PacketJob one;
+        const auto r = PacketDecoder::decode(in[i].data, in[i].length, LinkType::ETHERNET, one);
+        same = same && r == results[i];
+        if (r != PacketDecoder::Result::OK) continue;
+        same = same && one.tuple == batch[i].tuple && one.tcp_flags == batch[i].tcp_flags &&
+               one.ip_offset == batch[i].ip_offset &&
+               one.transport_offset == batch[i].transport_offset &&
+               one.payload_offset == batch[i].payload_offset &&
+               one.payload_length == batch[i].payload_length &&
+               batch[i].flow_hash == FiveTupleHash{}(one.tuple);
+        if (!same) std::cerr << "  batch decode differs at frame " << i << "\n";
+    }
+    CHECK(same, "decoder: batch decode matches decode()");
+    CHECK(results[0] == PacketDecoder::Result::OK && results[2] == PacketDecoder::Result::OK &&
+              batch[2].payload_length == 0 && results[5] == PacketDecoder::Result::FRAGMENT &&
+              results[6] == PacketDecoder::Result::MALFORMED,
+          "decoder: batch results");
+}
+
+// Tunneled traffic is decoded, hashed and tracked on the inner flow.
+static void testTunnels() {
+    const std::vector<uint8_t> payload = {'h', 'e', 'l', 'l', 'o'};
+    auto inner = ipv4Packet(6, payload, 0, 51515, 8443);
+    auto innerEthernet = withEthernet(inner, 0x0800, {0x8100});
+    const size_t inner_len = inner.size();
+
+    auto expectInner = [&](const std::vector<uint8_t>& frame, size_t ip_offset,
+                           const char* what) {
+        PacketJob job;
+        const bool ok = PacketDecoder::decode(frame.data(), frame.size(), LinkType::ETHERNET,
+                                              job) == PacketDecoder::Result::OK;
+        CHECK(ok && job.ip_offset == ip_offset && job.tuple.src_port == 51515 &&
+                  job.tuple.dst_port == 8443 && job.tuple.protocol == 6 &&
+                  job.payload_length == payload.size() &&
+                  job.payload_offset == ip_offset + inner_len - payload.size(),
+              what);
+    };
+
+    // GRE with a key, carrying IPv4.
+    std::vector<uint8_t> gre = {0x20, 0x00, 0x08, 0x00, 0, 0, 0, 42};
+    gre.insert(gre.end(), inner.begin(), inner.end());
+    expectInner(withEthernet(ipv4Packet(47, gre), 0x0800), 14 + 20 + 8, "decoder: GRE/IPv4");
+
+    // GRE carrying Ethernet (transparent bridging), then VXLAN and Geneve.
+    std::vector<uint8_t> teb = {0x00, 0x00, 0x65, 0x58};
+    teb.insert(teb.end(), innerEthernet.begin(), innerEthernet.end());
+    expectInner(withEthernet(ipv4Packet(47, teb), 0x0800), 14 + 20 + 4 + 18,
+                "decoder: GRE/Ethernet/VLAN");
+
+    std::vector<uint8_t> vxlan = {0x08, 0, 0, 0, 0, 0x12, 0x34, 0};
+    vxlan.insert(vxlan.end(), innerEthernet.begin(), innerEthernet.end());
+    const auto vxlan_frame = withEthernet(ipv4Packet(17, vxlan, 0, 61000, 4789), 0x0800);
+    expectInner(vxlan_frame, 14 + 28 + 8 + 18, "decoder: VXLAN");
+
+    std::vector<uint8_t> geneve = {0x02, 0x00, 0x65, 0x58, 0, 0, 0x2a, 0,
+                                   0x01, 0x02, 0x03, 0x01, 0, 0, 0, 0};   // one 8-byte option
+    geneve.insert(geneve.end(), innerEthernet.begin(), innerEthernet.end());
+    expectInner(withEthernet(ipv4Packet(17, geneve, 0, 61000, 6081), 0x0800),
+                14 + 28 + 16 + 18, "decoder: Geneve with options");
+
+    // Two MPLS labels over IPv4.
+    std::vector<uint8_t> mpls = {0x00, 0x01, 0x00, 0x40, 0x00, 0x02, 0x01, 0x40};
+    mpls.insert(mpls.end(), inner.begin(), inner.end());
+    expectInner(withEthernet(mpls, 0x8847, {0x88A8, 0x8100}), 14 + 8 + 8,
+                "decoder: QinQ + MPLS");
+
+    // A UDP packet to 4789 without the VNI flag is just UDP.
+    {
+        std::vector<uint8_t> not_vxlan(16, 0);
+        auto f = withEthernet(ipv4Packet(17, not_vxlan, 0, 61000, 4789), 0x0800);
+        PacketJob job;
+        CHECK(PacketDecoder::decode(f.data(), f.size(), LinkType::ETHERNET, job) ==
+                  PacketDecoder::Result::OK && job.tuple.dst_port == 4789,
+              "decoder: VXLAN port without a VXLAN header");
+    }
+
+    // Inner flows behind one pair of VTEPs spread over the FPs instead of
+    // all hashing on the outer addresses, batch path included.
+    const size_t flows = 1024, fps = 8;
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t i = 0; i < flows; i++) {
+        auto e = withEthernet(ipv4Packet(6, payload, 0, static_cast<uint16_t>(20000 + i), 443),
+                              0x0800);
+        std::vector<uint8_t> v = {0x08, 0, 0, 0, 0, 0x12, 0x34, 0};
+        v.insert(v.end(), e.begin(), e.end());
+        frames.push_back(withEthernet(ipv4Packet(17, v, 0, 61000, 4789), 0x0800));
+    }
+    std::vector<PacketDecoder::Frame> in;
+    for (const auto& f : frames) in.push_back({f.data(), f.size()});
+    std::vector<PacketJob> jobs(flows);
+    std::vector<PacketDecoder::Result> results(flows);
+    PacketDecoder::decodeBatch(in.data(), flows, LinkType::ETHERNET, jobs.data(), results.data());
+    std::vector<size_t> per_fp(fps, 0);
+    for (size_t i = 0; i < flows; i++) per_fp[jobs[i].flow_hash % fps]++;
+    CHECK(std::all_of(results.begin(), results.end(),
+                      [](PacketDecoder::Result r) { return r == PacketDecoder::Result::OK; }) &&
+              jobs[7].tuple.src_port == 20007,
+          "decoder: batch decode sees through VXLAN");
+    CHECK(*std::min_element(per_fp.begin(), per_fp.end()) > flows / fps / 2,
+          "decoder: VXLAN inner flows spread over FPs");
+}
+
 int main() {
     testSniExtraction();
     testAppClassification();
     testHttpHost();
     testDnsQuery();
+    testPacketDecoder();
+    testDecodeBatch();
+    testTunnels();
 
     std::cout << (failures ? "FAILED " : "ok ") << (checks - failures) << "/" << checks
               << " checks\n";
@@ -0,0 +1,1297 @@
+// Correctness tests for the pipeline stages between the reader and the
+// output file.
+//
+//   cd backend && ./build.sh && ./build/bin/dpi_pipeline_tests
+//
+// Same shape as test_extractors.cpp: plain checks and a counter. Each stage is
+// driven directly, single-threaded, with the arrival orders the FP threads can
+// produce, so a failure points at the stage rather than at a thread schedule.
+// The engine tests at the end run the whole pipeline over a capture they
+// write, for what only holds across stages.
+
+#include "connection_tracker.h"
+#include "cpu_affinity.h"
+#include "dpi_engine.h"
+#include "fast_path.h"
+#include "flow_rebalancer.h"
+#include "fragment_reassembler.h"
+#include "fragment_steering.h"
+#include "indirection_table.h"
+#include "load_balancer.h"
+#include "mpsc_queue.h"
+#include "reorder_buffer.h"
+#include "rule_manager.h"
+#include "spsc_queue.h"
+#include "tcp_reassembler.h"
+#include "thread_load.h"
+#include "thread_safe_queue.h"
+#include "types.h"
+#include "wait_policy.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace DPI;
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond, what)                                                      \
+    do {                                                                       \
+        ++checks;                                                              \
+        if (!(cond)) {                                                         \
+            ++failures;                                                        \
+            std::cerr << "FAIL " << (what) << "  [" << __FILE__ << ":"         \
+                      << __LINE__ << "]\n";                                    \
+        }                                                                      \
+    } while (0)
+
+static PacketJob jobWithId(uint32_t id) {
+    PacketJob job;
+    job.packet_id = id;
+    job.data.assign(4, static_cast<uint8_t>(id));
+    return job;
+}
+
+static void testReorderBuffer() {
+    std::vector<uint32_t> out;
+    ReorderBuffer rb(8, [&out](const PacketJob& job) { out.push_back(job.packet_id); });
+
+    // 0..9 arrive shuffled; 3 and 6 were dropped and come back as holes.
+    for (uint32_t id : {1u, 0u, 4u, 2u, 7u, 5u, 9u, 8u}) rb.push(jobWithId(id));
+    CHECK(out == std::vector<uint32_t>({0, 1, 2}), "reorder: held behind the first gap");
+    rb.pushHole(6);
+    rb.pushHole(3);
+    CHECK(out == std::vector<uint32_t>({0, 1, 2, 4, 5, 7, 8, 9}), "reorder: holes release the rest in order");
+    auto stats = rb.getStats();
+    CHECK(stats.current_occupancy == 0, "reorder: nothing held once the gaps are filled");
+    CHECK(stats.max_occupancy == 7, "reorder: peak occupancy tracked");
+    CHECK(stats.holes == 2 && stats.forced_skips == 0, "reorder: hole and skip counts");
+
+    // A gap that never fills: the window forces past it instead of stalling.
+    out.clear();
+    for (uint32_t id = 11; id < 18; id++) rb.push(jobWithId(id));
+    CHECK(out.empty(), "reorder: a full window still waits");
+    rb.push(jobWithId(18));
+    CHECK(out == std::vector<uint32_t>({11, 12, 13, 14, 15, 16, 17, 18}),
+          "reorder: window overflow skips the missing id");
+    CHECK(rb.getStats().forced_skips == 1, "reorder: forced skip counted");
+    rb.push(jobWithId(10));
+    CHECK(out.back() == 10 && rb.getStats().late_packets == 1, "reorder: a late packet is still written");
+
+    // End of input: everything still held comes out, in order, past any gap.
+    out.clear();
+    rb.push(jobWithId(30));
+    rb.push(jobWithId(28));
+    rb.flush();
+    CHECK(out == std::vector<uint32_t>({28, 30}),
+          "reorder: flush drains in order");
+
+}
+
+static IPAddress addr(const std::string& text) {
+    return IPAddress::parse(text).value_or(IPAddress{});
+}
+
+// The flow key every stage uses: connection tracking, LB/FP selection and the
+// IP rules.
+static void testDualStackFlows() {
+    CHECK(addr("2001:db8::1").toString() == "2001:db8::1", "ip: IPv6 round trip");
+    CHECK(addr("2001:db8:0:0:1:0:0:1").toString() == "2001:db8::1:0:0:1",
+          "ip: the longest zero run is the one compressed");
+    CHECK(addr("::ffff:10.0.0.1") == IPAddress::fromV4(10u | (1u << 24)) &&
+              addr("10.0.0.1").isV4() && addr("10.0.0.1").toString() == "10.0.0.1",
+          "ip: IPv4 is held v4-mapped");
+    CHECK(!IPAddress::parse("10.0.0.256") && !IPAddress::parse("1::2::3") &&
+              !IPAddress::parse("2001:db8:1") && !IPAddress::parse("fe80::1:"),
+          "ip: malformed text rejected");
+
+    // v6 flows that differ only in the host part of one /64, and flows that
+    // differ only in the prefix, both spread over the FPs like v4 does.
+    const size_t fps = 8;
+    for (int vary_prefix = 0; vary_prefix < 2; vary_prefix++) {
+        std::vector<size_t> per_fp(fps, 0);
+        const size_t flows = 4096;
+        for (size_t i = 0; i < flows; i++) {
+            FiveTuple t{addr("2001:db8::"), addr("2a00:1450:4001::200e"), 50000, 443, 6};
+            t.src_ip.bytes[vary_prefix ? 5 : 15] = static_cast<uint8_t>(i);
+            t.src_ip.bytes[vary_prefix ? 4 : 14] = static_cast<uint8_t>(i >> 8);
+            per_fp[FiveTupleHash{}(t) % fps]++;
+        }
+        const auto [lo, hi] = std::minmax_element(per_fp.begin(), per_fp.end());
+        CHECK(*lo > flows / fps / 2 && *hi < flows / fps * 3 / 2,
+              vary_prefix ? "ip: v6 prefixes spread over FPs" : "ip: v6 hosts spread over FPs");
+    }
+
+    // A v6 flow and the v4 flow that the old 32-bit fold mapped it onto are
+    // distinct connections now.
+    ConnectionTracker tracker(0);
+    FiveTuple v6{addr("::a00:1"), addr("::5db8:d822"), 40000, 443, 6};
+    FiveTuple v4{addr("10.0.0.1"), addr("93.184.216.34"), 40000, 443, 6};
+    tracker.getOrCreateConnection(v6);
+    tracker.getOrCreateConnection(v4);
+    CHECK(tracker.getActiveCount() == 2, "ip: v4 and v6 flows tracked apart");
+    CHECK(tracker.getConnection(v6.reverse()) != nullptr, "ip: v6 reverse lookup");
+
+    RuleManager rules;
+    rules.blockIP("2001:db8::bad");
+    rules.blockIP("192.168.1.50");
+    CHECK(rules.shouldBlock(addr("2001:db8::bad"), 443, AppType::UNKNOWN, ""),
+          "ip: v6 source blocked");
+    CHECK(rules.shouldBlock(addr("192.168.1.50"), 443, AppType::UNKNOWN, ""),
+          "ip: v4 source blocked");
+    CHECK(!rules.shouldBlock(addr("2001:db8::bae"), 443, AppType::UNKNOWN, "") &&
+              !rules.shouldBlock(addr("::c0a8:132"), 443, AppType::UNKNOWN, ""),
+          "ip: neighbours and the v4-compatible form are not");
+}
+
+/** A fragment as the decoder leaves it: its bytes of the datagram, owned. */
+static PacketJob fragmentJob(const IPAddress& src, uint8_t protocol, uint32_t id,
+                             const std::vector<uint8_t>& datagram, size_t begin, size_t end,
+                             bool more, uint32_t ts_sec = 100) {
+    PacketJob job;
+    job.packet_id = static_cast<uint32_t>(begin);
+    // No ports: FiveTuple leaves them unset, and the decoder zeroes them.
+    job.tuple = FiveTuple{};
+    job.tuple.src_ip = src;
+    job.tuple.dst_ip = addr("93.184.216.34");
+    job.tuple.protocol = protocol;
+    job.is_fragmented = true;
+    job.fragment_id = id;
+    job.fragment_offset = static_cast<uint32_t>(begin);
+    job.more_fragments = more;
+    job.data.assign(datagram.begin() + begin, datagram.begin() + end);
+    job.payload_length = end - begin;
+    job.ts_sec = ts_sec;
+    job.ts_usec = 0;
+    return job;
+}
+
+/** A 48-byte UDP (5353 -> 53) or TCP (40000 -> 443) datagram. */
+static std::vector<uint8_t> transportDatagram(uint8_t protocol) {
+    std::vector<uint8_t> d(48);
+    for (size_t i = 0; i < d.size(); i++) d[i] = static_cast<uint8_t>(i);
+    if (protocol == 17) {
+        d[0] = 0x14; d[1] = 0xe9; d[2] = 0; d[3] = 53;
+    } else {
+        d[0] = 0x9c; d[1] = 0x40; d[2] = 0x01; d[3] = 0xbb;
+        d[12] = 0x50;
+        d[13] = 0x18;
+    }
+    return d;
+}
+
+static void testFragmentReassembly() {
+    const IPAddress v4 = addr("10.0.0.1");
+    const IPAddress v6 = addr("2001:db8::1");
+    std::vector<PacketJob> held, dropped;
+    PacketJob datagram;
+
+    {
+        FragmentReassembler r;
+        const auto udp = transportDatagram(17);
+        CHECK(!r.add(fragmentJob(v4, 17, 1, udp, 0, 16, true), datagram, held, dropped) &&
+                  !r.add(fragmentJob(v4, 17, 1, udp, 16, 32, true), datagram, held, dropped),
+              "frag: incomplete datagram held");
+        CHECK(r.add(fragmentJob(v4, 17, 1, udp, 32, 48, false), datagram, held, dropped),
+              "frag: last fragment completes it");
+        CHECK(datagram.tuple.src_port == 5353 && datagram.tuple.dst_port == 53 &&
+                  datagram.payload_length == 40 && datagram.payload_data &&
+                  std::equal(udp.begin() + 8, udp.end(), datagram.payload_data),
+              "frag: UDP ports and payload reassembled");
+        CHECK(held.size() == 3 && held[0].packet_id == 0 && held[2].packet_id == 32 &&
+                  dropped.empty(),
+              "frag: every fragment handed back for the verdict");
+        held.clear();
+    }
+
+    {
+        FragmentReassembler r;
+        const auto tcp = transportDatagram(6);
+        r.add(fragmentJob(v6, 6, 7, tcp, 32, 48, false), datagram, held, dropped);
+        r.add(fragmentJob(v6, 6, 7, tcp, 0, 16, true), datagram, held, dropped);
+        // A different id from the same host is another datagram.
+        r.add(fragmentJob(v6, 6, 8, tcp, 16, 32, true), datagram, held, dropped);
+        CHECK(r.add(fragmentJob(v6, 6, 7, tcp, 16, 32, true), datagram, held, dropped) &&
+                  datagram.tuple.src_ip == v6 && datagram.tuple.dst_port == 443 &&
+                  datagram.tcp_flags == 0x18 && datagram.payload_length == 28 &&
+                  std::equal(tcp.begin() + 20, tcp.end(), datagram.payload_data),
+              "frag: IPv6 TCP out of order");
+        CHECK(r.getStats().datagrams_in_progress == 1, "frag: the other id still in progress");
+        r.flush(dropped);
+        CHECK(dropped.size() == 1 && r.getStats().datagrams_in_progress == 0 &&
+                  r.getStats().bytes_in_use == 0,
+              "frag: flush gives back the incomplete one");
+        held.clear();
+        dropped.clear();
+    }
+
+    // A repeat is dropped on its own; anything else overlapping sinks the
+    // whole datagram.
+    {
+        FragmentReassembler r;
+        const auto udp = transportDatagram(17);
+        r.add(fragmentJob(v4, 17, 2, udp, 0, 16, true), datagram, held, dropped);
+        r.add(fragmentJob(v4, 17, 2, udp, 0, 16, true), datagram, held, dropped);
+        CHECK(dropped.size() == 1 && r.getStats().duplicates == 1 &&
+                  r.getStats().datagrams_in_progress == 1,
+              "frag: exact duplicate dropped alone");
+        dropped.clear();
+        r.add(fragmentJob(v4, 17, 2, udp, 8, 24, true), datagram, held, dropped);
+        CHECK(dropped.size() == 2 && r.getStats().overlapping == 1 &&
+                  r.getStats().datagrams_in_progress == 0,
+              "frag: overlap discards the datagram");
+        dropped.clear();
+        r.add(fragmentJob(v4, 17, 3, udp, 0, 12, true), datagram, held, dropped);
+        CHECK(dropped.size() == 1 && r.getStats().malformed == 1,
+              "frag: non-final fragment not a multiple of 8");
+        dropped.clear();
+    }
+
+    // Timeouts run on packet time.
+    {
+        FragmentReassembler::Limits limits;
+        limits.timeout_seconds = 30;
+        FragmentReassembler r(limits);
+        const auto udp = transportDatagram(17);
+        r.add(fragmentJob(v4, 17, 4, udp, 0, 16, true, 100), datagram, held, dropped);
+        r.add(fragmentJob(v4, 17, 5, udp, 0, 16, true, 129), datagram, held, dropped);
+        CHECK(dropped.empty(), "frag: still in time");
+        r.add(fragmentJob(v4, 17, 5, udp, 16, 32, true, 130), datagram, held, dropped);
+        CHECK(dropped.size() == 1 && dropped[0].fragment_id == 4 && r.getStats().timed_out == 1,
+              "frag: first datagram timed out");
+        dropped.clear();
+
+        // Chunk readers feed an FP from far-apart stretches of a capture at
+        // once; one stretch's time does not expire another's datagrams.
+        FragmentReassembler ranges(limits);
+        ranges.add(fragmentJob(v4, 17, 6, udp, 0, 16, true, 100), datagram, held, dropped);
+        PacketJob later = fragmentJob(v4, 17, 7, udp, 0, 16, true, 1000);
+        later.source = 1;
+        ranges.add(std::move(later), datagram, held, dropped);
+        ranges.add(fragmentJob(v4, 17, 6, udp, 16, 32, true, 101), datagram, held, dropped);
+        CHECK(dropped.empty() &&
+                  ranges.add(fragmentJob(v4, 17, 6, udp, 32, 48, false, 102), datagram, held,
+                             dropped),
+              "frag: packet time kept per source");
+        held.clear();
+    }
+
+    // A flood of datagrams that never complete stays inside the budget.
+    {
+        FragmentReassembler::Limits limits;
+        limits.memory_bytes = 64 * 1024;
+        limits.max_datagrams = 1000;
+        FragmentReassembler r(limits);
+        const auto udp = transportDatagram(17);
+        const int flood = 5000;
+        for (int i = 0; i < flood; i++) {
+            IPAddress src = IPAddress::fromV4(static_cast<uint32_t>(i));
+            r.add(fragmentJob(src, 17, 9, udp, 0, 16, true), datagram, held, dropped);
+        }
+        auto stats = r.getStats();
+        CHECK(stats.peak_bytes <= limits.memory_bytes && stats.bytes_in_use <= limits.memory_bytes,
+              "frag: memory stays under the cap");
+        CHECK(stats.evicted + stats.datagrams_in_progress == static_cast<uint64_t>(flood) &&
+                  dropped.size() == stats.evicted && stats.evicted > 0,
+              "frag: oldest evicted and handed back");
+
+        limits.memory_bytes = 4 << 20;
+        limits.max_datagrams = 16;
+        FragmentReassembler capped(limits);
+        for (int i = 0; i < 100; i++) {
+            IPAddress src = IPAddress::fromV4(static_cast<uint32_t>(i));
+            capped.add(fragmentJob(src, 17, 9, udp, 0, 16, true), datagram, held, dropped);
+        }
+        CHECK(capped.getStats().datagrams_in_progress == 16, "frag: datagram count capped");
+        dropped.clear();
+    }
+
+    // Tiny fragments: the jobs held for them count against the budget, not
+    // just the slab they share, and a datagram in too many pieces is given up.
+    {
+        FragmentReassembler::Limits limits;
+        FragmentReassembler r(limits);
+        const std::vector<uint8_t> big(1024, 0);
+        size_t added = 0;
+        for (uint32_t i = 0; i < 2048; i++) {
+            IPAddress src = IPAddress::fromV4(i);
+            for (size_t at = 0; at + 8 <= 63 * 8; at += 8, added++) {
+                r.add(fragmentJob(src, 17, 9, big, at, at + 8, true), datagram, held, dropped);
+            }
+        }
+        const auto stats = r.getStats();
+        const size_t resident = added - dropped.size();
+        CHECK(stats.peak_bytes <= limits.memory_bytes &&
+                  resident * sizeof(PacketJob) <= limits.memory_bytes && stats.evicted > 0,
+              "frag: held jobs of a tiny-fragment flood stay inside the budget");
+        dropped.clear();
+
+        FragmentReassembler one(limits);
+        for (size_t at = 0; at <= limits.max_fragments * 8; at += 8) {
+            one.add(fragmentJob(v4, 17, 10, big, at, at + 8, true), datagram, held, dropped);
+        }
+        CHECK(dropped.size() == limits.max_fragments + 1 &&
+                  one.getStats().too_many_fragments == 1 &&
+                  one.getStats().datagrams_in_progress == 0 && one.getStats().bytes_in_use == 0,
+              "frag: a datagram in too many pieces is discarded whole");
+        dropped.clear();
+    }
+}
+
+/** fragmentJob() with the decoder's view of it: payload and address-pair hash. */
+static PacketJob decodedFragment(uint32_t id, const std::vector<uint8_t>& datagram,
+                                 size_t begin, size_t end, bool more, uint32_t ts_sec = 100) {
+    PacketJob job = fragmentJob(addr("10.0.0.1"), 6, id, datagram, begin, end, more, ts_sec);
+    job.payload_data = job.data.data();
+    job.flow_hash = FiveTupleHash{}(job.tuple);
+    return job;
+}
+
+static void testFragmentSteering() {
+    const auto tcp = transportDatagram(6);
+    FiveTuple flow{};
+    flow.src_ip = addr("10.0.0.1");
+    flow.dst_ip = addr("93.184.216.34");
+    flow.src_port = 40000;
+    flow.dst_port = 443;
+    flow.protocol = 6;
+    const uint64_t flow_hash = FiveTupleHash{}(flow);
+    const uint64_t pair_hash = decodedFragment(1, tcp, 16, 32, true).flow_hash;
+    std::vector<PacketJob> ready;
+
+    {
+        FragmentSteering s;
+        PacketJob plain = jobWithId(50);
+        plain.tuple = flow;
+        plain.flow_hash = flow_hash;
+        s.steer(std::move(plain), ready);
+        CHECK(ready.size() == 1 && ready[0].packet_id == 50 && ready[0].flow_hash == flow_hash,
+              "steer: unfragmented job untouched");
+        ready.clear();
+
+        s.steer(decodedFragment(1, tcp, 0, 16, true), ready);
+        s.steer(decodedFragment(1, tcp, 16, 32, true), ready);
+        CHECK(ready.size() == 2 && ready[0].flow_hash == flow_hash &&
+                  ready[1].flow_hash == flow_hash && s.held() == 0,
+              "steer: first fragment's ports give the flow hash");
+        ready.clear();
+    }
+
+    // A fragment ahead of its datagram's first waits for it, then goes first
+    // fragment first.
+    {
+        FragmentSteering s;
+        s.steer(decodedFragment(2, tcp, 32, 48, false), ready);
+        s.steer(decodedFragment(2, tcp, 16, 32, true), ready);
+        CHECK(ready.empty() && s.held() == 2, "steer: later fragments held");
+        s.steer(decodedFragment(2, tcp, 0, 16, true), ready);
+        CHECK(ready.size() == 3 && ready[0].packet_id == 0 && ready[1].packet_id == 32 &&
+                  ready[2].packet_id == 16 && s.held() == 0 &&
+                  std::all_of(ready.begin(), ready.end(),
+                              [&](const PacketJob& j) { return j.flow_hash == flow_hash; }),
+              "steer: held fragments released with the flow hash");
+        ready.clear();
+
+        s.steer(decodedFragment(3, tcp, 16, 32, true), ready);
+        s.flush(ready);
+        CHECK(ready.size() == 1 && ready[0].flow_hash == pair_hash && s.held() == 0,
+              "steer: flush lets an orphan go on its address pair");
+        ready.clear();
+    }
+
+    // Orphans leave on packet time or under the held limit, oldest first.
+    {
+        FragmentSteering::Limits limits;
+        limits.max_held = 2;
+        limits.timeout_seconds = 30;
+        FragmentSteering s(limits);
+        s.steer(decodedFragment(4, tcp, 16, 32, true, 100), ready);
+        s.steer(decodedFragment(5, tcp, 16, 32, true, 110), ready);
+        s.steer(decodedFragment(6, tcp, 16, 32, true, 120), ready);
+        CHECK(ready.size() == 1 && ready[0].fragment_id == 4 && s.held() == 2,
+              "steer: held fragments capped");
+        ready.clear();
+        s.steer(decodedFragment(7, tcp, 0, 16, true, 140), ready);
+        CHECK(ready.size() == 2 && ready[0].fragment_id == 5 && ready[0].flow_hash == pair_hash &&
+                  ready[1].fragment_id == 7 && ready[1].flow_hash == flow_hash && s.held() == 1,
+              "steer: timed-out datagram released unresolved");
+        ready.clear();
+    }
+}
+
+static FiveTuple tcpFlow(uint16_t sport) {
+    FiveTuple t{};
+    t.src_ip = addr("10.0.0.1");
+    t.dst_ip = addr("93.184.216.34");
+    t.src_port = sport;
+    t.dst_port = 443;
+    t.protocol = 6;
+    return t;
+}
+
+static void testTcpReassembly() {
+    std::vector<uint8_t> bytes(64);
+    for (size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<uint8_t>(i);
+    const uint8_t* b = bytes.data();
+
+    TcpReassembler::Limits limits;
+    limits.bytes_per_flow = 40;
+    limits.max_flows = 2;
+    TcpReassembler r(limits);
+    const FiveTuple a = tcpFlow(1000);
+
+    CHECK(!r.append(a, 0, b, 10), "tcp: unbuffered flows pass through");
+    // The sequence space wraps inside this buffer.
+    const uint32_t isn = 0xfffffff8u;
+    r.begin(a, isn, b, 10);
+    auto view = r.append(a, isn + 10, b + 10, 10);
+    CHECK(view && view->length == 20 && std::equal(b, b + 20, view->data) && !view->full,
+          "tcp: in-order segment appended across the wrap");
+    view = r.append(a, isn + 15, b + 15, 10);
+    CHECK(view && view->length == 25 && std::equal(b, b + 25, view->data),
+          "tcp: retransmission adds only its new bytes");
+    view = r.append(a, isn + 30, b + 30, 10);
+    CHECK(view && view->length == 25 && r.getStats().out_of_order == 1,
+          "tcp: segment after a gap not buffered");
+    view = r.append(a, isn + 25, b + 25, 20);
+    CHECK(view && view->length == 40 && view->full && r.getStats().overflows == 1 &&
+              std::equal(b, b + 40, view->data),
+          "tcp: capped at the per-flow limit");
+
+    r.begin(tcpFlow(1001), 0, b, 8);
+    r.begin(tcpFlow(1002), 0, b, 8);
+    CHECK(!r.append(a, isn + 45, b, 1) && r.getStats().evicted == 1 &&
+              r.getStats().flows_in_progress == 2,
+          "tcp: the longest-waiting flow gives up its buffer");
+    r.release(tcpFlow(1001));
+    CHECK(!r.append(tcpFlow(1001), 8, b, 8) && r.getStats().flows_in_progress == 1,
+          "tcp: release frees the buffer");
+}
+
+static void testIndirectionTable() {
+    IndirectionTable table(3, 8);
+    CHECK(table.buckets() == 8 && table.target(0) == 0 && table.target(uint64_t{4} << 32) == 1,
+          "rss: buckets dealt round robin, indexed by the high half");
+
+    // Two LBs of two FPs each: the LB takes hash % 2, and each LB's table
+    // must still reach both of its FPs rather than just the one whose index
+    // matches the LB's.
+    const size_t flows = 4096;
+    const IndirectionTable per_lb(2);
+    const IndirectionTable direct(4);
+    std::vector<size_t> two_tier(4, 0), one_tier(4, 0);
+    for (size_t i = 0; i < flows; i++) {
+        const uint64_t h = FiveTupleHash{}(tcpFlow(static_cast<uint16_t>(1024 + i)));
+        two_tier[(h % 2) * 2 + per_lb.target(h)]++;
+        one_tier[direct.target(h)]++;
+    }
+    CHECK(*std::min_element(two_tier.begin(), two_tier.end()) > flows / 4 / 2,
+          "rss: two-tier steering spreads over every FP");
+    CHECK(*std::min_element(one_tier.begin(), one_tier.end()) > flows / 4 / 2,
+          "rss: direct steering spreads over every FP");
+}
+
+static void testFlowRebalancing() {
+    // Two FPs, four buckets: 0 and 2 on FP 0, 1 and 3 on FP 1.
+    IndirectionTable table(2, 4);
+    CHECK(!FlowRebalancer::pickMove({10, 10, 10, 10}, table, 2) &&
+              !FlowRebalancer::pickMove({10, 10, 10, 10}, table, 1),
+          "rebalance: nothing to do when even or alone");
+    CHECK(!FlowRebalancer::pickMove({100, 5, 0, 5}, table, 2),
+          "rebalance: a single hot bucket is not moved over to the other side");
+    auto move = FlowRebalancer::pickMove({60, 10, 30, 10}, table, 2);
+    CHECK(move && move->bucket == 2 && move->from == 0 && move->to == 1,
+          "rebalance: the busiest FP's bucket nearest half the gap moves");
+    table.setTarget(2, 1);
+    CHECK(table.targetOfBucket(2) == 1 && table.target(uint64_t{6} << 32) == 1 &&
+              !FlowRebalancer::pickMove({60, 10, 30, 10}, table, 2),
+          "rebalance: repointed bucket counted on its new FP");
+
+    // The moving flows' state leaves one FP's tracker and reassemblers and
+    // lands in the other's.
+    const FiveTuple moving_flow = tcpFlow(2000);
+    const FiveTuple staying_flow = tcpFlow(2001);
+    const uint64_t moving_hash = FiveTupleHash{}(moving_flow);
+    const auto moves = [&](uint64_t h) { return h == moving_hash; };
+
+    ConnectionTracker from(0), to(1);
+    from.classifyConnection(from.getOrCreateConnection(moving_flow), AppType::YOUTUBE,
+                            "www.youtube.com");
+    from.blockConnection(from.getConnection(moving_flow));
+    from.getOrCreateConnection(staying_flow);
+    auto connections = from.extract(moves);
+    CHECK(connections.size() == 1 && !from.getConnection(moving_flow) &&
+              from.getConnection(staying_flow),
+          "rebalance: only the moving connection extracted");
+    to.adopt(std::move(connections));
+    const Connection* adopted = to.getConnection(moving_flow);
+    CHECK(adopted && adopted->state == ConnectionState::BLOCKED &&
+              adopted->app_type == AppType::YOUTUBE && adopted->sni == "www.youtube.com",
+          "rebalance: classification and verdict carried over");
+
+    std::vector<uint8_t> bytes(16);
+    for (size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<uint8_t>(i);
+    TcpReassembler streams_from, streams_to;
+    streams_from.begin(moving_flow, 100, bytes.data(), 8);
+    streams_from.begin(staying_flow, 100, bytes.data(), 8);
+    auto streams = streams_from.extract(moves);
+    CHECK(streams.size() == 1 && !streams_from.append(moving_flow, 108, bytes.data() + 8, 8) &&
+              streams_from.getStats().flows_in_progress == 1,
+          "rebalance: moving stream buffer extracted");
+    streams_to.adopt(std::move(streams));
+    auto view = streams_to.append(moving_flow, 108, bytes.data() + 8, 8);
+    CHECK(view && view->length == 16 && std::equal(bytes.begin(), bytes.end(), view->data),
+          "rebalance: adopted stream continues where it left off");
+
+    FragmentReassembler fragments_from;
+    std::vector<PacketJob> held, dropped, handed;
+    PacketJob datagram;
+    const auto udp = transportDatagram(17);
+    PacketJob first = fragmentJob(addr("10.0.0.1"), 17, 1, udp, 0, 16, true);
+    first.flow_hash = moving_hash;
+    PacketJob other = fragmentJob(addr("10.0.0.2"), 17, 1, udp, 0, 16, true);
+    other.flow_hash = moving_hash + 1;
+    fragments_from.add(std::move(first), datagram, held, dropped);
+    fragments_from.add(std::move(other), datagram, held, dropped);
+    fragments_from.extract(moves, handed);
+    CHECK(handed.size() == 1 && handed[0].flow_hash == moving_hash && dropped.empty() &&
+              fragments_from.getStats().datagrams_in_progress == 1 &&
+              fragments_from.getStats().timed_out == 0,
+          "rebalance: moving fragments handed over, not dropped");
+}
+
+// What the FPs hand the output stage, in order: packet ids, and -1 for an
+// end marker.
+struct OutputLog {
+    std::mutex mutex;
+    std::vector<std::vector<int64_t>> per_fp;
+    // Hand-overs passed on by FPs that hand over through the output.
+    std::vector<std::shared_ptr<FlowMigration>> handovers;
+
+    explicit OutputLog(size_t fps) : per_fp(fps) {}
+
+    PacketOutputCallback callback() {
+        return [this](int fp_id, PacketJob&& job, PacketAction) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job.migration) {
+                handovers.push_back(std::move(job.migration));
+                return;
+            }
+            per_fp[fp_id].push_back(job.end_of_stream ? -1 : int64_t{job.packet_id});
+        };
+    }
+
+    size_t handedOver() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return handovers.size();
+    }
+
+    size_t ended() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = 0;
+        for (const auto& log : per_fp) n += !log.empty() && log.back() == -1;
+        return n;
+    }
+
+    bool waitEnded(size_t fps) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (ended() < fps) {
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+};
+
+static PacketJob flowJob(uint32_t id, const FiveTuple& tuple) {
+    PacketJob job = jobWithId(id);
+    job.tuple = tuple;
+    job.flow_hash = FiveTupleHash{}(tuple);
+    return job;
+}
+
+static PacketJob endMarker() {
+    PacketJob end;
+    end.end_of_stream = true;
+    return end;
+}
+
+static void testEndOfStream() {
+    RuleManager rules;
+
+    // The LB passes its end marker to both FPs behind everything it routed,
+    // and each FP sends one on after its last packet.
+    {
+        OutputLog log(2);
+        FastPathProcessor fp0(0, &rules, log.callback(), true);
+        FastPathProcessor fp1(1, &rules, log.callback(), true);
+        LoadBalancer lb(0, {&fp0.getInputQueue(), &fp1.getInputQueue()}, 0, true);
+        fp0.start();
+        fp1.start();
+        lb.start();
+        const uint32_t packets = 200;
+        for (uint32_t i = 0; i < packets; i++) {
+            lb.getInputQueue().push(flowJob(i, tcpFlow(static_cast<uint16_t>(3000 + i % 40))));
+        }
+        lb.getInputQueue().push(endMarker());
+        CHECK(log.waitEnded(2), "eos: both FPs end");
+        size_t emitted = 0;
+        bool one_marker_last = true;
+        for (const auto& fp_log : log.per_fp) {
+            emitted += fp_log.size() - 1;
+            one_marker_last = one_marker_last &&
+                              std::count(fp_log.begin(), fp_log.end(), -1) == 1;
+        }
+        CHECK(emitted == packets && one_marker_last, "eos: every packet out before the markers");
+        CHECK(lb.getStats().packets_received == packets, "eos: the marker is not a packet");
+        lb.stop();
+        fp0.stop();
+        fp1.stop();
+    }
+
+    // An FP ending while a bucket is on its way to it waits for the other FP
+    // to hand the state over, then emits what it held, then ends.
+    {
+        OutputLog log(2);
+        FastPathProcessor fp0(0, &rules, log.callback(), true);
+        FastPathProcessor fp1(1, &rules, log.callback(), true);
+        fp0.start();
+        fp1.start();
+        const FiveTuple flow = tcpFlow(4000);
+        const uint64_t hash = FiveTupleHash{}(flow);
+        const size_t buckets = IndirectionTable::DEFAULT_BUCKETS;
+        auto migration = std::make_shared<FlowMigration>(
+            IndirectionTable::bucketOf(hash, buckets), buckets, 0, 1);
+
+        PacketJob acquire;
+        acquire.migration = migration;
+        fp1.getInputQueue().push(std::move(acquire));
+        fp1.getInputQueue().push(flowJob(7, flow));
+        fp1.getInputQueue().push(endMarker());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(log.ended() == 0, "eos: FP holds its end marker for the hand-over");
+
+        fp0.getInputQueue().push(flowJob(6, flow));
+        PacketJob release;
+        release.migration = migration;
+        fp0.getInputQueue().push(std::move(release));
+        fp0.getInputQueue().push(endMarker());
+        CHECK(log.waitEnded(2), "eos: both FPs end once the state moved");
+        CHECK(log.per_fp[0] == std::vector<int64_t>({6, -1}) &&
+                  log.per_fp[1] == std::vector<int64_t>({7, -1}) &&
+                  migration->adopted.load() && fp1.getConnectionTracker().getConnection(flow),
+              "eos: held packet handled with the adopted state before the end");
+        fp0.stop();
+        fp1.stop();
+    }
+
+    // Handing over through the output: the old FP passes the move on behind
+    // what it emitted, and the new FP holds the bucket until the consumer
+    // has taken that and sets handed_over.
+    {
+        OutputLog log(2);
+        FastPathProcessor fp0(0, &rules, log.callback(), true);
+        FastPathProcessor fp1(1, &rules, log.callback(), true);
+        fp0.setHandOverThroughOutput(true);
+        fp1.setHandOverThroughOutput(true);
+        fp0.start();
+        fp1.start();
+        const FiveTuple flow = tcpFlow(4000);
+        const uint64_t hash = FiveTupleHash{}(flow);
+        const size_t buckets = IndirectionTable::DEFAULT_BUCKETS;
+        auto migration = std::make_shared<FlowMigration>(
+            IndirectionTable::bucketOf(hash, buckets), buckets, 0, 1);
+
+        PacketJob acquire;
+        acquire.migration = migration;
+        fp1.getInputQueue().push(std::move(acquire));
+        fp1.getInputQueue().push(flowJob(7, flow));
+        fp0.getInputQueue().push(flowJob(6, flow));
+        PacketJob release;
+        release.migration = migration;
+        fp0.getInputQueue().push(std::move(release));
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (log.handedOver() == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        {
+            std::lock_guard<std::mutex> lock(log.mutex);
+            CHECK(log.handovers.size() == 1 && log.handovers[0] == migration &&
+                      !migration->handed_over.load() &&
+                      log.per_fp[0] == std::vector<int64_t>({6}) && log.per_fp[1].empty(),
+                  "eos: hand-over passed on behind the old FP's packets, new FP still holds");
+        }
+
+        migration->handed_over.store(true, std::memory_order_release);
+        fp0.getInputQueue().push(endMarker());
+        fp1.getInputQueue().push(endMarker());
+        CHECK(log.waitEnded(2) && log.per_fp[1] == std::vector<int64_t>({7, -1}) &&
+                  migration->adopted.load(),
+              "eos: new FP goes on once the consumer lets it");
+        fp0.stop();
+        fp1.stop();
+    }
+}
+
+static void testCpuPlacement() {
+    const auto list = parseCpuList("0-2,8,10-11");
+    CHECK(list && *list == std::vector<int>({0, 1, 2, 8, 10, 11}), "cpus: ranges and singles");
+    CHECK(!parseCpuList("") && !parseCpuList("3-1") && !parseCpuList("1,") &&
+              !parseCpuList("a") && !parseCpuList("1-"),
+          "cpus: malformed lists rejected");
+
+    // Two nodes of four CPUs, two LBs of two FPs: the front end takes node 0's
+    // first CPUs, and each LB sits with its FPs on a node of its own.
+    CpuTopology topology;
+    topology.nodes = {{0, {0, 1, 2, 3}}, {1, {4, 5, 6, 7}}};
+    ThreadPlacement auto_placed;
+    auto_placed.fillAuto(topology, 2, 2, 0);
+    CHECK(auto_placed.reader == std::vector<int>({0}) &&
+              auto_placed.output == std::vector<int>({1}),
+          "cpus: front end on the first node");
+    CHECK(auto_placed.lbs == std::vector<int>({2, 4}) &&
+              auto_placed.fps == std::vector<int>({3, 0, 5, 6}),
+          "cpus: each LB shares a node with its FPs, wrapping when full");
+    CHECK(topology.nodeOf(6) == 1 && topology.nodeOf(9) == -1 && topology.cpuCount() == 8,
+          "cpus: node lookup");
+
+    // A role given on the command line is left as it is.
+    ThreadPlacement manual;
+    manual.fps = {7};
+    manual.fillAuto(topology, 1, 4, 0);
+    CHECK(manual.fps == std::vector<int>({7}) && ThreadPlacement::cpuFor(manual.fps, 3) == 7 &&
+              ThreadPlacement::cpuFor({}, 0) == -1,
+          "cpus: explicit lists kept");
+}
+
+static void testSpscQueue() {
+    {
+        SpscQueue<uint64_t> q(4);
+        CHECK(q.capacity() == 4 && q.empty(), "spsc: empty at the stated capacity");
+        uint64_t in[6] = {1, 2, 3, 4, 5, 6};
+        CHECK(q.pushBatch(in, 3) == 3 && q.tryPush(4) && !q.tryPush(5) && q.size() == 4,
+              "spsc: full at capacity");
+        uint64_t out[8] = {};
+        CHECK(q.tryPopBatch(out, 3) == 3 && out[0] == 1 && out[2] == 3,
+              "spsc: batch pop in order");
+        // Wraps around the end of the slots.
+        CHECK(q.pushBatch(in + 4, 2) == 2 && q.tryPopBatch(out, 8) == 3 &&
+                  out[0] == 4 && out[1] == 5 && out[2] == 6 && q.empty(),
+              "spsc: order kept across the wrap");
+        CHECK(!q.popWithTimeout(std::chrono::milliseconds(5)), "spsc: pop times out when empty");
+        q.push(7);
+        q.shutdown();
+        CHECK(!q.push(8) && q.pop().value_or(0) == 7 && !q.pop(),
+              "spsc: shutdown refuses pushes and drains what is left");
+        CHECK(q.totalPushes() == 7 && q.totalPops() == 7, "spsc: push and pop counts");
+        // Pushes of 3, 1, 2, 1; pops of 3, 3, 1.
+        const auto pushes = q.pushBatchSizes();
+        const auto pops = q.popBatchSizes();
+        CHECK(pushes.batches == 4 && pushes.counts[0] == 2 && pushes.counts[1] == 2 &&
+                  pops.batches == 3 && pops.counts[1] == 2 && pops.items == 7,
+              "spsc: batch size histograms");
+    }
+
+    // A small queue between two threads, so both sides keep running into a
+    // full or empty queue and parking.
+    {
+        SpscQueue<uint64_t> q(16);
+        const uint64_t total = 200000;
+        std::thread producer([&] {
+            uint64_t batch[7];
+            uint64_t next = 0;
+            while (next < total) {
+                const size_t n = static_cast<size_t>(std::min<uint64_t>(1 + next % 7, total - next));
+                for (size_t i = 0; i < n; i++) batch[i] = next + i;
+                q.pushBatch(batch, n);
+                next += n;
+            }
+        });
+        uint64_t expected = 0;
+        bool in_order = true;
+        uint64_t out[5];
+        while (expected < total) {
+            const size_t n = q.popBatch(out, 5, std::chrono::milliseconds(1000));
+            if (n == 0) break;
+            for (size_t i = 0; i < n; i++) in_order = in_order && out[i] == expected++;
+        }
+        producer.join();
+        CHECK(in_order && expected == total && q.empty(), "spsc: every item once, in order");
+    }
+}
+
+static void testWaitPolicy() {
+    CHECK(parseWaitPolicy("busy-poll") && !parseWaitPolicy("busy-poll")->parks() &&
+              parseWaitPolicy("park")->name() == "park" && !parseWaitPolicy("spin"),
+          "wait: policy names");
+
+    // An empty queue: only the parking policies ever sleep on it.
+    for (const WaitPolicy& policy :
+         {WaitPolicy::adaptive(), WaitPolicy::park(), WaitPolicy::busyPoll()}) {
+        SpscQueue<uint64_t> q(4);
+        q.setConsumerWait(policy);
+        uint64_t out = 0;
+        CHECK(q.popBatch(&out, 1, std::chrono::milliseconds(5)) == 0 &&
+                  q.consumerParks() == (policy.parks() ? 1u : 0u),
+              "wait: " + policy.name() + " times out, parking only if it may");
+    }
+
+    // Items still get through when the consumer never parks, on one lane or
+    // several.
+    {
+        SpscQueue<uint64_t> q(8);
+        MpscQueue<uint64_t> m(2, 8);
+        q.setConsumerWait(WaitPolicy::busyPoll());
+        m.setConsumerWait(WaitPolicy::busyPoll());
+        const uint64_t total = 500;
+        std::thread producer([&] {
+            for (uint64_t i = 0; i < total; i++) {
+                q.push(i);
+                m.push(i % 2, i);
+            }
+        });
+        uint64_t expected = 0, merged = 0;
+        bool in_order = true;
+        uint64_t out[4];
+        while (expected < total || merged < total) {
+            size_t n = q.popBatch(out, 4, std::chrono::milliseconds(1000));
+            for (size_t i = 0; i < n; i++) in_order = in_order && out[i] == expected++;
+            const size_t got = m.popBatch(out, 4, std::chrono::milliseconds(1000));
+            merged += got;
+            if (n == 0 && got == 0) break;
+        }
+        producer.join();
+        CHECK(in_order && expected == total && merged == total && q.consumerParks() == 0 &&
+                  m.consumerParks() == 0,
+              "wait: busy-poll delivers everything without parking");
+    }
+
+    ThreadLoad load;
+    load.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    load.idle();
+    std::this_thread::sleep_for(std::chrono::milliseconds(4));
+    load.busy();
+    const auto snapshot = load.snapshot();
+    CHECK(snapshot.busy_ns >= 2000000 && snapshot.idle_ns >= 4000000 &&
+              snapshot.busyShare() > 0.0 && snapshot.busyShare() < 1.0,
+          "wait: busy and idle time charged to the right side");
+}
+
+static void testThreadSafeQueueBatches() {
+    ThreadSafeQueue<uint64_t> q(4);
+    uint64_t in[6] = {1, 2, 3, 4, 5, 6};
+    CHECK(q.pushBatch(in, 3) == 3 && q.size() == 3, "tsq: batch push");
+    uint64_t out[8] = {};
+    CHECK(q.tryPopBatch(out, 2) == 2 && out[0] == 1 && out[1] == 2, "tsq: batch pop in order");
+    CHECK(q.popBatch(out, 8, std::chrono::milliseconds(5)) == 1 && out[0] == 3,
+          "tsq: batch pop takes what is there");
+    CHECK(q.popBatch(out, 8, std::chrono::milliseconds(5)) == 0, "tsq: batch pop times out");
+
+    // More than fits: the producer waits while the consumer drains.
+    std::thread producer([&] { q.pushBatch(in, 6); });
+    uint64_t received = 0;
+    bool in_order = true;
+    while (received < 6) {
+        const size_t n = q.popBatch(out, 8, std::chrono::milliseconds(1000));
+        if (n == 0) break;
+        for (size_t i = 0; i < n; i++) in_order = in_order && out[i] == ++received;
+    }
+    producer.join();
+    CHECK(in_order && received == 6 && q.empty(), "tsq: batch push waits for room");
+
+    const auto pushes = q.pushBatchSizes();
+    const auto pops = q.popBatchSizes();
+    CHECK(pushes.items == 9 && pops.items == 9 && pushes.counts[1] >= 1,
+          "tsq: batch size histograms");
+    q.shutdown();
+    CHECK(q.pushBatch(in, 2) == 0, "tsq: batch push refused after shutdown");
+
+    BatchHistogram h;
+    h.record(0);
+    h.record(1);
+    h.record(7);
+    h.record(8);
+    h.record(100000);
+    const auto snap = h.snapshot();
+    CHECK(snap.batches == 4 && snap.counts[0] == 1 && snap.counts[2] == 1 && snap.counts[3] == 1 &&
+              snap.counts[BatchHistogram::BUCKETS - 1] == 1 && snap.items == 100016,
+          "histogram: power-of-two buckets, last one open-ended");
+}
+
+static void testMpscQueue() {
+    {
+        MpscQueue<uint64_t> q(3, 4);
+        CHECK(q.laneCount() == 3 && q.empty(), "mpsc: one empty lane per producer");
+        q.push(0, 1);
+        q.push(0, 2);
+        q.push(2, 3);
+        uint64_t out[8] = {};
+        CHECK(q.tryPopBatch(out, 8) == 3 && q.empty(), "mpsc: batch pop drains every lane");
+        CHECK(!q.popBatch(out, 8, std::chrono::milliseconds(5)), "mpsc: pop times out when empty");
+        q.push(1, 4);
+        q.shutdown();
+        CHECK(!q.push(1, 5) && q.tryPopBatch(out, 8) == 1 && out[0] == 4,
+              "mpsc: shutdown refuses pushes and drains what is left");
+    }
+
+    // Several producers into small lanes: each lane's items come out once and
+    // in order, whatever the interleaving with the others.
+    {
+        const size_t producers = 4;
+        const uint64_t per_producer = 50000;
+        MpscQueue<uint64_t> q(producers, 16);
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; p++) {
+            threads.emplace_back([&q, p, per_producer] {
+                for (uint64_t i = 0; i < per_producer; i++) q.push(p, (p << 32) | i);
+            });
+        }
+        std::vector<uint64_t> next(producers, 0);
+        bool in_order = true;
+        uint64_t received = 0;
+        uint64_t out[9];
+        while (received < producers * per_producer) {
+            const size_t n = q.popBatch(out, 9, std::chrono::milliseconds(1000));
+            if (n == 0) break;
+            for (size_t i = 0; i < n; i++) {
+                const size_t p = static_cast<size_t>(out[i] >> 32);
+                in_order = in_order && p < producers && (out[i] & 0xffffffffu) == next[p]++;
+            }
+            received += n;
+        }
+        for (auto& t : threads) t.join();
+        CHECK(in_order && received == producers * per_producer && q.empty(),
+              "mpsc: every item once, in order per producer");
+    }
+}
+
+static void put16(std::vector<uint8_t>& v, uint16_t x) {
+    v.push_back(static_cast<uint8_t>(x >> 8));
+    v.push_back(static_cast<uint8_t>(x & 0xFF));
+}
+
+static void putLE32(std::vector<uint8_t>& v, uint32_t x) {
+    for (int i = 0; i < 4; i++) v.push_back(static_cast<uint8_t>(x >> (8 * i)));
+}
+
+/** A TLS ClientHello record carrying `host` as its SNI. */
+static std::vector<uint8_t> clientHello(const std::string& host) {
+    std::vector<uint8_t> ext;
+    put16(ext, 0x0000);                                      // extension: SNI
+    put16(ext, static_cast<uint16_t>(host.size() + 5));
+    put16(ext, static_cast<uint16_t>(host.size() + 3));      // list length
+    ext.push_back(0x00);                                     // name type: hostname
+    put16(ext, static_cast<uint16_t>(host.size()));
+    ext.insert(ext.end(), host.begin(), host.end());
+
+    std::vector<uint8_t> body;
+    put16(body, 0x0303);                                     // client version
+    body.insert(body.end(), 32, 0x00);                       // random
+    body.push_back(0x00);                                    // empty session id
+    put16(body, 2);
+    put16(body, 0x1301);
+    body.insert(body.end(), {0x01, 0x00});                   // null compression
+    put16(body, static_cast<uint16_t>(ext.size()));
+    body.insert(body.end(), ext.begin(), ext.end());
+
+    std::vector<uint8_t> rec = {0x16, 0x03, 0x01};           // handshake record
+    put16(rec, static_cast<uint16_t>(body.size() + 4));
+    rec.insert(rec.end(), {0x01, 0x00});                     // ClientHello
+    put16(rec, static_cast<uint16_t>(body.size()));
+    rec.insert(rec.end(), body.begin(), body.end());
+    return rec;
+}
+
+/** A TCP segment without options from `sport` to 443. */
+static std::vector<uint8_t> tcpSegment(uint16_t sport, uint32_t seq, uint8_t flags,
+                                       const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> t;
+    put16(t, sport);
+    put16(t, 443);
+    put16(t, static_cast<uint16_t>(seq >> 16));
+    put16(t, static_cast<uint16_t>(seq));
+    t.insert(t.end(), {0, 0, 0, 1, 0x50, flags, 0xff, 0xff, 0, 0, 0, 0});
+    t.insert(t.end(), payload.begin(), payload.end());
+    return t;
+}
+
+/**
+ * An Ethernet frame with an IPv4 TCP packet from 192.168.1.100 to
+ * 142.250.`host`; `frag` is the flags and offset field, `bytes` what follows
+ * the IP header.
+ */
+static std::vector<uint8_t> ipv4Frame(uint16_t host, uint16_t id, uint16_t frag,
+                                      const std::vector<uint8_t>& bytes) {
+    std::vector<uint8_t> f(12, 0x02);
+    put16(f, 0x0800);
+    f.insert(f.end(), {0x45, 0x00});
+    put16(f, static_cast<uint16_t>(20 + bytes.size()));
+    put16(f, id);
+    put16(f, frag);
+    f.insert(f.end(), {64, 6, 0, 0, 192, 168, 1, 100, 142, 250});
+    put16(f, host);
+    f.insert(f.end(), bytes.begin(), bytes.end());
+    return f;
+}
+
+/** Writes `frames` as a classic pcap in the temp directory; returns its path. */
+static std::string writeCapture(const std::string& name,
+                                const std::vector<std::vector<uint8_t>>& frames) {
+    std::vector<uint8_t> out;
+    for (uint32_t word : {0xa1b2c3d4u, 0x00040002u, 0u, 0u, 65535u, 1u}) putLE32(out, word);
+    for (size_t i = 0; i < frames.size(); i++) {
+        putLE32(out, static_cast<uint32_t>(1000 + i / 1000));
+        putLE32(out, static_cast<uint32_t>(i % 1000 * 1000));
+        putLE32(out, static_cast<uint32_t>(frames[i].size()));
+        putLE32(out, static_cast<uint32_t>(frames[i].size()));
+        out.insert(out.end(), frames[i].begin(), frames[i].end());
+    }
+    const std::string path = (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream(path, std::ios::binary | std::ios::trunc)
+        .write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    return path;
+}
+
+/** The frames of a classic pcap the engine wrote. */
+static std::vector<std::vector<uint8_t>> readCapture(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(f)),
+                                     std::istreambuf_iterator<char>());
+    auto le32 = [&](size_t at) {
+        return static_cast<uint32_t>(bytes[at] | bytes[at + 1] << 8 | bytes[at + 2] << 16 |
+                                     static_cast<uint32_t>(bytes[at + 3]) << 24);
+    };
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t at = 24; at + 16 <= bytes.size();) {
+        const size_t length = le32(at + 8);
+        if (at + 16 + length > bytes.size()) break;
+        frames.emplace_back(bytes.begin() + at + 16, bytes.begin() + at + 16 + length);
+        at += 16 + length;
+    }
+    return frames;
+}
+
+struct EngineRun {
+    bool ok = false;
+    uint64_t forwarded = 0;
+    uint64_t dropped = 0;
+    std::string json;
+
+    uint64_t jsonCount(const std::string& key) const {
+        const auto at = json.find("\"" + key + "\":");
+        return at == std::string::npos ? 0 : std::stoull(json.substr(at + key.size() + 3));
+    }
+};
+
+/** Runs a fresh engine over `input` with YouTube blocked. */
+static EngineRun runEngine(DPIEngine::Config config, const std::string& input,
+                           const std::string& output) {
+    config.silent = true;
+    EngineRun run;
+    DPIEngine engine(config);
+    if (!engine.initialize()) return run;
+    engine.blockApp("YouTube");
+    run.ok = engine.processFile(input, output);
+    run.forwarded = engine.getStats().forwarded_packets;
+    run.dropped = engine.getStats().dropped_packets;
+    run.json = engine.generateJsonReport();
+    return run;
+}
+
+// Each flow's ClientHello is split over two IP fragments, so only the
+// reassembled datagram names YouTube. The segments after it carry nothing to
+// classify: they are dropped only if the verdict reached the flow's
+// Connection, on the FP they hash to.
+static void testEngineFragmentedFlows() {
+    const uint16_t flows = 64;
+    std::vector<std::vector<uint8_t>> frames;
+    for (uint16_t f = 0; f < flows; f++) {
+        const uint16_t sport = static_cast<uint16_t>(40000 + f);
+        const uint16_t host = static_cast<uint16_t>(((f / 8) << 8) | (f % 8 + 1));
+        frames.push_back(ipv4Frame(host, 1, 0x4000, tcpSegment(sport, 1000, 0x02, {})));
+
+        const auto hello = tcpSegment(sport, 1001, 0x18, clientHello("www.youtube.com"));
+        const size_t cut = hello.size() / 2 / 8 * 8;
+        const uint16_t id = static_cast<uint16_t>(100 + f);
+        auto first = ipv4Frame(host, id, 0x2000, {hello.begin(), hello.begin() + cut});
+        auto second = ipv4Frame(host, id, static_cast<uint16_t>(cut / 8),
+                                {hello.begin() + cut, hello.end()});
+        // Every other flow's fragments arrive last first.
+        if (f % 2) std::swap(first, second);
+        frames.push_back(std::move(first));
+        frames.push_back(std::move(second));
+
+        uint32_t seq = static_cast<uint32_t>(1001 + hello.size() - 20);
+        for (uint16_t k = 0; k < 3; k++, seq += 100) {
+            frames.push_back(ipv4Frame(host, static_cast<uint16_t>(2 + k), 0x4000,
+                                       tcpSegment(sport, seq, 0x18, std::vector<uint8_t>(100))));
+        }
+    }
+    const std::string input = writeCapture("dpi_pipeline_fragments.pcap", frames);
+    const std::string output = input + ".out";
+
+    struct Mode {
+        const char* name;
+        int lbs, fps, parse_workers;
+        bool direct, ordered;
+    };
+    for (const Mode& m : {Mode{"direct, 4 FPs", 1, 4, 0, true, false},
+                          Mode{"two LBs of 2 FPs", 2, 2, 0, false, false},
+                          Mode{"parse workers", 1, 4, 3, true, false},
+                          Mode{"ordered", 2, 3, 0, true, true}}) {
+        DPIEngine::Config config;
+        config.num_load_balancers = m.lbs;
+        config.fps_per_lb = m.fps;
+        config.parse_workers = m.parse_workers;
+        config.direct_dispatch = m.direct;
+        config.preserve_order = m.ordered;
+        const EngineRun run = runEngine(config, input, output);
+        CHECK(run.ok && run.forwarded == flows && run.dropped == frames.size() - flows,
+              std::string("engine: only the SYNs of blocked fragmented flows pass, ") + m.name);
+    }
+    std::filesystem::remove(input);
+    std::filesystem::remove(output);
+}
+
+// Parse workers must not change what comes out: the same packets, in the same
+// order per flow, and byte for byte the same --ordered output. --ordered
+// writes by packet id, so output in file order means the ids follow the file.
+// Nor must chunk readers, whose range boundaries every flow here crosses.
+// The capture is skewed so buckets keep moving, and with workers a move lands
+// while later batches are already staged for the old table. The frame index
+// rides in the source MAC.
+static void testEngineParseWorkers() {
+    const uint16_t flows = 256;
+    const size_t packets = 200000;
+    // A few heavy flows keep the FPs' shares apart, so buckets keep moving.
+    std::vector<uint32_t> weights(flows);
+    uint32_t total = 0;
+    std::mt19937 rng(21);
+    for (uint16_t f = 0; f < flows; f++) {
+        weights[f] = f % 32 == 0 ? 60 : 1 + rng() % 4;
+        total += weights[f];
+    }
+    std::vector<uint32_t> sent(flows, 0);
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t i = 0; i < packets; i++) {
+        uint32_t pick = rng() % total;
+        uint16_t f = 0;
+        while (pick >= weights[f]) pick -= weights[f++];
+        const uint16_t sport = static_cast<uint16_t>(20000 + f);
+        const uint32_t n = sent[f]++;
+        std::vector<uint8_t> segment;
+        if (n == 0) {
+            segment = tcpSegment(sport, 1000, 0x02, {});
+        } else if (n == 1) {
+            segment = tcpSegment(sport, 1001, 0x18,
+                                 clientHello(f % 5 ? "www.example.com" : "www.youtube.com"));
+        } else {
+            segment = tcpSegment(sport, 2000 + n * 64, 0x18, std::vector<uint8_t>(64));
+        }
+        auto frame = ipv4Frame(f, 1, 0x4000, segment);
+        for (int b = 0; b < 4; b++) frame[6 + b] = static_cast<uint8_t>(i >> (8 * b));
+        frames.push_back(std::move(frame));
+    }
+    const std::string input = writeCapture("dpi_pipeline_parse_workers.pcap", frames);
+    const std::string output = input + ".out";
+
+    auto indexOf = [](const std::vector<uint8_t>& frame) {
+        return static_cast<uint32_t>(frame[6] | frame[7] << 8 | frame[8] << 16 |
+                                     static_cast<uint32_t>(frame[9]) << 24);
+    };
+    // Frame indices per flow (destination host), in output order.
+    auto perFlow = [&](const std::vector<std::vector<uint8_t>>& out) {
+        std::vector<std::vector<uint32_t>> order(flows);
+        for (const auto& frame : out) {
+            order[(frame[32] << 8 | frame[33]) % flows].push_back(indexOf(frame));
+        }
+        return order;
+    };
+
+    for (bool ordered : {false, true}) {
+        const std::string mode = ordered ? ", ordered" : "";
+        std::vector<std::vector<uint8_t>> reference;
+        for (int workers : {0, 2, 3}) {
+            DPIEngine::Config config;
+            config.num_load_balancers = 2;
+            config.fps_per_lb = 2;
+            config.parse_workers = workers;
+            config.preserve_order = ordered;
+            const EngineRun run = runEngine(config, input, output);
+            const auto out = readCapture(output);
+            const std::string name = "engine: " + std::to_string(workers) + " parse workers" + mode;
+            CHECK(run.ok && out.size() == run.forwarded && run.dropped > 0 &&
+                      run.forwarded + run.dropped == packets,
+                  name + ", every packet judged");
+            if (workers == 0) {
+                reference = out;
+                const auto order = perFlow(out);
+                CHECK(std::all_of(order.begin(), order.end(),
+                                  [](const std::vector<uint32_t>& ids) {
+                                      return std::is_sorted(ids.begin(), ids.end());
+                                  }),
+                      name + ", per-flow order kept");
+                if (ordered) {
+                    std::vector<uint32_t> ids;
+                    for (const auto& frame : out) ids.push_back(indexOf(frame));
+                    CHECK(std::is_sorted(ids.begin(), ids.end()), name + ", file order");
+                }
+                continue;
+            }
+            CHECK(run.jsonCount("buckets_moved") > 0 && run.jsonCount("restaged_batches") > 0,
+                  name + ", buckets moved under staged batches");
+            if (ordered) {
+                CHECK(out == reference, name + ", output identical to one thread");
+            } else {
+                CHECK(perFlow(out) == perFlow(reference), name + ", same packets in per-flow order");
+            }
+        }
+        if (!ordered) {
+            DPIEngine::Config config;
+            config.num_load_balancers = 2;
+            config.fps_per_lb = 2;
+            config.num_readers = 4;
+            const EngineRun run = runEngine(config, input, output);
+            const auto out = readCapture(output);
+            CHECK(run.ok && out.size() == run.forwarded && run.forwarded + run.dropped == packets &&
+                      perFlow(out) == perFlow(reference),
+                  "engine: 4 chunk readers, same packets in per-flow order");
+        }
+    }
+    std::filesystem::remove(input);
+    std::filesystem::remove(output);
+}
+
+int main() {
+    testReorderBuffer();
+    testDualStackFlows();
+    testFragmentReassembly();
+    testFragmentSteering();
+    testTcpReassembly();
+    testIndirectionTable();
+    testFlowRebalancing();
+    testEndOfStream();
+    testCpuPlacement();
+    testSpscQueue();
+    testMpscQueue();
+    testThreadSafeQueueBatches();
+    testWaitPolicy();
+    testEngineFragmentedFlows();
+    testEngineParseWorkers();
+
+    std::cout << (failures ? "FAILED " : "ok ") << (checks - failures) << "/" << checks
+              << " checks\n";
+    return failures ? 1 : 0;
+}